@@ -14,8 +14,15 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
 
 
     var window: UIWindow?
+    #if DEBUG
+    private var loopbackLoadTest: LoopbackLoadTest?
+    #endif
 
     func application(_ application: UIApplication, didFinishLaunchingWithOptions launchOptions: [UIApplication.LaunchOptionsKey: Any]?) -> Bool {
+        // The tap sits in the path of every audio buffer, so only when needed
+        if Constants.isCallRecordingEnabled || Constants.isMicrophoneMeteringEnabled {
+            AudioTapDevice.install()
+        }
         let frame = UIScreen.main.bounds
         window = UIWindow(frame: frame)
 
@@ -23,9 +30,47 @@ class AppDelegate: UIResponder, UIApplicationDelegate {
         
         window!.rootViewController = rootVC
         window!.makeKeyAndVisible()
+        
+        #if DEBUG
+        // Load test and benchmarks are debug only; release builds leave Loopback out
+        if let streamCount = LoopbackLoadTest.requestedStreamCount(in: ProcessInfo.processInfo.arguments) {
+            startLoopbackLoadTest(streamCount: streamCount)
+        }
+        BenchmarkLauncher.launch(PipelineBenchmark.self)
+        BenchmarkLauncher.launch(DenoiseBenchmark.self)
+        BenchmarkLauncher.launch(StaticSceneBenchmark.self)
+        BenchmarkLauncher.launch(FramePacerBenchmark.self)
+        BenchmarkLauncher.launch(RecorderBenchmark.self)
+        BenchmarkLauncher.launch(AudioRingBenchmark.self)
+        BenchmarkLauncher.launch(AudioResamplerBenchmark.self)
+        BenchmarkLauncher.launch(FrameHandoffBenchmark.self)
+        BenchmarkLauncher.launch(AudioLevelBenchmark.self)
+        BenchmarkLauncher.launch(NetworkTelemetryBenchmark.self)
+        BenchmarkLauncher.launch(CompositorBenchmark.self)
+        BenchmarkLauncher.launch(DeliveryBenchmark.self)
+        BenchmarkLauncher.launch(FrameTransformerBenchmark.self)
+        BenchmarkLauncher.launch(FrameBufferPoolBenchmark.self)
+        BenchmarkLauncher.launch(ConversionBenchmark.self)
+        BenchmarkLauncher.launch(SubscriberQualityBenchmark.self)
+        BenchmarkLauncher.launch(SubscriptionSchedulerBenchmark.self)
+        BenchmarkLauncher.launch(SignalChannelBenchmark.self)
+        #endif
         return true
     }
 
+    #if DEBUG
+    private func startLoopbackLoadTest(streamCount: Int) {
+        let loadTest = LoopbackLoadTest(streamCount: streamCount)
+        loopbackLoadTest = loadTest
+        loadTest.run(duration: 30) { [weak self] report in
+            print(report.description)
+            DispatchQueue.main.async {
+                self?.loopbackLoadTest = nil
+            }
+        }
+    }
+    #endif
+
 
 }
 
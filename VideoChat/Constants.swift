@@ -20,4 +20,14 @@ struct Constants {
     
     static let сountCameras = 1
     static let maxCountCameras = 4
+    static let isCompositedRenderingEnabled = true
+    static let isSharedCameraCaptureEnabled = true
+    static let isLatencyTracingEnabled = true
+    static let isSubscriptionSchedulingEnabled = true
+    static let isVideoDenoisingEnabled = true
+    static let isStaticSceneSkippingEnabled = true
+    // Ranks local speech from microphone PCM rather than the SDK's levels
+    static let isMicrophoneMeteringEnabled = true
+    // Raw video of every stream, about 40 MB/s per 720p30 subscriber
+    static let isCallRecordingEnabled = false
 }
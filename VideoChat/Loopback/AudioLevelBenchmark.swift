@@ -0,0 +1,163 @@
+//
+//  AudioLevelBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Meters a labelled PCM fixture with AudioLevelMeter in 10 ms blocks, the way
+// the audio tap feeds it. The fixture alternates random stretches of near
+// silence, moderate and loud broadband noise, and voiced speech (a harmonic
+// series in 4 Hz syllables) over a -60 dBFS noise floor, and each block is
+// labelled speech or not. Reports how often `isSpeaking` agrees with the
+// label away from the edges, how long speech takes to be detected and the
+// cost per block. Start it with the `-audioLevelBenchmark [fixture seconds]`
+// launch argument.
+final class AudioLevelBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let sampleRate: Int
+        let seconds: Double
+        let scoredBlocks: Int
+        let accuracy: Double
+        let falsePositiveRate: Double
+        let falseNegativeRate: Double
+        let meanOnsetMilliseconds: Double
+        let microsecondsPerBlockMean: Double
+        let microsecondsPerBlockP99: Double
+    }
+
+    private enum Segment {
+        case silence
+        case noise
+        case loudNoise
+        case voice
+    }
+
+    static let argument = "-audioLevelBenchmark"
+    static let fileName = "audio-level-benchmark"
+    static let sampleRates = [16_000, 48_000]
+    // Not scored after a label change: onset needs two blocks and release
+    // holds for the hangover
+    static let transitionBlocks = 25
+
+    let seconds: Double
+
+    // Fixture seconds per rate, 120 by default.
+    init(parameter: Double?) {
+        seconds = parameter ?? 120
+    }
+
+    func run() -> [Result] {
+        return AudioLevelBenchmark.sampleRates.map { measure(sampleRate: $0) }
+    }
+
+    private func measure(sampleRate: Int) -> Result {
+        var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+        // xorshift64*, uniform in 0..<1
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+
+        let block = sampleRate / 100
+        let blockCount = Int(seconds * 100)
+        var samples = [Int16](repeating: 0, count: blockCount * block)
+        var labels = [Bool](repeating: false, count: blockCount)
+        var blockIndex = 0
+        var phase = 0.0
+        while blockIndex < blockCount {
+            let length = min(50 + Int(nextRandom() * 150), blockCount - blockIndex)
+            let kind: Segment = nextRandom() < 0.5
+                ? .voice
+                : [.silence, .noise, .loudNoise][Int(nextRandom() * 3)]
+            let pitch = 100 + nextRandom() * 150
+            for index in blockIndex * block..<(blockIndex + length) * block {
+                // Uniform noise scaled to unit RMS
+                let white = (nextRandom() * 2 - 1) * 1.732
+                var value = white * 0.001
+                switch kind {
+                case .silence:
+                    break
+                case .noise:
+                    value += white * 0.01
+                case .loudNoise:
+                    value += white * 0.056
+                case .voice:
+                    // Harmonics falling 6 dB per octave, about -23 dBFS at the syllable peaks
+                    phase += 2 * Double.pi * pitch / Double(sampleRate)
+                    var voiced = 0.0
+                    for harmonic in 1...8 {
+                        voiced += sin(phase * Double(harmonic)) / Double(harmonic)
+                    }
+                    let time = Double(index) / Double(sampleRate)
+                    value += voiced * (0.3 + 0.7 * abs(sin(Double.pi * 4 * time))) * 0.08
+                }
+                samples[index] = Int16(max(min(value * 32_767, 32_767), -32_768))
+            }
+            for index in blockIndex..<blockIndex + length {
+                labels[index] = kind == .voice
+            }
+            blockIndex += length
+        }
+
+        let meter = AudioLevelMeter(sampleRate: sampleRate)
+        let latency = LatencyHistogram()
+        var scored = 0
+        var correct = 0
+        var falsePositives = 0
+        var falseNegatives = 0
+        var speechBlocks = 0
+        var onsets: [Int] = []
+        var pendingOnset: Int?
+        var lastChange = 0
+        samples.withUnsafeBufferPointer { buffer in
+            for index in 0..<blockCount {
+                if index > 0 && labels[index] != labels[index - 1] {
+                    lastChange = index
+                    pendingOnset = labels[index] ? index : nil
+                }
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                meter.process(buffer.baseAddress! + index * block, count: block)
+                latency.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+
+                let isSpeaking = meter.isSpeaking
+                if isSpeaking, let start = pendingOnset {
+                    onsets.append(index - start)
+                    pendingOnset = nil
+                }
+                guard index - lastChange >= AudioLevelBenchmark.transitionBlocks else { continue }
+                scored += 1
+                if labels[index] {
+                    speechBlocks += 1
+                }
+                if isSpeaking == labels[index] {
+                    correct += 1
+                } else if isSpeaking {
+                    falsePositives += 1
+                } else {
+                    falseNegatives += 1
+                }
+            }
+        }
+
+        let summary = latency.summary
+        return Result(sampleRate: sampleRate,
+                      seconds: seconds,
+                      scoredBlocks: scored,
+                      accuracy: Double(correct) / Double(max(scored, 1)),
+                      falsePositiveRate: Double(falsePositives) / Double(max(scored - speechBlocks, 1)),
+                      falseNegativeRate: Double(falseNegatives) / Double(max(speechBlocks, 1)),
+                      meanOnsetMilliseconds: Double(onsets.reduce(0, +)) * 10 / Double(max(onsets.count, 1)),
+                      microsecondsPerBlockMean: summary.mean / 1_000,
+                      microsecondsPerBlockP99: Double(summary.p99) / 1_000)
+    }
+}
+
+#endif
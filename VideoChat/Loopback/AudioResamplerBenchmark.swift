@@ -0,0 +1,200 @@
+//
+//  AudioResamplerBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Checks AudioResampler two ways. For each rate pair a 1 kHz tone at -6 dBFS
+// is resampled in 10 ms blocks, timing every call, and THD+N is what is left
+// after fitting a 1 kHz sine to one second of output. Then a capture clock
+// running off by `drifts` ppm feeds an AudioRingBuffer through the resampler
+// while a render clock drains it every 10 ms, once with AudioDriftCompensator
+// steering the ratio and once without, counting underruns and overruns.
+// Start it with the `-resamplerBenchmark [simulated seconds]` launch argument.
+final class AudioResamplerBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let inputRate: Int
+        let outputRate: Int
+        // Quality runs
+        let thdPlusNoiseDecibels: Double?
+        let microsecondsPer10msMean: Double?
+        let microsecondsPer10msP99: Double?
+        // Drift runs
+        let driftPartsPerMillion: Double?
+        let isCompensated: Bool?
+        let underrunEvents: Int64?
+        let overrunEvents: Int64?
+        let minFillLevel: Double?
+        let maxFillLevel: Double?
+        let finalRatioAdjustment: Double?
+    }
+
+    static let argument = "-resamplerBenchmark"
+    static let fileName = "resampler-benchmark"
+    static let ratePairs = [(44_100, 16_000), (16_000, 44_100), (48_000, 16_000), (44_100, 32_000),
+                            (32_000, 44_100), (8_000, 16_000), (16_000, 8_000), (44_100, 48_000)]
+    static let driftPairs = [(44_100, 16_000), (16_000, 16_000)]
+    static let drifts = [-1_000.0, -100, 100, 1_000]
+    static let toneFrequency = 1_000.0
+
+    let simulatedSeconds: Double
+
+    // Simulated seconds per drift run, 600 by default.
+    init(parameter: Double?) {
+        simulatedSeconds = parameter ?? 600
+    }
+
+    func run() -> [Result] {
+        var results = AudioResamplerBenchmark.ratePairs.map { measureQuality(inputRate: $0.0, outputRate: $0.1) }
+        for pair in AudioResamplerBenchmark.driftPairs {
+            for drift in AudioResamplerBenchmark.drifts {
+                for isCompensated in [false, true] {
+                    results.append(measureDrift(inputRate: pair.0, outputRate: pair.1, drift: drift,
+                                                isCompensated: isCompensated))
+                }
+            }
+        }
+        return results
+    }
+
+    private func measureQuality(inputRate: Int, outputRate: Int) -> Result {
+        let resampler = AudioResampler(inputRate: inputRate, outputRate: outputRate)
+        let block = inputRate / 100
+        // Half a second to settle, then exactly one second to analyse
+        let settle = outputRate / 2
+        let wanted = settle + outputRate
+        let input = UnsafeMutablePointer<Int16>.allocate(capacity: block)
+        let output = UnsafeMutablePointer<Int16>.allocate(capacity: wanted + resampler.maxOutputFrames(forInput: block))
+        defer {
+            input.deallocate()
+            output.deallocate()
+        }
+        let histogram = LatencyHistogram()
+        let step = 2 * Double.pi * AudioResamplerBenchmark.toneFrequency / Double(inputRate)
+
+        var sample = 0
+        var produced = 0
+        while produced < wanted {
+            for index in 0..<block {
+                input[index] = Int16((sin(Double(sample + index) * step) * 16_384).rounded())
+            }
+            sample += block
+            var offset = 0
+            while offset < block {
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                let result = resampler.process(input: input + offset, count: block - offset, output: output + produced,
+                                               capacity: resampler.maxOutputFrames(forInput: block))
+                histogram.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+                offset += result.consumed
+                produced += result.produced
+            }
+        }
+
+        // One second holds a whole number of tone periods at any integer rate,
+        // so projecting on sine and cosine is an exact least-squares fit
+        let omega = 2 * Double.pi * AudioResamplerBenchmark.toneFrequency / Double(outputRate)
+        var sine = 0.0
+        var cosine = 0.0
+        var mean = 0.0
+        for index in 0..<outputRate {
+            let value = Double(output[settle + index])
+            sine += value * sin(Double(index) * omega)
+            cosine += value * cos(Double(index) * omega)
+            mean += value
+        }
+        sine *= 2 / Double(outputRate)
+        cosine *= 2 / Double(outputRate)
+        mean /= Double(outputRate)
+        var signal = 0.0
+        var residual = 0.0
+        for index in 0..<outputRate {
+            let fit = sine * sin(Double(index) * omega) + cosine * cos(Double(index) * omega) + mean
+            let error = Double(output[settle + index]) - fit
+            signal += fit * fit
+            residual += error * error
+        }
+
+        let latency = histogram.summary
+        return Result(inputRate: inputRate,
+                      outputRate: outputRate,
+                      thdPlusNoiseDecibels: 10 * log10(max(residual, 1e-12) / max(signal, 1e-12)),
+                      microsecondsPer10msMean: latency.mean / 1_000,
+                      microsecondsPer10msP99: Double(latency.p99) / 1_000,
+                      driftPartsPerMillion: nil,
+                      isCompensated: nil,
+                      underrunEvents: nil,
+                      overrunEvents: nil,
+                      minFillLevel: nil,
+                      maxFillLevel: nil,
+                      finalRatioAdjustment: nil)
+    }
+
+    private func measureDrift(inputRate: Int, outputRate: Int, drift: Double, isCompensated: Bool) -> Result {
+        let resampler = AudioResampler(inputRate: inputRate, outputRate: outputRate)
+        let compensator = AudioDriftCompensator()
+        let ring = AudioRingBuffer(sampleRate: outputRate)
+        let inputBlock = inputRate / 100
+        let outputBlock = ring.samplesPer10ms
+        let capacity = resampler.maxOutputFrames(forInput: inputBlock)
+        let input = UnsafeMutablePointer<Int16>.allocate(capacity: inputBlock)
+        let output = UnsafeMutablePointer<Int16>.allocate(capacity: max(capacity, outputBlock))
+        let silence = UnsafeMutablePointer<Int16>.allocate(capacity: ring.capacity)
+        input.initialize(repeating: 0, count: inputBlock)
+        silence.initialize(repeating: 0, count: ring.capacity)
+        defer {
+            input.deallocate()
+            output.deallocate()
+            silence.deallocate()
+        }
+
+        ring.write(silence, count: Int(Double(ring.capacity) * compensator.targetFill))
+        var minFill = ring.fillLevel
+        var maxFill = ring.fillLevel
+        // The capture clock delivers 10 ms of its audio every 10 ms of its own time
+        let capturePeriod = 0.010 / (1 + drift / 1_000_000)
+        var nextCapture = capturePeriod
+        var nextRender = 0.010
+        while nextRender <= simulatedSeconds {
+            if nextCapture <= nextRender {
+                var offset = 0
+                while offset < inputBlock {
+                    let result = resampler.process(input: input + offset, count: inputBlock - offset, output: output,
+                                                   capacity: capacity)
+                    ring.write(output, count: result.produced)
+                    offset += result.consumed
+                }
+                nextCapture += capturePeriod
+            } else {
+                ring.read(into: output, count: outputBlock)
+                if isCompensated {
+                    resampler.ratioAdjustment = compensator.update(fillLevel: ring.fillLevel)
+                }
+                nextRender += 0.010
+            }
+            minFill = min(minFill, ring.fillLevel)
+            maxFill = max(maxFill, ring.fillLevel)
+        }
+
+        let statistics = ring.statistics
+        return Result(inputRate: inputRate,
+                      outputRate: outputRate,
+                      thdPlusNoiseDecibels: nil,
+                      microsecondsPer10msMean: nil,
+                      microsecondsPer10msP99: nil,
+                      driftPartsPerMillion: drift,
+                      isCompensated: isCompensated,
+                      underrunEvents: statistics.underrunEvents,
+                      overrunEvents: statistics.overrunEvents,
+                      minFillLevel: minFill,
+                      maxFillLevel: maxFill,
+                      finalRatioAdjustment: resampler.ratioAdjustment)
+    }
+}
+
+#endif
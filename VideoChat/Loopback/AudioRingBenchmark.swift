@@ -0,0 +1,182 @@
+//
+//  AudioRingBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Drives AudioRingBuffer at every OTAudioFormat rate two ways. On a simulated
+// clock, a hardware callback writes every 10 ms with up to 4 ms of jitter and
+// the bus reads every 10 ms; each call is timed for real, which is the cost
+// the audio thread pays. Then a producer and a consumer thread race through
+// a counting ramp in random chunk sizes, and every sample read is checked.
+// Start it with the `-audioRingBenchmark [simulated seconds]` launch argument.
+final class AudioRingBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let sampleRate: Int
+        let simulatedSeconds: Double
+        let callbacks: Int64
+        let writeNanosecondsP99: Int64
+        let writeNanosecondsMax: Int64
+        let readNanosecondsP99: Int64
+        let readNanosecondsMax: Int64
+        let overrunEvents: Int64
+        let underrunEvents: Int64
+        let minFillLevel: Double
+        let maxFillLevel: Double
+        let threadedSamples: Int64
+        let threadedMismatches: Int64
+    }
+
+    static let argument = "-audioRingBenchmark"
+    static let fileName = "audio-ring-benchmark"
+    static let sampleRates = [8_000, 16_000, 32_000, 44_100]
+    static let period = 0.010
+    static let jitter = 0.004
+    static let threadedSamples = 20_000_000
+
+    let simulatedSeconds: Double
+
+    // Simulated seconds per rate, 600 by default.
+    init(parameter: Double?) {
+        simulatedSeconds = parameter ?? 600
+    }
+
+    func run() -> [Result] {
+        return AudioRingBenchmark.sampleRates.map { measure(sampleRate: $0) }
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.threadedMismatches == 0 else {
+            return "\(result.sampleRate) Hz: \(result.threadedMismatches) samples read back wrong"
+        }
+        return nil
+    }
+
+    private func measure(sampleRate: Int) -> Result {
+        let ring = AudioRingBuffer(sampleRate: sampleRate)
+        let chunk = ring.samplesPer10ms
+        let samples = UnsafeMutablePointer<Int16>.allocate(capacity: chunk)
+        samples.initialize(repeating: 0, count: chunk)
+        defer { samples.deallocate() }
+        let writes = LatencyHistogram()
+        let reads = LatencyHistogram()
+        var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+        // xorshift64*, uniform in 0..<1
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+
+        // Both callbacks run once per period; the hardware one lands anywhere
+        // within the jitter, so 30 ms of audio covers the worst case
+        ring.write(samples, count: chunk * 3)
+        var minFill = ring.fillLevel
+        var maxFill = ring.fillLevel
+        var callbacks: Int64 = 0
+        let periods = Int(simulatedSeconds / AudioRingBenchmark.period)
+        var nextWrite = AudioRingBenchmark.period + nextRandom() * AudioRingBenchmark.jitter
+        var nextRead = AudioRingBenchmark.period
+        var writeIndex = 1
+        var readIndex = 1
+        while readIndex <= periods {
+            if nextWrite <= nextRead {
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                ring.write(samples, count: chunk)
+                writes.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+                writeIndex += 1
+                nextWrite = Double(writeIndex) * AudioRingBenchmark.period + nextRandom() * AudioRingBenchmark.jitter
+            } else {
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                ring.read(into: samples, count: chunk)
+                reads.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+                readIndex += 1
+                nextRead = Double(readIndex) * AudioRingBenchmark.period
+            }
+            callbacks += 1
+            minFill = min(minFill, ring.fillLevel)
+            maxFill = max(maxFill, ring.fillLevel)
+        }
+
+        let statistics = ring.statistics
+        let write = writes.summary
+        let read = reads.summary
+        return Result(sampleRate: sampleRate,
+                      simulatedSeconds: simulatedSeconds,
+                      callbacks: callbacks,
+                      writeNanosecondsP99: write.p99,
+                      writeNanosecondsMax: write.max,
+                      readNanosecondsP99: read.p99,
+                      readNanosecondsMax: read.max,
+                      overrunEvents: statistics.overrunEvents,
+                      underrunEvents: statistics.underrunEvents,
+                      minFillLevel: minFill,
+                      maxFillLevel: maxFill,
+                      threadedSamples: Int64(AudioRingBenchmark.threadedSamples),
+                      threadedMismatches: race(sampleRate: sampleRate))
+    }
+
+    // Returns the samples that did not come out as they went in.
+    private func race(sampleRate: Int) -> Int64 {
+        let ring = AudioRingBuffer(sampleRate: sampleRate)
+        let total = AudioRingBenchmark.threadedSamples
+        let maxChunk = ring.samplesPer10ms * 2
+        let mismatches = AtomicInt()
+        let done = DispatchSemaphore(value: 0)
+
+        let producer = Thread {
+            let chunk = UnsafeMutablePointer<Int16>.allocate(capacity: maxChunk)
+            defer { chunk.deallocate() }
+            var random: UInt64 = 0x2545_F491_4F6C_DD1D
+            var next = 0
+            while next < total {
+                random ^= random << 13
+                random ^= random >> 7
+                random ^= random << 17
+                let count = min(Int(random % UInt64(maxChunk)) + 1, total - next, ring.availableToWrite)
+                guard count > 0 else { continue }
+                for index in 0..<count {
+                    chunk[index] = Int16(truncatingIfNeeded: next + index)
+                }
+                next += ring.write(chunk, count: count)
+            }
+            done.signal()
+        }
+        let consumer = Thread {
+            let chunk = UnsafeMutablePointer<Int16>.allocate(capacity: maxChunk)
+            defer { chunk.deallocate() }
+            var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+            var next = 0
+            while next < total {
+                random ^= random << 13
+                random ^= random >> 7
+                random ^= random << 17
+                // Only what is there, an underrun would pad with silence
+                let count = min(Int(random % UInt64(maxChunk)) + 1, total - next, ring.availableToRead)
+                guard count > 0 else { continue }
+                let read = ring.read(into: chunk, count: count)
+                for index in 0..<read where chunk[index] != Int16(truncatingIfNeeded: next + index) {
+                    mismatches.increment()
+                }
+                next += read
+            }
+            done.signal()
+        }
+        producer.qualityOfService = .userInteractive
+        consumer.qualityOfService = .userInteractive
+        producer.start()
+        consumer.start()
+        done.wait()
+        done.wait()
+        return mismatches.value
+    }
+}
+
+#endif
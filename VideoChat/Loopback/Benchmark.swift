@@ -0,0 +1,70 @@
+//
+//  Benchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// A measurement started by a launch argument, optionally followed by a number
+// (seconds per run, frames, ...). Results end up as a JSON array. Debug builds
+// only, like everything else under Loopback.
+protocol Benchmark {
+
+    associatedtype Result: Encodable
+
+    static var argument: String { get }
+    // Results go to Documents/<fileName>.json
+    static var fileName: String { get }
+
+    init(parameter: Double?)
+
+    // On the benchmark queue; may block for as long as it needs.
+    func run() -> [Result]
+
+    // What is wrong with a result, if anything: lost frames, corrupt output,
+    // allocations where there must be none. Timings are only reported.
+    func failure(in result: Result) -> String?
+}
+
+extension Benchmark {
+
+    func failure(in result: Result) -> String? {
+        return nil
+    }
+}
+
+// Runs the benchmarks named on the command line one after another, so they do
+// not skew each other, then prints each JSON document and writes it to
+// Documents. A failed check ends the process with status 1, so a scripted run
+// fails with it.
+enum BenchmarkLauncher {
+
+    private static let queue = DispatchQueue(label: "VideoChat.Benchmark", qos: .userInitiated)
+
+    static func launch<B: Benchmark>(_ type: B.Type, arguments: [String] = ProcessInfo.processInfo.arguments) {
+        guard let index = arguments.firstIndex(of: B.argument) else { return }
+        let parameter = index + 1 < arguments.count ? Double(arguments[index + 1]) : nil
+
+        queue.async {
+            let benchmark = B(parameter: parameter)
+            let results = benchmark.run()
+            let encoder = JSONEncoder()
+            encoder.outputFormatting = .prettyPrinted
+            let json = (try? encoder.encode(results)) ?? Data()
+            print(String(data: json, encoding: .utf8) ?? "")
+            if let documents = FileManager.default.urls(for: .documentDirectory, in: .userDomainMask).first {
+                try? json.write(to: documents.appendingPathComponent(B.fileName + ".json"))
+            }
+            let failures = results.compactMap { benchmark.failure(in: $0) }
+            guard !failures.isEmpty else { return }
+            failures.forEach { print("\(B.argument) failed: \($0)") }
+            exit(1)
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,159 @@
+//
+//  CompositorBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreGraphics
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// Renders 4, 8 and 16 synthetic 640x360 streams at 30 fps into a 1080p
+// VideoCompositor, each on its own queue the way subscriber renders call it,
+// half of them rotated, while a 60 Hz display timer takes an image whenever a
+// tile changed and keeps it for one period like the layer does. Reports the
+// render and image times and how long a probe every 2 ms waits for the canvas
+// lock.
+// Start it with the `-compositorBenchmark [seconds per run]` launch argument.
+final class CompositorBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let tiles: Int
+        let seconds: Double
+        let framesRendered: Int64
+        let imagesMade: Int64
+        let renderMicrosecondsP50: Double
+        let renderMicrosecondsP99: Double
+        let lockWaitMicrosecondsP99: Double
+        let makeImageMicrosecondsP50: Double
+        let makeImageMicrosecondsP99: Double
+        let makeImageMicrosecondsMax: Double
+    }
+
+    // Holds the image on screen until the next one, like the layer
+    private final class Screen {
+        var image: CGImage?
+    }
+
+    static let argument = "-compositorBenchmark"
+    static let fileName = "compositor-benchmark"
+    static let tileCounts = [4, 8, 16]
+    static let canvasWidth = 1920
+    static let canvasHeight = 1080
+    static let width = 640
+    static let height = 360
+    static let frameRate = 30
+    static let displayRate = 60
+
+    let seconds: TimeInterval
+
+    // Seconds per run, 5 by default.
+    init(parameter: Double?) {
+        seconds = parameter ?? 5
+    }
+
+    func run() -> [Result] {
+        return CompositorBenchmark.tileCounts.map { measure(tileCount: $0) }
+    }
+
+    private func measure(tileCount: Int) -> Result {
+        let compositor = VideoCompositor(tileCount: tileCount)
+        compositor.resize(width: CompositorBenchmark.canvasWidth, height: CompositorBenchmark.canvasHeight)
+        let renders = LatencyHistogram()
+        let lockWaits = LatencyHistogram()
+        let images = LatencyHistogram()
+        let group = DispatchGroup()
+        var timers: [DispatchSourceTimer] = []
+        let deadline = DispatchTime.now() + seconds
+
+        for index in 0..<tileCount {
+            let source = SyntheticVideoSource(pixelFormat: .i420, width: CompositorBenchmark.width,
+                                              height: CompositorBenchmark.height)
+            let frame = OTVideoFrame(format: source.format.makeVideoFormat())
+            frame.orientation = index.isMultiple(of: 2) ? .up : .left
+            let queue = DispatchQueue(label: "VideoChat.CompositorBenchmark.tile\(index)", qos: .userInteractive)
+            let timer = DispatchSource.makeTimerSource(queue: queue)
+            group.enter()
+            timer.schedule(deadline: .now(), repeating: 1 / Double(CompositorBenchmark.frameRate),
+                           leeway: .milliseconds(1))
+            timer.setEventHandler {
+                guard DispatchTime.now() < deadline else {
+                    timer.cancel()
+                    return
+                }
+                let buffer = source.nextFrame()
+                buffer.attach(to: frame)
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                compositor.render(frame, inTile: index)
+                renders.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+                buffer.release()
+            }
+            timer.setCancelHandler {
+                group.leave()
+            }
+            timers.append(timer)
+        }
+
+        // Probes how long the canvas lock is held, from the outside
+        let probeQueue = DispatchQueue(label: "VideoChat.CompositorBenchmark.probe", qos: .userInteractive)
+        let probe = DispatchSource.makeTimerSource(queue: probeQueue)
+        group.enter()
+        probe.schedule(deadline: .now(), repeating: .milliseconds(2), leeway: .microseconds(500))
+        probe.setEventHandler {
+            guard DispatchTime.now() < deadline else {
+                probe.cancel()
+                return
+            }
+            let startedAt = DispatchTime.now().uptimeNanoseconds
+            _ = compositor.canvasSize
+            lockWaits.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+        }
+        probe.setCancelHandler {
+            group.leave()
+        }
+        timers.append(probe)
+
+        let displayQueue = DispatchQueue(label: "VideoChat.CompositorBenchmark.display", qos: .userInteractive)
+        let display = DispatchSource.makeTimerSource(queue: displayQueue)
+        let screen = Screen()
+        group.enter()
+        display.schedule(deadline: .now(), repeating: 1 / Double(CompositorBenchmark.displayRate),
+                         leeway: .milliseconds(1))
+        display.setEventHandler {
+            guard DispatchTime.now() < deadline else {
+                screen.image = nil
+                display.cancel()
+                return
+            }
+            guard compositor.takeDirtyTiles() != 0 else { return }
+            let startedAt = DispatchTime.now().uptimeNanoseconds
+            screen.image = compositor.makeImage()
+            images.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+        }
+        display.setCancelHandler {
+            group.leave()
+        }
+        timers.append(display)
+
+        timers.forEach { $0.resume() }
+        group.wait()
+
+        let render = renders.summary
+        let image = images.summary
+        return Result(tiles: tileCount,
+                      seconds: seconds,
+                      framesRendered: render.count,
+                      imagesMade: image.count,
+                      renderMicrosecondsP50: Double(render.p50) / 1_000,
+                      renderMicrosecondsP99: Double(render.p99) / 1_000,
+                      lockWaitMicrosecondsP99: Double(lockWaits.summary.p99) / 1_000,
+                      makeImageMicrosecondsP50: Double(image.p50) / 1_000,
+                      makeImageMicrosecondsP99: Double(image.p99) / 1_000,
+                      makeImageMicrosecondsMax: Double(image.max) / 1_000)
+    }
+}
+
+#endif
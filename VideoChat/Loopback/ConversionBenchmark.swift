@@ -0,0 +1,129 @@
+//
+//  ConversionBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Times PixelFormatConverter in all six directions between I420, NV12 and
+// ARGB on synthetic 720p frames, with rows packed tight, aligned to
+// VideoFrameFormat.alignment and padded by an odd number of bytes, as strides
+// coming from the SDK can be. Reports megapixels per second, the time per
+// frame and the share of one core that 8 streams at 30 fps would take.
+// Start it with the `-conversionBenchmark [frames per run]` launch argument.
+final class ConversionBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let source: String
+        let destination: String
+        let rows: String
+        let frames: Int
+        let failures: Int
+        let megapixelsPerSecond: Double
+        let microsecondsPerFrameP50: Double
+        let microsecondsPerFrameP99: Double
+        let coreShareFor8Streams: Double
+    }
+
+    static let argument = "-conversionBenchmark"
+    static let fileName = "conversion-benchmark"
+    static let pixelFormats: [(name: String, format: PixelFormat)] = [("i420", .i420), ("nv12", .nv12), ("argb", .argb)]
+    static let rowLayouts = ["packed", "aligned", "padded"]
+    // Odd, so padded rows never start aligned
+    static let padding = 37
+    static let width = 1280
+    static let height = 720
+    static let streams = 8
+    static let frameRate = 30
+
+    let frames: Int
+
+    // Frames per run, 200 by default.
+    init(parameter: Double?) {
+        frames = max(Int(parameter ?? 200), 1)
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for source in ConversionBenchmark.pixelFormats {
+            for destination in ConversionBenchmark.pixelFormats where destination.format != source.format {
+                for rows in ConversionBenchmark.rowLayouts {
+                    results.append(measure(source: source, destination: destination, rows: rows))
+                }
+            }
+        }
+        return results
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.failures == 0 else {
+            return "\(result.source) to \(result.destination), \(result.rows) rows: \(result.failures) conversions failed"
+        }
+        return nil
+    }
+
+    private func measure(source: (name: String, format: PixelFormat),
+                         destination: (name: String, format: PixelFormat),
+                         rows: String) -> Result {
+        let pool = VideoFrameBufferPool()
+        let converter = PixelFormatConverter.shared
+        let input = SyntheticVideoSource(pixelFormat: source.format, width: ConversionBenchmark.width,
+                                         height: ConversionBenchmark.height, noise: 8, pool: pool)
+        let sourceBuffer = pool.acquire(format: format(source.format, rows: rows))
+        let destinationBuffer = pool.acquire(format: format(destination.format, rows: rows))
+        let sourcePlanes = VideoPlanes(buffer: sourceBuffer)
+        let destinationPlanes = VideoPlanes(buffer: destinationBuffer)
+        let histogram = LatencyHistogram()
+        var total: UInt64 = 0
+        var failures = 0
+
+        for _ in 0..<frames {
+            // Restrided outside the timing
+            let frame = input.nextFrame()
+            VideoPlanes(buffer: frame).copy(into: sourcePlanes)
+            frame.release()
+
+            let startedAt = DispatchTime.now().uptimeNanoseconds
+            if !converter.convert(sourcePlanes, into: destinationPlanes) {
+                failures += 1
+            }
+            let elapsed = DispatchTime.now().uptimeNanoseconds - startedAt
+            histogram.record(Int64(elapsed))
+            total += elapsed
+        }
+        sourceBuffer.release()
+        destinationBuffer.release()
+
+        let seconds = Double(max(total, 1)) / 1_000_000_000
+        let summary = histogram.summary
+        let budget = Double(ConversionBenchmark.streams * ConversionBenchmark.frameRate)
+        return Result(source: source.name,
+                      destination: destination.name,
+                      rows: rows,
+                      frames: frames,
+                      failures: failures,
+                      megapixelsPerSecond: Double(frames * ConversionBenchmark.width * ConversionBenchmark.height)
+                          / 1_000_000 / seconds,
+                      microsecondsPerFrameP50: Double(summary.p50) / 1_000,
+                      microsecondsPerFrameP99: Double(summary.p99) / 1_000,
+                      coreShareFor8Streams: seconds / Double(frames) * budget)
+    }
+
+    private func format(_ pixelFormat: PixelFormat, rows: String) -> VideoFrameFormat {
+        let aligned = VideoFrameFormat(pixelFormat: pixelFormat, width: ConversionBenchmark.width,
+                                       height: ConversionBenchmark.height)
+        guard rows != "aligned" else { return aligned }
+        let bytesPerRow = (0..<pixelFormat.planeCount).map { plane -> Int in
+            let rowLength = aligned.planeWidth(plane) * pixelFormat.bytesPerPixel(plane: plane)
+            return rows == "packed" ? rowLength : rowLength + ConversionBenchmark.padding
+        }
+        return VideoFrameFormat(pixelFormat: pixelFormat, width: ConversionBenchmark.width,
+                                height: ConversionBenchmark.height, bytesPerRow: bytesPerRow)
+    }
+}
+
+#endif
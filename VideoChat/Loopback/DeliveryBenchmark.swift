@@ -0,0 +1,168 @@
+//
+//  DeliveryBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreGraphics
+import CoreMedia
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// Sends synthetic 720p frames down the camera capturer's path into a
+// consumer that takes or refuses image buffers: optionally halved by a
+// FrameDownscaler, through no filter, a crop (a view, so the graph copies it
+// out) or a mirror (a filter writing its own buffer), then ImageBufferDelivery.
+// Reports the copies ImageBufferDelivery counted per frame next to the number
+// the path should take, the bytes copied and the time per frame. Start it
+// with the `-deliveryBenchmark [frames per run]` launch argument.
+final class DeliveryBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let pixelFormat: String
+        let acceptsImageBuffers: Bool
+        let isDownscaled: Bool
+        let filter: String
+        let frames: Int
+        let framesReceived: Int
+        let zeroCopyFrames: Int64
+        let copiesPerFrame: Double
+        let expectedCopiesPerFrame: Double
+        let kilobytesCopiedPerFrame: Double
+        let microsecondsPerFrame: Double
+    }
+
+    private final class CountingConsumer: NSObject, OTVideoCaptureConsumer {
+
+        let acceptsImageBuffers: Bool
+        private(set) var imageBuffers = 0
+        private(set) var frames = 0
+
+        init(acceptsImageBuffers: Bool) {
+            self.acceptsImageBuffers = acceptsImageBuffers
+            super.init()
+        }
+
+        func consumeFrame(_ frame: OTVideoFrame) {
+            frames += 1
+        }
+
+        func consumeImageBuffer(_ frame: CVImageBuffer, orientation: OTVideoOrientation,
+                                timestamp ts: CMTime, metadata: Data?) -> Bool {
+            if acceptsImageBuffers {
+                imageBuffers += 1
+            }
+            return acceptsImageBuffers
+        }
+    }
+
+    static let argument = "-deliveryBenchmark"
+    static let fileName = "delivery-benchmark"
+    static let pixelFormats: [(name: String, format: PixelFormat)] = [("nv12", .nv12), ("i420", .i420), ("argb", .argb)]
+    static let filters = ["none", "crop", "mirror"]
+    static let width = 1280
+    static let height = 720
+
+    let frames: Int
+
+    // Frames per run, 300 by default.
+    init(parameter: Double?) {
+        frames = Int(parameter ?? 300)
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for pixelFormat in DeliveryBenchmark.pixelFormats {
+            for acceptsImageBuffers in [true, false] {
+                for isDownscaled in [false, true] {
+                    for filter in DeliveryBenchmark.filters {
+                        results.append(measure(pixelFormat: pixelFormat, acceptsImageBuffers: acceptsImageBuffers,
+                                               isDownscaled: isDownscaled, filter: filter))
+                    }
+                }
+            }
+        }
+        return results
+    }
+
+    func failure(in result: Result) -> String? {
+        if result.framesReceived != result.frames {
+            return "\(result.pixelFormat) \(result.filter): \(result.framesReceived) of \(result.frames) frames received"
+        }
+        if result.copiesPerFrame > result.expectedCopiesPerFrame {
+            return "\(result.pixelFormat) \(result.filter): \(result.copiesPerFrame) copies per frame, "
+                + "expected \(result.expectedCopiesPerFrame)"
+        }
+        return nil
+    }
+
+    private func measure(pixelFormat: (name: String, format: PixelFormat), acceptsImageBuffers: Bool,
+                         isDownscaled: Bool, filter: String) -> Result {
+        let source = SyntheticVideoSource(pixelFormat: pixelFormat.format, width: DeliveryBenchmark.width,
+                                          height: DeliveryBenchmark.height)
+        let downscaler = FrameDownscaler()
+        let delivery = ImageBufferDelivery()
+        let graph = VideoFilterGraph()
+        graph.onCopy = { bytes in
+            delivery.recordCopy(bytes: bytes)
+        }
+        switch filter {
+        case "crop":
+            graph.filters = [CropFilter(rect: CGRect(x: 0.125, y: 0.125, width: 0.75, height: 0.75))]
+        case "mirror":
+            graph.filters = [MirrorFilter()]
+        default:
+            break
+        }
+        let consumer = CountingConsumer(acceptsImageBuffers: acceptsImageBuffers)
+
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        for index in 0..<frames {
+            let buffer = source.nextFrame()
+            var pixelBuffer: CVPixelBuffer?
+            if isDownscaled {
+                // As CameraFrameSource does for a publisher wanting a smaller size
+                downscaler.begin(VideoPlanes(buffer: buffer))
+                if let scaled = downscaler.scale(toWidth: DeliveryBenchmark.width / 2, height: DeliveryBenchmark.height / 2) {
+                    pixelBuffer = scaled.makePixelBuffer()
+                    delivery.recordCopy(bytes: scaled.format.byteCount)
+                    scaled.release()
+                }
+                downscaler.end()
+            } else {
+                pixelBuffer = buffer.makePixelBuffer()
+            }
+            buffer.release()
+            guard let input = pixelBuffer else { continue }
+            delivery.deliver(graph.process(input), orientation: .up,
+                             timestamp: CMTime(value: CMTimeValue(index), timescale: 30),
+                             metadata: nil, to: consumer)
+        }
+        let elapsed = Double(DispatchTime.now().uptimeNanoseconds - startedAt) / 1_000
+
+        var expected = filter == "crop" ? 1.0 : 0
+        if isDownscaled {
+            expected += 1
+        }
+        if !acceptsImageBuffers {
+            expected += 1
+        }
+        let statistics = delivery.statistics
+        return Result(pixelFormat: pixelFormat.name,
+                      acceptsImageBuffers: acceptsImageBuffers,
+                      isDownscaled: isDownscaled,
+                      filter: filter,
+                      frames: frames,
+                      framesReceived: consumer.imageBuffers + consumer.frames,
+                      zeroCopyFrames: statistics.zeroCopyFrames,
+                      copiesPerFrame: statistics.copiesPerFrame,
+                      expectedCopiesPerFrame: expected,
+                      kilobytesCopiedPerFrame: statistics.bytesCopiedPerFrame / 1_024,
+                      microsecondsPerFrame: elapsed / Double(max(frames, 1)))
+    }
+}
+
+#endif
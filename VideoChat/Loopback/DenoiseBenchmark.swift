@@ -0,0 +1,127 @@
+//
+//  DenoiseBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Runs TemporalDenoiseFilter over noisy synthetic sequences, a static ramp
+// with a moving square, for every 4:2:0 format, size and noise level. Reports
+// the time per frame and how much the luma difference energy between
+// consecutive frames (what the encoder pays for) drops. Start it with the
+// `-denoiseBenchmark [frames per run]` launch argument.
+final class DenoiseBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let pixelFormat: String
+        let width: Int
+        let height: Int
+        let noise: Int
+        let frames: Int
+        let meanMillisecondsPerFrame: Double
+        let p95MillisecondsPerFrame: Double
+        // Mean squared luma difference between consecutive frames
+        let inputDifferenceEnergy: Double
+        let outputDifferenceEnergy: Double
+        let energyReductionPercent: Double
+        let staticBlockShare: Double
+        let estimatedNoiseLevel: Double
+    }
+
+    static let argument = "-denoiseBenchmark"
+    static let fileName = "denoise-benchmark"
+    static let pixelFormats: [(name: String, format: PixelFormat)] = [("i420", .i420), ("nv12", .nv12)]
+    static let sizes = [(640, 360), (1280, 720), (1920, 1080)]
+    static let noiseLevels = [4, 8, 16]
+    static let warmUpFrames = 10
+
+    let frameCount: Int
+    private let pool = VideoFrameBufferPool.shared
+
+    // Frames per run, 150 by default.
+    init(parameter: Double?) {
+        frameCount = max(Int(parameter ?? 150), 2)
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for pixelFormat in DenoiseBenchmark.pixelFormats {
+            for size in DenoiseBenchmark.sizes {
+                for noise in DenoiseBenchmark.noiseLevels {
+                    results.append(measure(pixelFormat: pixelFormat, width: size.0, height: size.1, noise: noise))
+                }
+            }
+        }
+        return results
+    }
+
+    private func measure(pixelFormat: (name: String, format: PixelFormat), width: Int, height: Int, noise: Int) -> Result {
+        let source = SyntheticVideoSource(pixelFormat: pixelFormat.format, width: width, height: height,
+                                          scrollSpeed: 0, noise: noise)
+        let filter = TemporalDenoiseFilter()
+        let histogram = LatencyHistogram()
+        var previousInput: VideoFrameBuffer?
+        var previousOutput: VideoFrameBuffer?
+        var inputEnergy = 0.0
+        var outputEnergy = 0.0
+
+        for index in 0..<(DenoiseBenchmark.warmUpFrames + frameCount) {
+            let input = source.nextFrame()
+            let output = pool.acquire(format: input.format)
+            let startedAt = DispatchTime.now().uptimeNanoseconds
+            _ = filter.apply(VideoPlanes(buffer: input), into: VideoPlanes(buffer: output))
+            let elapsed = DispatchTime.now().uptimeNanoseconds - startedAt
+
+            if index >= DenoiseBenchmark.warmUpFrames {
+                histogram.record(Int64(elapsed))
+                if let previousInput = previousInput, let previousOutput = previousOutput {
+                    inputEnergy += differenceEnergy(input, previousInput)
+                    outputEnergy += differenceEnergy(output, previousOutput)
+                }
+            }
+            previousInput?.release()
+            previousOutput?.release()
+            previousInput = input
+            previousOutput = output
+        }
+        previousInput?.release()
+        previousOutput?.release()
+
+        let latency = histogram.summary
+        let statistics = filter.statistics
+        let pairs = Double(frameCount - 1)
+        return Result(pixelFormat: pixelFormat.name,
+                      width: width,
+                      height: height,
+                      noise: noise,
+                      frames: frameCount,
+                      meanMillisecondsPerFrame: latency.mean / 1_000_000,
+                      p95MillisecondsPerFrame: Double(latency.p95) / 1_000_000,
+                      inputDifferenceEnergy: inputEnergy / pairs,
+                      outputDifferenceEnergy: outputEnergy / pairs,
+                      energyReductionPercent: inputEnergy > 0 ? (1 - outputEnergy / inputEnergy) * 100 : 0,
+                      staticBlockShare: statistics.staticBlockShare,
+                      estimatedNoiseLevel: statistics.noiseLevel)
+    }
+
+    private func differenceEnergy(_ a: VideoFrameBuffer, _ b: VideoFrameBuffer) -> Double {
+        let width = a.format.width
+        let height = a.format.height
+        var sum = 0
+        for y in 0..<height {
+            let rowA = a.plane(0) + y * a.bytesPerRow(0)
+            let rowB = b.plane(0) + y * b.bytesPerRow(0)
+            for x in 0..<width {
+                let difference = Int(rowA[x]) - Int(rowB[x])
+                sum += difference * difference
+            }
+        }
+        return Double(sum) / Double(width * height)
+    }
+}
+
+#endif
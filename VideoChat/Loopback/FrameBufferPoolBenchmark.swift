@@ -0,0 +1,133 @@
+//
+//  FrameBufferPoolBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Darwin
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// Drives a VideoFrameBufferPool the way capturers do: one thread per camera,
+// one 720p format per camera cycling through I420, NV12 and ARGB, each frame
+// attached to an OTVideoFrame and held for `heldFrames` more frames like a
+// consumer still encoding it. After `warmupFrames` per camera the pool must
+// not allocate again; the run reports buffer allocations and heap growth
+// after warm-up next to the p50/p99 acquire latency. Start it with the
+// `-poolBenchmark [seconds per run]` launch argument.
+final class FrameBufferPoolBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let cameras: Int
+        let seconds: Double
+        let acquires: Int64
+        let warmupAllocations: Int64
+        let steadyStateAllocations: Int64
+        let steadyStateHeapGrowthBytes: Int
+        let acquireNanosecondsP50: Int64
+        let acquireNanosecondsP99: Int64
+        let acquireNanosecondsMax: Int64
+    }
+
+    static let argument = "-poolBenchmark"
+    static let fileName = "pool-benchmark"
+    static let cameraCounts = [1, Constants.maxCountCameras]
+    static let pixelFormats: [PixelFormat] = [.i420, .nv12, .argb]
+    static let width = 1280
+    static let height = 720
+    static let heldFrames = 2
+    static let warmupFrames = 30
+
+    let seconds: TimeInterval
+
+    // Seconds per run, 3 by default.
+    init(parameter: Double?) {
+        seconds = parameter ?? 3
+    }
+
+    func run() -> [Result] {
+        return FrameBufferPoolBenchmark.cameraCounts.map { measure(cameras: $0) }
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.steadyStateAllocations == 0 else {
+            return "\(result.cameras) cameras: \(result.steadyStateAllocations) allocations after warm-up"
+        }
+        return nil
+    }
+
+    private func measure(cameras: Int) -> Result {
+        let pool = VideoFrameBufferPool()
+        let histogram = LatencyHistogram()
+        let warmedUp = DispatchGroup()
+        let done = DispatchGroup()
+        let isRunning = AtomicInt(1)
+
+        for camera in 0..<cameras {
+            let pixelFormat = FrameBufferPoolBenchmark.pixelFormats[camera % FrameBufferPoolBenchmark.pixelFormats.count]
+            let format = VideoFrameFormat(pixelFormat: pixelFormat, width: FrameBufferPoolBenchmark.width,
+                                          height: FrameBufferPoolBenchmark.height)
+            warmedUp.enter()
+            done.enter()
+            Thread {
+                let frame = OTVideoFrame(format: format.makeVideoFormat())
+                var held: [VideoFrameBuffer] = []
+                held.reserveCapacity(FrameBufferPoolBenchmark.heldFrames + 1)
+                var count = 0
+                while isRunning.value != 0 {
+                    let startedAt = DispatchTime.now().uptimeNanoseconds
+                    let buffer = pool.acquire(format: format)
+                    histogram.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+                    buffer.attach(to: frame)
+                    // Touch the planes like a capturer writing the frame
+                    buffer.plane(0).pointee = UInt8(truncatingIfNeeded: count)
+                    held.append(buffer)
+                    if held.count > FrameBufferPoolBenchmark.heldFrames {
+                        held.removeFirst().release()
+                    }
+                    count += 1
+                    if count == FrameBufferPoolBenchmark.warmupFrames {
+                        warmedUp.leave()
+                    }
+                }
+                held.forEach { $0.release() }
+                if count < FrameBufferPoolBenchmark.warmupFrames {
+                    warmedUp.leave()
+                }
+                done.leave()
+            }.start()
+        }
+
+        warmedUp.wait()
+        let warmupAllocations = pool.statistics.allocations
+        let heapBefore = FrameBufferPoolBenchmark.heapBytesInUse()
+        histogram.reset()
+        Thread.sleep(forTimeInterval: seconds)
+        let heapAfter = FrameBufferPoolBenchmark.heapBytesInUse()
+        isRunning.store(0)
+        done.wait()
+
+        let summary = histogram.summary
+        return Result(cameras: cameras,
+                      seconds: seconds,
+                      acquires: summary.count,
+                      warmupAllocations: warmupAllocations,
+                      steadyStateAllocations: pool.statistics.allocations - warmupAllocations,
+                      steadyStateHeapGrowthBytes: heapAfter - heapBefore,
+                      acquireNanosecondsP50: summary.p50,
+                      acquireNanosecondsP99: summary.p99,
+                      acquireNanosecondsMax: summary.max)
+    }
+
+    // Whole process, so anything else running shows up as noise
+    private static func heapBytesInUse() -> Int {
+        var statistics = malloc_statistics_t()
+        malloc_zone_statistics(nil, &statistics)
+        return Int(statistics.size_in_use)
+    }
+}
+
+#endif
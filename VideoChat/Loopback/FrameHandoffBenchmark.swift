@@ -0,0 +1,194 @@
+//
+//  FrameHandoffBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Stresses FrameHandoffQueue with one and several producer threads pushing
+// as fast as they can against a consumer that sometimes stalls, so drops and
+// pops race on the oldest slot. Every frame is a tracked object that must be
+// released exactly once, by the consumer or the drop handler, and must be
+// deallocated once the queue is drained; the run counts leaks and double
+// releases. A paced
+// run then hands off 30 fps frames to a delivery queue the way the camera
+// capturer does and reports the handoff latency. Start it with the
+// `-handoffBenchmark [seconds per run]` launch argument.
+final class FrameHandoffBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let mode: String
+        let producers: Int
+        let capacity: Int
+        let seconds: Double
+        let pushed: Int64
+        let popped: Int64
+        let dropped: Int64
+        let framesCreated: Int64
+        let leakedFrames: Int64
+        let unreleasedFrames: Int64
+        let doubleReleases: Int64
+        let latencyMicrosecondsP50: Double
+        let latencyMicrosecondsP99: Double
+        let latencyMicrosecondsMax: Double
+    }
+
+    private final class Tracker {
+        let created = AtomicInt()
+        let alive = AtomicInt()
+        let released = AtomicInt()
+        let doubleReleases = AtomicInt()
+    }
+
+    private final class TrackedFrame {
+        private let tracker: Tracker
+        private let releases = AtomicInt()
+
+        init(tracker: Tracker) {
+            self.tracker = tracker
+            tracker.created.increment()
+            tracker.alive.increment()
+        }
+
+        deinit {
+            tracker.alive.decrement()
+        }
+
+        func release() {
+            if releases.increment() == 1 {
+                tracker.released.increment()
+            } else {
+                tracker.doubleReleases.increment()
+            }
+        }
+    }
+
+    static let argument = "-handoffBenchmark"
+    static let fileName = "handoff-benchmark"
+    static let producerCounts = [1, 4]
+    static let capacities = [2, 4]
+    static let frameRate = 30
+
+    let seconds: TimeInterval
+
+    // Seconds per run, 3 by default.
+    init(parameter: Double?) {
+        seconds = parameter ?? 3
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for producers in FrameHandoffBenchmark.producerCounts {
+            for capacity in FrameHandoffBenchmark.capacities {
+                results.append(stress(producers: producers, capacity: capacity))
+            }
+        }
+        results.append(paced())
+        return results
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.leakedFrames == 0, result.unreleasedFrames == 0, result.doubleReleases == 0 else {
+            return "\(result.mode), \(result.producers) producers: \(result.leakedFrames) leaked, "
+                + "\(result.unreleasedFrames) unreleased, \(result.doubleReleases) released twice"
+        }
+        return nil
+    }
+
+    private func stress(producers: Int, capacity: Int) -> Result {
+        let tracker = Tracker()
+        let queue = FrameHandoffQueue<TrackedFrame>(capacity: capacity) { $0.release() }
+        let isRunning = AtomicInt(1)
+        let group = DispatchGroup()
+
+        for _ in 0..<producers {
+            group.enter()
+            Thread {
+                while isRunning.value != 0 {
+                    queue.push(TrackedFrame(tracker: tracker))
+                }
+                group.leave()
+            }.start()
+        }
+        group.enter()
+        Thread {
+            var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+            while isRunning.value != 0 {
+                random ^= random << 13
+                random ^= random >> 7
+                random ^= random << 17
+                // Now and then a slow consumer, so producers have to drop
+                if random % 64 == 0 {
+                    usleep(50)
+                }
+                queue.pop()?.release()
+            }
+            group.leave()
+        }.start()
+
+        Thread.sleep(forTimeInterval: seconds)
+        isRunning.store(0)
+        group.wait()
+
+        while let frame = queue.pop() {
+            frame.release()
+        }
+        let statistics = queue.statistics
+        return result(mode: "stress", producers: producers, capacity: capacity, statistics: statistics,
+                      tracker: tracker)
+    }
+
+    // One producer at the camera rate, a delivery queue per push, like
+    // SharedCameraCapture.
+    private func paced() -> Result {
+        let tracker = Tracker()
+        let queue = FrameHandoffQueue<TrackedFrame> { $0.release() }
+        let captureQueue = DispatchQueue(label: "VideoChat.FrameHandoffBenchmark.capture", qos: .userInteractive)
+        let deliveryQueue = DispatchQueue(label: "VideoChat.FrameHandoffBenchmark.delivery", qos: .userInteractive)
+        let timer = DispatchSource.makeTimerSource(queue: captureQueue)
+        timer.schedule(deadline: .now(), repeating: 1 / Double(FrameHandoffBenchmark.frameRate),
+                       leeway: .milliseconds(1))
+        timer.setEventHandler {
+            queue.push(TrackedFrame(tracker: tracker))
+            deliveryQueue.async {
+                queue.pop()?.release()
+            }
+        }
+        timer.resume()
+        Thread.sleep(forTimeInterval: seconds)
+        timer.cancel()
+        captureQueue.sync {}
+        deliveryQueue.sync {}
+
+        while let frame = queue.pop() {
+            frame.release()
+        }
+        let statistics = queue.statistics
+        return result(mode: "paced", producers: 1, capacity: queue.capacity, statistics: statistics,
+                      tracker: tracker)
+    }
+
+    private func result(mode: String, producers: Int, capacity: Int,
+                        statistics: FrameHandoffQueue<TrackedFrame>.Statistics, tracker: Tracker) -> Result {
+        return Result(mode: mode,
+                      producers: producers,
+                      capacity: capacity,
+                      seconds: seconds,
+                      pushed: statistics.pushed,
+                      popped: statistics.popped,
+                      dropped: statistics.dropped,
+                      framesCreated: tracker.created.value,
+                      leakedFrames: tracker.alive.value,
+                      unreleasedFrames: tracker.created.value - tracker.released.value,
+                      doubleReleases: tracker.doubleReleases.value,
+                      latencyMicrosecondsP50: Double(statistics.latency.p50) / 1_000,
+                      latencyMicrosecondsP99: Double(statistics.latency.p99) / 1_000,
+                      latencyMicrosecondsMax: Double(statistics.latency.max) / 1_000)
+    }
+}
+
+#endif
@@ -0,0 +1,96 @@
+//
+//  FramePacerBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Feeds FramePacer seeded timestamp traces of a camera with jitter, a slightly
+// wrong clock and dropped frames, for every target frame rate, and reports the
+// spacing jitter before and after. Start it with the `-framePacerBenchmark`
+// launch argument.
+final class FramePacerBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let captureFrameRate: Double
+        let jitterMilliseconds: Double
+        let dropRate: Double
+        let targetFrameRate: Int
+        let inputFrames: Int64
+        let outputFrames: Int64
+        let outputFramesPerSecond: Double
+        let inputJitterMilliseconds: Double
+        let outputJitterMilliseconds: Double
+        // Largest gap between output frames over the target interval
+        let maxIntervalRatio: Double
+    }
+
+    static let argument = "-framePacerBenchmark"
+    static let fileName = "frame-pacer-benchmark"
+    // Nominal 30 fps on a clock 0.2% slow
+    static let captureFrameRate = 29.94
+    static let jitters = [0.002, 0.005, 0.010]
+    static let dropRates = [0.0, 0.02]
+    static let targetFrameRates = [30, 15, 7, 1]
+    static let duration: TimeInterval = 60
+
+    init(parameter: Double?) {
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for jitter in FramePacerBenchmark.jitters {
+            for dropRate in FramePacerBenchmark.dropRates {
+                for target in FramePacerBenchmark.targetFrameRates {
+                    results.append(measure(jitter: jitter, dropRate: dropRate, targetFrameRate: target))
+                }
+            }
+        }
+        return results
+    }
+
+    private func measure(jitter: Double, dropRate: Double, targetFrameRate: Int) -> Result {
+        let pacer = FramePacer(targetFrameRate: targetFrameRate)
+        var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+        // xorshift64*, uniform in 0..<1
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+
+        let period = 1 / FramePacerBenchmark.captureFrameRate
+        let frames = Int(FramePacerBenchmark.duration / period)
+        var last: Double?
+        var maxInterval = 0.0
+        for index in 0..<frames {
+            guard nextRandom() >= dropRate else { continue }
+            // Triangular jitter, mostly small with the odd late callback
+            let offset = (nextRandom() + nextRandom() - 1) * jitter
+            guard let time = pacer.pace(seconds: Double(index) * period + offset) else { continue }
+            if let last = last {
+                maxInterval = max(maxInterval, time - last)
+            }
+            last = time
+        }
+
+        let statistics = pacer.statistics
+        return Result(captureFrameRate: FramePacerBenchmark.captureFrameRate,
+                      jitterMilliseconds: jitter * 1_000,
+                      dropRate: dropRate,
+                      targetFrameRate: targetFrameRate,
+                      inputFrames: statistics.inputFrames,
+                      outputFrames: statistics.outputFrames,
+                      outputFramesPerSecond: Double(statistics.outputFrames) / FramePacerBenchmark.duration,
+                      inputJitterMilliseconds: statistics.inputJitter * 1_000,
+                      outputJitterMilliseconds: statistics.outputJitter * 1_000,
+                      maxIntervalRatio: maxInterval * Double(targetFrameRate))
+    }
+}
+
+#endif
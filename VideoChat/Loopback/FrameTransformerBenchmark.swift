@@ -0,0 +1,187 @@
+//
+//  FrameTransformerBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// Times FrameTransformer against the two-pass path it replaces: convert the
+// whole frame, then rotate all of it with one vImageRotate90 per plane, which
+// shares no code with the tiled path. Every pair of I420, NV12 and ARGB,
+// same-format rotation included, is transformed in all four orientations from
+// noisy synthetic 720p frames, whose height is not a multiple of the tile so
+// edge tiles are covered too, and the outputs are compared byte for byte.
+// FrameTransformerTests checks both against a per-pixel rotation. Start it
+// with the `-transformerBenchmark [frames per run]` launch argument.
+final class FrameTransformerBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let source: String
+        let destination: String
+        let orientation: String
+        let frames: Int
+        let mismatchedBytes: Int
+        let singlePassMicrosecondsP50: Double
+        let singlePassMicrosecondsP99: Double
+        let twoPassMicrosecondsP50: Double
+        let twoPassMicrosecondsP99: Double
+        let singlePassMegapixelsPerSecond: Double
+        let twoPassMegapixelsPerSecond: Double
+    }
+
+    static let argument = "-transformerBenchmark"
+    static let fileName = "transformer-benchmark"
+    static let pixelFormats: [(name: String, format: PixelFormat)] = [("i420", .i420), ("nv12", .nv12), ("argb", .argb)]
+    static let orientations: [(name: String, orientation: OTVideoOrientation, rotation: Int)] = [
+        ("up", .up, kRotate0DegreesClockwise), ("down", .down, kRotate180DegreesClockwise),
+        ("left", .left, kRotate90DegreesClockwise), ("right", .right, kRotate270DegreesClockwise)
+    ]
+    static let width = 1280
+    static let height = 720
+
+    let frames: Int
+
+    // Frames per run, 100 by default.
+    init(parameter: Double?) {
+        frames = max(Int(parameter ?? 100), 1)
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for source in FrameTransformerBenchmark.pixelFormats {
+            for destination in FrameTransformerBenchmark.pixelFormats {
+                for orientation in FrameTransformerBenchmark.orientations {
+                    results.append(measure(source: source, destination: destination, orientation: orientation))
+                }
+            }
+        }
+        return results
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.mismatchedBytes == 0 else {
+            return "\(result.source) to \(result.destination) \(result.orientation): "
+                + "\(result.mismatchedBytes) bytes differ from the reference"
+        }
+        return nil
+    }
+
+    private func measure(source: (name: String, format: PixelFormat),
+                         destination: (name: String, format: PixelFormat),
+                         orientation: (name: String, orientation: OTVideoOrientation, rotation: Int)) -> Result {
+        let input = SyntheticVideoSource(pixelFormat: source.format, width: FrameTransformerBenchmark.width,
+                                         height: FrameTransformerBenchmark.height, noise: 8)
+        let transformer = FrameTransformer()
+        let size = FrameTransformer.outputSize(width: FrameTransformerBenchmark.width,
+                                               height: FrameTransformerBenchmark.height,
+                                               orientation: orientation.orientation)
+        let rotatedFormat = VideoFrameFormat(pixelFormat: destination.format, width: size.width, height: size.height)
+        let converter = PixelFormatConverter.shared
+        let singlePass = LatencyHistogram()
+        let twoPass = LatencyHistogram()
+        var singlePassTotal: UInt64 = 0
+        var twoPassTotal: UInt64 = 0
+        var mismatched = 0
+
+        for _ in 0..<frames {
+            let frame = input.nextFrame()
+
+            var startedAt = DispatchTime.now().uptimeNanoseconds
+            let fused = transformer.transform(frame, orientation: orientation.orientation, to: destination.format)
+            var elapsed = DispatchTime.now().uptimeNanoseconds - startedAt
+            singlePass.record(Int64(elapsed))
+            singlePassTotal += elapsed
+
+            startedAt = DispatchTime.now().uptimeNanoseconds
+            let converted = converter.convert(frame, to: destination.format)
+            var rotated = converted
+            if let upright = converted, orientation.orientation != .up {
+                rotated = VideoFrameBufferPool.shared.acquire(format: rotatedFormat)
+                if !rotate(VideoPlanes(buffer: upright), into: VideoPlanes(buffer: rotated!),
+                           rotation: UInt8(orientation.rotation)) {
+                    rotated?.release()
+                    rotated = nil
+                }
+                upright.release()
+            }
+            elapsed = DispatchTime.now().uptimeNanoseconds - startedAt
+            twoPass.record(Int64(elapsed))
+            twoPassTotal += elapsed
+
+            if let fused = fused, let rotated = rotated {
+                mismatched += mismatchedBytes(VideoPlanes(buffer: fused), VideoPlanes(buffer: rotated))
+            } else {
+                // A failed transform counts as wrong everywhere
+                mismatched += (fused ?? rotated)?.format.byteCount ?? 1
+            }
+            fused?.release()
+            rotated?.release()
+            frame.release()
+        }
+
+        let megapixels = Double(frames * FrameTransformerBenchmark.width * FrameTransformerBenchmark.height) / 1_000_000
+        let fusedTimes = singlePass.summary
+        let baselineTimes = twoPass.summary
+        return Result(source: source.name,
+                      destination: destination.name,
+                      orientation: orientation.name,
+                      frames: frames,
+                      mismatchedBytes: mismatched,
+                      singlePassMicrosecondsP50: Double(fusedTimes.p50) / 1_000,
+                      singlePassMicrosecondsP99: Double(fusedTimes.p99) / 1_000,
+                      twoPassMicrosecondsP50: Double(baselineTimes.p50) / 1_000,
+                      twoPassMicrosecondsP99: Double(baselineTimes.p99) / 1_000,
+                      singlePassMegapixelsPerSecond: megapixels / (Double(max(singlePassTotal, 1)) / 1_000_000_000),
+                      twoPassMegapixelsPerSecond: megapixels / (Double(max(twoPassTotal, 1)) / 1_000_000_000))
+    }
+
+    // The whole frame at once, one plane after another
+    private func rotate(_ source: VideoPlanes, into destination: VideoPlanes, rotation: UInt8) -> Bool {
+        var black: [UInt8] = [0, 0, 0, 0]
+        for plane in 0..<source.pixelFormat.planeCount {
+            var src = source.plane(plane).vImageBuffer(width: source.planeWidth(plane), height: source.planeHeight(plane))
+            var dst = destination.plane(plane).vImageBuffer(width: destination.planeWidth(plane),
+                                                            height: destination.planeHeight(plane))
+            let flags = vImage_Flags(kvImageNoFlags)
+            let error: vImage_Error
+            switch source.pixelFormat.bytesPerPixel(plane: plane) {
+            case 1:
+                error = vImageRotate90_Planar8(&src, &dst, rotation, 0, flags)
+            case 2:
+                error = vImageRotate90_Planar16U(&src, &dst, rotation, 0, flags)
+            default:
+                error = vImageRotate90_ARGB8888(&src, &dst, rotation, &black, flags)
+            }
+            guard error == kvImageNoError else { return false }
+        }
+        return true
+    }
+
+    // Row padding is not compared, it is never written.
+    private func mismatchedBytes(_ lhs: VideoPlanes, _ rhs: VideoPlanes) -> Int {
+        guard lhs.pixelFormat == rhs.pixelFormat, lhs.width == rhs.width, lhs.height == rhs.height else {
+            return lhs.width * lhs.height * 4
+        }
+        var count = 0
+        for plane in 0..<lhs.pixelFormat.planeCount {
+            let rowLength = lhs.planeWidth(plane) * lhs.pixelFormat.bytesPerPixel(plane: plane)
+            for y in 0..<lhs.planeHeight(plane) {
+                let left = lhs.plane(plane).row(y)
+                let right = rhs.plane(plane).row(y)
+                guard memcmp(left, right, rowLength) != 0 else { continue }
+                for x in 0..<rowLength where left[x] != right[x] {
+                    count += 1
+                }
+            }
+        }
+        return count
+    }
+}
+
+#endif
@@ -0,0 +1,233 @@
+//
+//  LoopbackLoadTest.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreMedia
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// Runs `streamCount` publisher/subscriber pairs through SessionManager and the
+// loopback backend with synthetic video and audio, then reports what each
+// stream cost. Start it with the `-loopbackStreams <count>` launch argument.
+final class LoopbackLoadTest {
+
+    struct Report {
+        let streamCount: Int
+        let duration: TimeInterval
+        let framesSent: Int64
+        let framesRendered: Int64
+        let packetsDropped: Int64
+        let cpuPerStream: Double
+        let memoryPerStream: Int
+        let timeToConnect: LatencyHistogram.Summary
+        let meterNanosecondsPerBlock: Double
+        let dominantSpeaker: Int?
+        // Whole run, all sessions
+        let signalMessagesPosted: Int64
+        let signalMessagesSuperseded: Int64
+        let signalsSent: Int64
+        let signalBytesSent: Int64
+        let signalMessagesReceived: Int64
+
+        var description: String {
+            return "Loopback \(streamCount) streams, \(Int(duration)) s: "
+                + "\(framesSent) frames sent, \(framesRendered) rendered, \(packetsDropped) dropped, "
+                + String(format: "%.2f%% CPU", cpuPerStream * 100) + " and \(memoryPerStream / 1_024) KB per stream, "
+                + "connect p50 \(timeToConnect.p50 / 1_000_000) ms p99 \(timeToConnect.p99 / 1_000_000) ms, "
+                + String(format: "%.0f ns per metered audio block", meterNanosecondsPerBlock)
+                + ", dominant speaker \(dominantSpeaker.map { String($0) } ?? "none"), "
+                + "\(signalMessagesPosted) control messages posted, \(signalMessagesSuperseded) superseded, "
+                + "\(signalsSent) signals of \(signalBytesSent / max(signalsSent, 1)) bytes, "
+                + "\(signalMessagesReceived) received"
+        }
+    }
+
+    static let argument = "-loopbackStreams"
+
+    let streamCount: Int
+    let width: Int
+    let height: Int
+    let frameRate: Int
+
+    private let backend: LoopbackSessionBackend
+    private let manager: SessionManager
+    private let eventQueue = DispatchQueue(label: "VideoChat.LoopbackLoadTest.events")
+    private let sourceQueue = DispatchQueue(label: "VideoChat.LoopbackLoadTest.sources", attributes: .concurrent)
+    private var configs: [CameraSessionConfig] = []
+    private var streams: [Int: LoopbackSessionBackend.Stream] = [:]
+    private var subscriptions: [LoopbackSessionBackend.Subscription] = []
+    private var timers: [DispatchSourceTimer] = []
+    private let render = CountingRender()
+    private let speakers = ActiveSpeakerRanker()
+    private let meterNanoseconds = AtomicInt()
+    private let meteredBlocks = AtomicInt()
+
+    static func requestedStreamCount(in arguments: [String]) -> Int? {
+        guard let index = arguments.firstIndex(of: argument), index + 1 < arguments.count else { return nil }
+        return Int(arguments[index + 1])
+    }
+
+    init(streamCount: Int, configuration: NetworkShaper.Configuration = NetworkShaper.Configuration(),
+         width: Int = 320, height: Int = 240, frameRate: Int = 15) {
+        self.streamCount = streamCount
+        self.width = width
+        self.height = height
+        self.frameRate = frameRate
+        backend = LoopbackSessionBackend(configuration: configuration)
+        manager = SessionManager(backend: backend)
+        manager.callbackQueue = eventQueue
+        // Standby sessions would join every room and skew the per-session cost
+        manager.isWarmStandbyEnabled = false
+    }
+
+    // Each pair shares a room: config 2n publishes, 2n + 1 subscribes.
+    func run(duration: TimeInterval, completion: @escaping (Report) -> Void) {
+        configs = (0..<streamCount * 2).map { index in
+            CameraSessionConfig(apiKey: "loopback",
+                                cameraIndex: index,
+                                session: "loopback-room-\(index / 2)",
+                                token: "",
+                                isPublisher: index.isMultiple(of: 2))
+        }
+        let memoryBefore = ProcessMetrics.memoryFootprint()
+        manager.delegate = self
+        manager.connect(configs)
+
+        // Measure the steady state only, after everyone is connected
+        eventQueue.asyncAfter(deadline: .now() + 1) {
+            let cpuBefore = ProcessMetrics.cpuTime()
+            let sentBefore = self.streams.values.reduce(0) { $0 + $1.framesSent.value }
+            let renderedBefore = self.render.frames.value
+
+            self.eventQueue.asyncAfter(deadline: .now() + duration) {
+                let cpu = ProcessMetrics.cpuTime() - cpuBefore
+                let memory = ProcessMetrics.memoryFootprint() - memoryBefore
+                self.stop()
+
+                let connectTimes = LatencyHistogram()
+                for seconds in self.manager.timeToConnect.values {
+                    connectTimes.record(Int64(seconds * 1_000_000_000))
+                }
+                let streamCount = max(self.streamCount, 1)
+                let signals = self.configs.indices.compactMap { self.manager.signalChannel(at: $0)?.statistics }
+                completion(Report(streamCount: self.streamCount,
+                                  duration: duration,
+                                  framesSent: self.streams.values.reduce(0) { $0 + $1.framesSent.value } - sentBefore,
+                                  framesRendered: self.render.frames.value - renderedBefore,
+                                  packetsDropped: self.subscriptions.reduce(0) { $0 + $1.shaper.statistics.dropped },
+                                  cpuPerStream: cpu / duration / Double(streamCount),
+                                  memoryPerStream: max(memory, 0) / streamCount,
+                                  timeToConnect: connectTimes.summary,
+                                  meterNanosecondsPerBlock: Double(self.meterNanoseconds.value)
+                                      / Double(max(self.meteredBlocks.value, 1)),
+                                  dominantSpeaker: self.speakers.dominantSpeaker,
+                                  signalMessagesPosted: signals.reduce(0) { $0 + $1.messagesPosted },
+                                  signalMessagesSuperseded: signals.reduce(0) { $0 + $1.messagesSuperseded },
+                                  signalsSent: signals.reduce(0) { $0 + $1.signalsSent },
+                                  signalBytesSent: signals.reduce(0) { $0 + $1.bytesSent },
+                                  signalMessagesReceived: signals.reduce(0) { $0 + $1.messagesReceived }))
+            }
+        }
+    }
+
+    // Event queue. Besides media, each publisher posts a quality hint per frame
+    // and its speaker state per audio block, as the app's control traffic.
+    private func startSource(for stream: LoopbackSessionBackend.Stream, at index: Int) {
+        let channel = manager.signalChannel(at: index)
+        let subject = UInt16(truncatingIfNeeded: index)
+        let video = SyntheticVideoSource(pixelFormat: .i420, width: width, height: height)
+        let audio = SyntheticAudioSource()
+        let timer = DispatchSource.makeTimerSource(queue: sourceQueue)
+        let frameInterval = 1 / Double(frameRate)
+        var audioDue = 0.0
+        var elapsed = 0.0
+        timer.schedule(deadline: .now(), repeating: frameInterval)
+        timer.setEventHandler {
+            let buffer = video.nextFrame()
+            stream.send(VideoPlanes(buffer: buffer),
+                        timestamp: CMTime(value: CMTimeValue(video.frameIndex), timescale: CMTimeScale(self.frameRate)))
+            buffer.release()
+            channel?.post(.qualityHint, subject: subject, payload: Data([UInt8(truncatingIfNeeded: video.frameIndex)]))
+
+            elapsed += frameInterval
+            while audioDue < elapsed {
+                let block = audio.nextBlock()
+                block.withUnsafeBufferPointer { stream.send(audio: $0.baseAddress!, count: $0.count) }
+                channel?.post(.speakerState, subject: subject, payload: Data([UInt8(truncatingIfNeeded: Int(block[0]) >> 8)]))
+                audioDue += 0.01
+            }
+        }
+        timers.append(timer)
+        timer.resume()
+    }
+
+    // Subscription delivery queue.
+    private func meter(_ block: [Int16], with meter: AudioLevelMeter) {
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        block.withUnsafeBufferPointer { _ = meter.process($0.baseAddress!, count: $0.count) }
+        meterNanoseconds.increment(by: Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+        meteredBlocks.increment()
+    }
+
+    private func stop() {
+        timers.forEach { $0.cancel() }
+        timers.removeAll()
+        manager.disconnectAll()
+    }
+}
+
+// MARK: - SessionManagerDelegate callbacks
+extension LoopbackLoadTest: SessionManagerDelegate {
+
+    func sessionManager(_ manager: SessionManager, didConnectConfigAt index: Int) {
+        guard configs[index].isPublisher,
+            let session = manager.session(at: index),
+            let stream = backend.publish(on: session, name: "loopback-\(index)") else {
+            return
+        }
+        streams[index] = stream
+        startSource(for: stream, at: index)
+    }
+
+    func sessionManager(_ manager: SessionManager, didDisconnectConfigAt index: Int) {
+    }
+
+    func sessionManager(_ manager: SessionManager, configAt index: Int, didFailWithError error: Error) {
+        print("Loopback config \(index) failed: \(error)")
+    }
+
+    func sessionManager(_ manager: SessionManager, configAt index: Int, streamCreated stream: AnyObject) {
+        guard !configs[index].isPublisher, let session = manager.session(at: index) else { return }
+        let meter = speakers.meter(forConfigAt: index)
+        guard let subscription = backend.subscribe(on: session, to: stream, render: render, audio: { [weak self] block in
+            self?.meter(block, with: meter)
+        }) else {
+            return
+        }
+        subscriptions.append(subscription)
+    }
+
+    func sessionManager(_ manager: SessionManager, configAt index: Int, streamDestroyed stream: AnyObject) {
+    }
+}
+
+// Stands in for the views: touches every frame once and counts it.
+private final class CountingRender: NSObject, OTVideoRender {
+
+    let frames = AtomicInt()
+    private let checksum = AtomicInt()
+
+    func renderVideoFrame(_ frame: OTVideoFrame) {
+        if let planes = VideoPlanes(frame: frame) {
+            checksum.increment(by: Int64(planes.first.data[0]))
+        }
+        frames.increment()
+    }
+}
+
+#endif
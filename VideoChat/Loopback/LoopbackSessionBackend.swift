@@ -0,0 +1,274 @@
+//
+//  LoopbackSessionBackend.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreMedia
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// In-process stand-in for the OpenTok service. Sessions with the same session
+// id share a room: publishing announces the stream to every other connected
+// session, subscribers receive the publisher's frames and PCM through their
+// own NetworkShaper. Drives SessionManager like OpenTokSessionBackend does,
+// so the app logic and the media path can be load tested without a server.
+final class LoopbackSessionBackend: SessionBackend {
+
+    final class Session {
+        let sessionId: String
+        let connectionId: String
+        fileprivate let queue: DispatchQueue
+        fileprivate weak var events: SessionEventHandler?
+        fileprivate(set) var isConnected = false
+
+        fileprivate init(sessionId: String, connectionId: String, queue: DispatchQueue, events: SessionEventHandler) {
+            self.sessionId = sessionId
+            self.connectionId = connectionId
+            self.queue = queue
+            self.events = events
+        }
+    }
+
+    final class Stream {
+        let streamId: String
+        let name: String
+        fileprivate weak var session: Session?
+        fileprivate weak var backend: LoopbackSessionBackend?
+        fileprivate var subscriptions: [Subscription] = []
+        private let pool: VideoFrameBufferPool
+        private let converter: PixelFormatConverter
+        let framesSent = AtomicInt()
+
+        fileprivate init(streamId: String, name: String, session: Session, backend: LoopbackSessionBackend) {
+            self.streamId = streamId
+            self.name = name
+            self.session = session
+            self.backend = backend
+            pool = backend.pool
+            converter = backend.converter
+        }
+
+        // Publisher thread. The planes are copied before this returns.
+        func send(_ planes: VideoPlanes, timestamp: CMTime) {
+            let buffer = pool.acquire(format: VideoFrameFormat(pixelFormat: planes.pixelFormat,
+                                                               width: planes.width,
+                                                               height: planes.height))
+            guard converter.convert(planes, into: VideoPlanes(buffer: buffer)) else {
+                buffer.release()
+                return
+            }
+            framesSent.increment()
+            backend?.wire.async {
+                for subscription in self.subscriptions {
+                    subscription.receive(buffer, timestamp: timestamp)
+                }
+                buffer.release()
+            }
+        }
+
+        // Publisher thread, e.g. one 10 ms block.
+        func send(audio samples: UnsafePointer<Int16>, count: Int) {
+            let block = Array(UnsafeBufferPointer(start: samples, count: count))
+            backend?.wire.async {
+                for subscription in self.subscriptions {
+                    subscription.receive(block)
+                }
+            }
+        }
+    }
+
+    final class Subscription {
+        let stream: Stream
+        let shaper: NetworkShaper
+        fileprivate weak var session: Session?
+        private let render: OTVideoRender?
+        private let audio: (([Int16]) -> Void)?
+        private let deliveryQueue: DispatchQueue
+        private var videoFrame: OTVideoFrame?
+        let framesRendered = AtomicInt()
+
+        fileprivate init(stream: Stream, session: Session, configuration: NetworkShaper.Configuration,
+                         render: OTVideoRender?, audio: (([Int16]) -> Void)?) {
+            self.stream = stream
+            self.session = session
+            self.render = render
+            self.audio = audio
+            deliveryQueue = DispatchQueue(label: "VideoChat.Loopback.subscription", qos: .userInitiated)
+            shaper = NetworkShaper(configuration: configuration, queue: deliveryQueue)
+        }
+
+        // Wire queue.
+        fileprivate func receive(_ buffer: VideoFrameBuffer, timestamp: CMTime) {
+            guard render != nil else { return }
+            buffer.retain()
+            let bytes = (0..<buffer.format.planeCount).reduce(0) { $0 + buffer.format.planeSize($1) }
+            shaper.submit(bytes: bytes, deliver: {
+                self.renderFrame(buffer, timestamp: timestamp)
+                buffer.release()
+            }, drop: {
+                buffer.release()
+            })
+        }
+
+        // Wire queue.
+        fileprivate func receive(_ block: [Int16]) {
+            guard let audio = audio else { return }
+            shaper.submit(bytes: block.count * MemoryLayout<Int16>.size, deliver: {
+                audio(block)
+            })
+        }
+
+        private func renderFrame(_ buffer: VideoFrameBuffer, timestamp: CMTime) {
+            guard let render = render else { return }
+            if videoFrame?.format.flatMap({ VideoFrameFormat(format: $0) }) != buffer.format {
+                videoFrame = OTVideoFrame(format: buffer.format.makeVideoFormat())
+            }
+            guard let frame = videoFrame else { return }
+            buffer.attach(to: frame)
+            frame.timestamp = timestamp
+            frame.orientation = .up
+            render.renderVideoFrame(frame)
+            frame.clearPlanes()
+            framesRendered.increment()
+        }
+    }
+
+    var configuration: NetworkShaper.Configuration
+    fileprivate let wire = DispatchQueue(label: "VideoChat.Loopback.wire", qos: .userInitiated)
+    fileprivate let pool: VideoFrameBufferPool
+    fileprivate let converter: PixelFormatConverter
+    private var rooms: [String: [Session]] = [:]
+    private var streams: [String: [Stream]] = [:]
+    private var nextIdentifier = 0
+
+    init(configuration: NetworkShaper.Configuration = NetworkShaper.Configuration(),
+         pool: VideoFrameBufferPool = VideoFrameBufferPool.shared,
+         converter: PixelFormatConverter = PixelFormatConverter.shared) {
+        self.configuration = configuration
+        self.pool = pool
+        self.converter = converter
+    }
+
+    // MARK: - SessionBackend
+
+    func makeSession(apiKey: String, sessionId: String, queue: DispatchQueue, events: SessionEventHandler) -> AnyObject? {
+        return wire.sync {
+            let session = Session(sessionId: sessionId, connectionId: makeIdentifier("connection"), queue: queue, events: events)
+            rooms[sessionId, default: []].append(session)
+            return session
+        }
+    }
+
+    func connect(_ session: AnyObject, token: String) -> Error? {
+        guard let session = session as? Session else { return nil }
+        wire.asyncAfter(deadline: .now() + configuration.latency) {
+            guard !session.isConnected else { return }
+            session.isConnected = true
+            self.notify(session) { $0.sessionDidConnect(session) }
+            for stream in self.streams[session.sessionId] ?? [] where stream.session !== session {
+                self.notify(session) { $0.session(session, streamCreated: stream) }
+            }
+        }
+        return nil
+    }
+
+    func disconnect(_ session: AnyObject) {
+        guard let session = session as? Session else { return }
+        wire.async {
+            guard session.isConnected else { return }
+            for stream in self.streams[session.sessionId] ?? [] where stream.session === session {
+                self.remove(stream)
+            }
+            for stream in self.streams[session.sessionId] ?? [] {
+                stream.subscriptions.removeAll { $0.session === session }
+            }
+            session.isConnected = false
+            self.rooms[session.sessionId]?.removeAll { $0 === session }
+            self.notify(session) { $0.sessionDidDisconnect(session) }
+        }
+    }
+
+    // MARK: - Publishing and subscribing
+
+    func publish(on session: AnyObject, name: String) -> Stream? {
+        guard let session = session as? Session else { return nil }
+        return wire.sync {
+            guard session.isConnected else { return nil }
+            let stream = Stream(streamId: makeIdentifier("stream"), name: name, session: session, backend: self)
+            streams[session.sessionId, default: []].append(stream)
+            for other in rooms[session.sessionId] ?? [] where other !== session && other.isConnected {
+                notify(other) { $0.session(other, streamCreated: stream) }
+            }
+            return stream
+        }
+    }
+
+    func unpublish(_ stream: Stream) {
+        wire.async {
+            self.remove(stream)
+        }
+    }
+
+    func subscribe(on session: AnyObject, to stream: AnyObject,
+                   render: OTVideoRender?, audio: (([Int16]) -> Void)? = nil) -> Subscription? {
+        guard let session = session as? Session, let stream = stream as? Stream else { return nil }
+        return wire.sync {
+            guard session.isConnected else { return nil }
+            let subscription = Subscription(stream: stream, session: session, configuration: configuration,
+                                            render: render, audio: audio)
+            stream.subscriptions.append(subscription)
+            return subscription
+        }
+    }
+
+    func signal(_ session: AnyObject, type: String, string: String) -> Error? {
+        guard let session = session as? Session else { return nil }
+        guard string.utf8.count <= SignalChannel.maxSignalLength else {
+            return NSError(domain: "VideoChat.Loopback", code: 1413,
+                           userInfo: [NSLocalizedDescriptionKey: "Signal data too long"])
+        }
+        wire.asyncAfter(deadline: .now() + configuration.latency) {
+            guard session.isConnected else { return }
+            for other in self.rooms[session.sessionId] ?? [] where other !== session && other.isConnected {
+                self.notify(other) {
+                    $0.session(other, receivedSignalType: type, fromConnection: session.connectionId, string: string)
+                }
+            }
+        }
+        return nil
+    }
+
+    func unsubscribe(_ subscription: Subscription) {
+        wire.async {
+            subscription.stream.subscriptions.removeAll { $0 === subscription }
+        }
+    }
+
+    // Wire queue.
+    private func remove(_ stream: Stream) {
+        guard let session = stream.session else { return }
+        streams[session.sessionId]?.removeAll { $0 === stream }
+        stream.subscriptions.removeAll()
+        for other in rooms[session.sessionId] ?? [] where other !== session && other.isConnected {
+            notify(other) { $0.session(other, streamDestroyed: stream) }
+        }
+    }
+
+    private func notify(_ session: Session, _ body: @escaping (SessionEventHandler) -> Void) {
+        session.queue.async {
+            guard let events = session.events else { return }
+            body(events)
+        }
+    }
+
+    private func makeIdentifier(_ prefix: String) -> String {
+        nextIdentifier += 1
+        return "\(prefix)-\(nextIdentifier)"
+    }
+}
+
+#endif
@@ -0,0 +1,97 @@
+//
+//  NetworkShaper.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Emulates one direction of a link: packets queue behind a bandwidth limit,
+// are dropped at random with `lossRate`, and arrive `latency` ± `jitter`
+// later. Random numbers come from a seeded generator so runs repeat.
+final class NetworkShaper {
+
+    struct Configuration {
+        var bandwidth: Double = 4_000_000
+        var latency: TimeInterval = 0.05
+        var jitter: TimeInterval = 0.01
+        var lossRate = 0.0
+        // Packets waiting longer than this behind the bandwidth limit are
+        // dropped, like a router's tail drop
+        var maxQueueDelay: TimeInterval = 0.5
+        var seed: UInt64 = 0x9E37_79B9_7F4A_7C15
+    }
+
+    struct Statistics {
+        let sent: Int64
+        let delivered: Int64
+        let dropped: Int64
+        let bytesDelivered: Int64
+    }
+
+    let configuration: Configuration
+    private let queue: DispatchQueue
+    private var random: UInt64
+    private var linkFreeAt: UInt64 = 0
+    private let sent = AtomicInt()
+    private let delivered = AtomicInt()
+    private let dropped = AtomicInt()
+    private let bytesDelivered = AtomicInt()
+
+    // Deliveries run on `queue`.
+    init(configuration: Configuration = Configuration(), queue: DispatchQueue) {
+        self.configuration = configuration
+        self.queue = queue
+        random = configuration.seed == 0 ? 1 : configuration.seed
+    }
+
+    var statistics: Statistics {
+        return Statistics(sent: sent.value,
+                          delivered: delivered.value,
+                          dropped: dropped.value,
+                          bytesDelivered: bytesDelivered.value)
+    }
+
+    // Call from one thread at a time. Exactly one of `deliver` and `drop`
+    // runs for every packet; `drop` runs before submit returns.
+    func submit(bytes: Int, deliver: @escaping () -> Void, drop: (() -> Void)? = nil) {
+        sent.increment()
+        if nextRandom() < configuration.lossRate {
+            dropped.increment()
+            drop?()
+            return
+        }
+
+        let now = DispatchTime.now().uptimeNanoseconds
+        let transmit = UInt64(Double(bytes * 8) / configuration.bandwidth * 1_000_000_000)
+        let start = max(now, linkFreeAt)
+        guard Double(start - now) / 1_000_000_000 <= configuration.maxQueueDelay else {
+            dropped.increment()
+            drop?()
+            return
+        }
+        linkFreeAt = start + transmit
+
+        let jitter = (nextRandom() * 2 - 1) * configuration.jitter
+        let delay = max(configuration.latency + jitter, 0)
+        let arrival = DispatchTime(uptimeNanoseconds: linkFreeAt + UInt64(delay * 1_000_000_000))
+        queue.asyncAfter(deadline: arrival) { [delivered, bytesDelivered] in
+            delivered.increment()
+            bytesDelivered.increment(by: Int64(bytes))
+            deliver()
+        }
+    }
+
+    // xorshift64*, uniform in 0..<1
+    private func nextRandom() -> Double {
+        random ^= random >> 12
+        random ^= random << 25
+        random ^= random >> 27
+        return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+    }
+}
+
+#endif
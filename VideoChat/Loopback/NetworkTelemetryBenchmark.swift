@@ -0,0 +1,120 @@
+//
+//  NetworkTelemetryBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Times ingesting NetworkStats samples three ways: through a Key with a
+// remote subscriber id, the way every sample went before streams, through a
+// SubscriberStream, and through a PublisherStream fanning out to
+// `remoteSubscribers` ids. Each runs alone and against a thread reading
+// metrics and snapshots as fast as it can. Samples are timed in batches, so
+// the clock does not dominate. Start it with the `-telemetryBenchmark
+// [million samples per run]` launch argument.
+final class NetworkTelemetryBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let mode: String
+        let hasReader: Bool
+        let samples: Int
+        let nanosecondsPerSampleMean: Double
+        let nanosecondsPerSampleP99: Double
+        let snapshotsRead: Int64
+    }
+
+    static let argument = "-telemetryBenchmark"
+    static let fileName = "telemetry-benchmark"
+    static let modes = ["keyed", "subscriberStream", "publisherStream"]
+    static let remoteSubscribers = 8
+    static let batch = 1_000
+
+    let samples: Int
+
+    // Million samples per run, 2 by default.
+    init(parameter: Double?) {
+        samples = Int((parameter ?? 2) * 1_000_000)
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for mode in NetworkTelemetryBenchmark.modes {
+            for hasReader in [false, true] {
+                results.append(measure(mode: mode, hasReader: hasReader))
+            }
+        }
+        return results
+    }
+
+    private func measure(mode: String, hasReader: Bool) -> Result {
+        let telemetry = NetworkTelemetry()
+        let configIndex = 1
+        // Ids as long as the SDK's connection ids
+        let subscriberIds = (0..<NetworkTelemetryBenchmark.remoteSubscribers).map {
+            String(format: "%08X-0000-4000-8000-%012X", $0, $0)
+        }
+        let keys = subscriberIds.map {
+            NetworkTelemetry.Key(kind: .publisherVideo, configIndex: configIndex, subscriberId: $0)
+        }
+        let publisher = telemetry.publisherStream(configIndex: configIndex)
+        let subscriber = telemetry.subscriberStream(configIndex: configIndex)
+
+        let isRunning = AtomicInt(1)
+        let snapshots = AtomicInt()
+        let done = DispatchSemaphore(value: 0)
+        if hasReader {
+            Thread {
+                while isRunning.value != 0 {
+                    _ = telemetry.metrics(kind: .publisherVideo, configIndex: configIndex)
+                    _ = telemetry.snapshot()
+                    snapshots.increment()
+                }
+                done.signal()
+            }.start()
+        }
+
+        let histogram = LatencyHistogram()
+        var total: UInt64 = 0
+        var index = 0
+        while index < samples {
+            let count = min(NetworkTelemetryBenchmark.batch, samples - index)
+            let startedAt = DispatchTime.now().uptimeNanoseconds
+            for offset in index..<index + count {
+                let sample = NetworkStatsWindow.Sample(timestamp: Double(offset) * 100,
+                                                       bytes: Int64(offset) * 1_200,
+                                                       packets: Int64(offset),
+                                                       packetsLost: Int64(offset / 100))
+                let remote = offset % NetworkTelemetryBenchmark.remoteSubscribers
+                switch mode {
+                case "keyed":
+                    telemetry.record(sample, for: keys[remote])
+                case "subscriberStream":
+                    subscriber.recordVideo(sample)
+                default:
+                    publisher.recordVideo(sample, subscriberId: subscriberIds[remote])
+                }
+            }
+            let elapsed = DispatchTime.now().uptimeNanoseconds - startedAt
+            total += elapsed
+            histogram.record(Int64(elapsed) / Int64(count))
+            index += count
+        }
+
+        isRunning.store(0)
+        if hasReader {
+            done.wait()
+        }
+        return Result(mode: mode,
+                      hasReader: hasReader,
+                      samples: samples,
+                      nanosecondsPerSampleMean: Double(total) / Double(max(samples, 1)),
+                      nanosecondsPerSampleP99: Double(histogram.summary.p99),
+                      snapshotsRead: snapshots.value)
+    }
+}
+
+#endif
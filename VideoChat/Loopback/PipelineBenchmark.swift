@@ -0,0 +1,290 @@
+//
+//  PipelineBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreGraphics
+import CoreMedia
+import Foundation
+import OpenTok
+
+#if DEBUG
+
+// OTVideoCapture over a SyntheticVideoSource, paced at `frameRate`. Frames go
+// through a FrameHandoffQueue, a VideoFilterGraph and ImageBufferDelivery like
+// the camera capturer's, stamped for latency tracing.
+final class SyntheticVideoCapture: NSObject, OTVideoCapture {
+
+    weak var videoCaptureConsumer: OTVideoCaptureConsumer?
+
+    let source: SyntheticVideoSource
+    let frameRate: Int
+    // Without a budget, so every filter is measured on every frame
+    let filterGraph = VideoFilterGraph()
+    private let tracer: LatencyTracer
+    private let queue = FrameHandoffQueue<SharedCameraCapture.Frame>()
+    private let captureQueue = DispatchQueue(label: "VideoChat.SyntheticVideoCapture.capture", qos: .userInteractive)
+    private let deliveryQueue = DispatchQueue(label: "VideoChat.SyntheticVideoCapture.delivery", qos: .userInteractive)
+    private let delivery = ImageBufferDelivery()
+    private var timer: DispatchSourceTimer?
+    private var sequence: UInt32 = 0
+
+    init(source: SyntheticVideoSource, frameRate: Int, tracer: LatencyTracer) {
+        self.source = source
+        self.frameRate = frameRate
+        self.tracer = tracer
+        super.init()
+        filterGraph.onCopy = { [delivery] bytes in
+            delivery.recordCopy(bytes: bytes)
+        }
+    }
+
+    func initCapture() {
+    }
+
+    func releaseCapture() {
+        _ = stopCapture()
+    }
+
+    func startCapture() -> Int32 {
+        guard timer == nil else { return 0 }
+        let timer = DispatchSource.makeTimerSource(queue: captureQueue)
+        timer.schedule(deadline: .now(), repeating: 1 / Double(frameRate), leeway: .milliseconds(1))
+        timer.setEventHandler { [weak self] in
+            self?.capture()
+        }
+        self.timer = timer
+        timer.resume()
+        return 0
+    }
+
+    func stopCapture() -> Int32 {
+        timer?.cancel()
+        timer = nil
+        return 0
+    }
+
+    func isCaptureStarted() -> Bool {
+        return timer != nil
+    }
+
+    var deliveryStatistics: ImageBufferDelivery.Statistics {
+        return delivery.statistics
+    }
+
+    func captureSettings(_ videoFormat: OTVideoFormat) -> Int32 {
+        videoFormat.pixelFormat = source.format.pixelFormat.otPixelFormat
+        videoFormat.imageWidth = UInt32(source.format.width)
+        videoFormat.imageHeight = UInt32(source.format.height)
+        videoFormat.estimatedFramesPerSecond = Double(frameRate)
+        return 0
+    }
+
+    // Capture queue.
+    private func capture() {
+        let capturedAt = FrameStamp.now()
+        let frameIndex = source.frameIndex
+        let buffer = source.nextFrame()
+        let pixelBuffer = buffer.makePixelBuffer()
+        buffer.release()
+        guard let wrapped = pixelBuffer else { return }
+        queue.push(SharedCameraCapture.Frame(pixelBuffer: wrapped,
+                                             timestamp: CMTime(value: CMTimeValue(frameIndex),
+                                                               timescale: CMTimeScale(frameRate)),
+                                             capturedAt: capturedAt,
+                                             orientation: .up))
+        deliveryQueue.async {
+            self.consumePending()
+        }
+    }
+
+    // Delivery queue.
+    private func consumePending() {
+        guard let frame = queue.pop(), let consumer = videoCaptureConsumer else { return }
+        sequence &+= 1
+        delivery.deliver(filterGraph.process(frame.pixelBuffer), orientation: frame.orientation, timestamp: frame.timestamp,
+                         metadata: tracer.stamp(sequence: sequence, capturedAt: frame.capturedAt),
+                         to: consumer)
+    }
+}
+
+// Stands in for the encoder input: converts every frame to I420 and hands it
+// to a renderer, keeping the frame metadata.
+final class ConvertingCaptureConsumer: NSObject, OTVideoCaptureConsumer {
+
+    private let render: OTVideoRender
+    private let converter: PixelFormatConverter
+    private let pool: VideoFrameBufferPool
+    private var videoFrame: OTVideoFrame?
+
+    init(render: OTVideoRender,
+         converter: PixelFormatConverter = PixelFormatConverter.shared,
+         pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) {
+        self.render = render
+        self.converter = converter
+        self.pool = pool
+        super.init()
+    }
+
+    func consumeFrame(_ frame: OTVideoFrame) {
+        guard let source = VideoPlanes(frame: frame) else { return }
+        consume(source, timestamp: frame.timestamp, orientation: frame.orientation, metadata: frame.metadata)
+    }
+
+    func consumeImageBuffer(_ frame: CVImageBuffer, orientation: OTVideoOrientation,
+                            timestamp ts: CMTime, metadata: Data?) -> Bool {
+        CVPixelBufferLockBaseAddress(frame, .readOnly)
+        defer { CVPixelBufferUnlockBaseAddress(frame, .readOnly) }
+        guard let source = VideoPlanes(pixelBuffer: frame) else { return false }
+        consume(source, timestamp: ts, orientation: orientation, metadata: metadata)
+        return true
+    }
+
+    private func consume(_ source: VideoPlanes, timestamp: CMTime, orientation: OTVideoOrientation, metadata: Data?) {
+        let format = VideoFrameFormat(pixelFormat: .i420, width: source.width, height: source.height)
+        let buffer = pool.acquire(format: format)
+        defer { buffer.release() }
+        guard converter.convert(source, into: VideoPlanes(buffer: buffer)) else { return }
+
+        if videoFrame?.format.flatMap({ VideoFrameFormat(format: $0) }) != format {
+            videoFrame = OTVideoFrame(format: format.makeVideoFormat())
+        }
+        guard let output = videoFrame else { return }
+        buffer.attach(to: output)
+        output.timestamp = timestamp
+        output.orientation = orientation
+        if let metadata = metadata {
+            var error: OTError?
+            output.setMetadata(metadata, error: &error)
+        }
+        render.renderVideoFrame(output)
+        output.clearPlanes()
+    }
+}
+
+// Runs capture -> OTVideoCaptureConsumer -> conversion -> OTVideoRender for
+// every source format, size and frame rate, then NV12 at every size through
+// the built-in filter chain, and writes the results as JSON. Start it with the
+// `-pipelineBenchmark [seconds per run]` launch argument.
+final class PipelineBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let pixelFormat: String
+        let width: Int
+        let height: Int
+        let targetFrameRate: Int
+        let framesPerSecond: Double
+        let cpuMicrosecondsPerFrame: Double
+        let allocationsPerFrame: Double
+        let copiesPerFrame: Double
+        let p50LatencyMicroseconds: Double
+        let p99LatencyMicroseconds: Double
+        let filters: [String]
+        let filterMicrosecondsPerFrame: [String: Double]
+    }
+
+    static let argument = "-pipelineBenchmark"
+    static let fileName = "pipeline-benchmark"
+    static let pixelFormats: [(name: String, format: PixelFormat)] = [("i420", .i420), ("nv12", .nv12), ("argb", .argb)]
+    static let sizes = [(640, 360), (1280, 720), (1920, 1080)]
+    static let frameRates = [7, 15, 30]
+
+    let runDuration: TimeInterval
+
+    // Seconds per run, 3 by default.
+    init(parameter: Double?) {
+        runDuration = parameter ?? 3
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for pixelFormat in PipelineBenchmark.pixelFormats {
+            for size in PipelineBenchmark.sizes {
+                for frameRate in PipelineBenchmark.frameRates {
+                    results.append(measure(pixelFormat: pixelFormat, width: size.0, height: size.1,
+                                           frameRate: frameRate, filters: []))
+                }
+            }
+        }
+        for size in PipelineBenchmark.sizes {
+            results.append(measure(pixelFormat: ("nv12", .nv12), width: size.0, height: size.1,
+                                   frameRate: 30, filters: PipelineBenchmark.filterChain(width: size.0, height: size.1)))
+        }
+        return results
+    }
+
+    // Crops a 5% border and scales back up, then mirrors, denoises and
+    // stamps a badge.
+    static func filterChain(width: Int, height: Int) -> [VideoFilter] {
+        var filters: [VideoFilter] = [CropFilter(rect: CGRect(x: 0.05, y: 0.05, width: 0.9, height: 0.9)),
+                                      ScaleFilter(width: width, height: height),
+                                      MirrorFilter(),
+                                      TemporalDenoiseFilter()]
+        let badge = CGContext(data: nil, width: 128, height: 48, bitsPerComponent: 8, bytesPerRow: 128 * 4,
+                              space: CGColorSpaceCreateDeviceRGB(),
+                              bitmapInfo: CGImageAlphaInfo.premultipliedLast.rawValue)
+        badge?.setFillColor(red: 1, green: 1, blue: 1, alpha: 0.6)
+        badge?.fill(CGRect(x: 0, y: 0, width: 128, height: 48))
+        if let image = badge?.makeImage(), let overlay = OverlayFilter(image: image, x: 16, y: 16) {
+            filters.append(overlay)
+        }
+        return filters
+    }
+
+    private func measure(pixelFormat: (name: String, format: PixelFormat), width: Int, height: Int, frameRate: Int,
+                         filters: [VideoFilter]) -> Result {
+        let compositor = VideoCompositor(tileCount: 1)
+        compositor.resize(width: 640, height: 360)
+        let tracer = LatencyTracer()
+        let render = LatencyTracingRender(next: compositor.tileRender(at: 0), streamName: "benchmark", tracer: tracer)
+        let consumer = ConvertingCaptureConsumer(render: render)
+        let capture = SyntheticVideoCapture(source: SyntheticVideoSource(pixelFormat: pixelFormat.format,
+                                                                         width: width, height: height),
+                                            frameRate: frameRate,
+                                            tracer: tracer)
+        capture.videoCaptureConsumer = consumer
+        capture.filterGraph.filters = filters
+
+        // One second of warm-up fills the buffer pool
+        capture.initCapture()
+        _ = capture.startCapture()
+        Thread.sleep(forTimeInterval: 1)
+
+        tracer.register(stream: "benchmark").histogram.reset()
+        // Fresh timings without the warm-up
+        capture.filterGraph.filters = filters
+        let deliveryBefore = capture.deliveryStatistics
+        let allocationsBefore = VideoFrameBufferPool.shared.statistics.allocations
+        let cpuBefore = ProcessMetrics.cpuTime()
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        Thread.sleep(forTimeInterval: runDuration)
+        let elapsed = Double(DispatchTime.now().uptimeNanoseconds - startedAt) / 1_000_000_000
+        let cpu = ProcessMetrics.cpuTime() - cpuBefore
+        let allocations = VideoFrameBufferPool.shared.statistics.allocations - allocationsBefore
+        let delivery = capture.deliveryStatistics
+        let filterStatistics = capture.filterGraph.statistics.filters
+        capture.releaseCapture()
+
+        let latency = tracer.statistics["benchmark"]?.latency
+        let frames = max(Double(latency?.count ?? 0), 1)
+        return Result(pixelFormat: pixelFormat.name,
+                      width: width,
+                      height: height,
+                      targetFrameRate: frameRate,
+                      framesPerSecond: frames / elapsed,
+                      cpuMicrosecondsPerFrame: cpu / frames * 1_000_000,
+                      allocationsPerFrame: Double(allocations) / frames,
+                      copiesPerFrame: Double(delivery.copies - deliveryBefore.copies)
+                          / Double(max(delivery.frames - deliveryBefore.frames, 1)),
+                      p50LatencyMicroseconds: Double(latency?.p50 ?? 0) / 1_000,
+                      p99LatencyMicroseconds: Double(latency?.p99 ?? 0) / 1_000,
+                      filters: filterStatistics.map { $0.name },
+                      filterMicrosecondsPerFrame: Dictionary(uniqueKeysWithValues: filterStatistics.map {
+                          ($0.name, $0.latency.mean / 1_000)
+                      }))
+    }
+}
+
+#endif
@@ -0,0 +1,154 @@
+//
+//  RecorderBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Records 8 synthetic 720p30 I420 streams and a 48 kHz audio stream into a
+// CallRecorder, each on its own timer queue the way subscriber renders and the
+// audio device call it, with a full and a starved set of buffers. Reports the
+// data rate, frames dropped and how long the recording call held up each
+// frame, which should stay far below the disk's write time. Start it with the
+// `-recorderBenchmark [seconds per run]` launch argument.
+final class RecorderBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let streams: Int
+        let width: Int
+        let height: Int
+        let frameRate: Int
+        let bufferCount: Int
+        let seconds: Double
+        let framesOffered: Int64
+        let framesRecorded: Int64
+        let recordsDropped: Int64
+        let megabytesPerSecond: Double
+        let recordMicrosecondsP50: Double
+        let recordMicrosecondsP99: Double
+        let recordMicrosecondsMax: Double
+        let writeMillisecondsPerBuffer: Double
+        let maxQueuedBuffers: Int64
+        let writeErrors: Int64
+    }
+
+    static let argument = "-recorderBenchmark"
+    static let fileName = "recorder-benchmark"
+    static let streamCount = 8
+    static let width = 1280
+    static let height = 720
+    static let frameRate = 30
+    static let bufferCounts = [16, 3]
+    static let audioPacketSamples = 480
+
+    let duration: TimeInterval
+
+    // Seconds per run, 10 by default.
+    init(parameter: Double?) {
+        duration = parameter ?? 10
+    }
+
+    func run() -> [Result] {
+        return RecorderBenchmark.bufferCounts.compactMap { measure(bufferCount: $0) }
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.writeErrors == 0 else {
+            return "\(result.streams) streams: \(result.writeErrors) write errors"
+        }
+        return nil
+    }
+
+    private func measure(bufferCount: Int) -> Result? {
+        let url = FileManager.default.temporaryDirectory.appendingPathComponent("recorder-benchmark.vcrd")
+        defer { try? FileManager.default.removeItem(at: url) }
+        guard let recorder = CallRecorder(url: url, bufferCount: bufferCount) else { return nil }
+
+        let latency = LatencyHistogram()
+        let offered = AtomicInt()
+        let group = DispatchGroup()
+        var timers: [DispatchSourceTimer] = []
+        let deadline = DispatchTime.now() + duration
+
+        for index in 0..<RecorderBenchmark.streamCount {
+            let source = SyntheticVideoSource(pixelFormat: .i420, width: RecorderBenchmark.width,
+                                              height: RecorderBenchmark.height)
+            let stream = recorder.stream(named: "stream-\(index)", kind: .video)
+            let streamQueue = DispatchQueue(label: "VideoChat.RecorderBenchmark.stream\(index)", qos: .userInteractive)
+            let timer = DispatchSource.makeTimerSource(queue: streamQueue)
+            group.enter()
+            timer.schedule(deadline: .now(), repeating: 1 / Double(RecorderBenchmark.frameRate), leeway: .milliseconds(1))
+            timer.setEventHandler {
+                guard DispatchTime.now() < deadline else {
+                    timer.cancel()
+                    return
+                }
+                let frame = source.nextFrame()
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                recorder.recordVideo(VideoPlanes(buffer: frame), stream: stream)
+                latency.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+                offered.increment()
+                frame.release()
+            }
+            timer.setCancelHandler {
+                group.leave()
+            }
+            timers.append(timer)
+        }
+
+        let sampleRate = 48_000
+        let audioStream = recorder.stream(named: "audio", kind: .audio)
+        let samples = [Int16](repeating: 0, count: RecorderBenchmark.audioPacketSamples)
+        let audioTimer = DispatchSource.makeTimerSource(queue: DispatchQueue(label: "VideoChat.RecorderBenchmark.audio",
+                                                                             qos: .userInteractive))
+        group.enter()
+        audioTimer.schedule(deadline: .now(), repeating: Double(RecorderBenchmark.audioPacketSamples) / Double(sampleRate),
+                            leeway: .milliseconds(1))
+        audioTimer.setEventHandler {
+            guard DispatchTime.now() < deadline else {
+                audioTimer.cancel()
+                return
+            }
+            samples.withUnsafeBytes {
+                recorder.recordAudio($0.baseAddress!, count: samples.count, sampleRate: sampleRate, channels: 1,
+                                     stream: audioStream)
+            }
+        }
+        audioTimer.setCancelHandler {
+            group.leave()
+        }
+        timers.append(audioTimer)
+
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        timers.forEach { $0.resume() }
+        group.wait()
+        recorder.close()
+        let seconds = Double(DispatchTime.now().uptimeNanoseconds - startedAt) / 1_000_000_000
+
+        let statistics = recorder.statistics
+        let summary = latency.summary
+        return Result(streams: RecorderBenchmark.streamCount,
+                      width: RecorderBenchmark.width,
+                      height: RecorderBenchmark.height,
+                      frameRate: RecorderBenchmark.frameRate,
+                      bufferCount: bufferCount,
+                      seconds: seconds,
+                      framesOffered: offered.value,
+                      framesRecorded: statistics.videoFrames,
+                      recordsDropped: statistics.writer.droppedRecords,
+                      megabytesPerSecond: Double(statistics.writer.bytesWritten) / 1_048_576 / seconds,
+                      recordMicrosecondsP50: Double(summary.p50) / 1_000,
+                      recordMicrosecondsP99: Double(summary.p99) / 1_000,
+                      recordMicrosecondsMax: Double(summary.max) / 1_000,
+                      writeMillisecondsPerBuffer: Double(statistics.writer.writeNanoseconds)
+                        / Double(max(statistics.writer.buffersWritten, 1)) / 1_000_000,
+                      maxQueuedBuffers: statistics.writer.maxQueuedBuffers,
+                      writeErrors: statistics.writer.writeErrors)
+    }
+}
+
+#endif
@@ -0,0 +1,203 @@
+//
+//  SignalChannelBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Connects two SignalChannels over a loopback transport that enforces the
+// signal data limit and delivers on its own queue, like a session. Three
+// workloads go through it: speaker state and quality hints for 16 subjects
+// from 4 threads as fast as they can (mostly superseded), events with 32
+// byte payloads from 4 threads (never superseded, so envelopes fill up and
+// split), and the app's paced control traffic for 8 subscribers. Reports
+// end-to-end message throughput, signals and bytes on the wire against one
+// signal per message, payloads that arrived with the wrong length, and the
+// time to post and to receive. Start it with the
+// `-signalBenchmark [thousand messages per run]` launch argument.
+final class SignalChannelBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let workload: String
+        let seconds: Double
+        let messagesPosted: Int64
+        let messagesSuperseded: Int64
+        let messagesReceived: Int64
+        let messagesPerSecond: Double
+        let signalsSent: Int64
+        let signalsPerSecond: Double
+        let averageSignalBytes: Double
+        let maxSignalBytes: Int64
+        let bytesPerPostedMessage: Double
+        let bytesPerPostedMessageUnbatched: Double
+        let sendErrors: Int64
+        let malformedSignals: Int64
+        let wrongPayloads: Int64
+        let postNanosecondsMean: Double
+        let receiveMicrosecondsPerSignalP99: Double
+    }
+
+    static let argument = "-signalBenchmark"
+    static let fileName = "signal-benchmark"
+    static let workloads = ["state", "events", "paced"]
+    static let threads = 4
+    static let subjects = 16
+    static let pacedSubscribers = 8
+    static let pacedSeconds: TimeInterval = 5
+    // Gives up waiting for delivery after this
+    static let timeout: TimeInterval = 30
+
+    let messages: Int
+
+    // Thousand messages per run, 200 by default; the paced run lasts 5 s.
+    init(parameter: Double?) {
+        messages = max(Int((parameter ?? 200) * 1_000), SignalChannelBenchmark.threads)
+    }
+
+    func run() -> [Result] {
+        return SignalChannelBenchmark.workloads.map { measure(workload: $0) }
+    }
+
+    func failure(in result: Result) -> String? {
+        if result.sendErrors > 0 || result.malformedSignals > 0 || result.wrongPayloads > 0 {
+            return "\(result.workload): \(result.sendErrors) send errors, \(result.malformedSignals) malformed signals, "
+                + "\(result.wrongPayloads) wrong payloads"
+        }
+        if result.messagesReceived + result.messagesSuperseded != result.messagesPosted {
+            return "\(result.workload): \(result.messagesPosted) posted, \(result.messagesReceived) received, "
+                + "\(result.messagesSuperseded) superseded"
+        }
+        return nil
+    }
+
+    private func measure(workload: String) -> Result {
+        let receiveQueue = DispatchQueue(label: "VideoChat.SignalChannelBenchmark.receive", qos: .userInitiated)
+        let receiveTimes = LatencyHistogram()
+        let maxSignalBytes = AtomicInt()
+        let receiver = SignalChannel { _ in nil }
+        let sender = SignalChannel { string in
+            let length = string.utf8.count
+            guard length <= SignalChannel.maxSignalLength else {
+                return NSError(domain: "VideoChat.Loopback", code: 1413,
+                               userInfo: [NSLocalizedDescriptionKey: "Signal data too long"])
+            }
+            maxSignalBytes.storeMax(Int64(length))
+            receiveQueue.async {
+                let startedAt = DispatchTime.now().uptimeNanoseconds
+                receiver.receive(string)
+                receiveTimes.record(Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+            }
+            return nil
+        }
+        let wrongPayloads = AtomicInt()
+        receiver.onMessage = { message in
+            let expected = message.kind == .event ? 32 : (message.kind == .layout ? 16 : 1)
+            if message.payload.count != expected {
+                wrongPayloads.increment()
+            }
+        }
+
+        // What the same messages would take sent one per signal
+        let unbatchedBytes = AtomicInt()
+        let postTime = AtomicInt()
+        func post(_ kind: SignalChannel.Kind, subject: UInt16, payload: Data) {
+            let startedAt = DispatchTime.now().uptimeNanoseconds
+            sender.post(kind, subject: subject, payload: payload)
+            postTime.increment(by: Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+            unbatchedBytes.increment(by: Int64((8 + payload.count + 2) / 3 * 4))
+        }
+
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        switch workload {
+        case "paced":
+            postPaced(post)
+        default:
+            let group = DispatchGroup()
+            let perThread = messages / SignalChannelBenchmark.threads
+            for thread in 0..<SignalChannelBenchmark.threads {
+                group.enter()
+                Thread {
+                    var event = Data(count: 32)
+                    for index in 0..<perThread {
+                        let subject = UInt16((thread + index) % SignalChannelBenchmark.subjects)
+                        if workload == "events" {
+                            event[0] = UInt8(truncatingIfNeeded: index)
+                            post(.event, subject: subject, payload: event)
+                        } else {
+                            post(index.isMultiple(of: 3) ? .qualityHint : .speakerState,
+                                 subject: subject,
+                                 payload: Data([UInt8(truncatingIfNeeded: index)]))
+                        }
+                    }
+                    group.leave()
+                }.start()
+            }
+            group.wait()
+        }
+
+        // Every message is either superseded or received once the last
+        // window has flushed and the loopback drained
+        let deadline = DispatchTime.now() + SignalChannelBenchmark.timeout
+        while DispatchTime.now() < deadline {
+            let current = sender.statistics
+            let done = receiver.statistics.messagesReceived + current.messagesSuperseded
+            if done >= current.messagesPosted || current.sendErrors > 0 {
+                break
+            }
+            Thread.sleep(forTimeInterval: 0.005)
+        }
+        receiveQueue.sync {}
+        let seconds = Double(DispatchTime.now().uptimeNanoseconds - startedAt) / 1_000_000_000
+
+        let sent = sender.statistics
+        let got = receiver.statistics
+        let posted = max(Double(sent.messagesPosted), 1)
+        return Result(workload: workload,
+                      seconds: seconds,
+                      messagesPosted: sent.messagesPosted,
+                      messagesSuperseded: sent.messagesSuperseded,
+                      messagesReceived: got.messagesReceived,
+                      messagesPerSecond: Double(sent.messagesPosted) / seconds,
+                      signalsSent: sent.signalsSent,
+                      signalsPerSecond: Double(sent.signalsSent) / seconds,
+                      averageSignalBytes: Double(sent.bytesSent) / Double(max(sent.signalsSent, 1)),
+                      maxSignalBytes: maxSignalBytes.value,
+                      bytesPerPostedMessage: Double(sent.bytesSent) / posted,
+                      bytesPerPostedMessageUnbatched: Double(unbatchedBytes.value) / posted,
+                      sendErrors: sent.sendErrors,
+                      malformedSignals: got.malformedSignals,
+                      wrongPayloads: wrongPayloads.value,
+                      postNanosecondsMean: Double(postTime.value) / posted,
+                      receiveMicrosecondsPerSignalP99: Double(receiveTimes.summary.p99) / 1_000)
+    }
+
+    // Per subscriber a speaker state every audio block and a quality hint
+    // every frame, plus a layout change every second.
+    private func postPaced(_ post: (SignalChannel.Kind, UInt16, Data) -> Void) {
+        let blocks = Int(SignalChannelBenchmark.pacedSeconds * 100)
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        for block in 0..<blocks {
+            for subscriber in 0..<SignalChannelBenchmark.pacedSubscribers {
+                let subject = UInt16(subscriber)
+                post(.speakerState, subject, Data([UInt8(truncatingIfNeeded: block)]))
+                if block % 3 == 0 {
+                    post(.qualityHint, subject, Data([UInt8(truncatingIfNeeded: block / 3)]))
+                }
+            }
+            if block % 100 == 0 {
+                post(.layout, 0, Data(repeating: UInt8(truncatingIfNeeded: block / 100), count: 16))
+            }
+            let due = startedAt + UInt64(block + 1) * 10_000_000
+            let now = DispatchTime.now().uptimeNanoseconds
+            if due > now {
+                usleep(useconds_t((due - now) / 1_000))
+            }
+        }
+    }
+}
+
+#endif
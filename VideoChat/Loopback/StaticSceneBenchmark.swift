@@ -0,0 +1,131 @@
+//
+//  StaticSceneBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Plays a scripted sequence of still and moving stretches of the synthetic
+// pattern at 30 fps through a StaticSceneDetector, converting delivered frames
+// to I420 as a stand-in for the encoder input. Reports how many frames were
+// skipped, whether any moving frame was, how long resuming took and what the
+// detector costs. Start it with the `-staticSceneBenchmark` launch argument.
+final class StaticSceneBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let pixelFormat: String
+        let width: Int
+        let height: Int
+        let noise: Int
+        let frames: Int
+        let skippedFrames: Int
+        let movingFramesSkipped: Int
+        // Frames from the start of a moving stretch to the first one delivered
+        let maxResumeFrames: Int
+        let staticFramesPerSecond: Double
+        let detectionMicrosecondsPerFrame: Double
+        let rawMegabytesSkipped: Double
+        let cpuMillisecondsSaved: Double
+    }
+
+    static let argument = "-staticSceneBenchmark"
+    static let fileName = "static-scene-benchmark"
+    static let frameRate = 30
+    // Moving or not, for how many frames
+    static let script: [(isMoving: Bool, frames: Int)] = [(false, 90), (true, 30), (false, 150), (true, 5),
+                                                          (false, 60), (true, 60), (false, 300)]
+    static let pixelFormats: [(name: String, format: PixelFormat)] = [("i420", .i420), ("nv12", .nv12)]
+    static let sizes = [(640, 360), (1280, 720)]
+    static let noiseLevels = [0, 4]
+
+    private let pool = VideoFrameBufferPool.shared
+    private let converter = PixelFormatConverter.shared
+
+    init(parameter: Double?) {
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for pixelFormat in StaticSceneBenchmark.pixelFormats {
+            for size in StaticSceneBenchmark.sizes {
+                for noise in StaticSceneBenchmark.noiseLevels {
+                    results.append(measure(pixelFormat: pixelFormat, width: size.0, height: size.1, noise: noise))
+                }
+            }
+        }
+        return results
+    }
+
+    func failure(in result: Result) -> String? {
+        guard result.movingFramesSkipped == 0 else {
+            return "\(result.pixelFormat) noise \(result.noise): \(result.movingFramesSkipped) moving frames skipped"
+        }
+        return nil
+    }
+
+    private func measure(pixelFormat: (name: String, format: PixelFormat), width: Int, height: Int, noise: Int) -> Result {
+        let source = SyntheticVideoSource(pixelFormat: pixelFormat.format, width: width, height: height,
+                                          scrollSpeed: 0, noise: noise)
+        let detector = StaticSceneDetector()
+        let i420 = VideoFrameFormat(pixelFormat: .i420, width: source.format.width, height: source.format.height)
+        var frames = 0
+        var movingFramesSkipped = 0
+        var maxResumeFrames = 0
+        var staticFrames = 0
+        var staticFramesDelivered = 0
+
+        for stretch in StaticSceneBenchmark.script {
+            source.isMoving = stretch.isMoving
+            var resumeFrames: Int?
+            for index in 0..<stretch.frames {
+                let frame = source.nextFrame()
+                let time = Double(frames) / Double(StaticSceneBenchmark.frameRate)
+                let isDelivered = detector.shouldDeliver(VideoPlanes(buffer: frame), at: time)
+                frames += 1
+
+                if isDelivered {
+                    let startedAt = DispatchTime.now().uptimeNanoseconds
+                    let output = pool.acquire(format: i420)
+                    converter.convert(VideoPlanes(buffer: frame), into: VideoPlanes(buffer: output))
+                    output.release()
+                    detector.recordDelivery(nanoseconds: DispatchTime.now().uptimeNanoseconds - startedAt)
+                }
+                if stretch.isMoving {
+                    if !isDelivered {
+                        movingFramesSkipped += 1
+                    } else if resumeFrames == nil {
+                        resumeFrames = index
+                    }
+                } else {
+                    staticFrames += 1
+                    staticFramesDelivered += isDelivered ? 1 : 0
+                }
+                frame.release()
+            }
+            if stretch.isMoving {
+                maxResumeFrames = max(maxResumeFrames, resumeFrames ?? stretch.frames)
+            }
+        }
+
+        let statistics = detector.statistics
+        let staticSeconds = Double(staticFrames) / Double(StaticSceneBenchmark.frameRate)
+        return Result(pixelFormat: pixelFormat.name,
+                      width: width,
+                      height: height,
+                      noise: noise,
+                      frames: frames,
+                      skippedFrames: Int(statistics.skippedFrames),
+                      movingFramesSkipped: movingFramesSkipped,
+                      maxResumeFrames: maxResumeFrames,
+                      staticFramesPerSecond: Double(staticFramesDelivered) / max(staticSeconds, 1),
+                      detectionMicrosecondsPerFrame: Double(statistics.detectionNanoseconds) / Double(max(frames, 1)) / 1_000,
+                      rawMegabytesSkipped: Double(statistics.rawBytesSkipped) / 1_048_576,
+                      cpuMillisecondsSaved: Double(statistics.cpuNanosecondsSaved) / 1_000_000)
+    }
+}
+
+#endif
@@ -0,0 +1,168 @@
+//
+//  SubscriberQualityBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreGraphics
+import Foundation
+
+#if DEBUG
+
+// Replays bandwidth and CPU traces through SubscriberQualityPolicy, one
+// decision per SubscriberQualityController.updateInterval, for a large, a
+// medium and a small tile. Each period the stream sends what its level
+// needs; the link delivers up to its capacity and loses the rest, queueing
+// makes the packet rate uneven, and that is what the policy sees next
+// period, as it would from the telemetry.
+// Without the controller every stream asks for the top of the ladder.
+// Reports level changes and flaps (a change undone within `flapPeriods`)
+// per minute, congested periods with and without the controller and the
+// bandwidth saved. Start it with the `-qualityBenchmark [trace minutes]`
+// launch argument.
+final class SubscriberQualityBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let trace: String
+        let tileWidth: Int
+        let tileHeight: Int
+        let periods: Int
+        let levelChangesPerMinute: Double
+        let flapsPerMinute: Double
+        let meanLevel: Double
+        let congestedPeriods: Int
+        let congestedPeriodsWithoutController: Int
+        let deliveredMegabytes: Double
+        let deliveredMegabytesWithoutController: Double
+        let bandwidthSaved: Double
+    }
+
+    private struct Sample {
+        // Bits per second the link can carry
+        let capacity: Double
+        let cpuLoad: Double
+    }
+
+    static let argument = "-qualityBenchmark"
+    static let fileName = "quality-benchmark"
+    static let traces = ["steady", "step", "oscillating", "randomWalk", "cpuSpike"]
+    static let tileSizes = [CGSize(width: 1280, height: 720), CGSize(width: 640, height: 360),
+                            CGSize(width: 320, height: 180)]
+    static let flapPeriods = 5
+
+    let minutes: Double
+
+    // Trace minutes, 10 by default.
+    init(parameter: Double?) {
+        minutes = parameter ?? 10
+    }
+
+    func run() -> [Result] {
+        var results: [Result] = []
+        for trace in SubscriberQualityBenchmark.traces {
+            let samples = makeTrace(trace)
+            for tileSize in SubscriberQualityBenchmark.tileSizes {
+                results.append(replay(samples, trace: trace, tileSize: tileSize))
+            }
+        }
+        return results
+    }
+
+    private func makeTrace(_ name: String) -> [Sample] {
+        var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+        // xorshift64*, uniform in 0..<1
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+
+        let count = max(Int(minutes * 60 / SubscriberQualityController.updateInterval), 1)
+        var capacity = 2_000_000.0
+        return (0..<count).map { index -> Sample in
+            let isMiddleThird = index >= count / 3 && index < count * 2 / 3
+            switch name {
+            case "step":
+                return Sample(capacity: isMiddleThird ? 400_000 : 3_000_000, cpuLoad: 0.4)
+            case "oscillating":
+                // 20 s good, 20 s bad
+                return Sample(capacity: (index / 10).isMultiple(of: 2) ? 2_000_000 : 300_000, cpuLoad: 0.4)
+            case "randomWalk":
+                // Like a phone moving between cells, up to ±20% per period
+                capacity = min(max(capacity * (0.8 + nextRandom() * 0.4), 100_000), 4_000_000)
+                return Sample(capacity: capacity, cpuLoad: 0.3 + nextRandom() * 0.2)
+            case "cpuSpike":
+                return Sample(capacity: 3_000_000, cpuLoad: isMiddleThird ? 0.95 : 0.4)
+            default:
+                return Sample(capacity: 3_000_000, cpuLoad: 0.4)
+            }
+        }
+    }
+
+    private func replay(_ samples: [Sample], trace: String, tileSize: CGSize) -> Result {
+        let policy = SubscriberQualityPolicy()
+        let ladder = SubscriberQualityPolicy.ladder
+        let period = SubscriberQualityController.updateInterval
+        var state = SubscriberQualityPolicy.State()
+        var input = SubscriberQualityPolicy.Input(tileSize: tileSize, lossRate: 0, jitter: 0, cpuLoad: 0)
+        var changes = 0
+        var flaps = 0
+        var lastChange: (period: Int, direction: Int)?
+        var levelSum = 0
+        var congested = 0
+        var congestedWithout = 0
+        var delivered = 0.0
+        var deliveredWithout = 0.0
+
+        for (index, sample) in samples.enumerated() {
+            let previous = state.level
+            state = policy.next(state, input: input)
+            if state.level != previous {
+                let direction = state.level > previous ? 1 : -1
+                changes += 1
+                if let last = lastChange, last.direction != direction,
+                    index - last.period <= SubscriberQualityBenchmark.flapPeriods {
+                    flaps += 1
+                }
+                lastChange = (index, direction)
+            }
+            levelSum += state.level
+
+            let demand = ladder[state.level].bitrate
+            let sent = min(demand, sample.capacity)
+            delivered += sent * period / 8
+            if demand > sample.capacity {
+                congested += 1
+            }
+            let demandWithout = ladder[0].bitrate
+            deliveredWithout += min(demandWithout, sample.capacity) * period / 8
+            if demandWithout > sample.capacity {
+                congestedWithout += 1
+            }
+
+            let lossRate = max(demand - sample.capacity, 0) / demand
+            input = SubscriberQualityPolicy.Input(tileSize: tileSize,
+                                                  lossRate: lossRate,
+                                                  jitter: demand > sample.capacity ? 0.3 + lossRate : 0.1,
+                                                  cpuLoad: sample.cpuLoad)
+        }
+
+        let elapsedMinutes = Double(samples.count) * period / 60
+        return Result(trace: trace,
+                      tileWidth: Int(tileSize.width),
+                      tileHeight: Int(tileSize.height),
+                      periods: samples.count,
+                      levelChangesPerMinute: Double(changes) / elapsedMinutes,
+                      flapsPerMinute: Double(flaps) / elapsedMinutes,
+                      meanLevel: Double(levelSum) / Double(max(samples.count, 1)),
+                      congestedPeriods: congested,
+                      congestedPeriodsWithoutController: congestedWithout,
+                      deliveredMegabytes: delivered / 1_000_000,
+                      deliveredMegabytesWithoutController: deliveredWithout / 1_000_000,
+                      bandwidthSaved: 1 - delivered / max(deliveredWithout, 1))
+    }
+}
+
+#endif
@@ -0,0 +1,253 @@
+//
+//  SubscriptionSchedulerBenchmark.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Plays scripted speaker timelines for `participants` subscribers, the last
+// `offScreen` of them scrolled out of view, into an ActiveSpeakerRanker as
+// 10 ms PCM blocks of voice or room noise, and runs a SubscriptionScheduler
+// with SubscriptionSchedulerPolicy on the simulated clock every
+// SubscriptionScheduler.updateInterval. Reports slot changes per minute, how
+// long a visible speaker talking for at least `minUtterance` waits for a
+// full quality slot, the share of visible speech shown in full quality, and
+// the bandwidth and decode work saved against receiving every stream at full
+// quality. Start it with the `-schedulerBenchmark [timeline minutes]` launch
+// argument.
+final class SubscriptionSchedulerBenchmark: Benchmark {
+
+    struct Result: Codable {
+        let timeline: String
+        let participants: Int
+        let seconds: Double
+        let slotChangesPerMinute: Double
+        let utterances: Int
+        let promotionMillisecondsMean: Double
+        let promotionMillisecondsMax: Double
+        let unpromotedUtterances: Int
+        let speechInHighSlot: Double
+        let bandwidthSaved: Double
+        let decodeSaved: Double
+    }
+
+    static let argument = "-schedulerBenchmark"
+    static let fileName = "scheduler-benchmark"
+    static let timelines = ["lecture", "roundTable", "crosstalk", "chatty"]
+    static let participants = 8
+    static let offScreen = 2
+    static let sampleRate = 16_000
+    static let minUtterance: TimeInterval = 2
+
+    let minutes: Double
+
+    // Timeline minutes, 3 by default.
+    init(parameter: Double?) {
+        minutes = parameter ?? 3
+    }
+
+    func run() -> [Result] {
+        let clips = makeClips()
+        return SubscriptionSchedulerBenchmark.timelines.map { replay(makeTimeline($0), name: $0, clips: clips) }
+    }
+
+    // One second of voice per participant, each at its own pitch, and one of
+    // room noise. Played in a loop.
+    private func makeClips() -> (voices: [[Int16]], noise: [Int16]) {
+        var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+        // xorshift64*, uniform in 0..<1
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+
+        let rate = SubscriptionSchedulerBenchmark.sampleRate
+        let noise = (0..<rate).map { _ in Int16((nextRandom() * 2 - 1) * 1.732 * 0.001 * 32_767) }
+        let voices = (0..<SubscriptionSchedulerBenchmark.participants).map { participant -> [Int16] in
+            let pitch = 100 + Double(participant) * 20
+            return (0..<rate).map { index in
+                let time = Double(index) / Double(rate)
+                var voiced = 0.0
+                for harmonic in 1...4 {
+                    voiced += sin(2 * Double.pi * pitch * time * Double(harmonic)) / Double(harmonic)
+                }
+                let value = voiced * (0.3 + 0.7 * abs(sin(Double.pi * 4 * time))) * 0.08
+                return Int16(max(min(value * 32_767, 32_767), -32_768)) &+ noise[index]
+            }
+        }
+        return (voices, noise)
+    }
+
+    // Who is talking in every 10 ms block, one bit per participant.
+    private func makeTimeline(_ name: String) -> [UInt32] {
+        var random: UInt64 = 0x2545_F491_4F6C_DD1D
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+        func blocks(_ seconds: Double) -> Int {
+            return max(Int(seconds * 100), 1)
+        }
+
+        let count = blocks(minutes * 60)
+        let participants = SubscriptionSchedulerBenchmark.participants
+        var timeline = [UInt32](repeating: 0, count: count)
+        var index = 0
+        switch name {
+        case "lecture":
+            // One presenter, now and then a question from someone else
+            while index < count {
+                let talk = min(blocks(10 + nextRandom() * 20), count - index)
+                for block in index..<index + talk {
+                    timeline[block] = 1
+                }
+                index += talk
+                let question = min(blocks(2 + nextRandom() * 4), count - index)
+                let asker = 1 + Int(nextRandom() * Double(participants - 1))
+                for block in index..<index + question {
+                    timeline[block] = 1 << asker
+                }
+                index += question
+            }
+        case "roundTable":
+            // Turns of 6 to 12 s, a short pause between them
+            while index < count {
+                let speaker = Int(nextRandom() * Double(participants))
+                let turn = min(blocks(6 + nextRandom() * 6), count - index)
+                for block in index..<index + turn {
+                    timeline[block] = 1 << speaker
+                }
+                index += turn + blocks(0.5)
+            }
+        case "crosstalk":
+            // Two people in short bursts, often over each other, a third
+            // chiming in now and then
+            while index < count {
+                let burst = min(blocks(0.5 + nextRandom()), count - index)
+                var speaker: UInt32 = nextRandom() < 0.1 ? 1 << 2 : (nextRandom() < 0.5 ? 1 : 2)
+                if nextRandom() < 0.3 {
+                    speaker |= 3
+                }
+                for block in index..<index + burst {
+                    timeline[block] = speaker
+                }
+                index += burst
+            }
+        default:
+            // Anyone, 1 to 4 s at a time, starting up to 2 s after the last
+            while index < count {
+                let speaker = Int(nextRandom() * Double(participants))
+                let utterance = min(blocks(1 + nextRandom() * 3), count - index)
+                for block in index..<index + utterance {
+                    timeline[block] |= 1 << speaker
+                }
+                index += blocks(nextRandom() * 2)
+            }
+        }
+        return timeline
+    }
+
+    private func replay(_ timeline: [UInt32], name: String, clips: (voices: [[Int16]], noise: [Int16])) -> Result {
+        let participants = SubscriptionSchedulerBenchmark.participants
+        let rate = SubscriptionSchedulerBenchmark.sampleRate
+        let block = rate / 100
+        let updateBlocks = Int(SubscriptionScheduler.updateInterval * 100)
+        let speakers = ActiveSpeakerRanker()
+        let meters = (0..<participants).map { speakers.meter(forConfigAt: $0, sampleRate: rate) }
+        let scheduler = SubscriptionScheduler(speakers: speakers)
+        var visibility: [Int: Bool] = [:]
+        for participant in 0..<participants {
+            visibility[participant] = participant < participants - SubscriptionSchedulerBenchmark.offScreen
+        }
+
+        var changes = 0
+        var speechBlocks = 0
+        var speechInHigh = 0
+        // Block the current utterance started at, and how many blocks later
+        // it got a full quality slot. Utterances starting in one are not scored.
+        var utteranceStart = [Int?](repeating: nil, count: participants)
+        var isScored = [Bool](repeating: false, count: participants)
+        var promotedAfter = [Int?](repeating: nil, count: participants)
+        var promotions: [Int] = []
+        var utterances = 0
+        var unpromoted = 0
+
+        func endUtterance(of participant: Int, at index: Int) {
+            guard let start = utteranceStart[participant] else { return }
+            utteranceStart[participant] = nil
+            guard isScored[participant],
+                index - start >= Int(SubscriptionSchedulerBenchmark.minUtterance * 100) else { return }
+            utterances += 1
+            if let blocks = promotedAfter[participant] {
+                promotions.append(blocks * 10)
+            } else {
+                unpromoted += 1
+            }
+        }
+
+        for (index, talking) in timeline.enumerated() {
+            let offset = index * block % rate
+            for participant in 0..<participants {
+                let isTalking = talking & (1 << participant) != 0
+                let clip = isTalking ? clips.voices[participant] : clips.noise
+                clip.withUnsafeBufferPointer {
+                    meters[participant].process($0.baseAddress! + offset, count: block)
+                }
+
+                guard visibility[participant] == true else { continue }
+                if isTalking {
+                    if utteranceStart[participant] == nil {
+                        utteranceStart[participant] = index
+                        isScored[participant] = scheduler.slot(forConfigAt: participant) != .high
+                        promotedAfter[participant] = nil
+                    }
+                    speechBlocks += 1
+                    if scheduler.slot(forConfigAt: participant) == .high {
+                        speechInHigh += 1
+                    }
+                } else {
+                    endUtterance(of: participant, at: index)
+                }
+            }
+
+            guard (index + 1) % updateBlocks == 0 else { continue }
+            let now = Double(index + 1) / 100
+            changes += scheduler.update(visibility: visibility, now: now).count
+            for participant in 0..<participants {
+                guard let start = utteranceStart[participant], promotedAfter[participant] == nil,
+                    scheduler.slot(forConfigAt: participant) == .high else { continue }
+                promotedAfter[participant] = index + 1 - start
+            }
+        }
+        for participant in 0..<participants {
+            endUtterance(of: participant, at: timeline.count)
+        }
+
+        let seconds = Double(timeline.count) / 100
+        let savings = scheduler.savings
+        let full = SubscriptionSchedulerPolicy.cost(of: .high)
+        // Savings accrue from the first update on
+        let receivedSeconds = Double(participants) * max(seconds - SubscriptionScheduler.updateInterval, 1)
+        return Result(timeline: name,
+                      participants: participants,
+                      seconds: seconds,
+                      slotChangesPerMinute: Double(changes) / (seconds / 60),
+                      utterances: utterances,
+                      promotionMillisecondsMean: Double(promotions.reduce(0, +)) / Double(max(promotions.count, 1)),
+                      promotionMillisecondsMax: Double(promotions.max() ?? 0),
+                      unpromotedUtterances: unpromoted,
+                      speechInHighSlot: Double(speechInHigh) / Double(max(speechBlocks, 1)),
+                      bandwidthSaved: savings.bits / (full.bitrate * receivedSeconds),
+                      decodeSaved: savings.decodedPixels / (full.decodedPixelsPerSecond * receivedSeconds))
+    }
+}
+
+#endif
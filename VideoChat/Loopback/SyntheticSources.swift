@@ -0,0 +1,156 @@
+//
+//  SyntheticSources.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+#if DEBUG
+
+// Deterministic moving test pattern: a diagonal luma ramp scrolling by
+// `scrollSpeed` pixels per frame and a bright square bouncing across it, so
+// frame N is the same on every run and consecutive frames always differ.
+// `noise` adds seeded uniform noise of up to that many levels to every sample,
+// like a camera in low light. Clearing `isMoving` freezes the pattern.
+final class SyntheticVideoSource {
+
+    let format: VideoFrameFormat
+    let scrollSpeed: Int
+    let noise: Int
+    var isMoving = true
+    private(set) var frameIndex = 0
+    private var animationIndex = 0
+    private let pool: VideoFrameBufferPool
+    private var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+
+    init(pixelFormat: PixelFormat, width: Int, height: Int, scrollSpeed: Int = 3, noise: Int = 0,
+         pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) {
+        format = VideoFrameFormat(pixelFormat: pixelFormat, width: width & ~1, height: height & ~1)
+        self.scrollSpeed = scrollSpeed
+        self.noise = min(max(noise, 0), 127)
+        self.pool = pool
+    }
+
+    // Returns a retained buffer.
+    func nextFrame() -> VideoFrameBuffer {
+        let buffer = pool.acquire(format: format)
+        let planes = VideoPlanes(buffer: buffer)
+        draw(into: planes)
+        if noise > 0 {
+            addNoise(to: planes)
+        }
+        frameIndex += 1
+        if isMoving {
+            animationIndex += 1
+        }
+        return buffer
+    }
+
+    private func addNoise(to planes: VideoPlanes) {
+        let span = noise * 2 + 1
+        var bits: UInt64 = 0
+        var bitsLeft = 0
+        for plane in 0..<planes.pixelFormat.planeCount {
+            let rowLength = planes.planeWidth(plane) * planes.pixelFormat.bytesPerPixel(plane: plane)
+            for y in 0..<planes.planeHeight(plane) {
+                let row = planes.plane(plane).row(y)
+                for x in 0..<rowLength {
+                    if bitsLeft == 0 {
+                        // xorshift64*
+                        random ^= random >> 12
+                        random ^= random << 25
+                        random ^= random >> 27
+                        bits = random &* 0x2545_F491_4F6C_DD1D
+                        bitsLeft = 8
+                    }
+                    let offset = (Int(bits & 0xFF) * span) >> 8 - noise
+                    bits >>= 8
+                    bitsLeft -= 1
+                    row[x] = UInt8(min(max(Int(row[x]) + offset, 0), 255))
+                }
+            }
+        }
+    }
+
+    private func draw(into planes: VideoPlanes) {
+        let shift = animationIndex * scrollSpeed
+        let boxSize = max(planes.height / 6, 2) & ~1
+        let boxX = bounce(animationIndex * 5, range: planes.width - boxSize) & ~1
+        let boxY = bounce(animationIndex * 3, range: planes.height - boxSize) & ~1
+
+        if planes.pixelFormat == .argb {
+            for y in 0..<planes.height {
+                let row = planes.first.row(y)
+                for x in 0..<planes.width {
+                    let inBox = x >= boxX && x < boxX + boxSize && y >= boxY && y < boxY + boxSize
+                    let value = inBox ? 235 : UInt8(truncatingIfNeeded: x + y + shift)
+                    row[x * 4] = 255
+                    row[x * 4 + 1] = value
+                    row[x * 4 + 2] = UInt8(truncatingIfNeeded: Int(value) + 64)
+                    row[x * 4 + 3] = UInt8(truncatingIfNeeded: Int(value) + 128)
+                }
+            }
+            return
+        }
+
+        for y in 0..<planes.height {
+            let row = planes.first.row(y)
+            for x in 0..<planes.width {
+                let inBox = x >= boxX && x < boxX + boxSize && y >= boxY && y < boxY + boxSize
+                row[x] = inBox ? 235 : UInt8(16 + (x + y + shift) % 220)
+            }
+        }
+        let cb = UInt8(truncatingIfNeeded: 128 + animationIndex % 32)
+        let cr = UInt8(truncatingIfNeeded: 128 - animationIndex % 32)
+        for y in 0..<planes.planeHeight(1) {
+            if planes.pixelFormat == .nv12 {
+                let row = planes.plane(1).row(y)
+                for x in 0..<planes.planeWidth(1) {
+                    row[x * 2] = cb
+                    row[x * 2 + 1] = cr
+                }
+            } else {
+                memset(planes.plane(1).row(y), Int32(cb), planes.planeWidth(1))
+                memset(planes.plane(2).row(y), Int32(cr), planes.planeWidth(2))
+            }
+        }
+    }
+
+    private func bounce(_ position: Int, range: Int) -> Int {
+        guard range > 0 else { return 0 }
+        let period = range * 2
+        let offset = position % period
+        return offset < range ? offset : period - offset
+    }
+}
+
+// 16 bit mono sine in 10 ms blocks.
+final class SyntheticAudioSource {
+
+    let sampleRate: Int
+    let frequency: Double
+    let samplesPerBlock: Int
+    private var phase = 0.0
+    private var block: [Int16]
+
+    init(sampleRate: Int = 48_000, frequency: Double = 440) {
+        self.sampleRate = sampleRate
+        self.frequency = frequency
+        samplesPerBlock = sampleRate / 100
+        block = [Int16](repeating: 0, count: samplesPerBlock)
+    }
+
+    func nextBlock() -> [Int16] {
+        let step = 2 * Double.pi * frequency / Double(sampleRate)
+        for index in 0..<samplesPerBlock {
+            block[index] = Int16(sin(phase) * 8_000)
+            phase += step
+        }
+        phase = phase.truncatingRemainder(dividingBy: 2 * Double.pi)
+        return block
+    }
+}
+
+#endif
@@ -0,0 +1,149 @@
+//
+//  AudioLevelMeter.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+
+// RMS, peak and voice activity of one mono 16 bit stream, fed one 10 ms
+// OTAudioBus period at a time. Voice is energy above a tracked noise floor
+// with a low zero-crossing rate (broadband noise crosses far more often than
+// voiced speech), confirmed over two blocks and held for `hangover`. One
+// thread processes; the smoothed results are published through atomics so
+// any thread can read them. Nothing allocates after init.
+final class AudioLevelMeter {
+
+    struct Level {
+        let rms: Float
+        let peak: Float
+        // Sign changes per second
+        let zeroCrossingRate: Float
+        let isVoice: Bool
+    }
+
+    static let attack: TimeInterval = 0.01
+    static let release: TimeInterval = 0.3
+    static let activityWindow: TimeInterval = 1.5
+    static let hangover: TimeInterval = 0.2
+    static let minSpeechLevel: Float = -50
+    static let speechAboveNoise: Float = 10
+    static let maxSpeechCrossingRate: Float = 5_000
+
+    let sampleRate: Int
+    let maxBlockSize: Int
+
+    private let scratch: UnsafeMutablePointer<Float>
+    private var noiseFloor: Float = -60
+    private var smoothed: Float = 0
+    private var activity: Float = 0
+    private var voicedBlocks = 0
+    private var hangoverLeft: TimeInterval = 0
+    private var lastLevelTime: TimeInterval = 0
+
+    private let publishedLevel = AtomicInt()
+    private let publishedActivity = AtomicInt()
+    private let publishedSpeaking = AtomicInt()
+
+    init(sampleRate: Int = 48_000, maxBlockSize: Int? = nil) {
+        self.sampleRate = sampleRate
+        self.maxBlockSize = maxBlockSize ?? sampleRate / 25
+        // Slot 0 carries the previous block's last sample for zero crossings
+        scratch = UnsafeMutablePointer<Float>.allocate(capacity: self.maxBlockSize + 1)
+        scratch.initialize(repeating: 0, count: self.maxBlockSize + 1)
+    }
+
+    deinit {
+        scratch.deallocate()
+    }
+
+    // Attack/release smoothed RMS, 0...1.
+    var level: Float {
+        return Float(bitPattern: UInt32(truncatingIfNeeded: publishedLevel.value))
+    }
+
+    // Smoothed level while speaking, decaying over `activityWindow`.
+    var speechActivity: Float {
+        return Float(bitPattern: UInt32(truncatingIfNeeded: publishedActivity.value))
+    }
+
+    var isSpeaking: Bool {
+        return publishedSpeaking.value != 0
+    }
+
+    // Audio thread. Blocks longer than `maxBlockSize` are metered in parts.
+    @discardableResult
+    func process(_ samples: UnsafePointer<Int16>, count: Int) -> Level {
+        var level = Level(rms: 0, peak: 0, zeroCrossingRate: 0, isVoice: false)
+        var offset = 0
+        repeat {
+            let length = min(count - offset, maxBlockSize)
+            level = processBlock(samples + offset, count: length)
+            offset += length
+        } while offset < count
+        return level
+    }
+
+    // The SDK's audio level delegates report one 0...1 value every so often
+    // instead of PCM. Metered by energy alone.
+    @discardableResult
+    func process(audioLevel: Float, at time: TimeInterval = ProcessInfo.processInfo.systemUptime) -> Level {
+        let duration = lastLevelTime == 0 ? 0.05 : min(max(time - lastLevelTime, 0.01), 0.5)
+        lastLevelTime = time
+        return update(rms: audioLevel, peak: audioLevel, zeroCrossingRate: 0, duration: duration)
+    }
+
+    private func processBlock(_ samples: UnsafePointer<Int16>, count: Int) -> Level {
+        guard count > 0 else { return update(rms: 0, peak: 0, zeroCrossingRate: 0, duration: 0) }
+        let block = scratch + 1
+        vDSP_vflt16(samples, 1, block, 1, vDSP_Length(count))
+        var scale = Float(1.0 / 32_768.0)
+        vDSP_vsmul(block, 1, &scale, block, 1, vDSP_Length(count))
+
+        var rms: Float = 0
+        var peak: Float = 0
+        vDSP_rmsqv(block, 1, &rms, vDSP_Length(count))
+        vDSP_maxmgv(block, 1, &peak, vDSP_Length(count))
+        var lastCrossing: vDSP_Length = 0
+        var crossings: vDSP_Length = 0
+        vDSP_nzcros(scratch, 1, vDSP_Length(count + 1), &lastCrossing, &crossings, vDSP_Length(count + 1))
+        scratch[0] = block[count - 1]
+
+        let duration = TimeInterval(count) / TimeInterval(sampleRate)
+        return update(rms: rms, peak: peak,
+                      zeroCrossingRate: Float(Double(crossings) / duration),
+                      duration: duration)
+    }
+
+    private func update(rms: Float, peak: Float, zeroCrossingRate: Float, duration: TimeInterval) -> Level {
+        let decibels = 20 * log10(max(rms, 1e-6))
+        if decibels < noiseFloor {
+            noiseFloor += (decibels - noiseFloor) * 0.5
+        } else {
+            // Rises slowly, about 2 dB/s, so speech doesn't become the floor
+            noiseFloor += min(decibels - noiseFloor, Float(duration) * 2)
+        }
+        let threshold = max(noiseFloor + AudioLevelMeter.speechAboveNoise, AudioLevelMeter.minSpeechLevel)
+        let isVoice = decibels > threshold && zeroCrossingRate < AudioLevelMeter.maxSpeechCrossingRate
+
+        voicedBlocks = isVoice ? voicedBlocks + 1 : 0
+        if voicedBlocks >= 2 {
+            hangoverLeft = AudioLevelMeter.hangover
+        } else {
+            hangoverLeft = max(hangoverLeft - duration, 0)
+        }
+        let isSpeaking = hangoverLeft > 0
+
+        let tau = rms > smoothed ? AudioLevelMeter.attack : AudioLevelMeter.release
+        smoothed += (rms - smoothed) * Float(1 - exp(-duration / tau))
+        let target = isSpeaking ? smoothed : 0
+        activity += (target - activity) * Float(1 - exp(-duration / AudioLevelMeter.activityWindow))
+
+        publishedLevel.store(Int64(smoothed.bitPattern))
+        publishedActivity.store(Int64(activity.bitPattern))
+        publishedSpeaking.store(isSpeaking ? 1 : 0)
+        return Level(rms: rms, peak: peak, zeroCrossingRate: zeroCrossingRate, isVoice: isVoice)
+    }
+}
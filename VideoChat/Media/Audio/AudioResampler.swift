@@ -0,0 +1,197 @@
+//
+//  AudioResampler.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+import OpenTok
+
+// Streaming polyphase windowed-sinc resampler for mono 16 bit PCM. The step
+// between output samples can be nudged continuously with `ratioAdjustment`,
+// which is how the device keeps its buffers from drifting when capture and
+// render clocks differ. Output samples falling between two filter phases are
+// interpolated from both, so any ratio is exact. Dot products use vDSP.
+final class AudioResampler {
+
+    static let phaseCount = 64
+    static let tapCount = 24
+    static let maxRatioAdjustment = 0.01
+
+    let inputRate: Int
+    let outputRate: Int
+    let maxInputFrames: Int
+
+    // Multiplies the input consumed per output sample: above 1 drains the
+    // input faster, below 1 slower.
+    var ratioAdjustment: Double = 1 {
+        didSet {
+            let limit = AudioResampler.maxRatioAdjustment
+            ratioAdjustment = min(max(ratioAdjustment, 1 - limit), 1 + limit)
+        }
+    }
+
+    private let nominalStep: Double
+    private let filters: UnsafeMutablePointer<Float>
+    private let history: UnsafeMutablePointer<Float>
+    private let historyCapacity: Int
+    private var buffered = 0
+    private var position = 0.0
+    private let scratch: UnsafeMutablePointer<Float>
+    private let scratchCapacity: Int
+
+    init(inputRate: Int, outputRate: Int, maxInputFrames: Int = 4_410) {
+        self.inputRate = inputRate
+        self.outputRate = outputRate
+        self.maxInputFrames = maxInputFrames
+        nominalStep = Double(inputRate) / Double(outputRate)
+
+        let taps = AudioResampler.tapCount
+        let phases = AudioResampler.phaseCount
+        filters = UnsafeMutablePointer<Float>.allocate(capacity: (phases + 1) * taps)
+        historyCapacity = maxInputFrames + taps * 2
+        history = UnsafeMutablePointer<Float>.allocate(capacity: historyCapacity)
+        history.initialize(repeating: 0, count: historyCapacity)
+        let outputPerInput = Double(outputRate) / Double(inputRate) * (1 + AudioResampler.maxRatioAdjustment)
+        scratchCapacity = Int((Double(historyCapacity) * outputPerInput).rounded(.up)) + 1
+        scratch = UnsafeMutablePointer<Float>.allocate(capacity: max(scratchCapacity, maxInputFrames))
+        scratch.initialize(repeating: 0, count: max(scratchCapacity, maxInputFrames))
+
+        // Anti-aliasing cutoff relative to the input Nyquist frequency
+        let cutoff = min(1, Double(outputRate) / Double(inputRate)) * 0.92
+        let half = Double(taps / 2)
+        for phase in 0...phases {
+            let fraction = Double(phase) / Double(phases)
+            let coefficients = filters + phase * taps
+            var sum = 0.0
+            for tap in 0..<taps {
+                let distance = Double(tap) - half + 1 - fraction
+                let x = Double.pi * cutoff * distance
+                let sinc = abs(x) < 1e-9 ? 1 : sin(x) / x
+                let window = 0.42 + 0.5 * cos(Double.pi * distance / half) + 0.08 * cos(2 * Double.pi * distance / half)
+                let value = abs(distance) >= half ? 0 : cutoff * sinc * window
+                coefficients[tap] = Float(value)
+                sum += value
+            }
+            for tap in 0..<taps {
+                coefficients[tap] = Float(Double(coefficients[tap]) / sum)
+            }
+        }
+        reset()
+    }
+
+    convenience init(inputFormat: OTAudioFormat, outputFormat: OTAudioFormat) {
+        self.init(inputRate: Int(inputFormat.sampleRate), outputRate: Int(outputFormat.sampleRate))
+    }
+
+    deinit {
+        filters.deallocate()
+        history.deallocate()
+        scratch.deallocate()
+    }
+
+    func reset() {
+        let taps = AudioResampler.tapCount
+        history.assign(repeating: 0, count: historyCapacity)
+        buffered = taps
+        position = Double(taps / 2 - 1)
+    }
+
+    // Upper bound of output samples produced for `count` input samples.
+    func maxOutputFrames(forInput count: Int) -> Int {
+        let step = nominalStep * (1 - AudioResampler.maxRatioAdjustment)
+        return Int((Double(count + AudioResampler.tapCount) / step).rounded(.up))
+    }
+
+    // Takes as much of `input` as the history has room for, at least
+    // `maxInputFrames` once earlier input has been resampled. When `output`
+    // fills up first, pass the input after `consumed` again on the next call.
+    func process(input: UnsafePointer<Int16>, count: Int, output: UnsafeMutablePointer<Int16>,
+                 capacity: Int) -> (consumed: Int, produced: Int) {
+        let taps = AudioResampler.tapCount
+        let halfTaps = taps / 2
+        let phases = Double(AudioResampler.phaseCount)
+
+        let accepted = min(count, historyCapacity - buffered)
+        if accepted > 0 {
+            vDSP_vflt16(input, 1, history + buffered, 1, vDSP_Length(accepted))
+            var scale = Float(1.0 / 32_768.0)
+            vDSP_vsmul(history + buffered, 1, &scale, history + buffered, 1, vDSP_Length(accepted))
+            buffered += accepted
+        }
+
+        let step = nominalStep * ratioAdjustment
+        let limit = min(capacity, scratchCapacity)
+        var produced = 0
+        while produced < limit {
+            let index = Int(position)
+            guard index + halfTaps < buffered else { break }
+
+            let phase = (position - Double(index)) * phases
+            let phaseIndex = Int(phase)
+            let weight = Float(phase - Double(phaseIndex))
+            let window = history + (index - halfTaps + 1)
+            var lower: Float = 0
+            var upper: Float = 0
+            vDSP_dotpr(window, 1, filters + phaseIndex * taps, 1, &lower, vDSP_Length(taps))
+            vDSP_dotpr(window, 1, filters + (phaseIndex + 1) * taps, 1, &upper, vDSP_Length(taps))
+            scratch[produced] = lower + (upper - lower) * weight
+
+            produced += 1
+            position += step
+        }
+
+        // Keep only the history the next filter window still needs
+        let consumed = max(min(Int(position) - halfTaps + 1, buffered), 0)
+        if consumed > 0 {
+            memmove(history, history + consumed, (buffered - consumed) * MemoryLayout<Float>.stride)
+            buffered -= consumed
+            position -= Double(consumed)
+        }
+
+        guard produced > 0 else { return (accepted, 0) }
+        var scale = Float(32_768.0)
+        var low = Float(-32_768.0)
+        var high = Float(32_767.0)
+        vDSP_vsmul(scratch, 1, &scale, scratch, 1, vDSP_Length(produced))
+        vDSP_vclip(scratch, 1, &low, &high, scratch, 1, vDSP_Length(produced))
+        vDSP_vfixr16(scratch, 1, output, 1, vDSP_Length(produced))
+        return (accepted, produced)
+    }
+}
+
+// Steers a resampler's ratioAdjustment from the fill level of the buffer it
+// drains, so that buffer stays near `targetFill` regardless of clock drift.
+final class AudioDriftCompensator {
+
+    let targetFill: Double
+    private let proportionalGain: Double
+    private let integralGain: Double
+    private var smoothedFill: Double
+    private var integral = 0.0
+
+    init(targetFill: Double = 0.5, proportionalGain: Double = 0.01, integralGain: Double = 0.0005) {
+        self.targetFill = targetFill
+        self.proportionalGain = proportionalGain
+        self.integralGain = integralGain
+        smoothedFill = targetFill
+    }
+
+    // Call once per 10 ms period with the current fill level (0...1).
+    func update(fillLevel: Double) -> Double {
+        // The fill level moves in 10 ms steps, average that out first
+        smoothedFill += (fillLevel - smoothedFill) * 0.05
+        let error = smoothedFill - targetFill
+        let limit = AudioResampler.maxRatioAdjustment
+        integral = min(max(integral + error * integralGain, -limit), limit)
+        let adjustment = error * proportionalGain + integral
+        return 1 + min(max(adjustment, -limit), limit)
+    }
+
+    func reset() {
+        smoothedFill = targetFill
+        integral = 0
+    }
+}
@@ -0,0 +1,132 @@
+//
+//  AudioRingBuffer.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// Wait-free FIFO of 16 bit PCM between the hardware I/O callback and the
+// OTAudioBus. One thread writes, one thread reads; neither side allocates or
+// locks after init, so both are safe to call from the real-time audio thread.
+final class AudioRingBuffer {
+
+    struct Statistics {
+        let overrunEvents: Int64
+        let overrunSamples: Int64
+        let underrunEvents: Int64
+        let underrunSamples: Int64
+    }
+
+    let sampleRate: Int
+    let numChannels: Int
+    let capacity: Int
+
+    private let samples: UnsafeMutablePointer<Int16>
+    private let mask: Int64
+    private let readIndex = AtomicInt()
+    private let writeIndex = AtomicInt()
+    private let overrunEvents = AtomicInt()
+    private let overrunSamples = AtomicInt()
+    private let underrunEvents = AtomicInt()
+    private let underrunSamples = AtomicInt()
+
+    init(sampleRate: Int, numChannels: Int = 1, milliseconds: Int = 200) {
+        self.sampleRate = sampleRate
+        self.numChannels = numChannels
+        let wanted = max(sampleRate * numChannels * milliseconds / 1000, 1)
+        var capacity = 1
+        while capacity < wanted {
+            capacity <<= 1
+        }
+        self.capacity = capacity
+        mask = Int64(capacity - 1)
+        samples = UnsafeMutablePointer<Int16>.allocate(capacity: capacity)
+        samples.initialize(repeating: 0, count: capacity)
+    }
+
+    convenience init(format: OTAudioFormat, milliseconds: Int = 200) {
+        self.init(sampleRate: Int(format.sampleRate), numChannels: Int(format.numChannels), milliseconds: milliseconds)
+    }
+
+    deinit {
+        samples.deallocate()
+    }
+
+    // Samples per channel in one 10 ms OTAudioBus period
+    var samplesPer10ms: Int {
+        return sampleRate / 100
+    }
+
+    var availableToRead: Int {
+        return Int(writeIndex.value - readIndex.value)
+    }
+
+    var availableToWrite: Int {
+        return capacity - availableToRead
+    }
+
+    // 0 is empty, 1 is full. Drift compensation steers this towards a target.
+    var fillLevel: Double {
+        return Double(availableToRead) / Double(capacity)
+    }
+
+    var statistics: Statistics {
+        return Statistics(overrunEvents: overrunEvents.value,
+                          overrunSamples: overrunSamples.value,
+                          underrunEvents: underrunEvents.value,
+                          underrunSamples: underrunSamples.value)
+    }
+
+    // Producer side. Samples that don't fit are dropped and counted as overrun.
+    @discardableResult
+    func write(_ source: UnsafePointer<Int16>, count: Int) -> Int {
+        let write = writeIndex.value
+        let free = capacity - Int(write - readIndex.value)
+        let accepted = min(count, free)
+        if accepted < count {
+            overrunEvents.increment()
+            overrunSamples.increment(by: Int64(count - accepted))
+        }
+        guard accepted > 0 else { return 0 }
+
+        let start = Int(write & mask)
+        let firstPart = min(accepted, capacity - start)
+        (samples + start).assign(from: source, count: firstPart)
+        if firstPart < accepted {
+            samples.assign(from: source + firstPart, count: accepted - firstPart)
+        }
+        writeIndex.store(write + Int64(accepted))
+        return accepted
+    }
+
+    // Consumer side. Always fills `count` samples, padding with silence on underrun.
+    @discardableResult
+    func read(into destination: UnsafeMutablePointer<Int16>, count: Int) -> Int {
+        let read = readIndex.value
+        let available = Int(writeIndex.value - read)
+        let delivered = min(count, available)
+        if delivered < count {
+            underrunEvents.increment()
+            underrunSamples.increment(by: Int64(count - delivered))
+            (destination + delivered).assign(repeating: 0, count: count - delivered)
+        }
+        guard delivered > 0 else { return 0 }
+
+        let start = Int(read & mask)
+        let firstPart = min(delivered, capacity - start)
+        destination.assign(from: samples + start, count: firstPart)
+        if firstPart < delivered {
+            (destination + firstPart).assign(from: samples, count: delivered - firstPart)
+        }
+        readIndex.store(read + Int64(delivered))
+        return delivered
+    }
+
+    // Consumer side, drops buffered audio e.g. after a route change.
+    func flush() {
+        readIndex.store(writeIndex.value)
+    }
+}
@@ -0,0 +1,200 @@
+//
+//  AudioTapDevice.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// Sits in front of the SDK's audio device and hands everything through,
+// wrapping the audio bus so the mixed remote audio the device renders and the
+// microphone audio it captures can be recorded, and the microphone PCM
+// metered. The SDK mixes remote streams before they reach the bus, so this is
+// the only PCM the app sees. The audio threads only try the lock: while a
+// recorder or meter is being swapped they skip a buffer rather than wait.
+// Install before the first session is created.
+final class AudioTapDevice: NSObject, OTAudioDevice {
+
+    private(set) static var shared: AudioTapDevice?
+
+    private let device: OTAudioDevice
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+    private var currentRecorder: CallRecorder?
+    private var currentCaptureMeter: AudioLevelMeter?
+    private var renderStream: UInt16 = 0
+    private var captureStream: UInt16 = 0
+    private var renderLayout: (sampleRate: Int, channels: Int) = (0, 0)
+    private var captureLayout: (sampleRate: Int, channels: Int) = (0, 0)
+
+    init(device: OTAudioDevice) {
+        self.device = device
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+        super.init()
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    static func install() {
+        guard shared == nil else { return }
+        guard let current = OTAudioDeviceManager.currentAudioDevice() else {
+            print("No audio device to tap")
+            return
+        }
+        let device = AudioTapDevice(device: current)
+        OTAudioDeviceManager.setAudioDevice(device)
+        shared = device
+    }
+
+    var recorder: CallRecorder? {
+        get {
+            os_unfair_lock_lock(lock)
+            defer { os_unfair_lock_unlock(lock) }
+            return currentRecorder
+        }
+        set {
+            let render = device.renderFormat()
+            let capture = device.captureFormat()
+            os_unfair_lock_lock(lock)
+            defer { os_unfair_lock_unlock(lock) }
+            currentRecorder = newValue
+            renderLayout = (Int(render.sampleRate), max(Int(render.numChannels), 1))
+            captureLayout = (Int(capture.sampleRate), max(Int(capture.numChannels), 1))
+            guard let recorder = newValue else { return }
+            renderStream = recorder.stream(named: "audio-render", kind: .audio)
+            captureStream = recorder.stream(named: "audio-capture", kind: .audio)
+        }
+    }
+
+    // Fed every microphone buffer while capture is mono. Create it with
+    // `captureSampleRate`.
+    var captureMeter: AudioLevelMeter? {
+        get {
+            os_unfair_lock_lock(lock)
+            defer { os_unfair_lock_unlock(lock) }
+            return currentCaptureMeter
+        }
+        set {
+            let capture = device.captureFormat()
+            os_unfair_lock_lock(lock)
+            defer { os_unfair_lock_unlock(lock) }
+            currentCaptureMeter = newValue
+            captureLayout = (Int(capture.sampleRate), max(Int(capture.numChannels), 1))
+        }
+    }
+
+    var captureSampleRate: Int {
+        return Int(device.captureFormat().sampleRate)
+    }
+
+    // Audio threads.
+    fileprivate func tap(_ data: UnsafeRawPointer, count: Int, isRender: Bool) {
+        guard count > 0, os_unfair_lock_trylock(lock) else { return }
+        defer { os_unfair_lock_unlock(lock) }
+        let layout = isRender ? renderLayout : captureLayout
+        if !isRender, layout.channels == 1, let meter = currentCaptureMeter {
+            meter.process(data.assumingMemoryBound(to: Int16.self), count: count)
+        }
+        guard let recorder = currentRecorder else { return }
+        recorder.recordAudio(data, count: count, sampleRate: layout.sampleRate, channels: layout.channels,
+                             stream: isRender ? renderStream : captureStream)
+    }
+
+    // MARK: - OTAudioDevice
+
+    func setAudioBus(_ audioBus: OTAudioBus?) -> Bool {
+        return device.setAudioBus(audioBus.map { AudioTapBus(next: $0, device: self) })
+    }
+
+    func captureFormat() -> OTAudioFormat {
+        return device.captureFormat()
+    }
+
+    func renderFormat() -> OTAudioFormat {
+        return device.renderFormat()
+    }
+
+    func renderingIsAvailable() -> Bool {
+        return device.renderingIsAvailable()
+    }
+
+    func initializeRendering() -> Bool {
+        return device.initializeRendering()
+    }
+
+    func renderingIsInitialized() -> Bool {
+        return device.renderingIsInitialized()
+    }
+
+    func startRendering() -> Bool {
+        return device.startRendering()
+    }
+
+    func stopRendering() -> Bool {
+        return device.stopRendering()
+    }
+
+    func isRendering() -> Bool {
+        return device.isRendering()
+    }
+
+    func estimatedRenderDelay() -> UInt16 {
+        return device.estimatedRenderDelay()
+    }
+
+    func captureIsAvailable() -> Bool {
+        return device.captureIsAvailable()
+    }
+
+    func initializeCapture() -> Bool {
+        return device.initializeCapture()
+    }
+
+    func captureIsInitialized() -> Bool {
+        return device.captureIsInitialized()
+    }
+
+    func startCapture() -> Bool {
+        return device.startCapture()
+    }
+
+    func stopCapture() -> Bool {
+        return device.stopCapture()
+    }
+
+    func isCapturing() -> Bool {
+        return device.isCapturing()
+    }
+
+    func estimatedCaptureDelay() -> UInt16 {
+        return device.estimatedCaptureDelay()
+    }
+}
+
+private final class AudioTapBus: NSObject, OTAudioBus {
+
+    private let next: OTAudioBus
+    private unowned let device: AudioTapDevice
+
+    init(next: OTAudioBus, device: AudioTapDevice) {
+        self.next = next
+        self.device = device
+        super.init()
+    }
+
+    func writeCaptureData(_ data: UnsafeMutableRawPointer, numberOfSamples count: UInt32) {
+        device.tap(data, count: Int(count), isRender: false)
+        next.writeCaptureData(data, numberOfSamples: count)
+    }
+
+    func readRenderData(_ data: UnsafeMutableRawPointer, numberOfSamples count: UInt32) -> UInt32 {
+        let read = next.readRenderData(data, numberOfSamples: count)
+        device.tap(data, count: Int(read), isRender: true)
+        return read
+    }
+}
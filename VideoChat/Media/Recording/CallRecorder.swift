@@ -0,0 +1,152 @@
+//
+//  CallRecorder.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// Records every stream of a call, uncompressed, into one RecordingWriter
+// container: I420 video frames and 16 bit PCM audio, stamped in microseconds
+// since the recording started. Stream records name the streams first. Safe to
+// call from any thread; frames that find no free buffer are dropped and
+// counted rather than holding up the caller.
+final class CallRecorder {
+
+    enum StreamKind: UInt32 {
+        case video = 1
+        case audio = 2
+    }
+
+    struct Statistics {
+        let videoFrames: Int64
+        let audioPackets: Int64
+        let writer: RecordingWriter.Statistics
+    }
+
+    let url: URL
+    private let writer: RecordingWriter
+    private let converter = PixelFormatConverter.shared
+    private let startedAt = DispatchTime.now().uptimeNanoseconds
+    private let nextStream = AtomicInt()
+    private let videoFrames = AtomicInt()
+    private let audioPackets = AtomicInt()
+
+    init?(url: URL, bufferSize: Int = 4 << 20, bufferCount: Int = 16) {
+        guard let writer = RecordingWriter(url: url, bufferSize: bufferSize, bufferCount: bufferCount) else {
+            return nil
+        }
+        self.url = url
+        self.writer = writer
+    }
+
+    // A new `Documents/Recordings/call-<date>.vcrd`.
+    static func makeURL() -> URL? {
+        guard let documents = FileManager.default.urls(for: .documentDirectory, in: .userDomainMask).first else {
+            return nil
+        }
+        let directory = documents.appendingPathComponent("Recordings", isDirectory: true)
+        try? FileManager.default.createDirectory(at: directory, withIntermediateDirectories: true)
+        let formatter = DateFormatter()
+        formatter.dateFormat = "yyyyMMdd-HHmmss"
+        return directory.appendingPathComponent("call-\(formatter.string(from: Date())).vcrd")
+    }
+
+    var statistics: Statistics {
+        return Statistics(videoFrames: videoFrames.value,
+                          audioPackets: audioPackets.value,
+                          writer: writer.statistics)
+    }
+
+    // Returns the id to record the stream's frames with.
+    func stream(named name: String, kind: StreamKind) -> UInt16 {
+        let stream = UInt16(truncatingIfNeeded: nextStream.increment())
+        let bytes = Array(name.utf8)
+        writer.append(.stream, stream: stream, timestamp: timestamp(), length: bytes.count, a: kind.rawValue) { payload in
+            bytes.withUnsafeBytes { name in
+                if let base = name.baseAddress {
+                    payload.copyMemory(from: base, byteCount: name.count)
+                }
+            }
+        }
+        return stream
+    }
+
+    // Converts straight into the container, no intermediate frame.
+    @discardableResult
+    func recordVideo(_ planes: VideoPlanes, stream: UInt16) -> Bool {
+        let width = planes.width & ~1
+        let height = planes.height & ~1
+        guard width > 0, height > 0 else { return false }
+        let source = width == planes.width && height == planes.height
+            ? planes
+            : planes.cropped(x: 0, y: 0, width: width, height: height)
+        let lumaSize = width * height
+        let chromaSize = (width / 2) * (height / 2)
+
+        let isRecorded = writer.append(.video, stream: stream, timestamp: timestamp(), length: lumaSize + chromaSize * 2,
+                                       a: UInt32(width), b: UInt32(height),
+                                       c: UInt32(PixelFormat.i420.rawValue)) { payload in
+            let luma = payload.assumingMemoryBound(to: UInt8.self)
+            let destination = VideoPlanes(pixelFormat: .i420, width: width, height: height,
+                                          first: ImagePlane(data: luma, bytesPerRow: width),
+                                          second: ImagePlane(data: luma + lumaSize, bytesPerRow: width / 2),
+                                          third: ImagePlane(data: luma + lumaSize + chromaSize, bytesPerRow: width / 2))
+            converter.convert(source, into: destination)
+        }
+        if isRecorded {
+            videoFrames.increment()
+        }
+        return isRecorded
+    }
+
+    // Interleaved 16 bit samples, `count` per channel.
+    @discardableResult
+    func recordAudio(_ samples: UnsafeRawPointer, count: Int, sampleRate: Int, channels: Int, stream: UInt16) -> Bool {
+        let length = count * channels * MemoryLayout<Int16>.size
+        guard length > 0 else { return false }
+        let isRecorded = writer.append(.audio, stream: stream, timestamp: timestamp(), length: length,
+                                       a: UInt32(sampleRate), b: UInt32(channels), c: 16) { payload in
+            payload.copyMemory(from: samples, byteCount: length)
+        }
+        if isRecorded {
+            audioPackets.increment()
+        }
+        return isRecorded
+    }
+
+    // Writes out what is buffered and closes the file. Waits for the disk.
+    func close() {
+        writer.close()
+    }
+
+    private func timestamp() -> Int64 {
+        return Int64(DispatchTime.now().uptimeNanoseconds - startedAt) / 1_000
+    }
+}
+
+// Records the frames of a subscriber on their way to the tile.
+final class RecordingRender: NSObject, OTVideoRender {
+
+    let streamName: String
+    private let next: OTVideoRender
+    private let recorder: CallRecorder
+    private let stream: UInt16
+
+    init(next: OTVideoRender, streamName: String, recorder: CallRecorder) {
+        self.next = next
+        self.streamName = streamName
+        self.recorder = recorder
+        stream = recorder.stream(named: streamName, kind: .video)
+        super.init()
+    }
+
+    func renderVideoFrame(_ frame: OTVideoFrame) {
+        if let planes = VideoPlanes(frame: frame) {
+            recorder.recordVideo(planes, stream: stream)
+        }
+        next.renderVideoFrame(frame)
+    }
+}
@@ -0,0 +1,287 @@
+//
+//  RecordingWriter.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// Append-only recording container. The file is a sequence of records, each a
+// 32 byte little-endian header followed by the payload, padded to 8 bytes:
+//
+//   0  magic "VCRD"     8  timestamp, microseconds    20  a
+//   4  kind             16 payload length             24  b
+//   6  stream                                         28  c
+//
+// Records are packed into a fixed set of page aligned buffers allocated up
+// front. Appending only reserves space under a lock and copies outside it,
+// so callers on render threads never wait for the disk; when every buffer is
+// queued for writing the record is dropped instead. A dedicated thread writes
+// full buffers, and partly filled ones after `flushInterval`, with pwrite on
+// a file opened with F_NOCACHE, always in whole pages. Padding records fill
+// the gaps, so a reader just walks the headers.
+final class RecordingWriter {
+
+    enum Kind: UInt8 {
+        case file = 0
+        case stream = 1
+        case video = 2
+        case audio = 3
+        case padding = 0xFF
+    }
+
+    struct Statistics {
+        let records: Int64
+        let droppedRecords: Int64
+        let bytesWritten: Int64
+        let buffersWritten: Int64
+        let writeErrors: Int64
+        let writeNanoseconds: Int64
+        let maxQueuedBuffers: Int64
+    }
+
+    private final class Buffer {
+        let data: UnsafeMutableRawPointer
+        // Under the writer's lock
+        var used = 0
+        let committed = AtomicInt()
+
+        init(size: Int) {
+            var memory: UnsafeMutableRawPointer?
+            guard posix_memalign(&memory, RecordingWriter.pageSize, size) == 0, let allocated = memory else {
+                fatalError("Unable to allocate \(size) bytes for recording")
+            }
+            data = allocated
+        }
+
+        deinit {
+            free(data)
+        }
+    }
+
+    static let magic: UInt32 = 0x4452_4356 // "VCRD"
+    static let version: UInt32 = 1
+    static let headerSize = 32
+    static let pageSize = 4_096
+
+    let url: URL
+    let bufferSize: Int
+    let flushInterval: TimeInterval
+
+    private let descriptor: Int32
+    private var freeBuffers: [Buffer] = []
+    private var queuedBuffers: [Buffer] = []
+    private var current: Buffer?
+    private var isClosing = false
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+    private let queued = DispatchSemaphore(value: 0)
+    private let finished = DispatchSemaphore(value: 0)
+    private var fileOffset: off_t = 0
+
+    private let records = AtomicInt()
+    private let droppedRecords = AtomicInt()
+    private let bytesWritten = AtomicInt()
+    private let buffersWritten = AtomicInt()
+    private let writeErrors = AtomicInt()
+    private let writeNanoseconds = AtomicInt()
+    private let maxQueuedBuffers = AtomicInt()
+
+    // `bufferSize` is rounded up to whole pages and bounds the largest record.
+    init?(url: URL, bufferSize: Int = 4 << 20, bufferCount: Int = 16, flushInterval: TimeInterval = 0.5) {
+        self.url = url
+        self.bufferSize = (max(bufferSize, RecordingWriter.pageSize * 2) + RecordingWriter.pageSize - 1)
+            / RecordingWriter.pageSize * RecordingWriter.pageSize
+        self.flushInterval = flushInterval
+
+        descriptor = open(url.path, O_WRONLY | O_CREAT | O_TRUNC, 0o644)
+        guard descriptor >= 0 else {
+            print("Could not create recording \(url.path): \(String(cString: strerror(errno)))")
+            return nil
+        }
+        // Recordings are not read back during the call, keep them out of the page cache
+        _ = fcntl(descriptor, F_NOCACHE, 1)
+
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+        freeBuffers = (0..<max(bufferCount, 2)).map { _ in Buffer(size: self.bufferSize) }
+
+        _ = append(.file, stream: 0, timestamp: 0, length: 0, a: RecordingWriter.version) { _ in }
+        // The thread keeps the writer alive until close()
+        let thread = Thread {
+            self.writeLoop()
+        }
+        thread.name = "VideoChat.RecordingWriter"
+        thread.qualityOfService = .utility
+        thread.start()
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    var statistics: Statistics {
+        return Statistics(records: records.value,
+                          droppedRecords: droppedRecords.value,
+                          bytesWritten: bytesWritten.value,
+                          buffersWritten: buffersWritten.value,
+                          writeErrors: writeErrors.value,
+                          writeNanoseconds: writeNanoseconds.value,
+                          maxQueuedBuffers: maxQueuedBuffers.value)
+    }
+
+    // Any thread; never waits for the disk. `fill` writes exactly `length`
+    // payload bytes. Returns false when the record was dropped.
+    @discardableResult
+    func append(_ kind: Kind, stream: UInt16, timestamp: Int64, length: Int,
+                a: UInt32 = 0, b: UInt32 = 0, c: UInt32 = 0,
+                fill: (UnsafeMutableRawPointer) -> Void) -> Bool {
+        let size = RecordingWriter.recordSize(length)
+        guard let (buffer, offset) = reserve(size) else {
+            droppedRecords.increment()
+            return false
+        }
+
+        let record = buffer.data + offset
+        RecordingWriter.writeHeader(at: record, kind: kind, stream: stream, timestamp: timestamp, length: length,
+                                    a: a, b: b, c: c)
+        fill(record + RecordingWriter.headerSize)
+        buffer.committed.increment(by: Int64(size))
+        records.increment()
+        return true
+    }
+
+    // Writes out everything appended so far and closes the file. Waits.
+    func close() {
+        os_unfair_lock_lock(lock)
+        guard !isClosing else {
+            os_unfair_lock_unlock(lock)
+            return
+        }
+        isClosing = true
+        queueCurrent()
+        os_unfair_lock_unlock(lock)
+        queued.signal()
+        finished.wait()
+        Darwin.close(descriptor)
+    }
+
+    private static func recordSize(_ length: Int) -> Int {
+        return (headerSize + length + 7) & ~7
+    }
+
+    private static func writeHeader(at record: UnsafeMutableRawPointer, kind: Kind, stream: UInt16, timestamp: Int64,
+                                    length: Int, a: UInt32, b: UInt32, c: UInt32) {
+        record.storeBytes(of: magic.littleEndian, as: UInt32.self)
+        record.storeBytes(of: kind.rawValue, toByteOffset: 4, as: UInt8.self)
+        record.storeBytes(of: 0, toByteOffset: 5, as: UInt8.self)
+        record.storeBytes(of: stream.littleEndian, toByteOffset: 6, as: UInt16.self)
+        record.storeBytes(of: timestamp.littleEndian, toByteOffset: 8, as: Int64.self)
+        record.storeBytes(of: UInt32(length).littleEndian, toByteOffset: 16, as: UInt32.self)
+        record.storeBytes(of: a.littleEndian, toByteOffset: 20, as: UInt32.self)
+        record.storeBytes(of: b.littleEndian, toByteOffset: 24, as: UInt32.self)
+        record.storeBytes(of: c.littleEndian, toByteOffset: 28, as: UInt32.self)
+    }
+
+    private func reserve(_ size: Int) -> (Buffer, Int)? {
+        // Even in an empty buffer the tail has to be nothing or room for padding
+        guard size == bufferSize || size <= bufferSize - RecordingWriter.headerSize else { return nil }
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        guard !isClosing else { return nil }
+
+        // What is left after a record is either nothing or room for padding
+        if let buffer = current {
+            let left = bufferSize - buffer.used - size
+            if left < 0 || (left > 0 && left < RecordingWriter.headerSize) {
+                queueCurrent()
+                queued.signal()
+            }
+        }
+        if current == nil {
+            guard let buffer = freeBuffers.popLast() else { return nil }
+            current = buffer
+        }
+        guard let buffer = current else { return nil }
+        let offset = buffer.used
+        buffer.used += size
+        return (buffer, offset)
+    }
+
+    // Under the lock. Pads the current buffer to a whole page and queues it.
+    private func queueCurrent() {
+        guard let buffer = current, buffer.used > 0 else { return }
+        current = nil
+        var end = (buffer.used + RecordingWriter.pageSize - 1) / RecordingWriter.pageSize * RecordingWriter.pageSize
+        if end > buffer.used && end - buffer.used < RecordingWriter.headerSize {
+            end = min(end + RecordingWriter.pageSize, bufferSize)
+        }
+        let gap = end - buffer.used
+        if gap > 0 {
+            RecordingWriter.writeHeader(at: buffer.data + buffer.used, kind: .padding, stream: 0, timestamp: 0,
+                                        length: gap - RecordingWriter.headerSize, a: 0, b: 0, c: 0)
+            buffer.used = end
+            buffer.committed.increment(by: Int64(gap))
+        }
+        queuedBuffers.append(buffer)
+        maxQueuedBuffers.storeMax(Int64(queuedBuffers.count))
+    }
+
+    // Writer thread.
+    private func writeLoop() {
+        while true {
+            if queued.wait(timeout: .now() + flushInterval) == .timedOut {
+                os_unfair_lock_lock(lock)
+                queueCurrent()
+                os_unfair_lock_unlock(lock)
+            }
+
+            os_unfair_lock_lock(lock)
+            let buffers = queuedBuffers
+            queuedBuffers.removeAll(keepingCapacity: true)
+            let isDone = isClosing && current == nil
+            os_unfair_lock_unlock(lock)
+
+            for buffer in buffers {
+                write(buffer)
+                os_unfair_lock_lock(lock)
+                freeBuffers.append(buffer)
+                os_unfair_lock_unlock(lock)
+            }
+            if isDone && buffers.isEmpty {
+                break
+            }
+        }
+        finished.signal()
+    }
+
+    // Writer thread.
+    private func write(_ buffer: Buffer) {
+        // Appenders may still be copying into reserved space
+        while buffer.committed.value < Int64(buffer.used) {
+            usleep(100)
+        }
+
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        var written = 0
+        while written < buffer.used {
+            let result = pwrite(descriptor, buffer.data + written, buffer.used - written, fileOffset + off_t(written))
+            if result < 0 {
+                if errno == EINTR {
+                    continue
+                }
+                writeErrors.increment()
+                print("Recording write failed: \(String(cString: strerror(errno)))")
+                break
+            }
+            written += result
+        }
+        fileOffset += off_t(buffer.used)
+        writeNanoseconds.increment(by: Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+        bytesWritten.increment(by: Int64(written))
+        buffersWritten.increment()
+        buffer.used = 0
+        buffer.committed.store(0)
+    }
+}
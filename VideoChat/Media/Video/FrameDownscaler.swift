@@ -0,0 +1,173 @@
+//
+//  FrameDownscaler.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+
+// Produces several output sizes from one source frame. The source is halved
+// with an exact 2x2 area average as often as the smallest output allows, and
+// each output is scaled from the smallest level still at least its size, so
+// every resampling step is below 2:1 and the halvings are shared by all
+// outputs. Results are cached for the frame, outputs of equal size share one
+// buffer. Not thread safe, use one downscaler per capture queue.
+final class FrameDownscaler {
+
+    private let pool: VideoFrameBufferPool
+    private var source: VideoPlanes?
+    private var levels: [VideoFrameBuffer] = []
+    private var outputs: [VideoFrameFormat: VideoFrameBuffer] = [:]
+    private var tempBuffer: UnsafeMutableRawPointer?
+    private var tempBufferSize = 0
+
+    init(pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) {
+        self.pool = pool
+    }
+
+    deinit {
+        end()
+        free(tempBuffer)
+    }
+
+    // The source planes must stay valid until end().
+    func begin(_ source: VideoPlanes) {
+        end()
+        self.source = source
+    }
+
+    func end() {
+        levels.forEach { $0.release() }
+        levels.removeAll(keepingCapacity: true)
+        outputs.values.forEach { $0.release() }
+        outputs.removeAll(keepingCapacity: true)
+        source = nil
+    }
+
+    // Returns a retained buffer in the source pixel format, or nil if the
+    // source is not a 4:2:0 or ARGB frame at least as large as the target.
+    func scale(toWidth width: Int, height: Int) -> VideoFrameBuffer? {
+        guard let source = source else { return nil }
+        let width = width & ~1
+        let height = height & ~1
+        guard width > 0, height > 0, width <= source.width, height <= source.height else { return nil }
+
+        let format = VideoFrameFormat(pixelFormat: source.pixelFormat, width: width, height: height)
+        if let cached = outputs[format] {
+            cached.retain()
+            return cached
+        }
+
+        var level = source
+        for index in 0... {
+            guard level.width / 2 >= width, level.height / 2 >= height else { break }
+            level = index < levels.count ? VideoPlanes(buffer: levels[index]) : halve(level)
+        }
+
+        let output = pool.acquire(format: format)
+        let destination = VideoPlanes(buffer: output)
+        if level.width == width && level.height == height {
+            level.copy(into: destination)
+        } else if !resample(level, into: destination) {
+            output.release()
+            return nil
+        }
+        outputs[format] = output
+        output.retain()
+        return output
+    }
+
+    private func halve(_ source: VideoPlanes) -> VideoPlanes {
+        let format = VideoFrameFormat(pixelFormat: source.pixelFormat,
+                                      width: (source.width / 2) & ~1,
+                                      height: (source.height / 2) & ~1)
+        let buffer = pool.acquire(format: format)
+        levels.append(buffer)
+        let destination = VideoPlanes(buffer: buffer)
+
+        for plane in 0..<source.pixelFormat.planeCount {
+            let channels = source.pixelFormat.bytesPerPixel(plane: plane)
+            let src = source.plane(plane)
+            let dst = destination.plane(plane)
+            let count = destination.planeWidth(plane) * channels
+            for y in 0..<destination.planeHeight(plane) {
+                FrameDownscaler.halveRow(src.row(y * 2), src.row(y * 2 + 1), dst.row(y), count: count,
+                                         channels: channels)
+            }
+        }
+        return destination
+    }
+
+    // One output row of `count` bytes, 16 at a time. Each pixel's 2x2 sum is
+    // kept in 16 bit lanes and a 2 or 4 byte pixel is added to its neighbour
+    // as one wider lane, so every pixel size takes the same vector path.
+    @inline(__always)
+    private static func halveRow(_ top: UnsafePointer<UInt8>, _ bottom: UnsafePointer<UInt8>,
+                                 _ output: UnsafeMutablePointer<UInt8>, count: Int, channels: Int) {
+        let rounding = SIMD16<UInt16>(repeating: 2)
+        var lanesTop = SIMD32<UInt8>()
+        var lanesBottom = SIMD32<UInt8>()
+        var x = 0
+        while x + 16 <= count {
+            memcpy(&lanesTop, top + x * 2, 32)
+            memcpy(&lanesBottom, bottom + x * 2, 32)
+            let sums = SIMD32<UInt16>(truncatingIfNeeded: lanesTop) &+ SIMD32<UInt16>(truncatingIfNeeded: lanesBottom)
+            let pairs: SIMD16<UInt16>
+            switch channels {
+            case 1:
+                pairs = sums.evenHalf &+ sums.oddHalf
+            case 2:
+                let pixels = unsafeBitCast(sums, to: SIMD16<UInt32>.self)
+                pairs = unsafeBitCast(pixels.evenHalf &+ pixels.oddHalf, to: SIMD16<UInt16>.self)
+            default:
+                let pixels = unsafeBitCast(sums, to: SIMD8<UInt64>.self)
+                pairs = unsafeBitCast(pixels.evenHalf &+ pixels.oddHalf, to: SIMD16<UInt16>.self)
+            }
+            var result = SIMD16<UInt8>(truncatingIfNeeded: (pairs &+ rounding) &>> 2)
+            memcpy(output + x, &result, 16)
+            x += 16
+        }
+        while x < count {
+            let left = (x / channels) * 2 * channels + x % channels
+            let sum = UInt16(top[left]) + UInt16(top[left + channels])
+                + UInt16(bottom[left]) + UInt16(bottom[left + channels])
+            output[x] = UInt8((sum + 2) >> 2)
+            x += 1
+        }
+    }
+
+    private func resample(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        for plane in 0..<source.pixelFormat.planeCount {
+            var src = source.plane(plane).vImageBuffer(width: source.planeWidth(plane), height: source.planeHeight(plane))
+            var dst = destination.plane(plane).vImageBuffer(width: destination.planeWidth(plane),
+                                                            height: destination.planeHeight(plane))
+            let query = vImage_Flags(kvImageGetTempBufferSize)
+            let flags = vImage_Flags(kvImageNoFlags)
+            let error: vImage_Error
+            switch source.pixelFormat.bytesPerPixel(plane: plane) {
+            case 1:
+                let temp = reserveTempBuffer(vImageScale_Planar8(&src, &dst, nil, query))
+                error = vImageScale_Planar8(&src, &dst, temp, flags)
+            case 2:
+                let temp = reserveTempBuffer(vImageScale_CbCr8(&src, &dst, nil, query))
+                error = vImageScale_CbCr8(&src, &dst, temp, flags)
+            default:
+                let temp = reserveTempBuffer(vImageScale_ARGB8888(&src, &dst, nil, query))
+                error = vImageScale_ARGB8888(&src, &dst, temp, flags)
+            }
+            guard error == kvImageNoError else { return false }
+        }
+        return true
+    }
+
+    private func reserveTempBuffer(_ size: Int) -> UnsafeMutableRawPointer? {
+        if size > tempBufferSize {
+            free(tempBuffer)
+            tempBuffer = malloc(size)
+            tempBufferSize = size
+        }
+        return tempBuffer
+    }
+}
@@ -0,0 +1,147 @@
+//
+//  FrameHandoffQueue.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// Bounded ring between the camera callback and the thread feeding
+// OTVideoCaptureConsumer. When the ring is full the producer drops the oldest
+// frame instead of waiting, so a slow consumer never stalls capture. Every
+// slot carries a sequence number telling whether it is free or filled for the
+// current lap, as in Vyukov's bounded queue: producers claim slots with a CAS
+// on the write index, consumers and dropping producers claim the oldest entry
+// with a CAS on the read index, and whoever loses simply retries. A producer
+// only drops the very entry in its way; if a consumer got to it first the slot
+// is about to be freed and the producer spins instead. Any number of threads
+// may push and pop.
+final class FrameHandoffQueue<Element: AnyObject> {
+
+    struct Statistics {
+        let pushed: Int64
+        let popped: Int64
+        let dropped: Int64
+        let depth: Int64
+        let latency: LatencyHistogram.Summary
+    }
+
+    let capacity: Int
+
+    private let slots: AtomicIntArray
+    private let sequences: AtomicIntArray
+    private let enqueueTimes: AtomicIntArray
+    private let head = AtomicInt()
+    private let tail = AtomicInt()
+    private let pushed = AtomicInt()
+    private let popped = AtomicInt()
+    private let dropped = AtomicInt()
+    private let onDrop: ((Element) -> Void)?
+    let latency = LatencyHistogram()
+
+    // `onDrop` runs on the producer thread for frames replaced by newer ones,
+    // e.g. to release a pooled buffer. The ring has at least two slots; with
+    // one the free and filled sequence numbers would coincide.
+    init(capacity: Int = 2, onDrop: ((Element) -> Void)? = nil) {
+        self.capacity = max(capacity, 2)
+        self.onDrop = onDrop
+        slots = AtomicIntArray(count: self.capacity)
+        sequences = AtomicIntArray(count: self.capacity)
+        enqueueTimes = AtomicIntArray(count: self.capacity)
+        for index in 0..<self.capacity {
+            sequences.store(Int64(index), at: index)
+        }
+    }
+
+    deinit {
+        while let element = pop() {
+            onDrop?(element)
+        }
+    }
+
+    var depth: Int64 {
+        return tail.value - head.value
+    }
+
+    var statistics: Statistics {
+        return Statistics(pushed: pushed.value,
+                          popped: popped.value,
+                          dropped: dropped.value,
+                          depth: depth,
+                          latency: latency.summary)
+    }
+
+    // Producer side. Returns false if an older frame had to be dropped.
+    @discardableResult
+    func push(_ element: Element) -> Bool {
+        let bits = Int64(Int(bitPattern: Unmanaged.passRetained(element).toOpaque()))
+        var didDrop = false
+
+        while true {
+            let writeIndex = tail.value
+            let index = slot(writeIndex)
+            let sequence = sequences[index]
+            if sequence == writeIndex {
+                guard tail.compareExchange(expected: writeIndex, desired: writeIndex + 1) else { continue }
+                slots.store(bits, at: index)
+                enqueueTimes.store(FrameHandoffQueue.now(), at: index)
+                sequences.store(writeIndex + 1, at: index)
+                pushed.increment()
+                return !didDrop
+            }
+            // Full, the slot still holds the frame from a lap ago
+            let lapAgo = writeIndex - Int64(capacity)
+            if sequence == lapAgo + 1, let stale = claim(lapAgo)?.element {
+                dropped.increment()
+                didDrop = true
+                onDrop?(stale)
+            }
+        }
+    }
+
+    // Consumer side.
+    func pop() -> Element? {
+        guard let (element, enqueuedAt) = claimOldest() else { return nil }
+        popped.increment()
+        latency.record(FrameHandoffQueue.now() - enqueuedAt)
+        return element
+    }
+
+    // Nil when empty, or when the oldest slot is still being written.
+    private func claimOldest() -> (element: Element, enqueuedAt: Int64)? {
+        while true {
+            let readIndex = head.value
+            if sequences[slot(readIndex)] < readIndex + 1 {
+                return nil
+            }
+            if let entry = claim(readIndex) {
+                return entry
+            }
+        }
+    }
+
+    // Entry `readIndex`, if it is written and still the oldest.
+    private func claim(_ readIndex: Int64) -> (element: Element, enqueuedAt: Int64)? {
+        let index = slot(readIndex)
+        guard sequences[index] == readIndex + 1,
+            head.compareExchange(expected: readIndex, desired: readIndex + 1) else { return nil }
+        let bits = slots[index]
+        let enqueuedAt = enqueueTimes[index]
+        sequences.store(readIndex + Int64(capacity), at: index)
+        return (take(bits), enqueuedAt)
+    }
+
+    private func slot(_ index: Int64) -> Int {
+        return Int(index % Int64(capacity))
+    }
+
+    private func take(_ bits: Int64) -> Element {
+        let pointer = UnsafeRawPointer(bitPattern: Int(bits))!
+        return Unmanaged<Element>.fromOpaque(pointer).takeRetainedValue()
+    }
+
+    private static func now() -> Int64 {
+        return Int64(DispatchTime.now().uptimeNanoseconds)
+    }
+}
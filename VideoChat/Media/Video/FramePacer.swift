@@ -0,0 +1,153 @@
+//
+//  FramePacer.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreMedia
+import Foundation
+
+// Turns jittery capture timestamps into an even cadence at `targetFrameRate`.
+// A second order phase-locked loop tracks the camera's real frame period and
+// phase: each timestamp corrects the predicted one by `phaseGain` of the
+// error and the period by `frequencyGain`, and missed camera frames are
+// stepped over. Frames are then picked on an output grid of 1 / target
+// seconds, the one nearest each tick, and stamped with the tick itself, so a
+// 30 fps camera thinned to 7 fps comes out evenly spaced. When the target is
+// at or above the camera rate every frame passes with its smoothed time.
+// Not thread safe, use one pacer per capture.
+final class FramePacer {
+
+    struct Statistics {
+        let inputFrames: Int64
+        let outputFrames: Int64
+        // Standard deviation of the spacing between frames, in seconds
+        let inputJitter: Double
+        let outputJitter: Double
+        let estimatedPeriod: Double
+    }
+
+    // Running standard deviation of the interval between timestamps
+    private struct IntervalJitter {
+        var last: Double?
+        var count = 0
+        var mean = 0.0
+        var squares = 0.0
+
+        mutating func add(_ time: Double) {
+            defer { last = time }
+            guard let last = last else { return }
+            let interval = time - last
+            count += 1
+            let delta = interval - mean
+            mean += delta / Double(count)
+            squares += delta * (interval - mean)
+        }
+
+        var deviation: Double {
+            return count > 1 ? (squares / Double(count - 1)).squareRoot() : 0
+        }
+    }
+
+    let targetFrameRate: Int
+    var phaseGain = 0.1
+    var frequencyGain = 0.01
+    // Errors beyond this many periods restart the loop, e.g. after a pause
+    var resetThreshold = 8.0
+
+    private let targetInterval: Double
+    private var period: Double?
+    private var predicted: Double?
+    private var lastInput: Double?
+    private var nextTick: Double?
+    private var inputFrames: Int64 = 0
+    private var outputFrames: Int64 = 0
+    private var inputJitter = IntervalJitter()
+    private var outputJitter = IntervalJitter()
+
+    init(targetFrameRate: Int) {
+        self.targetFrameRate = max(targetFrameRate, 1)
+        targetInterval = 1 / Double(max(targetFrameRate, 1))
+    }
+
+    var statistics: Statistics {
+        return Statistics(inputFrames: inputFrames,
+                          outputFrames: outputFrames,
+                          inputJitter: inputJitter.deviation,
+                          outputJitter: outputJitter.deviation,
+                          estimatedPeriod: period ?? 0)
+    }
+
+    // Returns the timestamp to send the frame with, or nil to drop it.
+    func pace(_ timestamp: CMTime) -> CMTime? {
+        guard timestamp.isNumeric else { return timestamp }
+        let timescale = timestamp.timescale > 0 ? timestamp.timescale : 1_000_000_000
+        guard let time = pace(seconds: CMTimeGetSeconds(timestamp)) else { return nil }
+        return CMTime(seconds: time, preferredTimescale: timescale)
+    }
+
+    func pace(seconds time: Double) -> Double? {
+        inputFrames += 1
+        inputJitter.add(time)
+        let smoothed = track(time)
+
+        guard let period = period else {
+            return emit(smoothed)
+        }
+        // No thinning needed, the camera is not faster than the target
+        if targetInterval <= period * 1.05 {
+            return emit(smoothed)
+        }
+
+        guard let tick = nextTick, abs(smoothed - tick) <= targetInterval + period else {
+            nextTick = smoothed + targetInterval
+            return emit(smoothed)
+        }
+        // The frame nearest the tick: the next one would land further past it
+        guard smoothed + period / 2 > tick else { return nil }
+        nextTick = tick + targetInterval
+        return emit(tick)
+    }
+
+    // The loop; returns the de-jittered time of this frame.
+    private func track(_ time: Double) -> Double {
+        defer { lastInput = time }
+        guard var period = period, let predicted = predicted else {
+            if let lastInput = lastInput, time > lastInput {
+                self.period = time - lastInput
+                self.predicted = time + (time - lastInput)
+            } else {
+                self.predicted = nil
+            }
+            return time
+        }
+
+        var expected = predicted
+        var error = time - expected
+        if abs(error) > period * resetThreshold {
+            self.period = nil
+            self.predicted = nil
+            nextTick = nil
+            return time
+        }
+        // Frames the camera dropped
+        if error > period / 2 {
+            let missed = (error / period).rounded()
+            expected += missed * period
+            error = time - expected
+        }
+
+        let smoothed = expected + phaseGain * error
+        period = min(max(period + frequencyGain * error, period * 0.5), period * 2)
+        self.period = period
+        self.predicted = smoothed + period
+        return smoothed
+    }
+
+    private func emit(_ time: Double) -> Double {
+        outputFrames += 1
+        outputJitter.add(time)
+        return time
+    }
+}
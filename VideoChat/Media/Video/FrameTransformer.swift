@@ -0,0 +1,158 @@
+//
+//  FrameTransformer.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+import OpenTok
+
+// Rotates a frame upright and converts its pixel format in a single pass.
+// The frame is walked in small tiles: each tile is converted into a scratch
+// tile that stays in cache and is rotated from there straight into the
+// destination, so the full frame is read and written only once.
+// Not thread safe, use one transformer per render path.
+final class FrameTransformer {
+
+    static let tileSize = 64
+
+    private let converter: PixelFormatConverter
+    private let pool: VideoFrameBufferPool
+    private var scratch: VideoFrameBuffer?
+    private let transparentBlack = UnsafeMutablePointer<UInt8>.allocate(capacity: 4)
+
+    init(converter: PixelFormatConverter = PixelFormatConverter.shared,
+         pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) {
+        self.converter = converter
+        self.pool = pool
+        transparentBlack.initialize(repeating: 0, count: 4)
+    }
+
+    deinit {
+        scratch?.release()
+        transparentBlack.deallocate()
+    }
+
+    static func isTransposed(_ orientation: OTVideoOrientation) -> Bool {
+        return orientation == .left || orientation == .right
+    }
+
+    static func outputSize(width: Int, height: Int, orientation: OTVideoOrientation) -> (width: Int, height: Int) {
+        return isTransposed(orientation) ? (height, width) : (width, height)
+    }
+
+    func transform(_ source: VideoFrameBuffer, orientation: OTVideoOrientation, to pixelFormat: PixelFormat) -> VideoFrameBuffer? {
+        let size = FrameTransformer.outputSize(width: source.format.width, height: source.format.height, orientation: orientation)
+        let destination = pool.acquire(format: VideoFrameFormat(pixelFormat: pixelFormat, width: size.width, height: size.height))
+        guard transform(VideoPlanes(buffer: source), orientation: orientation, into: VideoPlanes(buffer: destination)) else {
+            destination.release()
+            return nil
+        }
+        return destination
+    }
+
+    @discardableResult
+    func transform(_ source: VideoPlanes, orientation: OTVideoOrientation, into destination: VideoPlanes) -> Bool {
+        let size = FrameTransformer.outputSize(width: source.width, height: source.height, orientation: orientation)
+        guard size.width == destination.width,
+            size.height == destination.height,
+            source.width.isMultiple(of: 2),
+            source.height.isMultiple(of: 2) else {
+            return false
+        }
+
+        if orientation == .up {
+            return converter.convert(source, into: destination)
+        }
+
+        let sameFormat = source.pixelFormat == destination.pixelFormat
+        let tileFormat = VideoFrameFormat(pixelFormat: destination.pixelFormat,
+                                          width: FrameTransformer.tileSize,
+                                          height: FrameTransformer.tileSize)
+        if !sameFormat && scratch?.format != tileFormat {
+            scratch?.release()
+            scratch = pool.acquire(format: tileFormat)
+        }
+
+        let tileSize = FrameTransformer.tileSize
+        var tileY = 0
+        while tileY < source.height {
+            let tileHeight = min(tileSize, source.height - tileY)
+            var tileX = 0
+            while tileX < source.width {
+                let tileWidth = min(tileSize, source.width - tileX)
+                var tile = source.cropped(x: tileX, y: tileY, width: tileWidth, height: tileHeight)
+                if !sameFormat, let scratch = scratch {
+                    let converted = VideoPlanes(buffer: scratch).cropped(x: 0, y: 0, width: tileWidth, height: tileHeight)
+                    guard converter.convert(tile, into: converted) else { return false }
+                    tile = converted
+                }
+                let target = destinationRect(x: tileX, y: tileY, width: tileWidth, height: tileHeight,
+                                             sourceWidth: source.width, sourceHeight: source.height,
+                                             orientation: orientation)
+                guard rotate(tile, into: destination.cropped(x: target.x, y: target.y, width: target.width, height: target.height),
+                             orientation: orientation) else {
+                    return false
+                }
+                tileX += tileWidth
+            }
+            tileY += tileHeight
+        }
+        return true
+    }
+
+    // Left means the camera image is turned 90° counter-clockwise, so it is
+    // rotated clockwise to be shown upright; Right is the opposite.
+    private func rotationConstant(_ orientation: OTVideoOrientation) -> UInt8 {
+        switch orientation {
+        case .left:
+            return UInt8(kRotate90DegreesClockwise)
+        case .right:
+            return UInt8(kRotate270DegreesClockwise)
+        case .down:
+            return UInt8(kRotate180DegreesClockwise)
+        default:
+            return UInt8(kRotate0DegreesClockwise)
+        }
+    }
+
+    private func destinationRect(x: Int, y: Int, width: Int, height: Int,
+                                 sourceWidth: Int, sourceHeight: Int,
+                                 orientation: OTVideoOrientation) -> (x: Int, y: Int, width: Int, height: Int) {
+        switch orientation {
+        case .left:
+            return (sourceHeight - y - height, x, height, width)
+        case .right:
+            return (y, sourceWidth - x - width, height, width)
+        case .down:
+            return (sourceWidth - x - width, sourceHeight - y - height, width, height)
+        default:
+            return (x, y, width, height)
+        }
+    }
+
+    private func rotate(_ source: VideoPlanes, into destination: VideoPlanes, orientation: OTVideoOrientation) -> Bool {
+        let rotation = rotationConstant(orientation)
+        let flags = vImage_Flags(kvImageNoFlags)
+
+        for plane in 0..<source.pixelFormat.planeCount {
+            var src = source.plane(plane).vImageBuffer(width: source.planeWidth(plane), height: source.planeHeight(plane))
+            var dst = destination.plane(plane).vImageBuffer(width: destination.planeWidth(plane),
+                                                            height: destination.planeHeight(plane))
+            let error: vImage_Error
+            switch source.pixelFormat.bytesPerPixel(plane: plane) {
+            case 1:
+                error = vImageRotate90_Planar8(&src, &dst, rotation, 0, flags)
+            case 2:
+                // Interleaved CbCr pairs move together as one 16 bit pixel
+                error = vImageRotate90_Planar16U(&src, &dst, rotation, 0, flags)
+            default:
+                error = vImageRotate90_ARGB8888(&src, &dst, rotation, transparentBlack, flags)
+            }
+            guard error == kvImageNoError else { return false }
+        }
+        return true
+    }
+}
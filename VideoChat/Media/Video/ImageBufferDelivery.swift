@@ -0,0 +1,246 @@
+//
+//  ImageBufferDelivery.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreMedia
+import CoreVideo
+import Foundation
+import OpenTok
+
+extension PixelFormat {
+
+    // Core Video pixel types with the same memory layout and range. Full range
+    // YCbCr has no PixelFormat: the converters and the SDK's frames take 4:2:0
+    // as video range, so such buffers can only pass through untouched.
+    init?(pixelType: OSType) {
+        switch pixelType {
+        case kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange:
+            self = .nv12
+        case kCVPixelFormatType_420YpCbCr8Planar:
+            self = .i420
+        case kCVPixelFormatType_32ARGB:
+            self = .argb
+        default:
+            return nil
+        }
+    }
+
+    var pixelType: OSType {
+        switch self {
+        case .i420:
+            return kCVPixelFormatType_420YpCbCr8Planar
+        case .nv12:
+            return kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange
+        case .argb:
+            return kCVPixelFormatType_32ARGB
+        }
+    }
+}
+
+extension VideoPlanes {
+
+    // The base address must stay locked while the planes are used.
+    init?(pixelBuffer: CVPixelBuffer) {
+        guard let pixelFormat = PixelFormat(pixelType: CVPixelBufferGetPixelFormatType(pixelBuffer)) else { return nil }
+        let isPlanar = CVPixelBufferIsPlanar(pixelBuffer)
+        guard !isPlanar || CVPixelBufferGetPlaneCount(pixelBuffer) == pixelFormat.planeCount else { return nil }
+
+        func planeAt(_ index: Int) -> ImagePlane? {
+            guard index < pixelFormat.planeCount else { return nil }
+            let base = isPlanar ? CVPixelBufferGetBaseAddressOfPlane(pixelBuffer, index) : CVPixelBufferGetBaseAddress(pixelBuffer)
+            guard let data = base else { return nil }
+            let bytesPerRow = isPlanar
+                ? CVPixelBufferGetBytesPerRowOfPlane(pixelBuffer, index)
+                : CVPixelBufferGetBytesPerRow(pixelBuffer)
+            return ImagePlane(data: data.assumingMemoryBound(to: UInt8.self), bytesPerRow: bytesPerRow)
+        }
+
+        guard let first = planeAt(0) else { return nil }
+        let evenMask = pixelFormat == .argb ? ~0 : ~1
+        self.init(pixelFormat: pixelFormat,
+                  width: CVPixelBufferGetWidth(pixelBuffer) & evenMask,
+                  height: CVPixelBufferGetHeight(pixelBuffer) & evenMask,
+                  first: first,
+                  second: planeAt(1),
+                  third: planeAt(2))
+    }
+}
+
+private func releaseWrappedBuffer(_ context: UnsafeMutableRawPointer?) {
+    guard let context = context else { return }
+    Unmanaged<VideoFrameBuffer>.fromOpaque(context).takeRetainedValue().release()
+}
+
+extension VideoFrameBuffer {
+
+    // Wraps the planes in a CVPixelBuffer without copying. The pixel buffer
+    // holds a reference until Core Video frees it.
+    func makePixelBuffer() -> CVPixelBuffer? {
+        retain()
+        let context = Unmanaged.passRetained(self).toOpaque()
+        var pixelBuffer: CVPixelBuffer?
+        let status: CVReturn
+        if format.planeCount == 1 {
+            status = CVPixelBufferCreateWithBytes(nil, format.width, format.height, format.pixelFormat.pixelType,
+                                                  plane(0), bytesPerRow(0),
+                                                  { context, _ in releaseWrappedBuffer(context) },
+                                                  context, nil, &pixelBuffer)
+        } else {
+            var addresses: [UnsafeMutableRawPointer?] = planes.map { UnsafeMutableRawPointer($0) }
+            var widths = (0..<format.planeCount).map { format.planeWidth($0) }
+            var heights = (0..<format.planeCount).map { format.planeHeight($0) }
+            var bytesPerRow = format.bytesPerRow
+            status = CVPixelBufferCreateWithPlanarBytes(nil, format.width, format.height, format.pixelFormat.pixelType,
+                                                        nil, 0, format.planeCount,
+                                                        &addresses, &widths, &heights, &bytesPerRow,
+                                                        { context, _, _, _, _ in releaseWrappedBuffer(context) },
+                                                        context, nil, &pixelBuffer)
+        }
+        guard status == kCVReturnSuccess, pixelBuffer != nil else {
+            releaseWrappedBuffer(context)
+            return nil
+        }
+        return pixelBuffer
+    }
+}
+
+// Hands CVPixelBuffers to an OTVideoCaptureConsumer. Pixel types the SDK takes
+// go through consumeImageBuffer untouched; anything else, or everything after a
+// consumer has refused an image buffer, is passed to consumeFrame, which
+// copies the planes into the SDK's own frame. A refusal holds until the pixel
+// buffers change format or for `retryFrames` frames. Counts every copy a frame took
+// on its way, the consumeFrame one and those the capturer reports with
+// recordCopy, such as downscaling and the filter graph's copy-out.
+final class ImageBufferDelivery {
+
+    struct Statistics {
+        let frames: Int64
+        let zeroCopyFrames: Int64
+        let copies: Int64
+        let bytesCopied: Int64
+        let framesDropped: Int64
+
+        var copiesPerFrame: Double {
+            return Double(copies) / Double(max(frames, 1))
+        }
+
+        var bytesCopiedPerFrame: Double {
+            return Double(bytesCopied) / Double(max(frames, 1))
+        }
+    }
+
+    // The pixel types consumeImageBuffer accepts
+    static let supportedPixelTypes: Set<OSType> = [
+        kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange,
+        kCVPixelFormatType_420YpCbCr8BiPlanarFullRange,
+        kCVPixelFormatType_420YpCbCr8Planar,
+        kCVPixelFormatType_420YpCbCr8PlanarFullRange,
+        kCVPixelFormatType_32ARGB,
+        kCVPixelFormatType_32BGRA,
+        kCVPixelFormatType_24RGB
+    ]
+
+    static let retryFrames = 300
+
+    private let acceptsImageBuffers = AtomicInt(1)
+    private let frames = AtomicInt()
+    private let zeroCopyFrames = AtomicInt()
+    private let copies = AtomicInt()
+    private let bytesCopied = AtomicInt()
+    private let framesDropped = AtomicInt()
+    private var videoFrame: OTVideoFrame?
+    // Delivery queue. Pixel type and size of the buffer refused last.
+    private var refusedFormat: (pixelType: OSType, width: Int, height: Int)?
+    private var framesSinceRefusal = 0
+
+    var statistics: Statistics {
+        return Statistics(frames: frames.value,
+                          zeroCopyFrames: zeroCopyFrames.value,
+                          copies: copies.value,
+                          bytesCopied: bytesCopied.value,
+                          framesDropped: framesDropped.value)
+    }
+
+    var isZeroCopy: Bool {
+        return acceptsImageBuffers.value == 1
+    }
+
+    static func canPassThrough(_ pixelType: OSType) -> Bool {
+        return supportedPixelTypes.contains(pixelType)
+    }
+
+    // Any thread. A frame written into new memory before it got here.
+    func recordCopy(bytes: Int) {
+        copies.increment()
+        bytesCopied.increment(by: Int64(bytes))
+    }
+
+    // Delivery queue, one caller at a time.
+    @discardableResult
+    func deliver(_ pixelBuffer: CVPixelBuffer, orientation: OTVideoOrientation, timestamp: CMTime,
+                 metadata: Data?, to consumer: OTVideoCaptureConsumer) -> Bool {
+        let pixelType = CVPixelBufferGetPixelFormatType(pixelBuffer)
+        if ImageBufferDelivery.canPassThrough(pixelType) && shouldTryImageBuffer(pixelBuffer) {
+            if consumer.consumeImageBuffer(pixelBuffer, orientation: orientation, timestamp: timestamp, metadata: metadata) {
+                refusedFormat = nil
+                acceptsImageBuffers.store(1)
+                frames.increment()
+                zeroCopyFrames.increment()
+                return true
+            }
+            if isZeroCopy {
+                print("The capture consumer refused an image buffer, falling back to consumeFrame")
+            }
+            refusedFormat = (pixelType, CVPixelBufferGetWidth(pixelBuffer), CVPixelBufferGetHeight(pixelBuffer))
+            framesSinceRefusal = 0
+            acceptsImageBuffers.store(0)
+        }
+
+        CVPixelBufferLockBaseAddress(pixelBuffer, .readOnly)
+        defer { CVPixelBufferUnlockBaseAddress(pixelBuffer, .readOnly) }
+        guard let planes = VideoPlanes(pixelBuffer: pixelBuffer) else {
+            framesDropped.increment()
+            return false
+        }
+        let format = VideoFrameFormat(pixelFormat: planes.pixelFormat,
+                                      width: planes.width,
+                                      height: planes.height,
+                                      bytesPerRow: (0..<planes.pixelFormat.planeCount).map { planes.plane($0).bytesPerRow })
+        let videoFrame = self.videoFrame(for: format)
+        var pointers = (0..<format.planeCount).map { planes.plane($0).data }
+        videoFrame.setPlanesWithPointers(&pointers, numPlanes: Int32(pointers.count))
+        videoFrame.timestamp = timestamp
+        videoFrame.orientation = orientation
+        // The frame is reused, so a frame without metadata must not keep the
+        // previous one's
+        var error: OTError?
+        videoFrame.setMetadata(metadata ?? Data(), error: &error)
+        consumer.consumeFrame(videoFrame)
+        videoFrame.clearPlanes()
+
+        frames.increment()
+        recordCopy(bytes: format.byteCount)
+        return true
+    }
+
+    private func shouldTryImageBuffer(_ pixelBuffer: CVPixelBuffer) -> Bool {
+        guard let refused = refusedFormat else { return true }
+        framesSinceRefusal += 1
+        return framesSinceRefusal >= ImageBufferDelivery.retryFrames
+            || refused.pixelType != CVPixelBufferGetPixelFormatType(pixelBuffer)
+            || refused.width != CVPixelBufferGetWidth(pixelBuffer)
+            || refused.height != CVPixelBufferGetHeight(pixelBuffer)
+    }
+
+    private func videoFrame(for format: VideoFrameFormat) -> OTVideoFrame {
+        if let videoFrame = videoFrame, videoFrame.format.flatMap({ VideoFrameFormat(format: $0) }) == format {
+            return videoFrame
+        }
+        let videoFrame = OTVideoFrame(format: format.makeVideoFormat())
+        self.videoFrame = videoFrame
+        return videoFrame
+    }
+}
@@ -0,0 +1,162 @@
+//
+//  LatencyTracer.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// What a publisher writes into OTVideoFrame.metadata: a per-capturer sequence
+// number and the monotonic capture time. Capture times are only comparable on
+// the device that took them, so glass-to-glass numbers are meaningful when
+// this device also subscribes to its own streams, as the multi-camera call
+// setup does.
+struct FrameStamp: Equatable {
+
+    static let size = 16
+    private static let magic: UInt32 = 0x3154_4C56 // "VLT1"
+
+    let sequence: UInt32
+    let capturedAt: UInt64
+
+    init(sequence: UInt32, capturedAt: UInt64) {
+        self.sequence = sequence
+        self.capturedAt = capturedAt
+    }
+
+    init?(metadata: Data) {
+        guard metadata.count >= FrameStamp.size else { return nil }
+        let fields = metadata.withUnsafeBytes { bytes -> (UInt32, UInt32, UInt64) in
+            (UInt32(littleEndian: bytes.loadUnaligned(fromByteOffset: 0)),
+             UInt32(littleEndian: bytes.loadUnaligned(fromByteOffset: 4)),
+             UInt64(littleEndian: bytes.loadUnaligned(fromByteOffset: 8)))
+        }
+        guard fields.0 == FrameStamp.magic else { return nil }
+        sequence = fields.1
+        capturedAt = fields.2
+    }
+
+    var data: Data {
+        var data = Data(capacity: FrameStamp.size)
+        var magic = FrameStamp.magic.littleEndian
+        var sequence = self.sequence.littleEndian
+        var capturedAt = self.capturedAt.littleEndian
+        withUnsafeBytes(of: &magic) { data.append(contentsOf: $0) }
+        withUnsafeBytes(of: &sequence) { data.append(contentsOf: $0) }
+        withUnsafeBytes(of: &capturedAt) { data.append(contentsOf: $0) }
+        return data
+    }
+
+    static func now() -> UInt64 {
+        return DispatchTime.now().uptimeNanoseconds
+    }
+}
+
+private extension UnsafeRawBufferPointer {
+
+    func loadUnaligned<T: FixedWidthInteger>(fromByteOffset offset: Int) -> T {
+        var value: T = 0
+        withUnsafeMutableBytes(of: &value) { $0.copyMemory(from: UnsafeRawBufferPointer(rebasing: self[offset..<offset + MemoryLayout<T>.size])) }
+        return value
+    }
+}
+
+// Glass-to-glass latency per received stream. The histograms are lock-free;
+// the lock only guards registering a new stream. Streams stay after their
+// renderer is gone, so the end-of-call report and streams subscribed again
+// after a recovery keep their history, until `removeAll()`.
+final class LatencyTracer {
+
+    struct StreamStatistics {
+        let latency: LatencyHistogram.Summary
+        let framesLost: Int64
+    }
+
+    static let shared = LatencyTracer()
+
+    private var histograms: [String: LatencyHistogram] = [:]
+    private var lostFrames: [String: AtomicInt] = [:]
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+
+    init() {
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    // Metadata for a frame about to be handed to OTVideoCaptureConsumer.
+    func stamp(sequence: UInt32, capturedAt: UInt64) -> Data {
+        return FrameStamp(sequence: sequence, capturedAt: capturedAt).data
+    }
+
+    func register(stream name: String) -> (histogram: LatencyHistogram, lost: AtomicInt) {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        if let histogram = histograms[name], let lost = lostFrames[name] {
+            return (histogram, lost)
+        }
+        let histogram = LatencyHistogram()
+        let lost = AtomicInt()
+        histograms[name] = histogram
+        lostFrames[name] = lost
+        return (histogram, lost)
+    }
+
+    func removeAll() {
+        os_unfair_lock_lock(lock)
+        histograms.removeAll()
+        lostFrames.removeAll()
+        os_unfair_lock_unlock(lock)
+    }
+
+    var statistics: [String: StreamStatistics] {
+        os_unfair_lock_lock(lock)
+        let histograms = self.histograms
+        let lostFrames = self.lostFrames
+        os_unfair_lock_unlock(lock)
+
+        var result: [String: StreamStatistics] = [:]
+        for (name, histogram) in histograms {
+            result[name] = StreamStatistics(latency: histogram.summary, framesLost: lostFrames[name]?.value ?? 0)
+        }
+        return result
+    }
+}
+
+// Sits in front of a subscriber's real renderer and records how long each
+// stamped frame took from capture to here. Unstamped frames pass through.
+final class LatencyTracingRender: NSObject, OTVideoRender {
+
+    let streamName: String
+    private let next: OTVideoRender
+    private let histogram: LatencyHistogram
+    private let lost: AtomicInt
+    private var lastSequence: UInt32?
+
+    init(next: OTVideoRender, streamName: String, tracer: LatencyTracer = LatencyTracer.shared) {
+        self.next = next
+        self.streamName = streamName
+        (histogram, lost) = tracer.register(stream: streamName)
+        super.init()
+    }
+
+    func renderVideoFrame(_ frame: OTVideoFrame) {
+        if let metadata = frame.metadata, let stamp = FrameStamp(metadata: metadata) {
+            let now = FrameStamp.now()
+            if now >= stamp.capturedAt {
+                histogram.record(Int64(now - stamp.capturedAt))
+            }
+            if let last = lastSequence, stamp.sequence &- last > 1, stamp.sequence &- last < UInt32.max / 2 {
+                lost.increment(by: Int64(stamp.sequence &- last - 1))
+            }
+            lastSequence = stamp.sequence
+        }
+        next.renderVideoFrame(frame)
+    }
+}
@@ -0,0 +1,161 @@
+//
+//  PixelFormatConverter.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+
+// Conversions between the three OTPixelFormat layouts. The YpCbCr <-> ARGB
+// work is done by vImage, which picks the NEON (or SSE/AVX in the simulator)
+// path for the running CPU. Chroma (de)interleaving is a plain loop the
+// compiler vectorizes.
+final class PixelFormatConverter {
+
+    static let shared = PixelFormatConverter()
+
+    private let i420ToARGB = UnsafeMutablePointer<vImage_YpCbCrToARGB>.allocate(capacity: 1)
+    private let nv12ToARGB = UnsafeMutablePointer<vImage_YpCbCrToARGB>.allocate(capacity: 1)
+    private let argbToI420 = UnsafeMutablePointer<vImage_ARGBToYpCbCr>.allocate(capacity: 1)
+    private let argbToNV12 = UnsafeMutablePointer<vImage_ARGBToYpCbCr>.allocate(capacity: 1)
+
+    init() {
+        // ITU-R BT.601 video range, what the OpenTok capturer produces
+        var pixelRange = vImage_YpCbCrPixelRange(Yp_bias: 16,
+                                                 CbCr_bias: 128,
+                                                 YpRangeMax: 235,
+                                                 CbCrRangeMax: 240,
+                                                 YpMax: 235,
+                                                 YpMin: 16,
+                                                 CbCrMax: 240,
+                                                 CbCrMin: 16)
+        let flags = vImage_Flags(kvImageNoFlags)
+        vImageConvert_YpCbCrToARGB_GenerateConversion(kvImage_YpCbCrToARGBMatrix_ITU_R_601_4, &pixelRange,
+                                                      i420ToARGB, kvImage420Yp8_Cb8_Cr8, kvImageARGB8888, flags)
+        vImageConvert_YpCbCrToARGB_GenerateConversion(kvImage_YpCbCrToARGBMatrix_ITU_R_601_4, &pixelRange,
+                                                      nv12ToARGB, kvImage420Yp8_CbCr8, kvImageARGB8888, flags)
+        vImageConvert_ARGBToYpCbCr_GenerateConversion(kvImage_ARGBToYpCbCrMatrix_ITU_R_601_4, &pixelRange,
+                                                      argbToI420, kvImageARGB8888, kvImage420Yp8_Cb8_Cr8, flags)
+        vImageConvert_ARGBToYpCbCr_GenerateConversion(kvImage_ARGBToYpCbCrMatrix_ITU_R_601_4, &pixelRange,
+                                                      argbToNV12, kvImageARGB8888, kvImage420Yp8_CbCr8, flags)
+    }
+
+    deinit {
+        i420ToARGB.deallocate()
+        nv12ToARGB.deallocate()
+        argbToI420.deallocate()
+        argbToNV12.deallocate()
+    }
+
+    func convert(_ source: VideoFrameBuffer, to pixelFormat: PixelFormat,
+                 pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) -> VideoFrameBuffer? {
+        let format = VideoFrameFormat(pixelFormat: pixelFormat, width: source.format.width, height: source.format.height)
+        let destination = pool.acquire(format: format)
+        guard convert(VideoPlanes(buffer: source), into: VideoPlanes(buffer: destination)) else {
+            destination.release()
+            return nil
+        }
+        return destination
+    }
+
+    // Source and destination must have the same size; 4:2:0 layouts need even dimensions.
+    @discardableResult
+    func convert(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        guard source.width == destination.width,
+            source.height == destination.height else {
+            return false
+        }
+        if (source.isSubsampled || destination.isSubsampled)
+            && (!source.width.isMultiple(of: 2) || !source.height.isMultiple(of: 2)) {
+            return false
+        }
+
+        let width = source.width
+        let height = source.height
+        let flags = vImage_Flags(kvImageNoFlags)
+
+        switch (source.pixelFormat, destination.pixelFormat) {
+        case (.i420, .i420), (.nv12, .nv12), (.argb, .argb):
+            for plane in 0..<source.pixelFormat.planeCount {
+                copyPlane(source.plane(plane), to: destination.plane(plane),
+                          rowLength: source.planeWidth(plane) * source.pixelFormat.bytesPerPixel(plane: plane),
+                          height: source.planeHeight(plane))
+            }
+            return true
+
+        case (.i420, .nv12):
+            copyPlane(source.first, to: destination.first, rowLength: width, height: height)
+            interleave(source.plane(1), source.plane(2), into: destination.plane(1),
+                       width: source.planeWidth(1), height: source.planeHeight(1))
+            return true
+
+        case (.nv12, .i420):
+            copyPlane(source.first, to: destination.first, rowLength: width, height: height)
+            deinterleave(source.plane(1), into: destination.plane(1), destination.plane(2),
+                         width: source.planeWidth(1), height: source.planeHeight(1))
+            return true
+
+        case (.i420, .argb):
+            var yp = source.first.vImageBuffer(width: width, height: height)
+            var cb = source.plane(1).vImageBuffer(width: width / 2, height: height / 2)
+            var cr = source.plane(2).vImageBuffer(width: width / 2, height: height / 2)
+            var argb = destination.first.vImageBuffer(width: width, height: height)
+            return vImageConvert_420Yp8_Cb8_Cr8ToARGB8888(&yp, &cb, &cr, &argb, i420ToARGB, nil, 255, flags) == kvImageNoError
+
+        case (.nv12, .argb):
+            var yp = source.first.vImageBuffer(width: width, height: height)
+            var cbcr = source.plane(1).vImageBuffer(width: width / 2, height: height / 2)
+            var argb = destination.first.vImageBuffer(width: width, height: height)
+            return vImageConvert_420Yp8_CbCr8ToARGB8888(&yp, &cbcr, &argb, nv12ToARGB, nil, 255, flags) == kvImageNoError
+
+        case (.argb, .i420):
+            var argb = source.first.vImageBuffer(width: width, height: height)
+            var yp = destination.first.vImageBuffer(width: width, height: height)
+            var cb = destination.plane(1).vImageBuffer(width: width / 2, height: height / 2)
+            var cr = destination.plane(2).vImageBuffer(width: width / 2, height: height / 2)
+            return vImageConvert_ARGB8888To420Yp8_Cb8_Cr8(&argb, &yp, &cb, &cr, argbToI420, nil, flags) == kvImageNoError
+
+        case (.argb, .nv12):
+            var argb = source.first.vImageBuffer(width: width, height: height)
+            var yp = destination.first.vImageBuffer(width: width, height: height)
+            var cbcr = destination.plane(1).vImageBuffer(width: width / 2, height: height / 2)
+            return vImageConvert_ARGB8888To420Yp8_CbCr8(&argb, &yp, &cbcr, argbToNV12, nil, flags) == kvImageNoError
+        }
+    }
+
+    private func copyPlane(_ source: ImagePlane, to destination: ImagePlane, rowLength: Int, height: Int) {
+        if source.bytesPerRow == rowLength && destination.bytesPerRow == rowLength {
+            memcpy(destination.data, source.data, rowLength * height)
+            return
+        }
+        for row in 0..<height {
+            memcpy(destination.row(row), source.row(row), rowLength)
+        }
+    }
+
+    private func interleave(_ cb: ImagePlane, _ cr: ImagePlane, into cbcr: ImagePlane, width: Int, height: Int) {
+        for row in 0..<height {
+            let u = cb.row(row)
+            let v = cr.row(row)
+            let uv = cbcr.row(row)
+            for column in 0..<width {
+                uv[2 * column] = u[column]
+                uv[2 * column + 1] = v[column]
+            }
+        }
+    }
+
+    private func deinterleave(_ cbcr: ImagePlane, into cb: ImagePlane, _ cr: ImagePlane, width: Int, height: Int) {
+        for row in 0..<height {
+            let uv = cbcr.row(row)
+            let u = cb.row(row)
+            let v = cr.row(row)
+            for column in 0..<width {
+                u[column] = uv[2 * column]
+                v[column] = uv[2 * column + 1]
+            }
+        }
+    }
+}
@@ -0,0 +1,384 @@
+//
+//  SharedCameraCapture.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import AVFoundation
+import OpenTok
+import UIKit
+
+// One capture session per physical camera, shared by every publisher of that
+// camera. Each frame is captured once and downscaled to every publisher's
+// size from the same source buffer; a publisher wanting the camera's own size
+// gets the camera's buffer itself.
+final class CameraFrameSource: NSObject {
+
+    private struct WeakSource {
+        weak var source: CameraFrameSource?
+    }
+
+    // Held by the captures only, so a camera nobody uses is let go
+    private static var sources: [AVCaptureDevice.Position: WeakSource] = [:]
+
+    // Main thread.
+    static func shared(position: AVCaptureDevice.Position) -> CameraFrameSource {
+        if let source = sources[position]?.source {
+            return source
+        }
+        sources = sources.filter { $0.value.source != nil }
+        let source = CameraFrameSource(position: position)
+        sources[position] = WeakSource(source: source)
+        return source
+    }
+
+    let position: AVCaptureDevice.Position
+    let captureQueue = DispatchQueue(label: "VideoChat.CameraFrameSource.capture", qos: .userInteractive)
+
+    private let session = AVCaptureSession()
+    private let downscaler = FrameDownscaler()
+    private var captures: [SharedCameraCapture] = []
+    private var orientation: OTVideoOrientation = .left
+    private var isConfigured = false
+
+    private init(position: AVCaptureDevice.Position) {
+        self.position = position
+        super.init()
+        UIDevice.current.beginGeneratingDeviceOrientationNotifications()
+        NotificationCenter.default.addObserver(self,
+                                               selector: #selector(deviceOrientationDidChange),
+                                               name: UIDevice.orientationDidChangeNotification,
+                                               object: nil)
+    }
+
+    deinit {
+        NotificationCenter.default.removeObserver(self)
+        UIDevice.current.endGeneratingDeviceOrientationNotifications()
+    }
+
+    func add(_ capture: SharedCameraCapture) {
+        captureQueue.async {
+            guard !self.captures.contains(where: { $0 === capture }) else { return }
+            self.captures.append(capture)
+            self.updateSession()
+        }
+    }
+
+    func remove(_ capture: SharedCameraCapture) {
+        captureQueue.async {
+            self.captures.removeAll { $0 === capture }
+            self.updateSession()
+        }
+    }
+
+    // Capture queue. Runs the session at the largest size anyone needs.
+    func updateSession() {
+        guard !captures.isEmpty else {
+            if session.isRunning {
+                session.stopRunning()
+            }
+            return
+        }
+        if !isConfigured {
+            isConfigured = configure()
+        }
+
+        let preset = CameraFrameSource.preset(forHeight: captures.map { $0.targetHeight }.max() ?? 0).preset
+        if session.sessionPreset != preset && session.canSetSessionPreset(preset) {
+            session.beginConfiguration()
+            session.sessionPreset = preset
+            session.commitConfiguration()
+        }
+        if !session.isRunning {
+            session.startRunning()
+        }
+    }
+
+    // The size frames for a target should come at before any has: the
+    // camera's aspect ratio fitted inside the target, never upscaled, with the
+    // camera at the preset the target needs.
+    static func expectedSize(forTargetWidth width: Int, height: Int) -> (width: Int, height: Int) {
+        let needed = preset(forHeight: height)
+        return fit(width: width, height: height, cameraWidth: needed.width, cameraHeight: needed.height)
+    }
+
+    private static func preset(forHeight height: Int) -> (preset: AVCaptureSession.Preset, width: Int, height: Int) {
+        if height > 480 {
+            return (.hd1280x720, 1280, 720)
+        }
+        if height > 288 {
+            return (.vga640x480, 640, 480)
+        }
+        return (.cif352x288, 352, 288)
+    }
+
+    // Even sizes, as FrameDownscaler produces them.
+    private static func fit(width: Int, height: Int, cameraWidth: Int, cameraHeight: Int) -> (width: Int, height: Int) {
+        let scale = min(Double(width) / Double(cameraWidth), Double(height) / Double(cameraHeight), 1)
+        guard scale < 1 else { return (cameraWidth, cameraHeight) }
+        return (Int(Double(cameraWidth) * scale) & ~1, Int(Double(cameraHeight) * scale) & ~1)
+    }
+
+    private func configure() -> Bool {
+        guard let device = AVCaptureDevice.default(.builtInWideAngleCamera, for: .video, position: position),
+            let input = try? AVCaptureDeviceInput(device: device),
+            session.canAddInput(input) else {
+            print("Could not open the \(position == .front ? "front" : "back") camera")
+            return false
+        }
+
+        let output = AVCaptureVideoDataOutput()
+        output.alwaysDiscardsLateVideoFrames = true
+        output.videoSettings = [kCVPixelBufferPixelFormatTypeKey as String: kCVPixelFormatType_420YpCbCr8BiPlanarVideoRange]
+        output.setSampleBufferDelegate(self, queue: captureQueue)
+        guard session.canAddOutput(output) else { return false }
+
+        session.beginConfiguration()
+        session.addInput(input)
+        session.addOutput(output)
+        session.commitConfiguration()
+        return true
+    }
+
+    // The sensor is landscape; the front camera turns the other way.
+    @objc private func deviceOrientationDidChange() {
+        let isFront = position == .front
+        let newOrientation: OTVideoOrientation
+        switch UIDevice.current.orientation {
+        case .portraitUpsideDown:
+            newOrientation = .right
+        case .landscapeLeft:
+            newOrientation = isFront ? .down : .up
+        case .landscapeRight:
+            newOrientation = isFront ? .up : .down
+        case .portrait:
+            newOrientation = .left
+        default:
+            return
+        }
+        captureQueue.async {
+            self.orientation = newOrientation
+        }
+    }
+}
+
+// MARK: - AVCaptureVideoDataOutputSampleBufferDelegate callbacks
+extension CameraFrameSource: AVCaptureVideoDataOutputSampleBufferDelegate {
+
+    func captureOutput(_ output: AVCaptureOutput, didOutput sampleBuffer: CMSampleBuffer, from connection: AVCaptureConnection) {
+        guard !captures.isEmpty, let pixelBuffer = CMSampleBufferGetImageBuffer(sampleBuffer) else { return }
+        let timestamp = CMSampleBufferGetPresentationTimeStamp(sampleBuffer)
+        let capturedAt = FrameStamp.now()
+
+        CVPixelBufferLockBaseAddress(pixelBuffer, .readOnly)
+        defer { CVPixelBufferUnlockBaseAddress(pixelBuffer, .readOnly) }
+        guard let source = VideoPlanes(pixelBuffer: pixelBuffer), source.pixelFormat == .nv12 else { return }
+
+        downscaler.begin(source)
+        for capture in captures {
+            guard let pacedTimestamp = capture.pace(timestamp) else { continue }
+            let (width, height) = CameraFrameSource.fit(width: capture.targetWidth, height: capture.targetHeight,
+                                                        cameraWidth: source.width, cameraHeight: source.height)
+            if width == source.width && height == source.height {
+                capture.deliver(pixelBuffer, timestamp: pacedTimestamp, capturedAt: capturedAt, orientation: orientation)
+                continue
+            }
+            guard let buffer = downscaler.scale(toWidth: width, height: height) else { continue }
+            let scaled = buffer.makePixelBuffer()
+            let bytes = buffer.format.byteCount
+            buffer.release()
+            if let scaled = scaled {
+                capture.deliver(scaled, timestamp: pacedTimestamp, capturedAt: capturedAt, orientation: orientation,
+                                copiedBytes: bytes)
+            }
+        }
+        downscaler.end()
+    }
+}
+
+// OTVideoCapture fed by a CameraFrameSource at a fixed size and frame rate.
+// A FramePacer thins the camera rate down evenly and smooths the timestamps
+// the encoder sees. Frames reach the consumer through a latest-wins handoff queue, so a slow
+// encoder drops stale frames instead of holding up the camera, and stay in
+// their CVPixelBuffer all the way to the SDK (see ImageBufferDelivery) unless
+// `filterGraph` has filters to run on them first. With a `sceneDetector`,
+// frames of a still scene are dropped before any of that work.
+final class SharedCameraCapture: NSObject, OTVideoCapture {
+
+    final class Frame {
+        let pixelBuffer: CVPixelBuffer
+        let timestamp: CMTime
+        let capturedAt: UInt64
+        let orientation: OTVideoOrientation
+
+        init(pixelBuffer: CVPixelBuffer, timestamp: CMTime, capturedAt: UInt64, orientation: OTVideoOrientation) {
+            self.pixelBuffer = pixelBuffer
+            self.timestamp = timestamp
+            self.capturedAt = capturedAt
+            self.orientation = orientation
+        }
+    }
+
+    weak var videoCaptureConsumer: OTVideoCaptureConsumer?
+    // Stamps outgoing frames for glass-to-glass measurements when set.
+    var tracer: LatencyTracer?
+    // Set before the capture starts.
+    var sceneDetector: StaticSceneDetector?
+
+    let source: CameraFrameSource
+    // Runs on the delivery queue, with half the frame interval as its budget
+    let filterGraph: VideoFilterGraph
+
+    private let queue = FrameHandoffQueue<Frame>()
+    private let deliveryQueue = DispatchQueue(label: "VideoChat.SharedCameraCapture.delivery", qos: .userInteractive)
+    private let delivery = ImageBufferDelivery()
+    private let isStarted = AtomicInt()
+    // width << 32 | height
+    private let targetSize = AtomicInt()
+    private let targetFrameRate = AtomicInt()
+    // Of the last frame delivered, width << 32 | height; 0 before the first
+    private let deliveredSize = AtomicInt()
+    // Capture queue
+    private var pacer: FramePacer
+    private var sequence: UInt32 = 0
+
+    init(source: CameraFrameSource, width: Int, height: Int, frameRate: Int) {
+        self.source = source
+        targetSize.store(Int64(width) << 32 | Int64(height))
+        targetFrameRate.store(Int64(max(frameRate, 1)))
+        filterGraph = VideoFilterGraph(budget: 0.5 / Double(max(frameRate, 1)))
+        pacer = FramePacer(targetFrameRate: max(frameRate, 1))
+        super.init()
+        filterGraph.onCopy = { [delivery] bytes in
+            delivery.recordCopy(bytes: bytes)
+        }
+    }
+
+    convenience init(position: AVCaptureDevice.Position, tier: CaptureGovernorPolicy.Tier) {
+        let size = SharedCameraCapture.size(for: tier.resolution)
+        self.init(source: CameraFrameSource.shared(position: position),
+                  width: size.width,
+                  height: size.height,
+                  frameRate: tier.frameRate.rawValue)
+    }
+
+    // Frame sizes the SDK's own capturer uses for each resolution.
+    static func size(for resolution: OTCameraCaptureResolution) -> (width: Int, height: Int) {
+        switch resolution.rawValue {
+        case 0:
+            return (352, 288)
+        case 1:
+            return (640, 480)
+        default:
+            return (1280, 720)
+        }
+    }
+
+    var targetWidth: Int {
+        return Int(targetSize.value >> 32)
+    }
+
+    var targetHeight: Int {
+        return Int(targetSize.value & 0xFFFF_FFFF)
+    }
+
+    var frameRate: Int {
+        return Int(targetFrameRate.value)
+    }
+
+    // Switches to another tier without a new publisher: the camera session,
+    // downscale and pacer follow from the next camera frame, and the SDK
+    // takes the size from each frame it is given.
+    func retarget(to tier: CaptureGovernorPolicy.Tier) {
+        let size = SharedCameraCapture.size(for: tier.resolution)
+        let frameRate = max(tier.frameRate.rawValue, 1)
+        source.captureQueue.async {
+            self.targetSize.store(Int64(size.width) << 32 | Int64(size.height))
+            self.targetFrameRate.store(Int64(frameRate))
+            self.pacer = FramePacer(targetFrameRate: frameRate)
+            self.filterGraph.budget = 0.5 / Double(frameRate)
+            self.source.updateSession()
+        }
+    }
+
+    func initCapture() {
+    }
+
+    func releaseCapture() {
+        _ = stopCapture()
+    }
+
+    func startCapture() -> Int32 {
+        if isStarted.exchange(1) == 0 {
+            source.add(self)
+        }
+        return 0
+    }
+
+    func stopCapture() -> Int32 {
+        if isStarted.exchange(0) == 1 {
+            source.remove(self)
+        }
+        return 0
+    }
+
+    func isCaptureStarted() -> Bool {
+        return isStarted.value == 1
+    }
+
+    var deliveryStatistics: ImageBufferDelivery.Statistics {
+        return delivery.statistics
+    }
+
+    func captureSettings(_ videoFormat: OTVideoFormat) -> Int32 {
+        videoFormat.pixelFormat = PixelFormat.nv12.otPixelFormat
+        // Frames keep the camera's aspect ratio, e.g. 352x198 for a CIF target on a 720p camera
+        let delivered = deliveredSize.value
+        let size = delivered > 0
+            ? (width: Int(delivered >> 32), height: Int(delivered & 0xFFFF_FFFF))
+            : CameraFrameSource.expectedSize(forTargetWidth: targetWidth, height: targetHeight)
+        videoFormat.imageWidth = UInt32(size.width)
+        videoFormat.imageHeight = UInt32(size.height)
+        videoFormat.estimatedFramesPerSecond = Double(frameRate)
+        videoFormat.estimatedCaptureDelay = 100
+        return 0
+    }
+
+    // Capture queue. Returns the timestamp to send the frame with, or nil
+    // when it is thinned out.
+    func pace(_ timestamp: CMTime) -> CMTime? {
+        return pacer.pace(timestamp)
+    }
+
+    // Capture queue. `copiedBytes` is what was written to make the buffer,
+    // 0 for the camera's own.
+    func deliver(_ pixelBuffer: CVPixelBuffer, timestamp: CMTime, capturedAt: UInt64, orientation: OTVideoOrientation,
+                 copiedBytes: Int = 0) {
+        if copiedBytes > 0 {
+            delivery.recordCopy(bytes: copiedBytes)
+        }
+        deliveredSize.store(Int64(CVPixelBufferGetWidth(pixelBuffer)) << 32 | Int64(CVPixelBufferGetHeight(pixelBuffer)))
+        queue.push(Frame(pixelBuffer: pixelBuffer, timestamp: timestamp, capturedAt: capturedAt, orientation: orientation))
+        deliveryQueue.async {
+            self.consumePending()
+        }
+    }
+
+    private func consumePending() {
+        guard let frame = queue.pop() else { return }
+        guard isCaptureStarted(), let consumer = videoCaptureConsumer else { return }
+        if let detector = sceneDetector,
+            !detector.shouldDeliver(frame.pixelBuffer, at: CMTimeGetSeconds(frame.timestamp)) {
+            return
+        }
+
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        sequence &+= 1
+        let metadata = tracer?.stamp(sequence: sequence, capturedAt: frame.capturedAt)
+        let pixelBuffer = filterGraph.process(frame.pixelBuffer)
+        delivery.deliver(pixelBuffer, orientation: frame.orientation, timestamp: frame.timestamp,
+                         metadata: metadata, to: consumer)
+        sceneDetector?.recordDelivery(nanoseconds: DispatchTime.now().uptimeNanoseconds - startedAt)
+    }
+}
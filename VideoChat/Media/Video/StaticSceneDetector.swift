@@ -0,0 +1,173 @@
+//
+//  StaticSceneDetector.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreVideo
+import Foundation
+
+// Decides which captured frames are worth sending when the camera looks at a
+// still scene. Every 16x16 luma block gets a signature of its four 8x8
+// quadrant sums, compared with the signatures of the last frame delivered, so
+// sensor noise averages out and slow drift still adds up to a change. Once
+// nothing changed for `settleFrames` frames, only one frame per
+// `keepAliveInterval` goes out; the first changed frame goes out at once.
+final class StaticSceneDetector {
+
+    struct Statistics {
+        let frames: Int64
+        let skippedFrames: Int64
+        let rawBytesSkipped: Int64
+        // Skipped frames times the measured cost of filtering and delivering one
+        let cpuNanosecondsSaved: Int64
+        let detectionNanoseconds: Int64
+    }
+
+    static let blockSize = 16
+
+    // Mean luma change of a quadrant that counts as a change, in levels
+    var changeThreshold = 3
+    // Share of the blocks that has to change, at least one block
+    var minChangedShare = 0.002
+    var settleFrames = 15
+    var keepAliveInterval: TimeInterval = 1
+
+    private var reference: [UInt16] = []
+    private var signatures: [UInt16] = []
+    private var referenceWidth = 0
+    private var referenceHeight = 0
+    private var staticFrames = 0
+    private var lastDeliveredAt: TimeInterval = -.greatestFiniteMagnitude
+    private var deliveryCost = 0.0
+    private let frames = AtomicInt()
+    private let skippedFrames = AtomicInt()
+    private let rawBytesSkipped = AtomicInt()
+    private let cpuNanosecondsSaved = AtomicInt()
+    private let detectionNanoseconds = AtomicInt()
+
+    var statistics: Statistics {
+        return Statistics(frames: frames.value,
+                          skippedFrames: skippedFrames.value,
+                          rawBytesSkipped: rawBytesSkipped.value,
+                          cpuNanosecondsSaved: cpuNanosecondsSaved.value,
+                          detectionNanoseconds: detectionNanoseconds.value)
+    }
+
+    // One caller at a time. `time` is the frame's presentation time in seconds.
+    func shouldDeliver(_ pixelBuffer: CVPixelBuffer, at time: TimeInterval) -> Bool {
+        CVPixelBufferLockBaseAddress(pixelBuffer, .readOnly)
+        defer { CVPixelBufferUnlockBaseAddress(pixelBuffer, .readOnly) }
+        guard let planes = VideoPlanes(pixelBuffer: pixelBuffer) else { return true }
+        return shouldDeliver(planes, at: time)
+    }
+
+    func shouldDeliver(_ planes: VideoPlanes, at time: TimeInterval) -> Bool {
+        frames.increment()
+        // ARGB has no luma plane to look at
+        guard planes.isSubsampled else { return true }
+
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        let isChanged = computeSignatures(planes)
+        detectionNanoseconds.increment(by: Int64(DispatchTime.now().uptimeNanoseconds - startedAt))
+
+        if isChanged {
+            staticFrames = 0
+        } else {
+            staticFrames += 1
+        }
+        guard isChanged || staticFrames <= settleFrames || time - lastDeliveredAt >= keepAliveInterval else {
+            skippedFrames.increment()
+            let bytes = (0..<planes.pixelFormat.planeCount).reduce(0) {
+                $0 + planes.planeWidth($1) * planes.planeHeight($1) * planes.pixelFormat.bytesPerPixel(plane: $1)
+            }
+            rawBytesSkipped.increment(by: Int64(bytes))
+            cpuNanosecondsSaved.increment(by: Int64(deliveryCost))
+            return false
+        }
+
+        swap(&reference, &signatures)
+        lastDeliveredAt = time
+        return true
+    }
+
+    // What a delivered frame cost downstream, to estimate what skipping saves.
+    func recordDelivery(nanoseconds: UInt64) {
+        deliveryCost = deliveryCost == 0 ? Double(nanoseconds) : deliveryCost * 0.95 + Double(nanoseconds) * 0.05
+    }
+
+    // Fills `signatures` and compares them with `reference`.
+    private func computeSignatures(_ planes: VideoPlanes) -> Bool {
+        let size = StaticSceneDetector.blockSize
+        let half = size / 2
+        let columns = (planes.width + size - 1) / size
+        let rows = (planes.height + size - 1) / size
+        let count = columns * rows * 4
+        if signatures.count != count {
+            signatures = [UInt16](repeating: 0, count: count)
+        }
+        let isNewSize = planes.width != referenceWidth || planes.height != referenceHeight
+        referenceWidth = planes.width
+        referenceHeight = planes.height
+
+        let luma = planes.first
+        signatures.withUnsafeMutableBufferPointer { signatures in
+            for row in 0..<rows {
+                for quadrantRow in 0..<2 {
+                    let top = row * size + quadrantRow * half
+                    let height = max(min(half, planes.height - top), 0)
+                    for column in 0..<columns {
+                        for quadrantColumn in 0..<2 {
+                            let left = column * size + quadrantColumn * half
+                            let width = max(min(half, planes.width - left), 0)
+                            var sum = 0
+                            for line in 0..<height {
+                                sum += StaticSceneDetector.sum(luma.row(top + line) + left, count: width)
+                            }
+                            // Mean scaled by 64, so partial blocks compare like full ones
+                            let pixels = max(width * height, 1)
+                            signatures[(row * columns + column) * 4 + quadrantRow * 2 + quadrantColumn]
+                                = UInt16(sum * 64 / pixels)
+                        }
+                    }
+                }
+            }
+        }
+        guard !isNewSize, reference.count == count else { return true }
+
+        let threshold = changeThreshold * 64
+        let required = max(Int(Double(columns * rows) * minChangedShare), 1)
+        var changed = 0
+        for block in 0..<columns * rows {
+            for quadrant in 0..<4 {
+                let index = block * 4 + quadrant
+                if abs(Int(signatures[index]) - Int(reference[index])) > threshold {
+                    changed += 1
+                    break
+                }
+            }
+            if changed >= required {
+                return true
+            }
+        }
+        return false
+    }
+
+    @inline(__always)
+    private static func sum(_ row: UnsafePointer<UInt8>, count: Int) -> Int {
+        var sum = 0
+        var x = 0
+        var lanes = SIMD8<UInt8>()
+        while x + 8 <= count {
+            memcpy(&lanes, row + x, 8)
+            sum += Int(SIMD8<UInt16>(truncatingIfNeeded: lanes).wrappedSum())
+            x += 8
+        }
+        while x < count {
+            sum += Int(row[x])
+            x += 1
+        }
+        return sum
+    }
+}
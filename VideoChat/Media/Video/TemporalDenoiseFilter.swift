@@ -0,0 +1,250 @@
+//
+//  TemporalDenoiseFilter.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// Motion-adaptive recursive denoiser for I420 and NV12 frames. Every plane is
+// blended with a running reference frame, block by block: the luma of each
+// 16x16 block is compared with the reference, and a block that only differs
+// by about the noise level takes a small share of the new frame, while a
+// block that moved takes the new frame as is. Single pixels far from the
+// reference are never blended, so edges moving inside a quiet block stay
+// sharp. The noise level is learned from the quietest quarter of the blocks.
+//
+// Kernels work on 8 pixels at a time in 16 bit lanes, one NEON register.
+final class TemporalDenoiseFilter: VideoFilter {
+
+    struct Statistics {
+        let frames: Int64
+        // Blocks blended at full strength
+        let staticBlockShare: Double
+        // Mean absolute luma difference of a static block
+        let noiseLevel: Double
+    }
+
+    static let blockSize = 16
+
+    let name = "denoise"
+    let isOptional = true
+    let isInPlace = true
+    // Share of the new frame a static block takes, in 1/256
+    let staticWeight: UInt16
+
+    private let pool: VideoFrameBufferPool
+    private var reference: VideoFrameBuffer?
+    private var blockWeights: [UInt16] = []
+    private var blockDifferences: [UInt8] = []
+    private var differenceHistogram = [Int](repeating: 0, count: 256)
+    private var noiseLevel = 2.0
+    private let frames = AtomicInt()
+    private let blocks = AtomicInt()
+    private let staticBlocks = AtomicInt()
+    // Hundredths
+    private let publishedNoiseLevel = AtomicInt()
+
+    init(strength: Double = 0.75, pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) {
+        staticWeight = UInt16((1 - min(max(strength, 0), 0.95)) * 256)
+        self.pool = pool
+    }
+
+    deinit {
+        reference?.release()
+    }
+
+    var statistics: Statistics {
+        return Statistics(frames: frames.value,
+                          staticBlockShare: Double(staticBlocks.value) / Double(max(blocks.value, 1)),
+                          noiseLevel: Double(publishedNoiseLevel.value) / 100)
+    }
+
+    func apply(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        guard source.isSubsampled else { return false }
+        let format = VideoFrameFormat(pixelFormat: source.pixelFormat, width: source.width, height: source.height)
+        guard let reference = reference, reference.format == format else {
+            // Nothing to compare with yet
+            self.reference?.release()
+            let buffer = pool.acquire(format: format)
+            source.copy(into: VideoPlanes(buffer: buffer))
+            source.copy(into: destination)
+            self.reference = buffer
+            return true
+        }
+
+        let referencePlanes = VideoPlanes(buffer: reference)
+        measureMotion(source, against: referencePlanes)
+        let pixelThreshold = UInt16(min(noiseLevel * 4 + 6, 255))
+        blend(source, with: referencePlanes, into: destination, pixelThreshold: pixelThreshold)
+        frames.increment()
+        return true
+    }
+
+    // Fills blockWeights from the luma difference of every block.
+    private func measureMotion(_ source: VideoPlanes, against reference: VideoPlanes) {
+        let size = TemporalDenoiseFilter.blockSize
+        let columns = (source.width + size - 1) / size
+        let rows = (source.height + size - 1) / size
+        if blockWeights.count != columns * rows {
+            blockWeights = [UInt16](repeating: 256, count: columns * rows)
+            blockDifferences = [UInt8](repeating: 0, count: columns * rows)
+        }
+        for index in 0..<differenceHistogram.count {
+            differenceHistogram[index] = 0
+        }
+
+        for row in 0..<rows {
+            let y = row * size
+            let height = min(size, source.height - y)
+            for column in 0..<columns {
+                let x = column * size
+                let width = min(size, source.width - x)
+                var sum = 0
+                for line in 0..<height {
+                    sum += TemporalDenoiseFilter.absoluteDifference(source.first.row(y + line) + x,
+                                                                    reference.first.row(y + line) + x,
+                                                                    count: width)
+                }
+                let difference = sum / (width * height)
+                blockDifferences[row * columns + column] = UInt8(min(difference, 255))
+                differenceHistogram[min(difference, 255)] += 1
+            }
+        }
+
+        // The quietest blocks are mostly noise
+        var seen = 0
+        var quartile = 0
+        for (difference, count) in differenceHistogram.enumerated() {
+            seen += count
+            if seen * 4 >= blockDifferences.count {
+                quartile = difference
+                break
+            }
+        }
+        noiseLevel = noiseLevel * 0.9 + Double(quartile) * 0.1
+        publishedNoiseLevel.store(Int64(noiseLevel * 100))
+
+        let low = noiseLevel * 1.5 + 1
+        let high = noiseLevel * 3 + 4
+        var quiet = 0
+        for index in 0..<blockDifferences.count {
+            let difference = Double(blockDifferences[index])
+            let weight: Double
+            if difference <= low {
+                weight = Double(staticWeight)
+                quiet += 1
+            } else if difference >= high {
+                weight = 256
+            } else {
+                weight = Double(staticWeight) + (256 - Double(staticWeight)) * (difference - low) / (high - low)
+            }
+            blockWeights[index] = UInt16(weight)
+        }
+        blocks.increment(by: Int64(blockDifferences.count))
+        staticBlocks.increment(by: Int64(quiet))
+    }
+
+    private func blend(_ source: VideoPlanes, with reference: VideoPlanes, into destination: VideoPlanes,
+                       pixelThreshold: UInt16) {
+        let size = TemporalDenoiseFilter.blockSize
+        let columns = (source.width + size - 1) / size
+        let rows = (source.height + size - 1) / size
+
+        for plane in 0..<source.pixelFormat.planeCount {
+            // Chroma blocks cover the same picture area as their luma block
+            let blockHeight = plane == 0 ? size : size / 2
+            let blockBytes = plane == 0 ? size : size / 2 * source.pixelFormat.bytesPerPixel(plane: plane)
+            let planeHeight = source.planeHeight(plane)
+            let rowBytes = source.planeWidth(plane) * source.pixelFormat.bytesPerPixel(plane: plane)
+            let input = source.plane(plane)
+            let past = reference.plane(plane)
+            let output = destination.plane(plane)
+
+            for row in 0..<rows {
+                let y = row * blockHeight
+                let height = min(blockHeight, planeHeight - y)
+                guard height > 0 else { break }
+                for column in 0..<columns {
+                    let x = column * blockBytes
+                    let width = min(blockBytes, rowBytes - x)
+                    guard width > 0 else { break }
+                    let weight = blockWeights[row * columns + column]
+                    for line in 0..<height {
+                        TemporalDenoiseFilter.blend(input.row(y + line) + x,
+                                                    past.row(y + line) + x,
+                                                    output.row(y + line) + x,
+                                                    count: width,
+                                                    weight: weight,
+                                                    threshold: pixelThreshold)
+                    }
+                }
+            }
+        }
+    }
+
+    @inline(__always)
+    private static func absoluteDifference(_ a: UnsafePointer<UInt8>, _ b: UnsafePointer<UInt8>, count: Int) -> Int {
+        var sum = 0
+        var x = 0
+        var lanesA = SIMD8<UInt8>()
+        var lanesB = SIMD8<UInt8>()
+        while x + 8 <= count {
+            memcpy(&lanesA, a + x, 8)
+            memcpy(&lanesB, b + x, 8)
+            let difference = pointwiseMax(lanesA, lanesB) &- pointwiseMin(lanesA, lanesB)
+            sum += Int(SIMD8<UInt16>(truncatingIfNeeded: difference).wrappedSum())
+            x += 8
+        }
+        while x < count {
+            sum += abs(Int(a[x]) - Int(b[x]))
+            x += 1
+        }
+        return sum
+    }
+
+    // output = current * weight + reference * (256 - weight), written to the
+    // reference too. `current` and `output` may be the same row.
+    @inline(__always)
+    private static func blend(_ current: UnsafePointer<UInt8>, _ reference: UnsafeMutablePointer<UInt8>,
+                              _ output: UnsafeMutablePointer<UInt8>, count: Int, weight: UInt16, threshold: UInt16) {
+        guard weight < 256 else {
+            memcpy(reference, current, count)
+            if UnsafePointer(output) != current {
+                memcpy(output, current, count)
+            }
+            return
+        }
+
+        let newWeight = SIMD8<UInt16>(repeating: weight)
+        let oldWeight = SIMD8<UInt16>(repeating: 256 - weight)
+        let limit = SIMD8<UInt16>(repeating: threshold)
+        let rounding = SIMD8<UInt16>(repeating: 128)
+        var lanesCurrent = SIMD8<UInt8>()
+        var lanesReference = SIMD8<UInt8>()
+        var x = 0
+        while x + 8 <= count {
+            memcpy(&lanesCurrent, current + x, 8)
+            memcpy(&lanesReference, reference + x, 8)
+            let now = SIMD8<UInt16>(truncatingIfNeeded: lanesCurrent)
+            let before = SIMD8<UInt16>(truncatingIfNeeded: lanesReference)
+            var blended = (now &* newWeight &+ before &* oldWeight &+ rounding) &>> 8
+            blended.replace(with: now, where: pointwiseMax(now, before) &- pointwiseMin(now, before) .> limit)
+            var result = SIMD8<UInt8>(truncatingIfNeeded: blended)
+            memcpy(output + x, &result, 8)
+            memcpy(reference + x, &result, 8)
+            x += 8
+        }
+        while x < count {
+            let now = UInt16(current[x])
+            let before = UInt16(reference[x])
+            let value = (now > before ? now - before : before - now) > threshold
+                ? now
+                : (now * weight + before * (256 - weight) + 128) >> 8
+            output[x] = UInt8(truncatingIfNeeded: value)
+            reference[x] = UInt8(truncatingIfNeeded: value)
+            x += 1
+        }
+    }
+}
@@ -0,0 +1,388 @@
+//
+//  VideoCompositor.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import CoreGraphics
+import Foundation
+import OpenTok
+
+// Composites up to `tileCount` incoming streams into one ARGB canvas laid out
+// as a grid. A tile is redrawn only when a frame for it arrives: the frame is
+// scaled in its own pixel format on the caller's render thread and only the
+// final conversion into the canvas happens under the canvas lock. The canvas
+// is double-buffered: tiles are drawn into the back canvas and images share the
+// memory of the front one, which is never drawn into. makeImage swaps the two
+// when something was drawn, and the new back catches up by copying only the
+// tiles drawn since the previous swap. Only a back canvas still held by an
+// image is replaced by a whole copy of the front.
+final class VideoCompositor {
+
+    private final class Tile {
+        var scaleBehavior: OTVideoViewScaleBehavior = .fit
+        var x = 0
+        var y = 0
+        var width = 0
+        var height = 0
+        var needsClear = true
+        var contentWidth = 0
+        var contentHeight = 0
+        var staging: VideoFrameBuffer?
+        var upright: VideoFrameBuffer?
+        let transformer = FrameTransformer()
+        var tempBuffer: UnsafeMutableRawPointer?
+        var tempBufferSize = 0
+
+        deinit {
+            staging?.release()
+            upright?.release()
+            free(tempBuffer)
+        }
+
+        func reserveTempBuffer(_ size: Int) -> UnsafeMutableRawPointer? {
+            if size > tempBufferSize {
+                free(tempBuffer)
+                tempBuffer = malloc(size)
+                tempBufferSize = size
+            }
+            return tempBuffer
+        }
+
+        func buffer(_ current: inout VideoFrameBuffer?, format: VideoFrameFormat, pool: VideoFrameBufferPool) -> VideoFrameBuffer {
+            if let buffer = current, buffer.format == format {
+                return buffer
+            }
+            current?.release()
+            let buffer = pool.acquire(format: format)
+            current = buffer
+            return buffer
+        }
+    }
+
+    let tileCount: Int
+    let columns: Int
+    let rows: Int
+
+    private let pool: VideoFrameBufferPool
+    private let converter: PixelFormatConverter
+    private var tiles: [Tile] = []
+    // Back canvas, drawn into
+    private var canvas: VideoFrameBuffer?
+    // Front canvas, shared with images
+    private var front: VideoFrameBuffer?
+    // Tiles drawn into the back since the last swap
+    private var drawnTiles: Int64 = 0
+    // Tiles the back is behind the front by
+    private var staleTiles: Int64 = 0
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+    private let dirtyTiles = AtomicInt()
+    private let opaqueBlack = UnsafeMutablePointer<UInt8>.allocate(capacity: 4)
+
+    init(tileCount: Int = Constants.maxCountCameras,
+         pool: VideoFrameBufferPool = VideoFrameBufferPool.shared,
+         converter: PixelFormatConverter = PixelFormatConverter.shared) {
+        self.tileCount = tileCount
+        self.pool = pool
+        self.converter = converter
+        columns = Int(Double(tileCount).squareRoot().rounded(.up))
+        rows = (tileCount + columns - 1) / columns
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+        opaqueBlack.initialize(to: 255)
+        (opaqueBlack + 1).initialize(repeating: 0, count: 3)
+        for _ in 0..<tileCount {
+            tiles.append(Tile())
+        }
+    }
+
+    deinit {
+        canvas?.release()
+        front?.release()
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+        opaqueBlack.deallocate()
+    }
+
+    var canvasSize: (width: Int, height: Int) {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        let current = canvas ?? front
+        return (current?.format.width ?? 0, current?.format.height ?? 0)
+    }
+
+    func tileRender(at index: Int) -> OTVideoRender {
+        return CompositorTileRender(compositor: self, tileIndex: index)
+    }
+
+    func resize(width: Int, height: Int) {
+        let width = width & ~1
+        let height = height & ~1
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        if let current = canvas ?? front, current.format.width == width, current.format.height == height {
+            return
+        }
+
+        canvas?.release()
+        canvas = nil
+        front?.release()
+        front = nil
+        drawnTiles = 0
+        staleTiles = 0
+        guard width > 0, height > 0 else { return }
+        let newCanvas = pool.acquire(format: VideoFrameFormat(pixelFormat: .argb, width: width, height: height))
+        var whole = VideoPlanes(buffer: newCanvas).first.vImageBuffer(width: width, height: height)
+        vImageBufferFill_ARGB8888(&whole, opaqueBlack, vImage_Flags(kvImageNoFlags))
+        canvas = newCanvas
+
+        let tileWidth = (width / columns) & ~1
+        let tileHeight = (height / rows) & ~1
+        for (index, tile) in tiles.enumerated() {
+            tile.x = (index % columns) * tileWidth
+            tile.y = (index / columns) * tileHeight
+            tile.width = tileWidth
+            tile.height = tileHeight
+            tile.needsClear = true
+        }
+        dirtyTiles.store(Int64(1 << tileCount) - 1)
+    }
+
+    func setScaleBehavior(_ scaleBehavior: OTVideoViewScaleBehavior, forTile index: Int) {
+        os_unfair_lock_lock(lock)
+        tiles[index].scaleBehavior = scaleBehavior
+        tiles[index].needsClear = true
+        os_unfair_lock_unlock(lock)
+    }
+
+    func clearTile(_ index: Int) {
+        lockWritableCanvas()
+        fill(tiles[index])
+        drawnTiles |= Int64(1 << index)
+        os_unfair_lock_unlock(lock)
+        dirtyTiles.setBits(Int64(1 << index))
+    }
+
+    // Bitmask of tiles updated since the previous call.
+    func takeDirtyTiles() -> Int64 {
+        return dirtyTiles.exchange(0)
+    }
+
+    func makeImage() -> CGImage? {
+        os_unfair_lock_lock(lock)
+        if let back = canvas, drawnTiles != 0 || front == nil {
+            // The old front is missing what was drawn since; without one the
+            // next draw copies the whole canvas
+            canvas = front
+            front = back
+            staleTiles = drawnTiles
+            drawnTiles = 0
+        }
+        guard let canvas = front else {
+            os_unfair_lock_unlock(lock)
+            return nil
+        }
+        canvas.retain()
+        os_unfair_lock_unlock(lock)
+
+        // The provider owns the retain and gives it back when the image goes
+        let info = Unmanaged.passRetained(canvas).toOpaque()
+        guard let provider = CGDataProvider(dataInfo: info,
+                                            data: canvas.plane(0),
+                                            size: canvas.format.planeSize(0),
+                                            releaseData: { info, _, _ in
+                                                guard let info = info else { return }
+                                                Unmanaged<VideoFrameBuffer>.fromOpaque(info).takeRetainedValue().release()
+                                            }) else {
+            Unmanaged<VideoFrameBuffer>.fromOpaque(info).release()
+            canvas.release()
+            return nil
+        }
+        let bitmapInfo = CGBitmapInfo(rawValue: CGImageAlphaInfo.noneSkipFirst.rawValue | CGBitmapInfo.byteOrder32Big.rawValue)
+        return CGImage(width: canvas.format.width,
+                       height: canvas.format.height,
+                       bitsPerComponent: 8,
+                       bitsPerPixel: 32,
+                       bytesPerRow: canvas.bytesPerRow(0),
+                       space: CGColorSpaceCreateDeviceRGB(),
+                       bitmapInfo: bitmapInfo,
+                       provider: provider,
+                       decode: nil,
+                       shouldInterpolate: false,
+                       intent: .defaultIntent)
+    }
+
+    func render(_ frame: OTVideoFrame, inTile index: Int) {
+        guard index < tileCount, var source = VideoPlanes(frame: frame) else { return }
+        let tile = tiles[index]
+
+        if frame.orientation != .up {
+            let size = FrameTransformer.outputSize(width: source.width, height: source.height, orientation: frame.orientation)
+            let pixelFormat: PixelFormat = source.pixelFormat == .argb ? .argb : .i420
+            let upright = tile.buffer(&tile.upright,
+                                      format: VideoFrameFormat(pixelFormat: pixelFormat, width: size.width, height: size.height),
+                                      pool: pool)
+            guard tile.transformer.transform(source, orientation: frame.orientation, into: VideoPlanes(buffer: upright)) else {
+                return
+            }
+            source = VideoPlanes(buffer: upright)
+        }
+
+        os_unfair_lock_lock(lock)
+        let tileWidth = tile.width
+        let tileHeight = tile.height
+        let scaleBehavior = tile.scaleBehavior
+        os_unfair_lock_unlock(lock)
+        guard tileWidth > 1, tileHeight > 1, source.width > 1, source.height > 1 else { return }
+
+        let geometry = layout(sourceWidth: source.width, sourceHeight: source.height,
+                              tileWidth: tileWidth, tileHeight: tileHeight,
+                              scaleBehavior: scaleBehavior)
+        let visible = source.cropped(x: geometry.cropX, y: geometry.cropY, width: geometry.cropWidth, height: geometry.cropHeight)
+
+        let staging = tile.buffer(&tile.staging,
+                                  format: VideoFrameFormat(pixelFormat: source.pixelFormat,
+                                                           width: geometry.contentWidth,
+                                                           height: geometry.contentHeight),
+                                  pool: pool)
+        let scaled = VideoPlanes(buffer: staging)
+        guard scale(visible, into: scaled, tile: tile) else { return }
+
+        lockWritableCanvas()
+        if let canvas = canvas, tile.width == tileWidth, tile.height == tileHeight {
+            if tile.needsClear || tile.contentWidth != geometry.contentWidth || tile.contentHeight != geometry.contentHeight {
+                fill(tile)
+                tile.needsClear = false
+                tile.contentWidth = geometry.contentWidth
+                tile.contentHeight = geometry.contentHeight
+            }
+            let target = VideoPlanes(buffer: canvas).cropped(x: tile.x + geometry.offsetX,
+                                                             y: tile.y + geometry.offsetY,
+                                                             width: geometry.contentWidth,
+                                                             height: geometry.contentHeight)
+            converter.convert(scaled, into: target)
+            drawnTiles |= Int64(1 << index)
+        }
+        os_unfair_lock_unlock(lock)
+        dirtyTiles.setBits(Int64(1 << index))
+    }
+
+    // MARK: - Private
+
+    private struct Geometry {
+        var cropX: Int
+        var cropY: Int
+        var cropWidth: Int
+        var cropHeight: Int
+        var contentWidth: Int
+        var contentHeight: Int
+        var offsetX: Int
+        var offsetY: Int
+    }
+
+    private func layout(sourceWidth: Int, sourceHeight: Int, tileWidth: Int, tileHeight: Int,
+                        scaleBehavior: OTVideoViewScaleBehavior) -> Geometry {
+        let scaleX = Double(tileWidth) / Double(sourceWidth)
+        let scaleY = Double(tileHeight) / Double(sourceHeight)
+
+        if scaleBehavior == .fill {
+            // Crop the source to the tile aspect ratio, keep it centered
+            let scale = max(scaleX, scaleY)
+            let cropWidth = min(sourceWidth, Int(Double(tileWidth) / scale)) & ~1
+            let cropHeight = min(sourceHeight, Int(Double(tileHeight) / scale)) & ~1
+            return Geometry(cropX: ((sourceWidth - cropWidth) / 2) & ~1,
+                            cropY: ((sourceHeight - cropHeight) / 2) & ~1,
+                            cropWidth: max(cropWidth, 2),
+                            cropHeight: max(cropHeight, 2),
+                            contentWidth: tileWidth,
+                            contentHeight: tileHeight,
+                            offsetX: 0,
+                            offsetY: 0)
+        }
+
+        // Letterbox the whole source inside the tile
+        let scale = min(scaleX, scaleY)
+        let contentWidth = max(Int(Double(sourceWidth) * scale) & ~1, 2)
+        let contentHeight = max(Int(Double(sourceHeight) * scale) & ~1, 2)
+        return Geometry(cropX: 0,
+                        cropY: 0,
+                        cropWidth: sourceWidth & ~1,
+                        cropHeight: sourceHeight & ~1,
+                        contentWidth: contentWidth,
+                        contentHeight: contentHeight,
+                        offsetX: (tileWidth - contentWidth) / 2,
+                        offsetY: (tileHeight - contentHeight) / 2)
+    }
+
+    // Takes the lock and brings the back canvas up to date with the front.
+    // The front is never drawn into, so it can be read under the lock while
+    // images read it too. A back an image still holds cannot be drawn into
+    // either and is traded for a fresh copy of the front.
+    private func lockWritableCanvas() {
+        os_unfair_lock_lock(lock)
+        guard let front = front else { return }
+        if let back = canvas, !back.isShared {
+            guard staleTiles != 0 else { return }
+            for (index, tile) in tiles.enumerated() where staleTiles & Int64(1 << index) != 0 {
+                VideoPlanes(buffer: front).cropped(x: tile.x, y: tile.y, width: tile.width, height: tile.height)
+                    .copy(into: VideoPlanes(buffer: back).cropped(x: tile.x, y: tile.y,
+                                                                  width: tile.width, height: tile.height))
+            }
+        } else {
+            canvas?.release()
+            let copy = pool.acquire(format: front.format)
+            VideoPlanes(buffer: front).copy(into: VideoPlanes(buffer: copy))
+            canvas = copy
+        }
+        staleTiles = 0
+    }
+
+    private func fill(_ tile: Tile) {
+        guard let canvas = canvas, tile.width > 0, tile.height > 0 else { return }
+        var area = VideoPlanes(buffer: canvas)
+            .cropped(x: tile.x, y: tile.y, width: tile.width, height: tile.height)
+            .first.vImageBuffer(width: tile.width, height: tile.height)
+        vImageBufferFill_ARGB8888(&area, opaqueBlack, vImage_Flags(kvImageNoFlags))
+    }
+
+    private func scale(_ source: VideoPlanes, into destination: VideoPlanes, tile: Tile) -> Bool {
+        for plane in 0..<source.pixelFormat.planeCount {
+            var src = source.plane(plane).vImageBuffer(width: source.planeWidth(plane), height: source.planeHeight(plane))
+            var dst = destination.plane(plane).vImageBuffer(width: destination.planeWidth(plane),
+                                                            height: destination.planeHeight(plane))
+            let query = vImage_Flags(kvImageGetTempBufferSize)
+            let flags = vImage_Flags(kvImageNoFlags)
+            let error: vImage_Error
+            switch source.pixelFormat.bytesPerPixel(plane: plane) {
+            case 1:
+                let temp = tile.reserveTempBuffer(vImageScale_Planar8(&src, &dst, nil, query))
+                error = vImageScale_Planar8(&src, &dst, temp, flags)
+            case 2:
+                let temp = tile.reserveTempBuffer(vImageScale_CbCr8(&src, &dst, nil, query))
+                error = vImageScale_CbCr8(&src, &dst, temp, flags)
+            default:
+                let temp = tile.reserveTempBuffer(vImageScale_ARGB8888(&src, &dst, nil, query))
+                error = vImageScale_ARGB8888(&src, &dst, temp, flags)
+            }
+            guard error == kvImageNoError else { return false }
+        }
+        return true
+    }
+}
+
+final class CompositorTileRender: NSObject, OTVideoRender {
+
+    let tileIndex: Int
+    private weak var compositor: VideoCompositor?
+
+    init(compositor: VideoCompositor, tileIndex: Int) {
+        self.compositor = compositor
+        self.tileIndex = tileIndex
+    }
+
+    func renderVideoFrame(_ frame: OTVideoFrame) {
+        compositor?.render(frame, inTile: tileIndex)
+    }
+}
@@ -0,0 +1,288 @@
+//
+//  VideoFilterGraph.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreVideo
+import Foundation
+
+// One processing step between capture and the capture consumer. The pixel
+// format never changes along the chain.
+protocol VideoFilter: AnyObject {
+    var name: String { get }
+    // Optional filters are skipped when a frame runs over the graph's budget
+    var isOptional: Bool { get }
+    // The filter may be given the same planes as source and destination
+    var isInPlace: Bool { get }
+
+    func outputSize(width: Int, height: Int) -> (width: Int, height: Int)
+    // Filters that only select part of the frame return the view instead of
+    // copying; the default returns nil and apply(_:into:) is used.
+    func view(of source: VideoPlanes) -> VideoPlanes?
+    // `destination` has outputSize. Returns false if the frame is unsuitable.
+    func apply(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool
+}
+
+extension VideoFilter {
+    var isOptional: Bool {
+        return false
+    }
+
+    var isInPlace: Bool {
+        return false
+    }
+
+    func outputSize(width: Int, height: Int) -> (width: Int, height: Int) {
+        return (width, height)
+    }
+
+    func view(of source: VideoPlanes) -> VideoPlanes? {
+        return nil
+    }
+}
+
+// Runs a chain of VideoFilters over captured frames before they reach the
+// capture consumer. Intermediate frames come from the buffer pool and
+// in-place filters reuse the frame they are given, so a chain costs at most
+// one pooled buffer per filter that changes the size. With no filters a frame
+// passes through untouched.
+//
+// Each filter is timed. A frame taking longer than `budget` skips the optional
+// filters still ahead of it, and sheds the most expensive optional filter for
+// the following frames; shed filters come back one at a time after
+// `recoveryFrames` frames well under budget.
+final class VideoFilterGraph {
+
+    struct FilterStatistics {
+        let name: String
+        let isShed: Bool
+        // Times the filter was shed for running over budget
+        let sheds: Int64
+        let skippedFrames: Int64
+        let failedFrames: Int64
+        let latency: LatencyHistogram.Summary
+    }
+
+    struct Statistics {
+        let frames: Int64
+        let bypassedFrames: Int64
+        let latency: LatencyHistogram.Summary
+        let filters: [FilterStatistics]
+    }
+
+    private final class Stage {
+        let filter: VideoFilter
+        let histogram = LatencyHistogram()
+        let skippedFrames = AtomicInt()
+        let failedFrames = AtomicInt()
+        let isShed = AtomicInt()
+        let sheds = AtomicInt()
+
+        init(filter: VideoFilter) {
+            self.filter = filter
+        }
+    }
+
+    static let recoveryFrames = 90
+
+    // Seconds per frame for the whole chain; 0 disables shedding. Any thread,
+    // takes effect from the next frame.
+    var budget: TimeInterval {
+        get {
+            return Double(budgetNanoseconds.value) / 1_000_000_000
+        }
+        set {
+            budgetNanoseconds.store(Int64(max(newValue, 0) * 1_000_000_000))
+        }
+    }
+    // Called with the bytes whenever a view has to be copied out. Set before
+    // the first frame.
+    var onCopy: ((Int) -> Void)?
+    private let budgetNanoseconds = AtomicInt()
+    private let pool: VideoFrameBufferPool
+    private var stages: [Stage] = []
+    private let histogram = LatencyHistogram()
+    private let bypassedFrames = AtomicInt()
+    private var framesUnderBudget = 0
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+
+    init(budget: TimeInterval = 0, pool: VideoFrameBufferPool = VideoFrameBufferPool.shared) {
+        self.pool = pool
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+        self.budget = budget
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    // Any thread; takes effect from the next frame and resets the timings.
+    var filters: [VideoFilter] {
+        get {
+            return currentStages().map { $0.filter }
+        }
+        set {
+            let stages = newValue.map { Stage(filter: $0) }
+            os_unfair_lock_lock(lock)
+            self.stages = stages
+            os_unfair_lock_unlock(lock)
+        }
+    }
+
+    var statistics: Statistics {
+        let stages = currentStages()
+        return Statistics(frames: histogram.count,
+                          bypassedFrames: bypassedFrames.value,
+                          latency: histogram.summary,
+                          filters: stages.map { stage in
+                              FilterStatistics(name: stage.filter.name,
+                                               isShed: stage.isShed.value == 1,
+                                               sheds: stage.sheds.value,
+                                               skippedFrames: stage.skippedFrames.value,
+                                               failedFrames: stage.failedFrames.value,
+                                               latency: stage.histogram.summary)
+                          })
+    }
+
+    // One caller at a time. Returns `pixelBuffer` itself when no filter ran.
+    func process(_ pixelBuffer: CVPixelBuffer) -> CVPixelBuffer {
+        let stages = currentStages()
+        guard !stages.isEmpty else {
+            bypassedFrames.increment()
+            return pixelBuffer
+        }
+
+        CVPixelBufferLockBaseAddress(pixelBuffer, .readOnly)
+        defer { CVPixelBufferUnlockBaseAddress(pixelBuffer, .readOnly) }
+        guard let source = VideoPlanes(pixelBuffer: pixelBuffer),
+            let output = process(source, stages: stages) else {
+            return pixelBuffer
+        }
+        let filtered = output.makePixelBuffer()
+        output.release()
+        return filtered ?? pixelBuffer
+    }
+
+    // One caller at a time. Returns a retained buffer, or nil when no filter
+    // ran. `source` is only read.
+    func process(_ source: VideoPlanes) -> VideoFrameBuffer? {
+        let stages = currentStages()
+        guard !stages.isEmpty else {
+            bypassedFrames.increment()
+            return nil
+        }
+        return process(source, stages: stages)
+    }
+
+    private func process(_ source: VideoPlanes, stages: [Stage]) -> VideoFrameBuffer? {
+        let startedAt = DispatchTime.now().uptimeNanoseconds
+        var current = source
+        // The pooled frame `current` lies in, if any
+        var owned: VideoFrameBuffer?
+        var ran = false
+
+        for stage in stages {
+            let filter = stage.filter
+            if filter.isOptional && (stage.isShed.value == 1 || isOverBudget(since: startedAt)) {
+                stage.skippedFrames.increment()
+                continue
+            }
+
+            let stageStartedAt = DispatchTime.now().uptimeNanoseconds
+            if let view = filter.view(of: current) {
+                current = view
+            } else {
+                let size = filter.outputSize(width: current.width, height: current.height)
+                guard size.width > 0, size.height > 0 else {
+                    stage.failedFrames.increment()
+                    continue
+                }
+
+                if filter.isInPlace && owned != nil && size.width == current.width && size.height == current.height {
+                    guard filter.apply(current, into: current) else {
+                        stage.failedFrames.increment()
+                        continue
+                    }
+                } else {
+                    let buffer = pool.acquire(format: VideoFrameFormat(pixelFormat: current.pixelFormat,
+                                                                       width: size.width,
+                                                                       height: size.height))
+                    let destination = VideoPlanes(buffer: buffer)
+                    guard filter.apply(current, into: destination) else {
+                        buffer.release()
+                        stage.failedFrames.increment()
+                        continue
+                    }
+                    owned?.release()
+                    owned = buffer
+                    current = destination
+                }
+            }
+            ran = true
+            stage.histogram.record(Int64(DispatchTime.now().uptimeNanoseconds - stageStartedAt))
+        }
+
+        // A view has to be copied out into a frame of its own
+        if ran && (owned == nil || !isWhole(current, of: owned!)) {
+            let buffer = pool.acquire(format: VideoFrameFormat(pixelFormat: current.pixelFormat,
+                                                               width: current.width,
+                                                               height: current.height))
+            current.copy(into: VideoPlanes(buffer: buffer))
+            onCopy?(buffer.format.byteCount)
+            owned?.release()
+            owned = buffer
+        }
+
+        let elapsed = DispatchTime.now().uptimeNanoseconds - startedAt
+        histogram.record(Int64(elapsed))
+        adjustShedding(elapsed: elapsed, stages: stages)
+        return owned
+    }
+
+    private func isOverBudget(since startedAt: UInt64) -> Bool {
+        let budget = UInt64(budgetNanoseconds.value)
+        return budget > 0 && DispatchTime.now().uptimeNanoseconds - startedAt > budget
+    }
+
+    private func isWhole(_ planes: VideoPlanes, of buffer: VideoFrameBuffer) -> Bool {
+        return planes.first.data == buffer.plane(0)
+            && planes.width == buffer.format.width
+            && planes.height == buffer.format.height
+    }
+
+    private func adjustShedding(elapsed: UInt64, stages: [Stage]) {
+        let budget = UInt64(budgetNanoseconds.value)
+        guard budget > 0 else { return }
+        let optional = stages.filter { $0.filter.isOptional }
+        guard !optional.isEmpty else { return }
+
+        if elapsed > budget {
+            framesUnderBudget = 0
+            let costliest = optional.filter { $0.isShed.value == 0 }
+                .map { (stage: $0, mean: $0.histogram.mean) }
+                .max { $0.mean < $1.mean }
+            if let stage = costliest?.stage {
+                stage.isShed.store(1)
+                stage.sheds.increment()
+            }
+        } else if elapsed < budget / 2 {
+            framesUnderBudget += 1
+            guard framesUnderBudget >= VideoFilterGraph.recoveryFrames else { return }
+            framesUnderBudget = 0
+            let cheapest = optional.filter { $0.isShed.value == 1 }
+                .map { (stage: $0, mean: $0.histogram.mean) }
+                .min { $0.mean < $1.mean }
+            cheapest?.stage.isShed.store(0)
+        }
+    }
+
+    private func currentStages() -> [Stage] {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return stages
+    }
+}
@@ -0,0 +1,280 @@
+//
+//  VideoFilters.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import CoreGraphics
+import Foundation
+
+// Keeps a rectangle given as fractions of the frame, so it follows capture
+// size changes. Only moves the plane pointers.
+final class CropFilter: VideoFilter {
+
+    let name = "crop"
+    let rect: CGRect
+
+    init(rect: CGRect) {
+        self.rect = rect.intersection(CGRect(x: 0, y: 0, width: 1, height: 1))
+    }
+
+    func view(of source: VideoPlanes) -> VideoPlanes? {
+        let mask = source.isSubsampled ? ~1 : ~0
+        let x = Int(rect.minX * CGFloat(source.width)) & mask
+        let y = Int(rect.minY * CGFloat(source.height)) & mask
+        let width = min(Int(rect.width * CGFloat(source.width)) & mask, source.width - x)
+        let height = min(Int(rect.height * CGFloat(source.height)) & mask, source.height - y)
+        guard width > 0, height > 0 else { return nil }
+        return source.cropped(x: x, y: y, width: width, height: height)
+    }
+
+    func apply(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        return false
+    }
+}
+
+// Resamples to a fixed size with vImage's high quality (Lanczos) scaler.
+final class ScaleFilter: VideoFilter {
+
+    let name = "scale"
+    let width: Int
+    let height: Int
+    private var tempBuffer: UnsafeMutableRawPointer?
+    private var tempBufferSize = 0
+
+    init(width: Int, height: Int) {
+        self.width = width & ~1
+        self.height = height & ~1
+    }
+
+    deinit {
+        free(tempBuffer)
+    }
+
+    func outputSize(width: Int, height: Int) -> (width: Int, height: Int) {
+        return (self.width, self.height)
+    }
+
+    func apply(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        if source.width == destination.width && source.height == destination.height {
+            source.copy(into: destination)
+            return true
+        }
+        for plane in 0..<source.pixelFormat.planeCount {
+            var src = source.plane(plane).vImageBuffer(width: source.planeWidth(plane), height: source.planeHeight(plane))
+            var dst = destination.plane(plane).vImageBuffer(width: destination.planeWidth(plane),
+                                                            height: destination.planeHeight(plane))
+            let flags = vImage_Flags(kvImageHighQualityResampling)
+            let query = flags | vImage_Flags(kvImageGetTempBufferSize)
+            let error: vImage_Error
+            switch source.pixelFormat.bytesPerPixel(plane: plane) {
+            case 1:
+                let temp = reserveTempBuffer(vImageScale_Planar8(&src, &dst, nil, query))
+                error = vImageScale_Planar8(&src, &dst, temp, flags)
+            case 2:
+                let temp = reserveTempBuffer(vImageScale_CbCr8(&src, &dst, nil, query))
+                error = vImageScale_CbCr8(&src, &dst, temp, flags)
+            default:
+                let temp = reserveTempBuffer(vImageScale_ARGB8888(&src, &dst, nil, query))
+                error = vImageScale_ARGB8888(&src, &dst, temp, flags)
+            }
+            guard error == kvImageNoError else { return false }
+        }
+        return true
+    }
+
+    private func reserveTempBuffer(_ size: Int) -> UnsafeMutableRawPointer? {
+        if size > tempBufferSize {
+            free(tempBuffer)
+            tempBuffer = malloc(size)
+            tempBufferSize = size
+        }
+        return tempBuffer
+    }
+}
+
+// Left-right flip, e.g. to send a front camera the way the preview shows it.
+final class MirrorFilter: VideoFilter {
+
+    let name = "mirror"
+
+    func apply(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        let flags = vImage_Flags(kvImageNoFlags)
+        for plane in 0..<source.pixelFormat.planeCount {
+            var src = source.plane(plane).vImageBuffer(width: source.planeWidth(plane), height: source.planeHeight(plane))
+            var dst = destination.plane(plane).vImageBuffer(width: destination.planeWidth(plane),
+                                                            height: destination.planeHeight(plane))
+            let error: vImage_Error
+            switch source.pixelFormat.bytesPerPixel(plane: plane) {
+            case 1:
+                error = vImageHorizontalReflect_Planar8(&src, &dst, flags)
+            case 2:
+                // Interleaved CbCr pairs move together as one 16 bit pixel
+                error = vImageHorizontalReflect_Planar16U(&src, &dst, flags)
+            default:
+                error = vImageHorizontalReflect_ARGB8888(&src, &dst, flags)
+            }
+            guard error == kvImageNoError else { return false }
+        }
+        return true
+    }
+}
+
+// Blends an image with alpha over 4:2:0 frames at a fixed position, e.g. a
+// logo or a name badge. The image is converted to video range YCbCr once.
+final class OverlayFilter: VideoFilter {
+
+    let name = "overlay"
+    let isOptional = true
+    let isInPlace = true
+    let x: Int
+    let y: Int
+    let width: Int
+    let height: Int
+    // Luma and alpha per pixel, Cb, Cr and alpha per 2x2 block; alpha in 0...256.
+    // CbCr is also kept interleaved, with its alpha doubled up, for NV12.
+    private let luma: [UInt8]
+    private let lumaAlpha: [UInt16]
+    private let cb: [UInt8]
+    private let cr: [UInt8]
+    private let chromaAlpha: [UInt16]
+    private let cbcr: [UInt8]
+    private let cbcrAlpha: [UInt16]
+
+    init?(image: CGImage, x: Int, y: Int) {
+        let width = image.width & ~1
+        let height = image.height & ~1
+        guard width > 0, height > 0,
+            let context = CGContext(data: nil, width: width, height: height, bitsPerComponent: 8,
+                                    bytesPerRow: width * 4, space: CGColorSpaceCreateDeviceRGB(),
+                                    bitmapInfo: CGImageAlphaInfo.premultipliedLast.rawValue),
+            let pixels = context.data?.assumingMemoryBound(to: UInt8.self) else {
+            return nil
+        }
+        context.draw(image, in: CGRect(x: 0, y: 0, width: width, height: height))
+
+        var luma = [UInt8](repeating: 0, count: width * height)
+        var lumaAlpha = [UInt16](repeating: 0, count: width * height)
+        var cb = [UInt8](repeating: 0, count: width * height / 4)
+        var cr = [UInt8](repeating: 0, count: width * height / 4)
+        var chromaAlpha = [UInt16](repeating: 0, count: width * height / 4)
+        for row in stride(from: 0, to: height, by: 2) {
+            for column in stride(from: 0, to: width, by: 2) {
+                var red = 0, green = 0, blue = 0, alpha = 0
+                for (dx, dy) in [(0, 0), (1, 0), (0, 1), (1, 1)] {
+                    let index = (row + dy) * width + column + dx
+                    let pixel = pixels + index * 4
+                    let a = Int(pixel[3])
+                    // Premultiplied, so these are already weighted by alpha
+                    let r = Int(pixel[0]), g = Int(pixel[1]), b = Int(pixel[2])
+                    let value = a > 0 ? 16 + ((66 * r + 129 * g + 25 * b) * 255 / a + 128) / 256 : 16
+                    luma[index] = UInt8(min(value, 235))
+                    lumaAlpha[index] = UInt16(a + a >> 7)
+                    red += r
+                    green += g
+                    blue += b
+                    alpha += a
+                }
+                let index = row / 2 * width / 2 + column / 2
+                if alpha > 0 {
+                    cb[index] = UInt8(min(max(128 + (-38 * red - 74 * green + 112 * blue) * 255 / alpha / 256, 16), 240))
+                    cr[index] = UInt8(min(max(128 + (112 * red - 94 * green - 18 * blue) * 255 / alpha / 256, 16), 240))
+                }
+                let average = alpha / 4
+                chromaAlpha[index] = UInt16(average + average >> 7)
+            }
+        }
+
+        self.x = max(x, 0) & ~1
+        self.y = max(y, 0) & ~1
+        self.width = width
+        self.height = height
+        self.luma = luma
+        self.lumaAlpha = lumaAlpha
+        self.cb = cb
+        self.cr = cr
+        self.chromaAlpha = chromaAlpha
+        cbcr = (0..<cb.count * 2).map { $0 & 1 == 0 ? cb[$0 / 2] : cr[$0 / 2] }
+        cbcrAlpha = (0..<chromaAlpha.count * 2).map { chromaAlpha[$0 / 2] }
+    }
+
+    func apply(_ source: VideoPlanes, into destination: VideoPlanes) -> Bool {
+        guard source.isSubsampled else { return false }
+        source.copy(into: destination)
+        let visibleWidth = min(width, destination.width - x)
+        let visibleHeight = min(height, destination.height - y)
+        guard visibleWidth > 0, visibleHeight > 0 else { return true }
+
+        luma.withUnsafeBufferPointer { luma in
+            lumaAlpha.withUnsafeBufferPointer { alpha in
+                for row in 0..<visibleHeight {
+                    let offset = row * width
+                    OverlayFilter.blend(destination.first.row(y + row) + x, luma.baseAddress! + offset,
+                                        alpha.baseAddress! + offset, count: visibleWidth)
+                }
+            }
+        }
+
+        let chromaWidth = visibleWidth / 2
+        if destination.pixelFormat == .nv12 {
+            cbcr.withUnsafeBufferPointer { cbcr in
+                cbcrAlpha.withUnsafeBufferPointer { alpha in
+                    for row in 0..<visibleHeight / 2 {
+                        let offset = row * width
+                        OverlayFilter.blend(destination.plane(1).row(y / 2 + row) + x, cbcr.baseAddress! + offset,
+                                            alpha.baseAddress! + offset, count: chromaWidth * 2)
+                    }
+                }
+            }
+            return true
+        }
+        cb.withUnsafeBufferPointer { cb in
+            cr.withUnsafeBufferPointer { cr in
+                chromaAlpha.withUnsafeBufferPointer { alpha in
+                    for row in 0..<visibleHeight / 2 {
+                        let offset = row * width / 2
+                        let chromaRow = y / 2 + row
+                        OverlayFilter.blend(destination.plane(1).row(chromaRow) + x / 2, cb.baseAddress! + offset,
+                                            alpha.baseAddress! + offset, count: chromaWidth)
+                        OverlayFilter.blend(destination.plane(2).row(chromaRow) + x / 2, cr.baseAddress! + offset,
+                                            alpha.baseAddress! + offset, count: chromaWidth)
+                    }
+                }
+            }
+        }
+        return true
+    }
+
+    // base = base * (256 - alpha) + over * alpha, eight pixels at a time
+    @inline(__always)
+    private static func blend(_ base: UnsafeMutablePointer<UInt8>, _ over: UnsafePointer<UInt8>,
+                              _ alpha: UnsafePointer<UInt16>, count: Int) {
+        let full = SIMD8<UInt16>(repeating: 256)
+        let rounding = SIMD8<UInt16>(repeating: 128)
+        var lanesBase = SIMD8<UInt8>()
+        var lanesOver = SIMD8<UInt8>()
+        var lanesAlpha = SIMD8<UInt16>()
+        var x = 0
+        while x + 8 <= count {
+            memcpy(&lanesBase, base + x, 8)
+            memcpy(&lanesOver, over + x, 8)
+            memcpy(&lanesAlpha, alpha + x, 16)
+            let blended = (SIMD8<UInt16>(truncatingIfNeeded: lanesBase) &* (full &- lanesAlpha)
+                &+ SIMD8<UInt16>(truncatingIfNeeded: lanesOver) &* lanesAlpha &+ rounding) &>> 8
+            var result = SIMD8<UInt8>(truncatingIfNeeded: blended)
+            memcpy(base + x, &result, 8)
+            x += 8
+        }
+        while x < count {
+            base[x] = blend(base[x], over[x], alpha[x])
+            x += 1
+        }
+    }
+
+    @inline(__always)
+    private static func blend(_ base: UInt8, _ over: UInt8, _ alpha: UInt16) -> UInt8 {
+        return UInt8(truncatingIfNeeded: (UInt16(base) * (256 - alpha) + UInt16(over) * alpha + 128) >> 8)
+    }
+}
@@ -0,0 +1,154 @@
+//
+//  VideoFrameBufferPool.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// Plane memory for one frame. Buffers are handed out by VideoFrameBufferPool
+// with a reference count of 1 and go back to the pool on the last release().
+final class VideoFrameBuffer {
+
+    let format: VideoFrameFormat
+    private(set) var planes: [UnsafeMutablePointer<UInt8>] = []
+    fileprivate weak var pool: VideoFrameBufferPool?
+    fileprivate let referenceCount = AtomicInt(0)
+    private let storage: UnsafeMutableRawPointer
+
+    init(format: VideoFrameFormat) {
+        self.format = format
+
+        var offsets: [Int] = []
+        var size = 0
+        for plane in 0..<format.planeCount {
+            offsets.append(size)
+            size += VideoFrameFormat.align(format.planeSize(plane))
+        }
+
+        var memory: UnsafeMutableRawPointer?
+        guard posix_memalign(&memory, VideoFrameFormat.alignment, max(size, VideoFrameFormat.alignment)) == 0,
+            let allocated = memory else {
+            fatalError("Unable to allocate \(size) bytes for video frame")
+        }
+        storage = allocated
+        planes = offsets.map { allocated.advanced(by: $0).assumingMemoryBound(to: UInt8.self) }
+    }
+
+    deinit {
+        free(storage)
+    }
+
+    var isShared: Bool {
+        return referenceCount.value > 1
+    }
+
+    func plane(_ index: Int) -> UnsafeMutablePointer<UInt8> {
+        return planes[index]
+    }
+
+    func bytesPerRow(_ index: Int) -> Int {
+        return format.bytesPerRow[index]
+    }
+
+    func retain() {
+        referenceCount.increment()
+    }
+
+    func release() {
+        let remaining = referenceCount.decrement()
+        assert(remaining >= 0, "VideoFrameBuffer over-released")
+        if remaining == 0 {
+            pool?.recycle(self)
+        }
+    }
+
+    // The frame only keeps the plane pointers, the buffer must stay retained
+    // until the consumer returns.
+    func attach(to frame: OTVideoFrame) {
+        frame.setPlanesWithPointers(&planes, numPlanes: Int32(planes.count))
+    }
+}
+
+final class VideoFrameBufferPool {
+
+    struct Statistics {
+        let allocations: Int64
+        let reuses: Int64
+        let outstanding: Int64
+    }
+
+    static let shared = VideoFrameBufferPool()
+
+    let maxFreeBuffersPerFormat: Int
+
+    private var freeBuffers: [VideoFrameFormat: [VideoFrameBuffer]] = [:]
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+    private let allocations = AtomicInt()
+    private let reuses = AtomicInt()
+    private let outstanding = AtomicInt()
+
+    init(maxFreeBuffersPerFormat: Int = Constants.maxCountCameras * 2) {
+        self.maxFreeBuffersPerFormat = maxFreeBuffersPerFormat
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    var statistics: Statistics {
+        return Statistics(allocations: allocations.value, reuses: reuses.value, outstanding: outstanding.value)
+    }
+
+    func acquire(format: VideoFrameFormat) -> VideoFrameBuffer {
+        os_unfair_lock_lock(lock)
+        let reused = freeBuffers[format]?.popLast()
+        os_unfair_lock_unlock(lock)
+
+        let buffer: VideoFrameBuffer
+        if let reused = reused {
+            reuses.increment()
+            buffer = reused
+        } else {
+            allocations.increment()
+            buffer = VideoFrameBuffer(format: format)
+            buffer.pool = self
+        }
+        outstanding.increment()
+        buffer.referenceCount.store(1)
+        return buffer
+    }
+
+    func prewarm(format: VideoFrameFormat, count: Int) {
+        var buffers: [VideoFrameBuffer] = []
+        for _ in 0..<count {
+            buffers.append(acquire(format: format))
+        }
+        buffers.forEach { $0.release() }
+    }
+
+    func purge() {
+        os_unfair_lock_lock(lock)
+        freeBuffers.removeAll()
+        os_unfair_lock_unlock(lock)
+    }
+
+    fileprivate func recycle(_ buffer: VideoFrameBuffer) {
+        outstanding.decrement()
+        os_unfair_lock_lock(lock)
+        if freeBuffers[buffer.format] == nil {
+            var list: [VideoFrameBuffer] = []
+            list.reserveCapacity(maxFreeBuffersPerFormat)
+            freeBuffers[buffer.format] = list
+        }
+        if freeBuffers[buffer.format]!.count < maxFreeBuffersPerFormat {
+            freeBuffers[buffer.format]!.append(buffer)
+        }
+        os_unfair_lock_unlock(lock)
+    }
+}
@@ -0,0 +1,125 @@
+//
+//  VideoFrameFormat.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+enum PixelFormat: Int32 {
+    // Four character codes of OTPixelFormat
+    case i420 = 0x49343230
+    case argb = 0x41524742
+    case nv12 = 0x4E563132
+
+    init?(_ format: OTPixelFormat) {
+        self.init(rawValue: format.rawValue)
+    }
+
+    var otPixelFormat: OTPixelFormat {
+        return OTPixelFormat(rawValue: rawValue)!
+    }
+
+    var planeCount: Int {
+        switch self {
+        case .i420:
+            return 3
+        case .nv12:
+            return 2
+        case .argb:
+            return 1
+        }
+    }
+
+    func bytesPerPixel(plane: Int) -> Int {
+        switch self {
+        case .i420:
+            return 1
+        case .nv12:
+            return plane == 0 ? 1 : 2
+        case .argb:
+            return 4
+        }
+    }
+}
+
+struct VideoFrameFormat: Hashable {
+
+    static let alignment = 64
+
+    let pixelFormat: PixelFormat
+    let width: Int
+    let height: Int
+    let bytesPerRow: [Int]
+
+    init(pixelFormat: PixelFormat, width: Int, height: Int, bytesPerRow: [Int]) {
+        self.pixelFormat = pixelFormat
+        self.width = width
+        self.height = height
+        self.bytesPerRow = bytesPerRow
+    }
+
+    init(pixelFormat: PixelFormat, width: Int, height: Int) {
+        var bytesPerRow: [Int] = []
+        for plane in 0..<pixelFormat.planeCount {
+            let planeWidth = plane == 0 ? width : (width + 1) / 2
+            bytesPerRow.append(VideoFrameFormat.align(planeWidth * pixelFormat.bytesPerPixel(plane: plane)))
+        }
+        self.init(pixelFormat: pixelFormat, width: width, height: height, bytesPerRow: bytesPerRow)
+    }
+
+    init?(format: OTVideoFormat) {
+        guard let pixelFormat = PixelFormat(format.pixelFormat) else { return nil }
+        var bytesPerRow: [Int] = []
+        for case let number as NSNumber in format.bytesPerRow {
+            bytesPerRow.append(number.intValue)
+        }
+        if bytesPerRow.count == pixelFormat.planeCount {
+            self.init(pixelFormat: pixelFormat,
+                      width: Int(format.imageWidth),
+                      height: Int(format.imageHeight),
+                      bytesPerRow: bytesPerRow)
+        } else {
+            self.init(pixelFormat: pixelFormat, width: Int(format.imageWidth), height: Int(format.imageHeight))
+        }
+    }
+
+    static func align(_ value: Int) -> Int {
+        return (value + alignment - 1) / alignment * alignment
+    }
+
+    var planeCount: Int {
+        return pixelFormat.planeCount
+    }
+
+    var pixelCount: Int {
+        return width * height
+    }
+
+    func planeWidth(_ plane: Int) -> Int {
+        return plane == 0 ? width : (width + 1) / 2
+    }
+
+    func planeHeight(_ plane: Int) -> Int {
+        return plane == 0 ? height : (height + 1) / 2
+    }
+
+    func planeSize(_ plane: Int) -> Int {
+        return bytesPerRow[plane] * planeHeight(plane)
+    }
+
+    var byteCount: Int {
+        return (0..<planeCount).reduce(0) { $0 + planeSize($1) }
+    }
+
+    func makeVideoFormat() -> OTVideoFormat {
+        let format = OTVideoFormat()
+        format.pixelFormat = pixelFormat.otPixelFormat
+        format.imageWidth = UInt32(width)
+        format.imageHeight = UInt32(height)
+        format.bytesPerRow = NSMutableArray(array: bytesPerRow.map { NSNumber(value: $0) })
+        return format
+    }
+}
@@ -0,0 +1,131 @@
+//
+//  VideoPlanes.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Accelerate
+import Foundation
+import OpenTok
+
+struct ImagePlane {
+
+    var data: UnsafeMutablePointer<UInt8>
+    var bytesPerRow: Int
+
+    func offsetBy(x: Int, y: Int, bytesPerPixel: Int) -> ImagePlane {
+        return ImagePlane(data: data + y * bytesPerRow + x * bytesPerPixel, bytesPerRow: bytesPerRow)
+    }
+
+    func row(_ index: Int) -> UnsafeMutablePointer<UInt8> {
+        return data + index * bytesPerRow
+    }
+
+    func vImageBuffer(width: Int, height: Int) -> vImage_Buffer {
+        return vImage_Buffer(data: UnsafeMutableRawPointer(data),
+                             height: vImagePixelCount(height),
+                             width: vImagePixelCount(width),
+                             rowBytes: bytesPerRow)
+    }
+}
+
+// Non-owning view over the planes of a frame, or a rectangle inside it.
+struct VideoPlanes {
+
+    let pixelFormat: PixelFormat
+    let width: Int
+    let height: Int
+    let first: ImagePlane
+    let second: ImagePlane?
+    let third: ImagePlane?
+
+    init(pixelFormat: PixelFormat, width: Int, height: Int, first: ImagePlane, second: ImagePlane?, third: ImagePlane?) {
+        self.pixelFormat = pixelFormat
+        self.width = width
+        self.height = height
+        self.first = first
+        self.second = second
+        self.third = third
+    }
+
+    init(buffer: VideoFrameBuffer) {
+        let format = buffer.format
+        self.init(pixelFormat: format.pixelFormat,
+                  width: format.width,
+                  height: format.height,
+                  first: ImagePlane(data: buffer.plane(0), bytesPerRow: format.bytesPerRow[0]),
+                  second: format.planeCount > 1 ? ImagePlane(data: buffer.plane(1), bytesPerRow: format.bytesPerRow[1]) : nil,
+                  third: format.planeCount > 2 ? ImagePlane(data: buffer.plane(2), bytesPerRow: format.bytesPerRow[2]) : nil)
+    }
+
+    init?(frame: OTVideoFrame) {
+        guard let videoFormat = frame.format,
+            let format = VideoFrameFormat(format: videoFormat),
+            let planes = frame.planes,
+            planes.count >= format.planeCount else {
+            return nil
+        }
+
+        func planeAt(_ index: Int) -> ImagePlane? {
+            guard index < format.planeCount, let pointer = planes.pointer(at: index) else { return nil }
+            return ImagePlane(data: pointer.assumingMemoryBound(to: UInt8.self), bytesPerRow: format.bytesPerRow[index])
+        }
+
+        guard let first = planeAt(0) else { return nil }
+        self.init(pixelFormat: format.pixelFormat,
+                  width: format.width,
+                  height: format.height,
+                  first: first,
+                  second: planeAt(1),
+                  third: planeAt(2))
+    }
+
+    var isSubsampled: Bool {
+        return pixelFormat != .argb
+    }
+
+    func plane(_ index: Int) -> ImagePlane {
+        switch index {
+        case 0:
+            return first
+        case 1:
+            return second!
+        default:
+            return third!
+        }
+    }
+
+    func planeWidth(_ index: Int) -> Int {
+        return index == 0 ? width : (width + 1) / 2
+    }
+
+    func planeHeight(_ index: Int) -> Int {
+        return index == 0 ? height : (height + 1) / 2
+    }
+
+    // Row by row, the destination must have the same format and size.
+    func copy(into destination: VideoPlanes) {
+        for plane in 0..<pixelFormat.planeCount {
+            let rowLength = planeWidth(plane) * pixelFormat.bytesPerPixel(plane: plane)
+            let source = self.plane(plane)
+            let target = destination.plane(plane)
+            guard source.data != target.data else { continue }
+            for y in 0..<planeHeight(plane) {
+                memcpy(target.row(y), source.row(y), rowLength)
+            }
+        }
+    }
+
+    // For 4:2:0 formats x and y must be even.
+    func cropped(x: Int, y: Int, width: Int, height: Int) -> VideoPlanes {
+        let chromaX = x / 2
+        let chromaY = y / 2
+        return VideoPlanes(pixelFormat: pixelFormat,
+                           width: width,
+                           height: height,
+                           first: first.offsetBy(x: x, y: y, bytesPerPixel: pixelFormat.bytesPerPixel(plane: 0)),
+                           second: second?.offsetBy(x: chromaX, y: chromaY, bytesPerPixel: pixelFormat.bytesPerPixel(plane: 1)),
+                           third: third?.offsetBy(x: chromaX, y: chromaY, bytesPerPixel: pixelFormat.bytesPerPixel(plane: 2)))
+    }
+}
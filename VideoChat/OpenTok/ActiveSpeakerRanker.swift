@@ -0,0 +1,72 @@
+//
+//  ActiveSpeakerRanker.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// One AudioLevelMeter per subscribed camera config, across all sessions, and
+// the speakers ranked by recent speech activity. Meters are handed out once
+// and fed lock-free from the audio or delegate thread; only creating,
+// removing and ranking take the lock.
+final class ActiveSpeakerRanker {
+
+    struct Speaker {
+        let configIndex: Int
+        let level: Float
+        let activity: Float
+        let isSpeaking: Bool
+    }
+
+    // Activity below this is silence, not a quiet speaker
+    static let minActivity: Float = 0.002
+
+    private var meters: [Int: AudioLevelMeter] = [:]
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+
+    init() {
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    func meter(forConfigAt index: Int, sampleRate: Int = 48_000) -> AudioLevelMeter {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        if let meter = meters[index] {
+            return meter
+        }
+        let meter = AudioLevelMeter(sampleRate: sampleRate)
+        meters[index] = meter
+        return meter
+    }
+
+    func remove(configIndex index: Int) {
+        os_unfair_lock_lock(lock)
+        meters[index] = nil
+        os_unfair_lock_unlock(lock)
+    }
+
+    // Most active first; ties go to the lower config index so the order is stable.
+    func ranking() -> [Speaker] {
+        os_unfair_lock_lock(lock)
+        let speakers = meters.map { index, meter in
+            Speaker(configIndex: index, level: meter.level, activity: meter.speechActivity, isSpeaking: meter.isSpeaking)
+        }
+        os_unfair_lock_unlock(lock)
+        return speakers.sorted {
+            $0.activity != $1.activity ? $0.activity > $1.activity : $0.configIndex < $1.configIndex
+        }
+    }
+
+    var dominantSpeaker: Int? {
+        guard let first = ranking().first, first.activity >= ActiveSpeakerRanker.minActivity else { return nil }
+        return first.configIndex
+    }
+}
@@ -33,9 +33,12 @@ struct CameraSessionConfig {
         self.isPublisher = isPublisher
     }
     
-    mutating func createPublisher(delegate: OTPublisherKitDelegate?, settings: OTPublisherSettings) {
+    mutating func createPublisher(delegate: OTPublisherKitDelegate?, settings: OTPublisherSettings, videoCapture: OTVideoCapture? = nil) {
         self.publisher = OTPublisher(delegate: delegate, settings: settings)
         guard let publisher = self.publisher else { return }
+        if let videoCapture = videoCapture {
+            publisher.videoCapture = videoCapture
+        }
         error = nil
         self.session?.publish(publisher, error: &error)
         guard error == nil else {
@@ -44,9 +47,28 @@ struct CameraSessionConfig {
         }
     }
     
-    mutating func createSubscriber(delegate: OTSubscriberKitDelegate?, stream: OTStream) {
+    mutating func unpublish() {
+        guard let publisher = self.publisher else { return }
+        publisher.view?.removeFromSuperview()
+        error = nil
+        self.session?.unpublish(publisher, error: &error)
+        if error != nil {
+            print("Error unpublish for index \(cameraIndex): \(error!)")
+        }
+        self.publisher = nil
+    }
+    
+    // `wrapRender` is put in front of `videoRender`, or of the SDK's own
+    // renderer behind the subscriber view when there is none.
+    mutating func createSubscriber(delegate: OTSubscriberKitDelegate?, stream: OTStream, videoRender: OTVideoRender? = nil,
+                                   wrapRender: ((OTVideoRender) -> OTVideoRender)? = nil) {
         self.subscriber = OTSubscriber(stream: stream, delegate: delegate)
         guard let subscriber = self.subscriber else { return }
+        if let render = videoRender ?? subscriber.videoRender {
+            subscriber.videoRender = wrapRender?(render) ?? render
+        } else if wrapRender != nil {
+            print("No video renderer to wrap for index \(cameraIndex)")
+        }
         error = nil
         self.session?.subscribe(subscriber, error: &error)
         guard error == nil else {
@@ -55,7 +77,9 @@ struct CameraSessionConfig {
         }
     }
     
-    mutating func clear() {
+    // Drops the session and its publisher or subscriber but keeps the tile
+    // view, so a recovered session can show video in the same place.
+    mutating func detach() {
         if self.isPublisher {
             self.publisher?.view?.removeFromSuperview()
         } else {
@@ -64,7 +88,23 @@ struct CameraSessionConfig {
         self.session = nil
         self.publisher = nil
         self.subscriber = nil
-        self.view = nil
         self.error = nil
     }
+    
+    mutating func unsubscribe() {
+        guard let subscriber = self.subscriber else { return }
+        subscriber.view?.removeFromSuperview()
+        error = nil
+        self.session?.unsubscribe(subscriber, error: &error)
+        if error != nil {
+            print("Error unsubscribe for index \(cameraIndex): \(error!)")
+        }
+        self.subscriber = nil
+        error = nil
+    }
+    
+    mutating func clear() {
+        detach()
+        self.view = nil
+    }
 }
@@ -0,0 +1,176 @@
+//
+//  CaptureGovernor.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import OpenTok
+
+// Splits one uplink budget across all local cameras. Every camera starts on
+// the cheapest tier and the camera whose next tier buys the most quality per
+// extra bit is raised until the budget is spent.
+struct CaptureGovernorPolicy {
+
+    struct Tier: Equatable {
+        let resolution: OTCameraCaptureResolution
+        let frameRate: OTCameraCaptureFrameRate
+        // Bits per second the tier usually needs
+        let bitrate: Double
+        let quality: Double
+
+        init(resolution: Int, frameRate: Int, pixels: Double, bitrate: Double) {
+            self.resolution = OTCameraCaptureResolution(rawValue: resolution)!
+            self.frameRate = OTCameraCaptureFrameRate(rawValue: frameRate)!
+            self.bitrate = bitrate
+            // Diminishing returns in both pixels and frames
+            quality = log2(pixels) + log2(Double(frameRate)) * 0.75
+        }
+    }
+
+    // Cheapest first
+    static let tiers = [
+        Tier(resolution: 0, frameRate: 1, pixels: 352 * 288, bitrate: 30_000),
+        Tier(resolution: 0, frameRate: 7, pixels: 352 * 288, bitrate: 120_000),
+        Tier(resolution: 0, frameRate: 15, pixels: 352 * 288, bitrate: 200_000),
+        Tier(resolution: 1, frameRate: 7, pixels: 640 * 480, bitrate: 300_000),
+        Tier(resolution: 1, frameRate: 15, pixels: 640 * 480, bitrate: 500_000),
+        Tier(resolution: 1, frameRate: 30, pixels: 640 * 480, bitrate: 800_000),
+        Tier(resolution: 2, frameRate: 15, pixels: 1280 * 720, bitrate: 1_000_000),
+        Tier(resolution: 2, frameRate: 30, pixels: 1280 * 720, bitrate: 1_500_000)
+    ]
+
+    var minBudget = 200_000.0
+    var maxBudget = 6_000_000.0
+    var congestedLoss = 0.05
+    var cleanLoss = 0.01
+    // Additive increase per clean period, multiplicative decrease otherwise
+    var budgetStep = 150_000.0
+    var backoff = 0.85
+
+    func allocate(budget: Double, cameraCount: Int) -> [Int] {
+        let tiers = CaptureGovernorPolicy.tiers
+        var allocation = [Int](repeating: 0, count: cameraCount)
+        var spent = tiers[0].bitrate * Double(cameraCount)
+
+        while true {
+            var best: Int?
+            var bestGain = 0.0
+            for camera in 0..<cameraCount where allocation[camera] + 1 < tiers.count {
+                let current = tiers[allocation[camera]]
+                let next = tiers[allocation[camera] + 1]
+                let cost = next.bitrate - current.bitrate
+                guard spent + cost <= budget else { continue }
+                let gain = (next.quality - current.quality) / cost
+                if gain > bestGain {
+                    bestGain = gain
+                    best = camera
+                }
+            }
+            guard let camera = best else { return allocation }
+            spent += tiers[allocation[camera] + 1].bitrate - tiers[allocation[camera]].bitrate
+            allocation[camera] += 1
+        }
+    }
+
+    // `sent` is the aggregate uplink bitrate actually achieved, `loss` the
+    // worst loss any remote subscriber reports.
+    func nextBudget(_ budget: Double, sent: Double, loss: Double) -> Double {
+        if loss > congestedLoss {
+            return max(min(budget, sent) * backoff, minBudget)
+        }
+        if loss < cleanLoss && sent >= budget * 0.8 {
+            return min(budget + budgetStep, maxBudget)
+        }
+        return budget
+    }
+}
+
+// Runs the policy on the publisher stats in NetworkTelemetry. Tier changes
+// mean republishing, so a new allocation must hold for a few periods and a
+// camera is not retiered more often than `minRetierInterval`; drops are let
+// through sooner than raises.
+final class CaptureGovernor {
+
+    static let updateInterval: TimeInterval = 5
+
+    var policy = CaptureGovernorPolicy()
+    var minRetierInterval: TimeInterval = 10
+    var downgradeHold = 1
+    var upgradeHold = 3
+    // Called on the main thread when a camera should change tier.
+    var onRetier: ((Int, CaptureGovernorPolicy.Tier) -> Void)?
+
+    private(set) var budget: Double
+    private let telemetry: NetworkTelemetry
+    private var tiers: [Int: Int] = [:]
+    private var pending: [Int: (tier: Int, periods: Int)] = [:]
+    private var retieredAt: [Int: TimeInterval] = [:]
+
+    init(telemetry: NetworkTelemetry, initialBudget: Double = 2_000_000) {
+        self.telemetry = telemetry
+        budget = initialBudget
+    }
+
+    // Tier to publish a camera with. A new camera gets the share of its slot
+    // among the publishers in config order, as `update` will allocate it,
+    // or the smallest share if that would overspend next to the tiers
+    // already handed out.
+    func tier(forConfigAt index: Int, cameraCount: Int) -> CaptureGovernorPolicy.Tier {
+        if let tier = tiers[index] {
+            return CaptureGovernorPolicy.tiers[tier]
+        }
+        let share = policy.allocate(budget: budget, cameraCount: max(cameraCount, 1))
+        let slot = min(tiers.keys.filter { $0 < index }.count, share.count - 1)
+        let spent = tiers.values.reduce(0) { $0 + CaptureGovernorPolicy.tiers[$1].bitrate }
+        var tier = share[slot]
+        if spent + CaptureGovernorPolicy.tiers[tier].bitrate > budget {
+            tier = share.min() ?? 0
+        }
+        tiers[index] = tier
+        return CaptureGovernorPolicy.tiers[tier]
+    }
+
+    // Main thread, every `updateInterval`, with the publishing config indexes.
+    func update(publishers: [Int]) {
+        guard !publishers.isEmpty else { return }
+        var sent = 0.0
+        var loss = 0.0
+        for index in publishers {
+            // Routed sessions report one entry, relayed ones one per subscriber;
+            // the camera is limited by its slowest receiver
+            let metrics = telemetry.metrics(kind: .publisherVideo, configIndex: index).values
+            sent += metrics.map { $0.bitrate }.min() ?? 0
+            loss = max(loss, metrics.map { $0.lossRate }.max() ?? 0)
+        }
+        budget = policy.nextBudget(budget, sent: sent, loss: loss)
+
+        let allocation = policy.allocate(budget: budget, cameraCount: publishers.count)
+        let now = ProcessInfo.processInfo.systemUptime
+        for (slot, index) in publishers.enumerated() {
+            let current = tiers[index] ?? 0
+            let target = allocation[slot]
+            guard target != current else {
+                pending.removeValue(forKey: index)
+                continue
+            }
+
+            let periods = pending[index]?.tier == target ? pending[index]!.periods + 1 : 1
+            pending[index] = (target, periods)
+            let hold = target < current ? downgradeHold : upgradeHold
+            let lastRetier = retieredAt[index] ?? -.infinity
+            guard periods >= hold, now - lastRetier >= minRetierInterval else { continue }
+
+            tiers[index] = target
+            retieredAt[index] = now
+            pending.removeValue(forKey: index)
+            onRetier?(index, CaptureGovernorPolicy.tiers[target])
+        }
+    }
+
+    func remove(configIndex: Int) {
+        tiers.removeValue(forKey: configIndex)
+        pending.removeValue(forKey: configIndex)
+        retieredAt.removeValue(forKey: configIndex)
+    }
+}
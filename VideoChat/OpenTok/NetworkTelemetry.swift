@@ -0,0 +1,335 @@
+//
+//  NetworkTelemetry.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// The last `capacity` cumulative stat samples of one stream. One thread
+// appends (the SDK delivers a stream's stats serially), any thread reads.
+// Readers retry if an append raced with them, appends never wait.
+final class NetworkStatsWindow {
+
+    static let capacity = 16
+    private static let fieldCount = 4
+
+    struct Sample {
+        // Milliseconds, as reported by the SDK
+        let timestamp: Double
+        let bytes: Int64
+        let packets: Int64
+        let packetsLost: Int64
+    }
+
+    struct Metrics {
+        let sampleCount: Int
+        let timestamp: Double
+        let bitrate: Double
+        // Lost / (lost + delivered) over the window
+        let lossRate: Double
+        // Coefficient of variation of the per-interval packet rate; a jitter
+        // proxy, since the SDK does not report jitter itself
+        let jitter: Double
+    }
+
+    private let fields = AtomicIntArray(count: NetworkStatsWindow.capacity * NetworkStatsWindow.fieldCount)
+    private let written = AtomicInt()
+    private let sequence = AtomicInt()
+
+    var count: Int {
+        return Int(min(written.value, Int64(NetworkStatsWindow.capacity)))
+    }
+
+    func append(_ sample: Sample) {
+        let base = Int(written.value % Int64(NetworkStatsWindow.capacity)) * NetworkStatsWindow.fieldCount
+        sequence.increment()
+        fields.store(Int64(sample.timestamp * 1_000), at: base)
+        fields.store(sample.bytes, at: base + 1)
+        fields.store(sample.packets, at: base + 2)
+        fields.store(sample.packetsLost, at: base + 3)
+        written.increment()
+        sequence.increment()
+    }
+
+    // Oldest first.
+    func samples() -> [Sample] {
+        var result: [Sample] = []
+        result.reserveCapacity(NetworkStatsWindow.capacity)
+        while true {
+            let before = sequence.value
+            if before % 2 != 0 {
+                continue
+            }
+            result.removeAll(keepingCapacity: true)
+            let total = written.value
+            let available = min(total, Int64(NetworkStatsWindow.capacity))
+            for index in (total - available)..<total {
+                let base = Int(index % Int64(NetworkStatsWindow.capacity)) * NetworkStatsWindow.fieldCount
+                result.append(Sample(timestamp: Double(fields[base]) / 1_000,
+                                     bytes: fields[base + 1],
+                                     packets: fields[base + 2],
+                                     packetsLost: fields[base + 3]))
+            }
+            if sequence.value == before {
+                return result
+            }
+        }
+    }
+
+    var metrics: Metrics {
+        let window = samples()
+        var elapsed = 0.0
+        var bytes: Int64 = 0
+        var packets: Int64 = 0
+        var lost: Int64 = 0
+        var rates: [Double] = []
+        rates.reserveCapacity(window.count)
+
+        for index in window.indices.dropFirst() {
+            let previous = window[index - 1]
+            let current = window[index]
+            let interval = current.timestamp - previous.timestamp
+            // Counters restart when the publisher or subscriber is recreated
+            guard interval > 0, current.bytes >= previous.bytes, current.packets >= previous.packets else {
+                continue
+            }
+            elapsed += interval
+            bytes += current.bytes - previous.bytes
+            packets += current.packets - previous.packets
+            lost += max(current.packetsLost - previous.packetsLost, 0)
+            rates.append(Double(current.packets - previous.packets) / interval)
+        }
+
+        var jitter = 0.0
+        if rates.count > 1 {
+            let mean = rates.reduce(0, +) / Double(rates.count)
+            let variance = rates.reduce(0) { $0 + ($1 - mean) * ($1 - mean) } / Double(rates.count)
+            jitter = mean > 0 ? variance.squareRoot() / mean : 0
+        }
+
+        return Metrics(sampleCount: window.count,
+                       timestamp: window.last?.timestamp ?? 0,
+                       bitrate: elapsed > 0 ? Double(bytes) * 8 / (elapsed / 1_000) : 0,
+                       lossRate: packets + lost > 0 ? Double(lost) / Double(packets + lost) : 0,
+                       jitter: jitter)
+    }
+}
+
+// Collects the NetworkStats delegate samples of every publisher and
+// subscriber. Each one's stats delegate keeps a PublisherStream or
+// SubscriberStream that resolves its windows once, so ingesting a sample is a
+// few atomic stores; metrics are only derived when someone asks for them.
+final class NetworkTelemetry {
+
+    enum Kind: UInt8 {
+        case publisherVideo
+        case publisherAudio
+        case subscriberVideo
+        case subscriberAudio
+    }
+
+    struct Key: Hashable {
+        let kind: Kind
+        let configIndex: Int
+        // Publisher stats come per remote subscriber, empty for subscribers
+        let subscriberId: String
+    }
+
+    // The two windows of one subscriber, looked up on their first sample.
+    // One delegate thread.
+    final class SubscriberStream {
+
+        let configIndex: Int
+        private let telemetry: NetworkTelemetry
+        private var video: NetworkStatsWindow?
+        private var audio: NetworkStatsWindow?
+
+        fileprivate init(telemetry: NetworkTelemetry, configIndex: Int) {
+            self.telemetry = telemetry
+            self.configIndex = configIndex
+        }
+
+        func record(_ stats: OTSubscriberKitVideoNetworkStats) {
+            recordVideo(NetworkStatsWindow.Sample(timestamp: stats.timestamp,
+                                                  bytes: Int64(stats.videoBytesReceived),
+                                                  packets: Int64(stats.videoPacketsReceived),
+                                                  packetsLost: Int64(stats.videoPacketsLost)))
+        }
+
+        func record(_ stats: OTSubscriberKitAudioNetworkStats) {
+            recordAudio(NetworkStatsWindow.Sample(timestamp: stats.timestamp,
+                                                  bytes: Int64(stats.audioBytesReceived),
+                                                  packets: Int64(stats.audioPacketsReceived),
+                                                  packetsLost: Int64(stats.audioPacketsLost)))
+        }
+
+        func recordVideo(_ sample: NetworkStatsWindow.Sample) {
+            let window = video ?? telemetry.window(for: Key(kind: .subscriberVideo, configIndex: configIndex,
+                                                            subscriberId: ""))
+            video = window
+            window.append(sample)
+        }
+
+        func recordAudio(_ sample: NetworkStatsWindow.Sample) {
+            let window = audio ?? telemetry.window(for: Key(kind: .subscriberAudio, configIndex: configIndex,
+                                                            subscriberId: ""))
+            audio = window
+            window.append(sample)
+        }
+    }
+
+    // The windows of one publisher, one per remote subscriber. There are only
+    // a few, so they are found by comparing ids rather than hashing; only the
+    // first sample of a new remote subscriber takes the telemetry lock. One
+    // delegate thread.
+    final class PublisherStream {
+
+        let configIndex: Int
+        private let telemetry: NetworkTelemetry
+        private var video: [(subscriberId: String, window: NetworkStatsWindow)] = []
+        private var audio: [(subscriberId: String, window: NetworkStatsWindow)] = []
+
+        fileprivate init(telemetry: NetworkTelemetry, configIndex: Int) {
+            self.telemetry = telemetry
+            self.configIndex = configIndex
+        }
+
+        func record(_ stats: [OTPublisherKitVideoNetworkStats]) {
+            for stat in stats {
+                recordVideo(NetworkStatsWindow.Sample(timestamp: stat.timestamp,
+                                                      bytes: stat.videoBytesSent,
+                                                      packets: stat.videoPacketsSent,
+                                                      packetsLost: stat.videoPacketsLost),
+                            subscriberId: stat.subscriberId)
+            }
+        }
+
+        func record(_ stats: [OTPublisherKitAudioNetworkStats]) {
+            for stat in stats {
+                recordAudio(NetworkStatsWindow.Sample(timestamp: stat.timestamp,
+                                                      bytes: stat.audioBytesSent,
+                                                      packets: stat.audioPacketsSent,
+                                                      packetsLost: stat.audioPacketsLost),
+                            subscriberId: stat.subscriberId)
+            }
+        }
+
+        func recordVideo(_ sample: NetworkStatsWindow.Sample, subscriberId: String) {
+            window(for: subscriberId, kind: .publisherVideo, in: &video).append(sample)
+        }
+
+        func recordAudio(_ sample: NetworkStatsWindow.Sample, subscriberId: String) {
+            window(for: subscriberId, kind: .publisherAudio, in: &audio).append(sample)
+        }
+
+        private func window(for subscriberId: String, kind: Kind,
+                            in windows: inout [(subscriberId: String, window: NetworkStatsWindow)]) -> NetworkStatsWindow {
+            if let entry = windows.first(where: { $0.subscriberId == subscriberId }) {
+                return entry.window
+            }
+            let window = telemetry.window(for: Key(kind: kind, configIndex: configIndex, subscriberId: subscriberId))
+            windows.append((subscriberId, window))
+            return window
+        }
+    }
+
+    static let snapshotMagic: UInt32 = 0x3154_4E56 // "VNT1"
+
+    private var windows: [Key: NetworkStatsWindow] = [:]
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+
+    init() {
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    // Drop the stream together with `remove(configIndex:)`; its windows are
+    // not in the telemetry any more.
+    func subscriberStream(configIndex: Int) -> SubscriberStream {
+        return SubscriberStream(telemetry: self, configIndex: configIndex)
+    }
+
+    func publisherStream(configIndex: Int) -> PublisherStream {
+        return PublisherStream(telemetry: self, configIndex: configIndex)
+    }
+
+    // Looks the window up every time; streams are for the delegate path.
+    func record(_ sample: NetworkStatsWindow.Sample, for key: Key) {
+        window(for: key).append(sample)
+    }
+
+    func metrics(for key: Key) -> NetworkStatsWindow.Metrics? {
+        os_unfair_lock_lock(lock)
+        let window = windows[key]
+        os_unfair_lock_unlock(lock)
+        return window?.metrics
+    }
+
+    // Every stream of one config, e.g. all remote subscribers of a publisher.
+    func metrics(kind: Kind, configIndex: Int) -> [Key: NetworkStatsWindow.Metrics] {
+        var result: [Key: NetworkStatsWindow.Metrics] = [:]
+        for (key, window) in allWindows() where key.kind == kind && key.configIndex == configIndex {
+            result[key] = window.metrics
+        }
+        return result
+    }
+
+    func remove(configIndex: Int) {
+        os_unfair_lock_lock(lock)
+        windows = windows.filter { $0.key.configIndex != configIndex }
+        os_unfair_lock_unlock(lock)
+    }
+
+    // Little endian: magic, record count (UInt16), then per stream
+    // kind (UInt8), config index (UInt8), sample count (UInt8),
+    // timestamp ms (Float64), bitrate bps (UInt32), loss and jitter in
+    // 1/10000 (UInt16 each). 19 bytes per stream; subscriber ids are
+    // not included.
+    func snapshot() -> Data {
+        let entries = allWindows()
+        var data = Data(capacity: 6 + entries.count * 19)
+        append(NetworkTelemetry.snapshotMagic, to: &data)
+        append(UInt16(min(entries.count, Int(UInt16.max))), to: &data)
+        for (key, window) in entries.prefix(Int(UInt16.max)) {
+            let metrics = window.metrics
+            append(key.kind.rawValue, to: &data)
+            append(UInt8(clamping: key.configIndex), to: &data)
+            append(UInt8(clamping: metrics.sampleCount), to: &data)
+            append(metrics.timestamp.bitPattern, to: &data)
+            append(UInt32(clamping: Int64(metrics.bitrate)), to: &data)
+            append(UInt16(clamping: Int(metrics.lossRate * 10_000)), to: &data)
+            append(UInt16(clamping: Int(metrics.jitter * 10_000)), to: &data)
+        }
+        return data
+    }
+
+    fileprivate func window(for key: Key) -> NetworkStatsWindow {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        if let window = windows[key] {
+            return window
+        }
+        let window = NetworkStatsWindow()
+        windows[key] = window
+        return window
+    }
+
+    private func allWindows() -> [(key: Key, value: NetworkStatsWindow)] {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return windows.map { $0 }
+    }
+
+    private func append<T: FixedWidthInteger>(_ value: T, to data: inout Data) {
+        var littleEndian = value.littleEndian
+        withUnsafeBytes(of: &littleEndian) { data.append(contentsOf: $0) }
+    }
+}
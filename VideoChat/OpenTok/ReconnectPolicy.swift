@@ -0,0 +1,27 @@
+//
+//  ReconnectPolicy.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// Exponential backoff with jitter between attempts to get a lost session
+// back: attempt n waits between half and all of baseDelay * 2^n, capped at
+// maxDelay, so clients dropped at the same moment do not retry in lockstep.
+struct ReconnectPolicy {
+
+    var baseDelay: TimeInterval = 0.25
+    var maxDelay: TimeInterval = 8
+    var maxAttempts = 8
+    // A connect still pending after this long counts as failed
+    var connectTimeout: TimeInterval = 10
+    var seed: UInt64 = 0x2545_F491_4F6C_DD1D
+
+    // `random` is uniform in 0..<1.
+    func delay(forAttempt attempt: Int, random: Double) -> TimeInterval {
+        let ceiling = min(maxDelay, baseDelay * pow(2, Double(min(max(attempt, 0), 30))))
+        return ceiling / 2 + ceiling / 2 * random
+    }
+}
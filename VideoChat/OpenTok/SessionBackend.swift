@@ -0,0 +1,242 @@
+//
+//  SessionBackend.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import OpenTok
+
+// Session lifecycle events, keyed by the opaque session object the backend
+// returned from makeSession.
+protocol SessionEventHandler: AnyObject {
+    func sessionDidConnect(_ session: AnyObject)
+    func sessionDidDisconnect(_ session: AnyObject)
+    func session(_ session: AnyObject, didFailWithError error: Error)
+    func session(_ session: AnyObject, streamCreated stream: AnyObject)
+    func session(_ session: AnyObject, streamDestroyed stream: AnyObject)
+    func sessionDidBeginReconnecting(_ session: AnyObject)
+    func sessionDidReconnect(_ session: AnyObject)
+    func session(_ session: AnyObject, receivedSignalType type: String?, fromConnection connectionId: String?, string: String?)
+}
+
+// What SessionManager needs from the SDK. Events are delivered on `queue`.
+protocol SessionBackend: AnyObject {
+    func makeSession(apiKey: String, sessionId: String, queue: DispatchQueue, events: SessionEventHandler) -> AnyObject?
+    func connect(_ session: AnyObject, token: String) -> Error?
+    func disconnect(_ session: AnyObject)
+    // Signals every other connection in the session.
+    func signal(_ session: AnyObject, type: String, string: String) -> Error?
+}
+
+final class OpenTokSessionBackend: NSObject, SessionBackend {
+
+    private weak var events: SessionEventHandler?
+
+    func makeSession(apiKey: String, sessionId: String, queue: DispatchQueue, events: SessionEventHandler) -> AnyObject? {
+        self.events = events
+        let session = OTSession(apiKey: apiKey, sessionId: sessionId, delegate: self)
+        session?.apiQueue = queue
+        return session
+    }
+
+    func connect(_ session: AnyObject, token: String) -> Error? {
+        guard let session = session as? OTSession else { return nil }
+        var error: OTError?
+        session.connect(withToken: token, error: &error)
+        return error
+    }
+
+    func disconnect(_ session: AnyObject) {
+        guard let session = session as? OTSession else { return }
+        var error: OTError?
+        session.disconnect(&error)
+        if error != nil {
+            print(error!)
+        }
+    }
+
+    func signal(_ session: AnyObject, type: String, string: String) -> Error? {
+        guard let session = session as? OTSession else { return nil }
+        var error: OTError?
+        session.signal(withType: type, string: string, connection: nil, retryAfterReconnect: false, error: &error)
+        return error
+    }
+}
+
+// MARK: - OTSessionDelegate callbacks
+extension OpenTokSessionBackend: OTSessionDelegate {
+
+    func sessionDidConnect(_ session: OTSession) {
+        events?.sessionDidConnect(session)
+    }
+
+    func sessionDidDisconnect(_ session: OTSession) {
+        events?.sessionDidDisconnect(session)
+    }
+
+    func session(_ session: OTSession, didFailWithError error: OTError) {
+        events?.session(session, didFailWithError: error)
+    }
+
+    func session(_ session: OTSession, streamCreated stream: OTStream) {
+        events?.session(session, streamCreated: stream)
+    }
+
+    func session(_ session: OTSession, streamDestroyed stream: OTStream) {
+        events?.session(session, streamDestroyed: stream)
+    }
+
+    func sessionDidBeginReconnecting(_ session: OTSession) {
+        events?.sessionDidBeginReconnecting(session)
+    }
+
+    func sessionDidReconnect(_ session: OTSession) {
+        events?.sessionDidReconnect(session)
+    }
+
+    func session(_ session: OTSession, receivedSignalType type: String?, from connection: OTConnection?, with string: String?) {
+        // Signals to everyone come back to the sender too
+        if let connection = connection, connection.connectionId == session.connection?.connectionId {
+            return
+        }
+        events?.session(session, receivedSignalType: type, fromConnection: connection?.connectionId, string: string)
+    }
+}
+
+// Connects after a fixed delay without touching the network, so the manager's
+// fan-out and lookups can be exercised on a simulator or in a profiling run.
+// `faults` makes connects hang and connections drop or briefly reconnect,
+// drawn from a seeded generator so a run can be repeated.
+final class FakeSessionBackend: SessionBackend {
+
+    final class Session {
+        let sessionId: String
+        fileprivate(set) var isConnected = false
+
+        init(sessionId: String) {
+            self.sessionId = sessionId
+        }
+    }
+
+    struct Faults {
+        // Share of connects that never complete
+        var connectTimeoutRate = 0.0
+        // Share of connected sessions dropped after up to `dropDelay`
+        var dropRate = 0.0
+        var dropDelay: TimeInterval = 5
+        // Share of connected sessions that go through an SDK reconnect instead
+        var reconnectRate = 0.0
+        var seed: UInt64 = 0x9E37_79B9_7F4A_7C15
+    }
+
+    let connectDelay: TimeInterval
+    let faults: Faults
+    private var queues: [ObjectIdentifier: DispatchQueue] = [:]
+    private weak var events: SessionEventHandler?
+    private var random: UInt64
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+
+    init(connectDelay: TimeInterval = 0.05, faults: Faults = Faults()) {
+        self.connectDelay = connectDelay
+        self.faults = faults
+        random = faults.seed == 0 ? 1 : faults.seed
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    func makeSession(apiKey: String, sessionId: String, queue: DispatchQueue, events: SessionEventHandler) -> AnyObject? {
+        let session = Session(sessionId: sessionId)
+        os_unfair_lock_lock(lock)
+        self.events = events
+        queues[ObjectIdentifier(session)] = queue
+        os_unfair_lock_unlock(lock)
+        return session
+    }
+
+    func connect(_ session: AnyObject, token: String) -> Error? {
+        guard let session = session as? Session, let queue = queue(for: session) else { return nil }
+        if nextRandom() < faults.connectTimeoutRate {
+            return nil
+        }
+        queue.asyncAfter(deadline: .now() + connectDelay) { [weak self] in
+            guard let self = self else { return }
+            session.isConnected = true
+            self.events?.sessionDidConnect(session)
+
+            let roll = self.nextRandom()
+            let after = self.faults.dropDelay * self.nextRandom()
+            if roll < self.faults.dropRate {
+                queue.asyncAfter(deadline: .now() + after) { [weak self] in
+                    self?.dropConnection(session)
+                }
+            } else if roll < self.faults.dropRate + self.faults.reconnectRate {
+                queue.asyncAfter(deadline: .now() + after) { [weak self] in
+                    self?.interruptConnection(session, for: self?.connectDelay ?? 0)
+                }
+            }
+        }
+        return nil
+    }
+
+    func disconnect(_ session: AnyObject) {
+        guard let session = session as? Session, let queue = queue(for: session) else { return }
+        queue.async { [weak self] in
+            guard session.isConnected else { return }
+            session.isConnected = false
+            self?.events?.sessionDidDisconnect(session)
+        }
+    }
+
+    // Nobody else is in a fake session.
+    func signal(_ session: AnyObject, type: String, string: String) -> Error? {
+        return nil
+    }
+
+    // Fails a connected session the way the SDK reports a lost connection.
+    func dropConnection(_ session: AnyObject) {
+        guard let session = session as? Session, let queue = queue(for: session) else { return }
+        queue.async { [weak self] in
+            guard session.isConnected else { return }
+            session.isConnected = false
+            let error = NSError(domain: "OTSessionErrorDomain", code: 1022, // OTConnectionDropped
+                                userInfo: [NSLocalizedDescriptionKey: "Connection dropped"])
+            self?.events?.session(session, didFailWithError: error)
+        }
+    }
+
+    // The SDK restoring the same session after a short network loss.
+    func interruptConnection(_ session: AnyObject, for duration: TimeInterval) {
+        guard let session = session as? Session, let queue = queue(for: session) else { return }
+        queue.async { [weak self] in
+            guard session.isConnected else { return }
+            self?.events?.sessionDidBeginReconnecting(session)
+            queue.asyncAfter(deadline: .now() + duration) { [weak self] in
+                guard session.isConnected else { return }
+                self?.events?.sessionDidReconnect(session)
+            }
+        }
+    }
+
+    private func queue(for session: Session) -> DispatchQueue? {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return queues[ObjectIdentifier(session)]
+    }
+
+    // xorshift64*, uniform in 0..<1
+    private func nextRandom() -> Double {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        random ^= random >> 12
+        random ^= random << 25
+        random ^= random >> 27
+        return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+    }
+}
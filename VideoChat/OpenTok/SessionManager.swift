@@ -0,0 +1,470 @@
+//
+//  SessionManager.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+protocol SessionManagerDelegate: AnyObject {
+    func sessionManager(_ manager: SessionManager, didConnectConfigAt index: Int)
+    func sessionManager(_ manager: SessionManager, didDisconnectConfigAt index: Int)
+    func sessionManager(_ manager: SessionManager, configAt index: Int, didFailWithError error: Error)
+    func sessionManager(_ manager: SessionManager, configAt index: Int, streamCreated stream: AnyObject)
+    func sessionManager(_ manager: SessionManager, configAt index: Int, streamDestroyed stream: AnyObject)
+    // The SDK lost the connection and is restoring the same session, with its
+    // publishers and subscribers.
+    func sessionManager(_ manager: SessionManager, didBeginReconnectingConfigAt index: Int)
+    func sessionManager(_ manager: SessionManager, didReconnectConfigAt index: Int)
+    // The session is gone and its publisher or subscriber with it. A new
+    // session follows with didConnectConfigAt and streamCreated as usual.
+    func sessionManager(_ manager: SessionManager, willRecoverConfigAt index: Int)
+}
+
+extension SessionManagerDelegate {
+    func sessionManager(_ manager: SessionManager, didBeginReconnectingConfigAt index: Int) {
+    }
+
+    func sessionManager(_ manager: SessionManager, didReconnectConfigAt index: Int) {
+    }
+
+    func sessionManager(_ manager: SessionManager, willRecoverConfigAt index: Int) {
+    }
+}
+
+// Owns the sessions behind a list of camera configs. All sessions are created
+// and connected concurrently, their callbacks arrive on `apiQueue` instead of
+// the main thread, and sessions, publishers and subscribers map back to their
+// config index through hashed lookups. Delegate calls are made on
+// `callbackQueue` with the config index.
+//
+// A config whose session fails, times out or is dropped gets a new one: the
+// warm standby kept connected for the same credentials if there is one,
+// otherwise a fresh connect after ReconnectPolicy's backoff. The config only
+// fails to the delegate once the policy runs out of attempts.
+final class SessionManager {
+
+    private struct Endpoint: Hashable {
+        let apiKey: String
+        let sessionId: String
+        let token: String
+    }
+
+    private final class Standby {
+        let session: AnyObject
+        var isConnected = false
+        var streams: [AnyObject] = []
+
+        init(session: AnyObject) {
+            self.session = session
+        }
+    }
+
+    let backend: SessionBackend
+    let apiQueue = DispatchQueue(label: "VideoChat.SessionManager.api", qos: .userInitiated)
+    var callbackQueue = DispatchQueue.main
+    weak var delegate: SessionManagerDelegate?
+    var reconnectPolicy = ReconnectPolicy() {
+        didSet {
+            random = reconnectPolicy.seed == 0 ? 1 : reconnectPolicy.seed
+        }
+    }
+    var isWarmStandbyEnabled = true
+    // Session lost until the config showed video again
+    let timeToFirstFrame = LatencyHistogram()
+
+    private var sessions: [Int: AnyObject] = [:]
+    private var sessionIndexes: [ObjectIdentifier: Int] = [:]
+    private var publisherIndexes: [ObjectIdentifier: Int] = [:]
+    private var subscriberIndexes: [ObjectIdentifier: Int] = [:]
+    private var connectStartedAt: [Int: UInt64] = [:]
+    private var connectDurations: [Int: TimeInterval] = [:]
+    private var signalChannels: [Int: SignalChannel] = [:]
+    private var endpoints: [Int: Endpoint] = [:]
+    private var attempts: [Int: Int] = [:]
+    private var lostAt: [Int: UInt64] = [:]
+    private var connectTimeouts: [Int: DispatchWorkItem] = [:]
+    private var standbys: [Endpoint: Standby] = [:]
+    private var standbyEndpoints: [ObjectIdentifier: Endpoint] = [:]
+    private var isShuttingDown = false
+    private var random: UInt64
+    private let lock: UnsafeMutablePointer<os_unfair_lock>
+
+    init(backend: SessionBackend = OpenTokSessionBackend()) {
+        self.backend = backend
+        random = reconnectPolicy.seed
+        lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+    }
+
+    deinit {
+        lock.deinitialize(count: 1)
+        lock.deallocate()
+    }
+
+    // Returns immediately; each config's session is created and connected
+    // on its own worker.
+    func connect(_ configs: [CameraSessionConfig]) {
+        os_unfair_lock_lock(lock)
+        isShuttingDown = false
+        for (index, config) in configs.enumerated() {
+            endpoints[index] = Endpoint(apiKey: config.apiKey, sessionId: config.sessionId, token: config.token)
+        }
+        os_unfair_lock_unlock(lock)
+
+        DispatchQueue.global(qos: .userInitiated).async {
+            DispatchQueue.concurrentPerform(iterations: configs.count) { index in
+                self.connect(configAt: index)
+            }
+        }
+    }
+
+    func disconnectAll() {
+        os_unfair_lock_lock(lock)
+        isShuttingDown = true
+        let all = Array(sessions.values) + standbys.values.map { $0.session }
+        standbys.removeAll()
+        standbyEndpoints.removeAll()
+        connectTimeouts.values.forEach { $0.cancel() }
+        connectTimeouts.removeAll()
+        os_unfair_lock_unlock(lock)
+        for session in all {
+            backend.disconnect(session)
+        }
+    }
+
+    func session(at index: Int) -> AnyObject? {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return sessions[index]
+    }
+
+    func index(ofSession session: AnyObject) -> Int? {
+        return lookup(session, in: \.sessionIndexes)
+    }
+
+    func index(ofPublisher publisher: AnyObject) -> Int? {
+        return lookup(publisher, in: \.publisherIndexes)
+    }
+
+    func index(ofSubscriber subscriber: AnyObject) -> Int? {
+        return lookup(subscriber, in: \.subscriberIndexes)
+    }
+
+    func register(publisher: AnyObject, at index: Int) {
+        os_unfair_lock_lock(lock)
+        publisherIndexes[ObjectIdentifier(publisher)] = index
+        os_unfair_lock_unlock(lock)
+    }
+
+    func register(subscriber: AnyObject, at index: Int) {
+        os_unfair_lock_lock(lock)
+        subscriberIndexes[ObjectIdentifier(subscriber)] = index
+        os_unfair_lock_unlock(lock)
+    }
+
+    // Drops the publisher and subscriber registered for the config, e.g. when
+    // it is cleared. The session stays known until disconnectAll.
+    func unregister(at index: Int) {
+        os_unfair_lock_lock(lock)
+        publisherIndexes = publisherIndexes.filter { $0.value != index }
+        subscriberIndexes = subscriberIndexes.filter { $0.value != index }
+        os_unfair_lock_unlock(lock)
+    }
+
+    // Control messages for the config's session, created on first use and
+    // kept across recoveries. Received messages reach onMessage on
+    // `callbackQueue`.
+    func signalChannel(at index: Int) -> SignalChannel? {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        if let channel = signalChannels[index] {
+            return channel
+        }
+        guard sessions[index] != nil else { return nil }
+        let channel = SignalChannel { [weak self] string in
+            guard let self = self, let session = self.session(at: index) else { return nil }
+            return self.backend.signal(session, type: SignalChannel.signalType, string: string)
+        }
+        signalChannels[index] = channel
+        return channel
+    }
+
+    // Seconds from connect() to sessionDidConnect, per config index.
+    var timeToConnect: [Int: TimeInterval] {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return connectDurations
+    }
+
+    // Call when a config's publisher is live again or its subscriber renders;
+    // closes the time to first frame measurement if a loss is pending.
+    func reportFirstFrame(at index: Int) {
+        os_unfair_lock_lock(lock)
+        let lost = lostAt.removeValue(forKey: index)
+        os_unfair_lock_unlock(lock)
+        guard let startedAt = lost else { return }
+        let duration = Int64(DispatchTime.now().uptimeNanoseconds - startedAt)
+        timeToFirstFrame.record(duration)
+        print("Config \(index) showed video \(duration / 1_000_000) ms after losing its session")
+    }
+
+    private func connect(configAt index: Int) {
+        os_unfair_lock_lock(lock)
+        let endpoint = endpoints[index]
+        os_unfair_lock_unlock(lock)
+        guard let config = endpoint,
+            let session = backend.makeSession(apiKey: config.apiKey,
+                                              sessionId: config.sessionId,
+                                              queue: apiQueue,
+                                              events: self) else {
+            print("Could not create session for index \(index)")
+            return
+        }
+
+        let timeout = DispatchWorkItem { [weak self, weak session] in
+            guard let self = self, let session = session else { return }
+            let error = NSError(domain: "OTSessionErrorDomain", code: 1021, // OTSessionConnectionTimeout
+                                userInfo: [NSLocalizedDescriptionKey: "Connect timed out"])
+            self.sessionLost(session, error: error)
+        }
+        os_unfair_lock_lock(lock)
+        sessions[index] = session
+        sessionIndexes[ObjectIdentifier(session)] = index
+        connectStartedAt[index] = DispatchTime.now().uptimeNanoseconds
+        connectTimeouts[index]?.cancel()
+        connectTimeouts[index] = timeout
+        os_unfair_lock_unlock(lock)
+        apiQueue.asyncAfter(deadline: .now() + reconnectPolicy.connectTimeout, execute: timeout)
+
+        if let error = backend.connect(session, token: config.token) {
+            apiQueue.async {
+                self.sessionLost(session, error: error)
+            }
+        }
+    }
+
+    // API queue. Moves the config to a new session, or gives up.
+    private func sessionLost(_ session: AnyObject, error: Error) {
+        os_unfair_lock_lock(lock)
+        guard let index = sessionIndexes[ObjectIdentifier(session)], sessions[index] === session else {
+            os_unfair_lock_unlock(lock)
+            return
+        }
+        sessions[index] = nil
+        sessionIndexes[ObjectIdentifier(session)] = nil
+        connectTimeouts.removeValue(forKey: index)?.cancel()
+        let attempt = attempts[index, default: 0]
+        let givesUp = isShuttingDown || attempt >= reconnectPolicy.maxAttempts
+        if !givesUp && lostAt[index] == nil {
+            lostAt[index] = DispatchTime.now().uptimeNanoseconds
+        }
+        let endpoint = endpoints[index]
+        let standby = endpoint.flatMap { standbys[$0] }
+        os_unfair_lock_unlock(lock)
+        backend.disconnect(session)
+
+        if givesUp {
+            print("Session \(index) failed: \(error)")
+            notify(index) { $0.sessionManager(self, configAt: $1, didFailWithError: error) }
+            return
+        }
+        notify(index) { $0.sessionManager(self, willRecoverConfigAt: $1) }
+
+        if let standby = standby, standby.isConnected, let endpoint = endpoint {
+            print("Session \(index) lost (\(error)), switching to the standby session")
+            promote(standby, for: endpoint, at: index)
+            return
+        }
+
+        let delay = reconnectPolicy.delay(forAttempt: attempt, random: nextRandom())
+        print("Session \(index) lost (\(error)), reconnecting in \(Int(delay * 1_000)) ms")
+        os_unfair_lock_lock(lock)
+        attempts[index] = attempt + 1
+        os_unfair_lock_unlock(lock)
+        apiQueue.asyncAfter(deadline: .now() + delay) {
+            os_unfair_lock_lock(self.lock)
+            let isWanted = !self.isShuttingDown && self.sessions[index] == nil
+            os_unfair_lock_unlock(self.lock)
+            if isWanted {
+                self.connect(configAt: index)
+            }
+        }
+    }
+
+    // API queue. The standby is already connected and has seen the streams.
+    private func promote(_ standby: Standby, for endpoint: Endpoint, at index: Int) {
+        let session = standby.session
+        os_unfair_lock_lock(lock)
+        standbys[endpoint] = nil
+        standbyEndpoints[ObjectIdentifier(session)] = nil
+        sessions[index] = session
+        sessionIndexes[ObjectIdentifier(session)] = index
+        attempts[index] = 0
+        os_unfair_lock_unlock(lock)
+
+        notify(index) { $0.sessionManager(self, didConnectConfigAt: $1) }
+        for stream in standby.streams {
+            notify(index) { $0.sessionManager(self, configAt: $1, streamCreated: stream) }
+        }
+        makeStandby(for: endpoint)
+    }
+
+    // API queue.
+    private func makeStandby(for endpoint: Endpoint) {
+        os_unfair_lock_lock(lock)
+        let isWanted = isWarmStandbyEnabled && !isShuttingDown && standbys[endpoint] == nil
+        os_unfair_lock_unlock(lock)
+        guard isWanted,
+            let session = backend.makeSession(apiKey: endpoint.apiKey,
+                                              sessionId: endpoint.sessionId,
+                                              queue: apiQueue,
+                                              events: self) else {
+            return
+        }
+
+        os_unfair_lock_lock(lock)
+        standbys[endpoint] = Standby(session: session)
+        standbyEndpoints[ObjectIdentifier(session)] = endpoint
+        os_unfair_lock_unlock(lock)
+        if backend.connect(session, token: endpoint.token) != nil {
+            dropStandby(session)
+        }
+    }
+
+    private func dropStandby(_ session: AnyObject) {
+        os_unfair_lock_lock(lock)
+        if let endpoint = standbyEndpoints.removeValue(forKey: ObjectIdentifier(session)) {
+            standbys[endpoint] = nil
+        }
+        os_unfair_lock_unlock(lock)
+        backend.disconnect(session)
+    }
+
+    private func standby(for session: AnyObject) -> Standby? {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return standbyEndpoints[ObjectIdentifier(session)].flatMap { standbys[$0] }
+    }
+
+    // xorshift64*, uniform in 0..<1
+    private func nextRandom() -> Double {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        random ^= random >> 12
+        random ^= random << 25
+        random ^= random >> 27
+        return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+    }
+
+    private func lookup(_ object: AnyObject, in table: KeyPath<SessionManager, [ObjectIdentifier: Int]>) -> Int? {
+        os_unfair_lock_lock(lock)
+        defer { os_unfair_lock_unlock(lock) }
+        return self[keyPath: table][ObjectIdentifier(object)]
+    }
+
+    private func notify(_ session: AnyObject, _ body: @escaping (SessionManagerDelegate, Int) -> Void) {
+        guard let index = index(ofSession: session) else { return }
+        notify(index, body)
+    }
+
+    private func notify(_ index: Int, _ body: @escaping (SessionManagerDelegate, Int) -> Void) {
+        callbackQueue.async { [weak self] in
+            guard let self = self, let delegate = self.delegate else { return }
+            body(delegate, index)
+        }
+    }
+}
+
+// MARK: - SessionEventHandler callbacks
+extension SessionManager: SessionEventHandler {
+
+    func sessionDidConnect(_ session: AnyObject) {
+        if let standby = standby(for: session) {
+            standby.isConnected = true
+            return
+        }
+
+        os_unfair_lock_lock(lock)
+        let index = sessionIndexes[ObjectIdentifier(session)]
+        if let index = index {
+            attempts[index] = 0
+            connectTimeouts.removeValue(forKey: index)?.cancel()
+            if let startedAt = connectStartedAt[index] {
+                let duration = TimeInterval(DispatchTime.now().uptimeNanoseconds - startedAt) / 1_000_000_000
+                connectDurations[index] = duration
+                print("Session \(index) connected in \(Int(duration * 1_000)) ms")
+            }
+        }
+        let endpoint = index.flatMap { endpoints[$0] }
+        os_unfair_lock_unlock(lock)
+
+        notify(session) { $0.sessionManager(self, didConnectConfigAt: $1) }
+        if let endpoint = endpoint {
+            makeStandby(for: endpoint)
+        }
+    }
+
+    func sessionDidDisconnect(_ session: AnyObject) {
+        if standby(for: session) != nil {
+            dropStandby(session)
+            return
+        }
+        os_unfair_lock_lock(lock)
+        let isUnexpected = !isShuttingDown
+        os_unfair_lock_unlock(lock)
+        if isUnexpected {
+            let error = NSError(domain: "OTSessionErrorDomain", code: 1022, // OTConnectionDropped
+                                userInfo: [NSLocalizedDescriptionKey: "Disconnected"])
+            sessionLost(session, error: error)
+            return
+        }
+        notify(session) { $0.sessionManager(self, didDisconnectConfigAt: $1) }
+    }
+
+    func session(_ session: AnyObject, didFailWithError error: Error) {
+        if standby(for: session) != nil {
+            dropStandby(session)
+            return
+        }
+        sessionLost(session, error: error)
+    }
+
+    func session(_ session: AnyObject, streamCreated stream: AnyObject) {
+        if let standby = standby(for: session) {
+            standby.streams.append(stream)
+            return
+        }
+        notify(session) { $0.sessionManager(self, configAt: $1, streamCreated: stream) }
+    }
+
+    func session(_ session: AnyObject, streamDestroyed stream: AnyObject) {
+        if let standby = standby(for: session) {
+            standby.streams.removeAll { $0 === stream }
+            return
+        }
+        notify(session) { $0.sessionManager(self, configAt: $1, streamDestroyed: stream) }
+    }
+
+    func sessionDidBeginReconnecting(_ session: AnyObject) {
+        guard let index = index(ofSession: session) else { return }
+        os_unfair_lock_lock(lock)
+        if lostAt[index] == nil {
+            lostAt[index] = DispatchTime.now().uptimeNanoseconds
+        }
+        os_unfair_lock_unlock(lock)
+        notify(index) { $0.sessionManager(self, didBeginReconnectingConfigAt: $1) }
+    }
+
+    func sessionDidReconnect(_ session: AnyObject) {
+        notify(session) { $0.sessionManager(self, didReconnectConfigAt: $1) }
+    }
+
+    func session(_ session: AnyObject, receivedSignalType type: String?, fromConnection connectionId: String?, string: String?) {
+        guard type == SignalChannel.signalType, let string = string, let index = index(ofSession: session) else { return }
+        callbackQueue.async { [weak self] in
+            self?.signalChannel(at: index)?.receive(string)
+        }
+    }
+}
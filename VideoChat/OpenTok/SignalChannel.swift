@@ -0,0 +1,241 @@
+//
+//  SignalChannel.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// Control messages (layout, quality hints, speaker state) over one session's
+// signals. Everything posted within `window` goes out as one signal, and a
+// state message replaces an unsent one of the same kind and subject. Messages
+// are packed as binary records, base64 encoded and split so no signal exceeds
+// `maxSignalLength`. Receiving decodes into a preallocated buffer and hands
+// out payload pointers, so it does not allocate.
+final class SignalChannel {
+
+    enum Kind: UInt8 {
+        case layout = 1
+        case qualityHint = 2
+        case speakerState = 3
+        case event = 4
+
+        // Newer state makes unsent older state of the same subject obsolete
+        var isState: Bool {
+            return self != .event
+        }
+    }
+
+    struct Message {
+        let kind: Kind
+        let subject: UInt16
+        // Only valid inside onMessage
+        let payload: UnsafeRawBufferPointer
+    }
+
+    struct Statistics {
+        let messagesPosted: Int64
+        let messagesSuperseded: Int64
+        let signalsSent: Int64
+        let bytesSent: Int64
+        let sendErrors: Int64
+        let signalsReceived: Int64
+        let messagesReceived: Int64
+        let malformedSignals: Int64
+    }
+
+    static let signalType = "vc"
+    // The data limit of OTSession signals
+    static let maxSignalLength = 8_192
+    static let maxPayloadLength = 255
+    private static let version: UInt8 = 1
+    // Version, sequence, record count
+    private static let headerSize = 4
+    // Kind, subject, payload length
+    private static let recordHeaderSize = 4
+    private static let maxEnvelopeSize = maxSignalLength / 4 * 3
+
+    private static let decodeTable: UnsafeMutablePointer<UInt8> = {
+        let table = UnsafeMutablePointer<UInt8>.allocate(capacity: 256)
+        table.initialize(repeating: 0xFF, count: 256)
+        for (value, character) in "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/".utf8.enumerated() {
+            table[Int(character)] = UInt8(value)
+        }
+        return table
+    }()
+
+    let window: TimeInterval
+    // Called on the thread calling receive(_:)
+    var onMessage: ((Message) -> Void)?
+
+    private let queue = DispatchQueue(label: "VideoChat.SignalChannel", qos: .userInitiated)
+    private let send: (String) -> Error?
+    private var pending: [(kind: Kind, subject: UInt16, payload: Data)] = []
+    private var pendingState: [UInt32: Int] = [:]
+    private var isFlushScheduled = false
+    private var sequence: UInt16 = 0
+    private let receiveBuffer: UnsafeMutablePointer<UInt8>
+
+    private let messagesPosted = AtomicInt()
+    private let messagesSuperseded = AtomicInt()
+    private let signalsSent = AtomicInt()
+    private let bytesSent = AtomicInt()
+    private let sendErrors = AtomicInt()
+    private let signalsReceived = AtomicInt()
+    private let messagesReceived = AtomicInt()
+    private let malformedSignals = AtomicInt()
+
+    // `window` is clamped to 20...50 ms.
+    init(window: TimeInterval = 0.03, send: @escaping (String) -> Error?) {
+        self.window = min(max(window, 0.02), 0.05)
+        self.send = send
+        receiveBuffer = UnsafeMutablePointer<UInt8>.allocate(capacity: SignalChannel.maxEnvelopeSize)
+    }
+
+    deinit {
+        receiveBuffer.deallocate()
+    }
+
+    var statistics: Statistics {
+        return Statistics(messagesPosted: messagesPosted.value,
+                          messagesSuperseded: messagesSuperseded.value,
+                          signalsSent: signalsSent.value,
+                          bytesSent: bytesSent.value,
+                          sendErrors: sendErrors.value,
+                          signalsReceived: signalsReceived.value,
+                          messagesReceived: messagesReceived.value,
+                          malformedSignals: malformedSignals.value)
+    }
+
+    // Any thread.
+    func post(_ kind: Kind, subject: UInt16, payload: Data) {
+        guard payload.count <= SignalChannel.maxPayloadLength else {
+            print("Signal payload of \(payload.count) bytes is too long")
+            return
+        }
+        messagesPosted.increment()
+        queue.async {
+            let key = UInt32(kind.rawValue) << 16 | UInt32(subject)
+            if kind.isState, let index = self.pendingState[key] {
+                self.pending[index].payload = payload
+                self.messagesSuperseded.increment()
+            } else {
+                if kind.isState {
+                    self.pendingState[key] = self.pending.count
+                }
+                self.pending.append((kind, subject, payload))
+            }
+            if !self.isFlushScheduled {
+                self.isFlushScheduled = true
+                self.queue.asyncAfter(deadline: .now() + self.window) {
+                    self.flush()
+                }
+            }
+        }
+    }
+
+    // One receiving thread. Signals of another type should not be passed in.
+    func receive(_ string: String) {
+        signalsReceived.increment()
+        let decoded = string.utf8.withContiguousStorageIfAvailable { decode($0) } ?? decode(string.utf8)
+        if let length = decoded, parse(length: length) {
+            return
+        }
+        malformedSignals.increment()
+    }
+
+    // Queue.
+    private func flush() {
+        isFlushScheduled = false
+        guard !pending.isEmpty else { return }
+
+        var envelope = [UInt8]()
+        envelope.reserveCapacity(SignalChannel.maxEnvelopeSize)
+        var count = 0
+        for message in pending {
+            let recordSize = SignalChannel.recordHeaderSize + message.payload.count
+            if count == Int(UInt8.max) || envelope.count + recordSize > SignalChannel.maxEnvelopeSize {
+                emit(&envelope, count: count)
+                count = 0
+            }
+            if envelope.isEmpty {
+                sequence &+= 1
+                envelope.append(SignalChannel.version)
+                envelope.append(UInt8(truncatingIfNeeded: sequence))
+                envelope.append(UInt8(truncatingIfNeeded: sequence >> 8))
+                envelope.append(0)
+            }
+            envelope.append(message.kind.rawValue)
+            envelope.append(UInt8(truncatingIfNeeded: message.subject))
+            envelope.append(UInt8(truncatingIfNeeded: message.subject >> 8))
+            envelope.append(UInt8(message.payload.count))
+            envelope.append(contentsOf: message.payload)
+            count += 1
+        }
+        emit(&envelope, count: count)
+        pending.removeAll(keepingCapacity: true)
+        pendingState.removeAll(keepingCapacity: true)
+    }
+
+    private func emit(_ envelope: inout [UInt8], count: Int) {
+        guard count > 0 else { return }
+        envelope[3] = UInt8(count)
+        let string = Data(envelope).base64EncodedString()
+        envelope.removeAll(keepingCapacity: true)
+        if let error = send(string) {
+            sendErrors.increment()
+            print("Could not send signal: \(error)")
+            return
+        }
+        signalsSent.increment()
+        bytesSent.increment(by: Int64(string.utf8.count))
+    }
+
+    // Base64 into receiveBuffer; returns the decoded length.
+    private func decode<Characters: Sequence>(_ characters: Characters) -> Int? where Characters.Element == UInt8 {
+        let table = SignalChannel.decodeTable
+        var length = 0
+        var bits: UInt32 = 0
+        var bitCount = 0
+        for character in characters {
+            if character == UInt8(ascii: "=") {
+                break
+            }
+            let value = table[Int(character)]
+            guard value != 0xFF else { return nil }
+            bits = bits << 6 | UInt32(value)
+            bitCount += 6
+            if bitCount >= 8 {
+                bitCount -= 8
+                guard length < SignalChannel.maxEnvelopeSize else { return nil }
+                receiveBuffer[length] = UInt8(truncatingIfNeeded: bits >> UInt32(bitCount))
+                length += 1
+            }
+        }
+        return length
+    }
+
+    private func parse(length: Int) -> Bool {
+        let buffer = receiveBuffer
+        guard length >= SignalChannel.headerSize, buffer[0] == SignalChannel.version else { return false }
+        let count = Int(buffer[3])
+        var offset = SignalChannel.headerSize
+        for _ in 0..<count {
+            guard offset + SignalChannel.recordHeaderSize <= length else { return false }
+            let subject = UInt16(buffer[offset + 1]) | UInt16(buffer[offset + 2]) << 8
+            let payloadLength = Int(buffer[offset + 3])
+            let payloadStart = offset + SignalChannel.recordHeaderSize
+            guard payloadStart + payloadLength <= length else { return false }
+            // Kinds from newer clients are skipped
+            if let kind = Kind(rawValue: buffer[offset]) {
+                messagesReceived.increment()
+                onMessage?(Message(kind: kind,
+                                   subject: subject,
+                                   payload: UnsafeRawBufferPointer(start: buffer + payloadStart, count: payloadLength)))
+            }
+            offset = payloadStart + payloadLength
+        }
+        return true
+    }
+}
@@ -0,0 +1,147 @@
+//
+//  SubscriberQualityController.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import OpenTok
+import UIKit
+
+// Pure decision logic: given what a subscriber tile needs and how the link
+// and CPU are doing, pick a rung of the quality ladder. Drops happen after
+// `downgradeHold` bad periods, raises only after `upgradeHold` good ones, so
+// a noisy link does not flap between levels.
+struct SubscriberQualityPolicy {
+
+    struct Level: Equatable {
+        let resolution: CGSize
+        let frameRate: Float
+        // Bits per second the level usually needs
+        let bitrate: Double
+    }
+
+    struct Input {
+        // Pixels the stream is displayed in
+        let tileSize: CGSize
+        let lossRate: Double
+        // As NetworkTelemetry.Metrics.jitter
+        let jitter: Double
+        let cpuLoad: Double
+    }
+
+    struct State: Equatable {
+        var level = 0
+        var goodPeriods = 0
+        var badPeriods = 0
+    }
+
+    // Best first
+    static let ladder = [
+        Level(resolution: CGSize(width: 1280, height: 720), frameRate: 30, bitrate: 1_500_000),
+        Level(resolution: CGSize(width: 640, height: 480), frameRate: 30, bitrate: 800_000),
+        Level(resolution: CGSize(width: 640, height: 480), frameRate: 15, bitrate: 500_000),
+        Level(resolution: CGSize(width: 320, height: 240), frameRate: 15, bitrate: 250_000),
+        Level(resolution: CGSize(width: 320, height: 240), frameRate: 7, bitrate: 150_000),
+        Level(resolution: CGSize(width: 160, height: 120), frameRate: 7, bitrate: 60_000),
+        Level(resolution: CGSize(width: 160, height: 120), frameRate: 1, bitrate: 20_000)
+    ]
+
+    var downgradeLoss = 0.05
+    var upgradeLoss = 0.01
+    var downgradeJitter = 0.5
+    var upgradeJitter = 0.25
+    var highCPU = 0.85
+    var lowCPU = 0.6
+    var downgradeHold = 2
+    var upgradeHold = 4
+
+    // Smallest resolution still covering the tile, at its best frame rate.
+    func ceiling(for tileSize: CGSize) -> Int {
+        let ladder = SubscriberQualityPolicy.ladder
+        var best = 0
+        for (index, level) in ladder.enumerated()
+            where level.resolution.width >= tileSize.width && level.resolution.height >= tileSize.height {
+            if level.resolution != ladder[best].resolution {
+                best = index
+            }
+        }
+        return best
+    }
+
+    func next(_ state: State, input: Input) -> State {
+        let ladder = SubscriberQualityPolicy.ladder
+        let ceiling = self.ceiling(for: input.tileSize)
+        var state = state
+
+        // Never spend more than the tile can show
+        if state.level < ceiling {
+            return State(level: ceiling, goodPeriods: 0, badPeriods: 0)
+        }
+
+        // The received bitrate says little: a still scene or a quiet encoder
+        // sends well under the level's rate on a link with room to spare
+        let congested = input.lossRate > downgradeLoss || input.jitter > downgradeJitter || input.cpuLoad > highCPU
+        let healthy = input.lossRate < upgradeLoss && input.jitter < upgradeJitter && input.cpuLoad < lowCPU
+
+        if congested {
+            state.goodPeriods = 0
+            state.badPeriods += 1
+            if state.badPeriods >= downgradeHold && state.level < ladder.count - 1 {
+                state.level += 1
+                state.badPeriods = 0
+            }
+        } else if healthy {
+            state.badPeriods = 0
+            state.goodPeriods += 1
+            if state.goodPeriods >= upgradeHold && state.level > ceiling {
+                state.level -= 1
+                state.goodPeriods = 0
+            }
+        } else {
+            state.goodPeriods = 0
+            state.badPeriods = 0
+        }
+        return state
+    }
+}
+
+// Applies the policy to every subscriber once per `update` call, using the
+// video stats collected by NetworkTelemetry.
+final class SubscriberQualityController {
+
+    static let updateInterval: TimeInterval = 2
+
+    var policy = SubscriberQualityPolicy()
+    private let telemetry: NetworkTelemetry
+    private var states: [Int: SubscriberQualityPolicy.State] = [:]
+
+    init(telemetry: NetworkTelemetry) {
+        self.telemetry = telemetry
+    }
+
+    // Main thread. Returns the level now requested for the subscriber.
+    @discardableResult
+    func update(_ subscriber: OTSubscriberKit, configIndex: Int, tileSize: CGSize, cpuLoad: Double) -> SubscriberQualityPolicy.Level {
+        let key = NetworkTelemetry.Key(kind: .subscriberVideo, configIndex: configIndex, subscriberId: "")
+        let metrics = telemetry.metrics(for: key)
+        let input = SubscriberQualityPolicy.Input(tileSize: tileSize,
+                                                  lossRate: metrics?.lossRate ?? 0,
+                                                  jitter: metrics?.jitter ?? 0,
+                                                  cpuLoad: cpuLoad)
+        let previous = states[configIndex]
+        let state = policy.next(previous ?? SubscriberQualityPolicy.State(), input: input)
+        states[configIndex] = state
+
+        let level = SubscriberQualityPolicy.ladder[state.level]
+        if previous?.level != state.level {
+            subscriber.preferredResolution = level.resolution
+            subscriber.preferredFrameRate = level.frameRate
+        }
+        return level
+    }
+
+    func remove(configIndex: Int) {
+        states.removeValue(forKey: configIndex)
+    }
+}
@@ -0,0 +1,180 @@
+//
+//  SubscriptionScheduler.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+import UIKit
+
+// Pure decision logic: which visible subscribers get full quality video, which
+// a thumbnail and which audio only. The most active speakers win the `maxHigh`
+// slots; a speaker already holding one counts `incumbentAdvantage` times as
+// active and keeps it for at least `minHold`, so two people talking over each
+// other do not swap slots every update. Promotion itself is immediate.
+struct SubscriptionSchedulerPolicy {
+
+    enum Slot {
+        case high
+        case thumbnail
+        case audioOnly
+    }
+
+    struct Candidate {
+        let configIndex: Int
+        let activity: Float
+        let isVisible: Bool
+    }
+
+    struct State: Equatable {
+        var slot: Slot
+        var changedAt: TimeInterval
+    }
+
+    // Estimated cost of receiving one stream in a slot
+    struct Cost {
+        let bitrate: Double
+        let decodedPixelsPerSecond: Double
+    }
+
+    var maxHigh = 2
+    var maxThumbnails = 4
+    var incumbentAdvantage: Float = 1.5
+    var minHold: TimeInterval = 2
+
+    static func cost(of slot: Slot) -> Cost {
+        switch slot {
+        case .high:
+            return cost(of: SubscriberQualityPolicy.ladder[0])
+        case .thumbnail:
+            return cost(of: SubscriptionScheduler.thumbnailLevel)
+        case .audioOnly:
+            return Cost(bitrate: 0, decodedPixelsPerSecond: 0)
+        }
+    }
+
+    private static func cost(of level: SubscriberQualityPolicy.Level) -> Cost {
+        let pixels = Double(level.resolution.width * level.resolution.height)
+        return Cost(bitrate: level.bitrate, decodedPixelsPerSecond: pixels * Double(level.frameRate))
+    }
+
+    func next(_ states: [Int: State], candidates: [Candidate], now: TimeInterval) -> [Int: State] {
+        func isIncumbent(_ candidate: Candidate) -> Bool {
+            return states[candidate.configIndex]?.slot == .high
+        }
+        func isPinned(_ candidate: Candidate) -> Bool {
+            guard let state = states[candidate.configIndex], state.slot == .high else { return false }
+            return now - state.changedAt < minHold
+        }
+        func score(_ candidate: Candidate) -> Float {
+            return isIncumbent(candidate) ? candidate.activity * incumbentAdvantage : candidate.activity
+        }
+
+        let ordered = candidates.filter { $0.isVisible }.sorted { a, b in
+            if isPinned(a) != isPinned(b) {
+                return isPinned(a)
+            }
+            if score(a) != score(b) {
+                return score(a) > score(b)
+            }
+            if isIncumbent(a) != isIncumbent(b) {
+                return isIncumbent(a)
+            }
+            return a.configIndex < b.configIndex
+        }
+
+        var slots: [Int: Slot] = [:]
+        for (rank, candidate) in ordered.enumerated() {
+            if rank < maxHigh {
+                slots[candidate.configIndex] = .high
+            } else if rank < maxHigh + maxThumbnails {
+                slots[candidate.configIndex] = .thumbnail
+            } else {
+                slots[candidate.configIndex] = .audioOnly
+            }
+        }
+
+        var next: [Int: State] = [:]
+        for candidate in candidates {
+            let slot = slots[candidate.configIndex] ?? .audioOnly
+            if let state = states[candidate.configIndex], state.slot == slot {
+                next[candidate.configIndex] = state
+            } else {
+                next[candidate.configIndex] = State(slot: slot, changedAt: now)
+            }
+        }
+        return next
+    }
+}
+
+// Applies the policy to the subscribers using ActiveSpeakerRanker activity,
+// and keeps a running estimate of what the demotions saved compared with
+// receiving every stream at full quality.
+final class SubscriptionScheduler {
+
+    struct Savings {
+        let bits: Double
+        let decodedPixels: Double
+    }
+
+    static let updateInterval: TimeInterval = 0.5
+    static let thumbnailLevel = SubscriberQualityPolicy.ladder[3]
+    static let thumbnailSize = thumbnailLevel.resolution
+
+    var policy = SubscriptionSchedulerPolicy()
+    private let speakers: ActiveSpeakerRanker
+    private var states: [Int: SubscriptionSchedulerPolicy.State] = [:]
+    private var lastUpdate: TimeInterval?
+    private var savedBits = 0.0
+    private var savedPixels = 0.0
+
+    init(speakers: ActiveSpeakerRanker) {
+        self.speakers = speakers
+    }
+
+    var savings: Savings {
+        return Savings(bits: savedBits, decodedPixels: savedPixels)
+    }
+
+    // Subscribers start in full quality until the first update says otherwise.
+    func slot(forConfigAt index: Int) -> SubscriptionSchedulerPolicy.Slot {
+        return states[index]?.slot ?? .high
+    }
+
+    // Main thread. `visibility` maps every subscribed config index to whether
+    // its tile is on screen. Returns the subscribers whose slot changed.
+    func update(visibility: [Int: Bool],
+                now: TimeInterval = ProcessInfo.processInfo.systemUptime) -> [Int: SubscriptionSchedulerPolicy.Slot] {
+        if let lastUpdate = lastUpdate {
+            let elapsed = now - lastUpdate
+            let full = SubscriptionSchedulerPolicy.cost(of: .high)
+            for state in states.values {
+                let cost = SubscriptionSchedulerPolicy.cost(of: state.slot)
+                savedBits += (full.bitrate - cost.bitrate) * elapsed
+                savedPixels += (full.decodedPixelsPerSecond - cost.decodedPixelsPerSecond) * elapsed
+            }
+        }
+        lastUpdate = now
+
+        var activity: [Int: Float] = [:]
+        for speaker in speakers.ranking() {
+            activity[speaker.configIndex] = speaker.activity
+        }
+        let candidates = visibility.map { index, isVisible in
+            SubscriptionSchedulerPolicy.Candidate(configIndex: index, activity: activity[index] ?? 0, isVisible: isVisible)
+        }
+        let next = policy.next(states, candidates: candidates, now: now)
+
+        var changes: [Int: SubscriptionSchedulerPolicy.Slot] = [:]
+        for (index, state) in next where state.slot != slot(forConfigAt: index) {
+            changes[index] = state.slot
+        }
+        states = next
+        return changes
+    }
+
+    func remove(configIndex: Int) {
+        states.removeValue(forKey: configIndex)
+    }
+}
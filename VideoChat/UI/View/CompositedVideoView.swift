@@ -0,0 +1,45 @@
+//
+//  CompositedVideoView.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import UIKit
+
+class CompositedVideoView: UIView {
+
+    let compositor: VideoCompositor
+    private var displayLink: CADisplayLink?
+
+    init(compositor: VideoCompositor) {
+        self.compositor = compositor
+        super.init(frame: .zero)
+        backgroundColor = .black
+        layer.contentsGravity = .resize
+    }
+
+    required init?(coder aDecoder: NSCoder) {
+        fatalError("init(coder:) has not been implemented")
+    }
+
+    override func layoutSubviews() {
+        super.layoutSubviews()
+        let scale = window?.screen.scale ?? UIScreen.main.scale
+        compositor.resize(width: Int(bounds.width * scale), height: Int(bounds.height * scale))
+    }
+
+    override func didMoveToWindow() {
+        super.didMoveToWindow()
+        displayLink?.invalidate()
+        displayLink = nil
+        guard window != nil else { return }
+        displayLink = CADisplayLink(target: self, selector: #selector(refresh))
+        displayLink?.add(to: .main, forMode: .common)
+    }
+
+    @objc private func refresh() {
+        guard compositor.takeDirtyTiles() != 0 else { return }
+        layer.contents = compositor.makeImage()
+    }
+}
@@ -23,4 +23,21 @@ class UserCamerasView: BaseXibView {
         }
     }
 
+    private(set) var compositedView: CompositedVideoView?
+
+    // One shared canvas over the 2x2 grid instead of a render view per camera
+    func installCompositor(_ compositor: VideoCompositor) {
+        compositedView?.removeFromSuperview()
+        let compositedView = CompositedVideoView(compositor: compositor)
+        compositedView.translatesAutoresizingMaskIntoConstraints = false
+        view.addSubview(compositedView)
+        NSLayoutConstraint.activate([
+            compositedView.topAnchor.constraint(equalTo: camera1View.topAnchor),
+            compositedView.leadingAnchor.constraint(equalTo: camera1View.leadingAnchor),
+            compositedView.bottomAnchor.constraint(equalTo: camera4View.bottomAnchor),
+            compositedView.trailingAnchor.constraint(equalTo: camera4View.trailingAnchor)
+        ])
+        self.compositedView = compositedView
+    }
+
 }
@@ -6,6 +6,7 @@
 //  Copyright © 2020 SW-Expert. All rights reserved.
 //
 
+import AVFoundation
 import UIKit
 import OpenTok
 
@@ -14,46 +15,177 @@ class VideoVC: UIViewController {
     @IBOutlet weak var myCamerasView: UserCamerasView!
     @IBOutlet weak var interlocutorCamerasView: UserCamerasView!
     var allCameraConfig: [CameraSessionConfig] = []
+    let interlocutorCompositor = VideoCompositor()
+    let sessionManager = SessionManager()
+    let telemetry = NetworkTelemetry()
+    // By publisher and subscriber object. Changed on the main thread and read
+    // by stats callbacks on the API queue, so only under telemetryLock.
+    private var publisherTelemetry: [ObjectIdentifier: NetworkTelemetry.PublisherStream] = [:]
+    private var subscriberTelemetry: [ObjectIdentifier: NetworkTelemetry.SubscriberStream] = [:]
+    private let telemetryLock: UnsafeMutablePointer<os_unfair_lock> = {
+        let lock = UnsafeMutablePointer<os_unfair_lock>.allocate(capacity: 1)
+        lock.initialize(to: os_unfair_lock())
+        return lock
+    }()
+    let speakers = ActiveSpeakerRanker()
+    lazy var subscriberQuality = SubscriberQualityController(telemetry: telemetry)
+    lazy var captureGovernor = CaptureGovernor(telemetry: telemetry)
+    lazy var subscriptionScheduler = SubscriptionScheduler(speakers: speakers)
+    private var qualityTimer: Timer?
+    private var governorTimer: Timer?
+    private var schedulerTimer: Timer?
+    private var publisherCount = 0
+    private var recorder: CallRecorder?
+    // The publisher config the microphone is metered under
+    private var microphoneConfigIndex: Int?
+    
+    deinit {
+        telemetryLock.deinitialize(count: 1)
+        telemetryLock.deallocate()
+    }
     
     override func viewDidLoad() {
         super.viewDidLoad()
 
-        
+        sessionManager.delegate = self
+        captureGovernor.onRetier = { [weak self] index, tier in
+            self?.retier(at: index, to: tier)
+        }
+
+        if Constants.isCompositedRenderingEnabled {
+            interlocutorCamerasView.installCompositor(interlocutorCompositor)
+        }
     }
     
     override func viewWillDisappear(_ animated: Bool) {
         super.viewWillDisappear(animated)
         
+        for config in allCameraConfig {
+            guard let capture = config.publisher?.videoCapture as? SharedCameraCapture else { continue }
+            let statistics = capture.deliveryStatistics
+            print("Camera \(config.cameraIndex) delivered \(statistics.frames) frames, \(statistics.zeroCopyFrames) zero-copy, "
+                + String(format: "%.2f copies and %.0f KB copied per frame", statistics.copiesPerFrame,
+                         statistics.bytesCopiedPerFrame / 1_024))
+            for filter in capture.filterGraph.statistics.filters {
+                print("Camera \(config.cameraIndex) filter \(filter.name) mean \(Int(filter.latency.mean / 1_000)) us "
+                    + "p95 \(filter.latency.p95 / 1_000) us, \(filter.skippedFrames) frames skipped"
+                    + ", shed \(filter.sheds) times" + (filter.isShed ? ", shed now" : ""))
+            }
+            if let scene = capture.sceneDetector?.statistics {
+                print("Camera \(config.cameraIndex) skipped \(scene.skippedFrames) of \(scene.frames) frames as static, "
+                    + "\(scene.rawBytesSkipped / 1_048_576) MB raw video and "
+                    + "\(scene.cpuNanosecondsSaved / 1_000_000) ms CPU saved")
+            }
+            for case let denoiser as TemporalDenoiseFilter in capture.filterGraph.filters {
+                let statistics = denoiser.statistics
+                print("Camera \(config.cameraIndex) noise level " + String(format: "%.1f, %.0f%% static blocks",
+                                                                         statistics.noiseLevel,
+                                                                         statistics.staticBlockShare * 100))
+            }
+        }
         for index in 0..<allCameraConfig.count {
             allCameraConfig[index].clear()
         }
+        sessionManager.disconnectAll()
+        AudioTapDevice.shared?.captureMeter = nil
+        microphoneConfigIndex = nil
+        let recovery = sessionManager.timeToFirstFrame.summary
+        if recovery.count > 0 {
+            print("\(recovery.count) session recoveries, time to first frame ms p50 \(recovery.p50 / 1_000_000) "
+                + "p95 \(recovery.p95 / 1_000_000) max \(recovery.max / 1_000_000)")
+        }
+        if let recorder = recorder {
+            AudioTapDevice.shared?.recorder = nil
+            recorder.close()
+            let statistics = recorder.statistics
+            print("Recorded \(statistics.videoFrames) video frames and \(statistics.audioPackets) audio packets, "
+                + "\(statistics.writer.bytesWritten / 1_048_576) MB to \(recorder.url.lastPathComponent), "
+                + "\(statistics.writer.droppedRecords) dropped")
+            self.recorder = nil
+        }
+        for (stream, statistics) in LatencyTracer.shared.statistics {
+            let latency = statistics.latency
+            print("Stream \(stream) latency ms p50 \(latency.p50 / 1_000_000) p95 \(latency.p95 / 1_000_000) "
+                + "p99 \(latency.p99 / 1_000_000) max \(latency.max / 1_000_000), \(statistics.framesLost) frames lost")
+        }
+        LatencyTracer.shared.removeAll()
+        qualityTimer?.invalidate()
+        qualityTimer = nil
+        governorTimer?.invalidate()
+        governorTimer = nil
+        schedulerTimer?.invalidate()
+        schedulerTimer = nil
+        let savings = subscriptionScheduler.savings
+        print("Subscription scheduling saved \(Int(savings.bits / 8_000_000)) MB received "
+            + "and \(Int(savings.decodedPixels / 1_000_000)) Mpx decoded")
     }
     
     override func viewDidAppear(_ animated: Bool) {
         super.viewDidAppear(animated)
         
+        if Constants.isCallRecordingEnabled, let url = CallRecorder.makeURL() {
+            recorder = CallRecorder(url: url)
+            AudioTapDevice.shared?.recorder = recorder
+        }
         connectToAnOpenTokSessions()
+        qualityTimer = Timer.scheduledTimer(withTimeInterval: SubscriberQualityController.updateInterval,
+                                            repeats: true) { [weak self] _ in
+            self?.updateSubscriberQuality()
+        }
+        governorTimer = Timer.scheduledTimer(withTimeInterval: CaptureGovernor.updateInterval,
+                                             repeats: true) { [weak self] _ in
+            guard let self = self else { return }
+            self.captureGovernor.update(publishers: self.allCameraConfig.indices.filter {
+                self.allCameraConfig[$0].publisher != nil
+            })
+        }
+        if Constants.isSubscriptionSchedulingEnabled {
+            schedulerTimer = Timer.scheduledTimer(withTimeInterval: SubscriptionScheduler.updateInterval,
+                                                  repeats: true) { [weak self] _ in
+                self?.updateSubscriptionSlots()
+            }
+        }
     }
     
 
     func connectToAnOpenTokSessions() {
-        var error: OTError?
         for index in 0..<allCameraConfig.count {
-            error = nil
-            let config = allCameraConfig[index]
-            allCameraConfig[index].view = getCameraWrapper(config: config)
-            allCameraConfig[index].session = OTSession(apiKey: config.apiKey, sessionId: config.sessionId, delegate: self)
-            allCameraConfig[index].session?.connect(withToken: config.token, error: &error)
-            if error != nil {
-                print(error!)
-            }
+            allCameraConfig[index].view = getCameraWrapper(config: allCameraConfig[index])
         }
+        publisherCount = allCameraConfig.filter { $0.isPublisher }.count
+        sessionManager.connect(allCameraConfig)
     }
     
-    func createPublisher(config: inout CameraSessionConfig) {
+    func createPublisher(config: inout CameraSessionConfig, index: Int) {
+        let tier = captureGovernor.tier(forConfigAt: index, cameraCount: publisherCount)
         let settings = OTPublisherSettings()
         settings.name = UIDevice.current.name
-        config.createPublisher(delegate: self, settings: settings)
+        settings.cameraResolution = tier.resolution
+        settings.cameraFrameRate = tier.frameRate
+        let position: AVCaptureDevice.Position = config.cameraIndex.isMultiple(of: Constants.сountCameras)
+            ? .front
+            : .back
+        let videoCapture = Constants.isSharedCameraCaptureEnabled
+            ? SharedCameraCapture(position: position, tier: tier)
+            : nil
+        if Constants.isLatencyTracingEnabled {
+            videoCapture?.tracer = LatencyTracer.shared
+        }
+        if Constants.isVideoDenoisingEnabled {
+            videoCapture?.filterGraph.filters = [TemporalDenoiseFilter()]
+        }
+        if Constants.isStaticSceneSkippingEnabled {
+            videoCapture?.sceneDetector = StaticSceneDetector()
+        }
+        config.createPublisher(delegate: self, settings: settings, videoCapture: videoCapture)
+        if let publisher = config.publisher {
+            sessionManager.register(publisher: publisher, at: index)
+            let stream = telemetry.publisherStream(configIndex: index)
+            os_unfair_lock_lock(telemetryLock)
+            publisherTelemetry[ObjectIdentifier(publisher)] = stream
+            os_unfair_lock_unlock(telemetryLock)
+            publisher.networkStatsDelegate = self
+        }
         guard config.publisher != nil,
             config.error == nil,
             let wrapperView = config.view,
@@ -61,17 +193,39 @@ class VideoVC: UIViewController {
             return
         }
         
-        config.publisher?.cameraPosition = config.cameraIndex.isMultiple(of: Constants.сountCameras)
-            ? .front
-            : .back
+        if videoCapture == nil {
+            config.publisher?.cameraPosition = position
+        }
 
         publisherView.frame = CGRect(origin: CGPoint(x: 0, y: 0), size: wrapperView.frame.size )
         wrapperView.addSubview(publisherView)
     }
     
-    func createSubscriber(config: inout CameraSessionConfig, stream: OTStream) {
-        config.createSubscriber(delegate: self, stream: stream)
-        guard config.subscriber != nil,
+    func createSubscriber(config: inout CameraSessionConfig, index: Int, stream: OTStream) {
+        let tileRender = Constants.isCompositedRenderingEnabled
+            ? interlocutorCompositor.tileRender(at: tileIndex(config: config))
+            : nil
+        config.createSubscriber(delegate: self, stream: stream, videoRender: tileRender) { [recorder] render in
+            var render = render
+            if Constants.isLatencyTracingEnabled {
+                render = LatencyTracingRender(next: render, streamName: stream.streamId)
+            }
+            if let recorder = recorder {
+                render = RecordingRender(next: render, streamName: stream.streamId, recorder: recorder)
+            }
+            return render
+        }
+        if let subscriber = config.subscriber {
+            sessionManager.register(subscriber: subscriber, at: index)
+            let stream = telemetry.subscriberStream(configIndex: index)
+            os_unfair_lock_lock(telemetryLock)
+            subscriberTelemetry[ObjectIdentifier(subscriber)] = stream
+            os_unfair_lock_unlock(telemetryLock)
+            subscriber.networkStatsDelegate = self
+            subscriber.audioLevelDelegate = self
+        }
+        guard tileRender == nil,
+            config.subscriber != nil,
             config.error == nil,
             let wrapperView = config.view,
             let subscriberView = config.subscriber?.view else {
@@ -82,10 +236,96 @@ class VideoVC: UIViewController {
         wrapperView.addSubview(subscriberView)
     }
     
+    // A shared camera capture is retargeted in place; the SDK's own capturer
+    // only takes capture settings when a publisher is created.
+    func retier(at index: Int, to tier: CaptureGovernorPolicy.Tier) {
+        if let capture = allCameraConfig[index].publisher?.videoCapture as? SharedCameraCapture {
+            capture.retarget(to: tier)
+            return
+        }
+        republish(at: index)
+    }
+    
+    func republish(at index: Int) {
+        guard allCameraConfig[index].publisher != nil else { return }
+        allCameraConfig[index].unpublish()
+        sessionManager.unregister(at: index)
+        forgetTelemetry(configIndex: index)
+        createPublisher(config: &allCameraConfig[index], index: index)
+    }
+    
+    func updateSubscriberQuality() {
+        let cpuLoad = CPULoad.current()
+        for index in 0..<allCameraConfig.count {
+            guard let subscriber = allCameraConfig[index].subscriber,
+                subscriptionScheduler.slot(forConfigAt: index) != .audioOnly else { continue }
+            subscriberQuality.update(subscriber, configIndex: index,
+                                     tileSize: scheduledTileSize(at: index),
+                                     cpuLoad: cpuLoad)
+        }
+    }
+    
+    func updateSubscriptionSlots() {
+        var visibility: [Int: Bool] = [:]
+        for index in 0..<allCameraConfig.count where allCameraConfig[index].subscriber != nil {
+            visibility[index] = isTileVisible(config: allCameraConfig[index])
+        }
+        for (index, slot) in subscriptionScheduler.update(visibility: visibility) {
+            applySubscriptionSlot(slot, at: index)
+        }
+    }
+    
+    // Takes effect right away; the quality state restarts from the new tile size.
+    func applySubscriptionSlot(_ slot: SubscriptionSchedulerPolicy.Slot, at index: Int) {
+        guard let subscriber = allCameraConfig[index].subscriber else { return }
+        subscriber.subscribeToVideo = slot != .audioOnly
+        subscriberQuality.remove(configIndex: index)
+        if slot == .audioOnly {
+            if Constants.isCompositedRenderingEnabled {
+                interlocutorCompositor.clearTile(tileIndex(config: allCameraConfig[index]))
+            }
+            return
+        }
+        subscriberQuality.update(subscriber, configIndex: index,
+                                 tileSize: scheduledTileSize(at: index),
+                                 cpuLoad: CPULoad.current())
+    }
+    
+    func scheduledTileSize(at index: Int) -> CGSize {
+        if subscriptionScheduler.slot(forConfigAt: index) == .thumbnail {
+            return SubscriptionScheduler.thumbnailSize
+        }
+        return tileSize(config: allCameraConfig[index])
+    }
+    
+    func isTileVisible(config: CameraSessionConfig) -> Bool {
+        if Constants.isCompositedRenderingEnabled && !config.isPublisher {
+            return interlocutorCamerasView.window != nil && !interlocutorCamerasView.isHidden
+        }
+        guard let view = config.view else { return false }
+        return view.window != nil && !view.isHidden
+    }
+    
+    // Pixels a camera is drawn in, the compositor tile when compositing.
+    func tileSize(config: CameraSessionConfig) -> CGSize {
+        if Constants.isCompositedRenderingEnabled && !config.isPublisher {
+            let canvas = interlocutorCompositor.canvasSize
+            return CGSize(width: canvas.width / interlocutorCompositor.columns,
+                          height: canvas.height / interlocutorCompositor.rows)
+        }
+        let scale = UIScreen.main.scale
+        let size = config.view?.bounds.size ?? .zero
+        return CGSize(width: size.width * scale, height: size.height * scale)
+    }
+    
+    func tileIndex(config: CameraSessionConfig) -> Int {
+        return config.cameraIndex % Constants.maxCountCameras
+    }
+    
     func getCameraWrapper(config: CameraSessionConfig) -> UIView? {
         let userCamerasView = config.isPublisher ? myCamerasView : interlocutorCamerasView
         
-        switch config.cameraIndex % Constants.maxCountCameras {
+        switch tileIndex(config: config) {
         case 0:
             return userCamerasView?.camera1View
         case 1:
@@ -99,76 +339,132 @@ class VideoVC: UIViewController {
         }
     }
     
-    func findCameraConfig(by session: OTSession) -> CameraSessionConfig? {
-        let index = self.allCameraConfig.firstIndex { (cameraConfig) -> Bool in
-            cameraConfig.session == session
-        }
-        guard index != nil else { return nil }
-        return self.allCameraConfig[index!]
+    func clearCameraConfig(at index: Int) {
+        allCameraConfig[index].clear()
+        forgetCameraConfig(at: index)
     }
     
-    func findCameraConfig(by publisher: OTPublisherKit) -> CameraSessionConfig? {
-        let index = self.allCameraConfig.firstIndex { (cameraConfig) -> Bool in
-            cameraConfig.publisher == publisher
+    // Per-config state that belongs to the publisher or subscriber, not the tile
+    func forgetCameraConfig(at index: Int) {
+        sessionManager.unregister(at: index)
+        forgetTelemetry(configIndex: index)
+        subscriberQuality.remove(configIndex: index)
+        captureGovernor.remove(configIndex: index)
+        speakers.remove(configIndex: index)
+        subscriptionScheduler.remove(configIndex: index)
+        if microphoneConfigIndex == index {
+            AudioTapDevice.shared?.captureMeter = nil
+            microphoneConfigIndex = nil
         }
-        guard index != nil else { return nil }
-        return self.allCameraConfig[index!]
     }
-    
-    func findCameraConfig(by subscriber: OTSubscriberKit) -> CameraSessionConfig? {
-        let index = self.allCameraConfig.firstIndex { (cameraConfig) -> Bool in
-            cameraConfig.subscriber == subscriber
-        }
-        guard index != nil else { return nil }
-        return self.allCameraConfig[index!]
+
+    private func forgetTelemetry(configIndex index: Int) {
+        os_unfair_lock_lock(telemetryLock)
+        publisherTelemetry = publisherTelemetry.filter { $0.value.configIndex != index }
+        subscriberTelemetry = subscriberTelemetry.filter { $0.value.configIndex != index }
+        os_unfair_lock_unlock(telemetryLock)
+        telemetry.remove(configIndex: index)
+    }
+
+    fileprivate func telemetryStream(of publisher: OTPublisherKit) -> NetworkTelemetry.PublisherStream? {
+        os_unfair_lock_lock(telemetryLock)
+        defer { os_unfair_lock_unlock(telemetryLock) }
+        return publisherTelemetry[ObjectIdentifier(publisher)]
+    }
+
+    fileprivate func telemetryStream(of subscriber: OTSubscriberKit) -> NetworkTelemetry.SubscriberStream? {
+        os_unfair_lock_lock(telemetryLock)
+        defer { os_unfair_lock_unlock(telemetryLock) }
+        return subscriberTelemetry[ObjectIdentifier(subscriber)]
+    }
+
+    // Local speech is ranked from microphone PCM. Remote speakers still come
+    // from the SDK's audio level callbacks: their PCM is only seen mixed.
+    func meterMicrophone(forConfigAt index: Int) {
+        guard microphoneConfigIndex == nil, let device = AudioTapDevice.shared else { return }
+        device.captureMeter = speakers.meter(forConfigAt: index, sampleRate: device.captureSampleRate)
+        microphoneConfigIndex = index
     }
 
 }
 
-// MARK: - OTSessionDelegate callbacks
-extension VideoVC: OTSessionDelegate {
+// MARK: - SessionManagerDelegate callbacks
+extension VideoVC: SessionManagerDelegate {
     
-    func sessionDidConnect(_ session: OTSession) {
+    func sessionManager(_ manager: SessionManager, didConnectConfigAt index: Int) {
         print("The client connected to the OpenTok session.")
-        guard var cameraConfig = findCameraConfig(by: session) else { return }
-        if cameraConfig.isPublisher {
-            createPublisher(config: &cameraConfig)
+        allCameraConfig[index].session = manager.session(at: index) as? OTSession
+        if allCameraConfig[index].isPublisher {
+            createPublisher(config: &allCameraConfig[index], index: index)
+            meterMicrophone(forConfigAt: index)
         }
     }
 
-    func sessionDidDisconnect(_ session: OTSession) {
+    func sessionManager(_ manager: SessionManager, didDisconnectConfigAt index: Int) {
         print("The client disconnected from the OpenTok session.")
     }
 
-    func session(_ session: OTSession, didFailWithError error: OTError) {
+    func sessionManager(_ manager: SessionManager, configAt index: Int, didFailWithError error: Error) {
         print("The client failed to connect to the OpenTok session: \(error).")
-        guard var cameraConfig = findCameraConfig(by: session) else { return }
-        cameraConfig.clear()
+        clearCameraConfig(at: index)
     }
 
-    func session(_ session: OTSession, streamCreated stream: OTStream) {
+    func sessionManager(_ manager: SessionManager, configAt index: Int, streamCreated stream: AnyObject) {
         print("A stream was created in the session.")
-        guard var cameraConfig = findCameraConfig(by: session) else { return }
-        if !(cameraConfig.isPublisher) {
-            createSubscriber(config: &cameraConfig, stream: stream)
+        guard let stream = stream as? OTStream else { return }
+        if !(allCameraConfig[index].isPublisher) && allCameraConfig[index].subscriber == nil {
+            createSubscriber(config: &allCameraConfig[index], index: index, stream: stream)
         }
     }
 
-    func session(_ session: OTSession, streamDestroyed stream: OTStream) {
+    // Keeps the tile so the next stream in the session is subscribed into it.
+    func sessionManager(_ manager: SessionManager, configAt index: Int, streamDestroyed stream: AnyObject) {
         print("A stream was destroyed in the session.")
-        guard var cameraConfig = findCameraConfig(by: session) else { return }
-        cameraConfig.clear()
-        
+        guard !allCameraConfig[index].isPublisher,
+            let subscribed = allCameraConfig[index].subscriber?.stream,
+            subscribed.streamId == (stream as? OTStream)?.streamId else {
+            return
+        }
+        if Constants.isCompositedRenderingEnabled {
+            interlocutorCompositor.clearTile(tileIndex(config: allCameraConfig[index]))
+        }
+        allCameraConfig[index].unsubscribe()
+        forgetCameraConfig(at: index)
+    }
+
+    func sessionManager(_ manager: SessionManager, didBeginReconnectingConfigAt index: Int) {
+        print("The client is reconnecting to the OpenTok session.")
+    }
+
+    func sessionManager(_ manager: SessionManager, didReconnectConfigAt index: Int) {
+        print("The client reconnected to the OpenTok session.")
+    }
+
+    func sessionManager(_ manager: SessionManager, willRecoverConfigAt index: Int) {
+        print("The client lost the OpenTok session and is joining it again.")
+        if Constants.isCompositedRenderingEnabled && !allCameraConfig[index].isPublisher {
+            interlocutorCompositor.clearTile(tileIndex(config: allCameraConfig[index]))
+        }
+        allCameraConfig[index].detach()
+        forgetCameraConfig(at: index)
     }
 }
 
 // MARK: - OTPublisherDelegate callbacks
+// The SDK calls these on the session manager's API queue; anything touching
+// the configs or views goes to the main thread.
 extension VideoVC: OTPublisherDelegate {
     func publisher(_ publisher: OTPublisherKit, didFailWithError error: OTError) {
         print("The publisher failed: \(error)")
-        guard var cameraConfig = findCameraConfig(by: publisher) else { return }
-        cameraConfig.clear()
-    
+        DispatchQueue.main.async { [weak self] in
+            guard let self = self, let index = self.sessionManager.index(ofPublisher: publisher) else { return }
+            self.clearCameraConfig(at: index)
+        }
+    }
+
+    func publisher(_ publisher: OTPublisherKit, streamCreated stream: OTStream) {
+        guard let index = sessionManager.index(ofPublisher: publisher) else { return }
+        sessionManager.reportFirstFrame(at: index)
     }
 }
 
@@ -178,10 +474,47 @@ extension VideoVC: OTSubscriberDelegate {
        print("The subscriber did connect to the stream.")
    }
 
+   // Every frame, so it stays on the API queue: it only takes the manager's lock.
+   public func subscriberVideoDataReceived(_ subscriber: OTSubscriber) {
+       guard let index = sessionManager.index(ofSubscriber: subscriber) else { return }
+       sessionManager.reportFirstFrame(at: index)
+   }
+
    public func subscriber(_ subscriber: OTSubscriberKit, didFailWithError error: OTError) {
        print("The subscriber failed to connect to the stream.")
-    guard var cameraConfig = findCameraConfig(by: subscriber) else { return }
-    cameraConfig.clear()
-    
+       DispatchQueue.main.async { [weak self] in
+           guard let self = self, let index = self.sessionManager.index(ofSubscriber: subscriber) else { return }
+           self.clearCameraConfig(at: index)
+       }
    }
 }
+
+// MARK: - OTPublisherKitNetworkStatsDelegate callbacks
+extension VideoVC: OTPublisherKitNetworkStatsDelegate {
+    func publisher(_ publisher: OTPublisherKit, videoNetworkStatsUpdated stats: [OTPublisherKitVideoNetworkStats]) {
+        telemetryStream(of: publisher)?.record(stats)
+    }
+
+    func publisher(_ publisher: OTPublisherKit, audioNetworkStatsUpdated stats: [OTPublisherKitAudioNetworkStats]) {
+        telemetryStream(of: publisher)?.record(stats)
+    }
+}
+
+// MARK: - OTSubscriberKitNetworkStatsDelegate callbacks
+extension VideoVC: OTSubscriberKitNetworkStatsDelegate {
+    func subscriber(_ subscriber: OTSubscriberKit, videoNetworkStatsUpdated stats: OTSubscriberKitVideoNetworkStats) {
+        telemetryStream(of: subscriber)?.record(stats)
+    }
+
+    func subscriber(_ subscriber: OTSubscriberKit, audioNetworkStatsUpdated stats: OTSubscriberKitAudioNetworkStats) {
+        telemetryStream(of: subscriber)?.record(stats)
+    }
+}
+
+// MARK: - OTSubscriberKitAudioLevelDelegate callbacks
+extension VideoVC: OTSubscriberKitAudioLevelDelegate {
+    func subscriber(_ subscriber: OTSubscriberKit, audioLevelUpdated audioLevel: Float) {
+        guard let index = sessionManager.index(ofSubscriber: subscriber) else { return }
+        speakers.meter(forConfigAt: index).process(audioLevel: audioLevel)
+    }
+}
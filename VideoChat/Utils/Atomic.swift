@@ -0,0 +1,101 @@
+//
+//  Atomic.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+final class AtomicInt {
+
+    private let storage: UnsafeMutablePointer<Int64>
+
+    init(_ value: Int64 = 0) {
+        storage = UnsafeMutablePointer<Int64>.allocate(capacity: 1)
+        storage.initialize(to: value)
+    }
+
+    deinit {
+        storage.deinitialize(count: 1)
+        storage.deallocate()
+    }
+
+    var value: Int64 {
+        return vc_atomic_load(storage)
+    }
+
+    func store(_ newValue: Int64) {
+        vc_atomic_store(storage, newValue)
+    }
+
+    @discardableResult
+    func exchange(_ newValue: Int64) -> Int64 {
+        return vc_atomic_exchange(storage, newValue)
+    }
+
+    @discardableResult
+    func increment(by delta: Int64 = 1) -> Int64 {
+        return vc_atomic_fetch_add(storage, delta) + delta
+    }
+
+    @discardableResult
+    func decrement(by delta: Int64 = 1) -> Int64 {
+        return vc_atomic_fetch_add(storage, -delta) - delta
+    }
+
+    @discardableResult
+    func setBits(_ bits: Int64) -> Int64 {
+        return vc_atomic_fetch_or(storage, bits) | bits
+    }
+
+    func compareExchange(expected: Int64, desired: Int64) -> Bool {
+        return vc_atomic_compare_exchange(storage, expected, desired)
+    }
+
+    func storeMax(_ candidate: Int64) {
+        vc_atomic_store_max(storage, candidate)
+    }
+}
+
+// Fixed number of atomics in one allocation: ring slots, histogram buckets.
+final class AtomicIntArray {
+
+    let count: Int
+    private let storage: UnsafeMutablePointer<Int64>
+
+    init(count: Int, repeating value: Int64 = 0) {
+        self.count = count
+        storage = UnsafeMutablePointer<Int64>.allocate(capacity: count)
+        storage.initialize(repeating: value, count: count)
+    }
+
+    deinit {
+        storage.deinitialize(count: count)
+        storage.deallocate()
+    }
+
+    subscript(index: Int) -> Int64 {
+        return vc_atomic_load(storage + index)
+    }
+
+    func store(_ newValue: Int64, at index: Int) {
+        vc_atomic_store(storage + index, newValue)
+    }
+
+    @discardableResult
+    func exchange(_ newValue: Int64, at index: Int) -> Int64 {
+        return vc_atomic_exchange(storage + index, newValue)
+    }
+
+    @discardableResult
+    func increment(at index: Int, by delta: Int64 = 1) -> Int64 {
+        return vc_atomic_fetch_add(storage + index, delta) + delta
+    }
+
+    func reset() {
+        for index in 0..<count {
+            vc_atomic_store(storage + index, 0)
+        }
+    }
+}
@@ -0,0 +1,48 @@
+//
+//  Atomics.h
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+#ifndef Atomics_h
+#define Atomics_h
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Swift 5 has no atomics of its own, so the lock-free pieces of the media
+// pipeline go through these wrappers around the clang __atomic builtins.
+
+static inline int64_t vc_atomic_load(const int64_t *value) {
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void vc_atomic_store(int64_t *value, int64_t newValue) {
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+static inline int64_t vc_atomic_exchange(int64_t *value, int64_t newValue) {
+    return __atomic_exchange_n(value, newValue, __ATOMIC_ACQ_REL);
+}
+
+static inline int64_t vc_atomic_fetch_add(int64_t *value, int64_t delta) {
+    return __atomic_fetch_add(value, delta, __ATOMIC_ACQ_REL);
+}
+
+static inline int64_t vc_atomic_fetch_or(int64_t *value, int64_t bits) {
+    return __atomic_fetch_or(value, bits, __ATOMIC_ACQ_REL);
+}
+
+static inline bool vc_atomic_compare_exchange(int64_t *value, int64_t expected, int64_t desired) {
+    return __atomic_compare_exchange_n(value, &expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+static inline void vc_atomic_store_max(int64_t *value, int64_t candidate) {
+    int64_t current = __atomic_load_n(value, __ATOMIC_RELAXED);
+    while (candidate > current &&
+           !__atomic_compare_exchange_n(value, &current, candidate, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+    }
+}
+
+#endif /* Atomics_h */
@@ -0,0 +1,41 @@
+//
+//  CPULoad.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+enum CPULoad {
+
+    // CPU used by this process across all of its threads, as a fraction of
+    // every core being busy (0...1).
+    static func current() -> Double {
+        var threads: thread_act_array_t?
+        var threadCount = mach_msg_type_number_t(0)
+        guard task_threads(mach_task_self_, &threads, &threadCount) == KERN_SUCCESS, let list = threads else {
+            return 0
+        }
+        defer {
+            vm_deallocate(mach_task_self_,
+                          vm_address_t(UInt(bitPattern: list)),
+                          vm_size_t(Int(threadCount) * MemoryLayout<thread_t>.stride))
+        }
+
+        var usage = 0.0
+        for index in 0..<Int(threadCount) {
+            var info = thread_basic_info()
+            var count = mach_msg_type_number_t(MemoryLayout<thread_basic_info>.size / MemoryLayout<integer_t>.size)
+            let result = withUnsafeMutablePointer(to: &info) {
+                $0.withMemoryRebound(to: integer_t.self, capacity: Int(count)) {
+                    thread_info(list[index], thread_flavor_t(THREAD_BASIC_INFO), $0, &count)
+                }
+            }
+            mach_port_deallocate(mach_task_self_, list[index])
+            guard result == KERN_SUCCESS, info.flags & TH_FLAGS_IDLE == 0 else { continue }
+            usage += Double(info.cpu_usage) / Double(TH_USAGE_SCALE)
+        }
+        return min(usage / Double(ProcessInfo.processInfo.activeProcessorCount), 1)
+    }
+}
@@ -0,0 +1,102 @@
+//
+//  LatencyHistogram.swift
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import Foundation
+
+// Log-linear histogram of nanosecond latencies, 8 buckets per power of two
+// (about 12% resolution) up to ~18 minutes. Any thread can record without
+// locking; percentiles are read from a snapshot of the buckets.
+final class LatencyHistogram {
+
+    struct Summary {
+        let count: Int64
+        let mean: Double
+        let p50: Int64
+        let p95: Int64
+        let p99: Int64
+        let max: Int64
+    }
+
+    private static let subBucketBits: Int64 = 3
+    private static let subBucketCount: Int64 = 1 << subBucketBits
+    private static let linearLimit: Int64 = subBucketCount * 2
+    private static let maxExponent: Int64 = 40
+    static let bucketCount = Int(linearLimit + (maxExponent - subBucketBits - 1) * subBucketCount)
+
+    private let buckets = AtomicIntArray(count: LatencyHistogram.bucketCount)
+    private let total = AtomicInt()
+    private let sum = AtomicInt()
+    private let maximum = AtomicInt()
+
+    func record(_ nanoseconds: Int64) {
+        let value = max(nanoseconds, 0)
+        buckets.increment(at: LatencyHistogram.bucketIndex(value))
+        total.increment()
+        sum.increment(by: value)
+        maximum.storeMax(value)
+    }
+
+    func reset() {
+        buckets.reset()
+        total.store(0)
+        sum.store(0)
+        maximum.store(0)
+    }
+
+    var count: Int64 {
+        return total.value
+    }
+
+    var mean: Double {
+        let count = total.value
+        return count > 0 ? Double(sum.value) / Double(count) : 0
+    }
+
+    func percentile(_ percent: Double) -> Int64 {
+        let count = total.value
+        guard count > 0 else { return 0 }
+        let rank = max(Int64((Double(count) * percent / 100).rounded(.up)), 1)
+        var seen: Int64 = 0
+        for index in 0..<buckets.count {
+            seen += buckets[index]
+            if seen >= rank {
+                return min(LatencyHistogram.upperBound(of: index), maximum.value)
+            }
+        }
+        return maximum.value
+    }
+
+    var summary: Summary {
+        return Summary(count: total.value,
+                       mean: mean,
+                       p50: percentile(50),
+                       p95: percentile(95),
+                       p99: percentile(99),
+                       max: maximum.value)
+    }
+
+    private static func bucketIndex(_ value: Int64) -> Int {
+        if value < linearLimit {
+            return Int(value)
+        }
+        let exponent = min(Int64(63 - value.leadingZeroBitCount), maxExponent - 1)
+        let mantissa = (value >> (exponent - subBucketBits)) & (subBucketCount - 1)
+        let index = linearLimit + (exponent - subBucketBits - 1) * subBucketCount + mantissa
+        return Int(min(index, Int64(bucketCount - 1)))
+    }
+
+    private static func upperBound(of index: Int) -> Int64 {
+        let index = Int64(index)
+        if index < linearLimit {
+            return index
+        }
+        let exponent = (index - linearLimit) / subBucketCount + subBucketBits + 1
+        let mantissa = (index - linearLimit) % subBucketCount
+        let lower = (subBucketCount + mantissa) << (exponent - subBucketBits)
+        return lower + (1 << (exponent - subBucketBits)) - 1
+    }
+}
@@ -0,0 +1,8 @@
+//
+//  VideoChat-Bridging-Header.h
+//  VideoChat
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+#import "Utils/Atomics.h"
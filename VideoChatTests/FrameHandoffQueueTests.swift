@@ -0,0 +1,139 @@
+//
+//  FrameHandoffQueueTests.swift
+//  VideoChatTests
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import XCTest
+@testable import VideoChat
+
+final class FrameHandoffQueueTests: XCTestCase {
+
+    // Counts frames alive and released, and releases of a frame after the first
+    private final class Tracker {
+        let created = AtomicInt()
+        let alive = AtomicInt()
+        let released = AtomicInt()
+        let doubleReleases = AtomicInt()
+    }
+
+    private final class TrackedFrame {
+        let number: Int
+        private let tracker: Tracker
+        private let releases = AtomicInt()
+
+        init(_ number: Int = 0, tracker: Tracker) {
+            self.number = number
+            self.tracker = tracker
+            tracker.created.increment()
+            tracker.alive.increment()
+        }
+
+        deinit {
+            tracker.alive.decrement()
+        }
+
+        func release() {
+            if releases.increment() == 1 {
+                tracker.released.increment()
+            } else {
+                tracker.doubleReleases.increment()
+            }
+        }
+    }
+
+    func testFullRingDropsOldest() {
+        let tracker = Tracker()
+        var dropped: [Int] = []
+        let queue = FrameHandoffQueue<TrackedFrame>(capacity: 2) { frame in
+            dropped.append(frame.number)
+            frame.release()
+        }
+
+        XCTAssertTrue(queue.push(TrackedFrame(1, tracker: tracker)))
+        XCTAssertTrue(queue.push(TrackedFrame(2, tracker: tracker)))
+        XCTAssertFalse(queue.push(TrackedFrame(3, tracker: tracker)))
+        XCTAssertEqual(dropped, [1])
+        XCTAssertEqual(queue.pop()?.number, 2)
+        XCTAssertEqual(queue.pop()?.number, 3)
+        XCTAssertNil(queue.pop())
+
+        let statistics = queue.statistics
+        XCTAssertEqual(statistics.pushed, 3)
+        XCTAssertEqual(statistics.popped, 2)
+        XCTAssertEqual(statistics.dropped, 1)
+        XCTAssertEqual(statistics.depth, 0)
+    }
+
+    func testDeinitHandsBackQueuedFrames() {
+        let tracker = Tracker()
+        var queue: FrameHandoffQueue<TrackedFrame>? = FrameHandoffQueue(capacity: 4) { $0.release() }
+        for number in 0..<3 {
+            queue?.push(TrackedFrame(number, tracker: tracker))
+        }
+        queue = nil
+
+        XCTAssertEqual(tracker.released.value, 3)
+        XCTAssertEqual(tracker.alive.value, 0)
+    }
+
+    // Several producers and a consumer that stalls now and then, so pushes
+    // race pops and drops. Every frame must end up released exactly once.
+    func testStressLosesAndDoubleReleasesNothing() {
+        for (producers, capacity) in [(1, 2), (4, 2), (4, 4)] {
+            let tracker = Tracker()
+            let released = AtomicInt()
+            let queue = FrameHandoffQueue<TrackedFrame>(capacity: capacity) { $0.release() }
+            let isRunning = AtomicInt(1)
+            let group = DispatchGroup()
+
+            for _ in 0..<producers {
+                group.enter()
+                Thread {
+                    while isRunning.value != 0 {
+                        queue.push(TrackedFrame(tracker: tracker))
+                    }
+                    group.leave()
+                }.start()
+            }
+            group.enter()
+            Thread {
+                var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+                while isRunning.value != 0 {
+                    random ^= random << 13
+                    random ^= random >> 7
+                    random ^= random << 17
+                    if random % 64 == 0 {
+                        usleep(50)
+                    }
+                    if let frame = queue.pop() {
+                        frame.release()
+                        released.increment()
+                    }
+                }
+                group.leave()
+            }.start()
+
+            Thread.sleep(forTimeInterval: 1)
+            isRunning.store(0)
+            XCTAssertEqual(group.wait(timeout: .now() + 10), .success)
+
+            while let frame = queue.pop() {
+                frame.release()
+                released.increment()
+            }
+            let statistics = queue.statistics
+            XCTAssertGreaterThan(statistics.pushed, 0)
+            XCTAssertEqual(statistics.popped, released.value)
+            XCTAssertEqual(statistics.pushed, statistics.popped + statistics.dropped,
+                           "\(producers) producers, capacity \(capacity)")
+
+            XCTAssertEqual(tracker.alive.value, 0, "\(producers) producers, capacity \(capacity): frames leaked")
+            XCTAssertEqual(tracker.released.value, tracker.created.value,
+                           "\(producers) producers, capacity \(capacity): frames never released")
+            XCTAssertEqual(tracker.doubleReleases.value, 0,
+                           "\(producers) producers, capacity \(capacity): frames released twice")
+        }
+    }
+}
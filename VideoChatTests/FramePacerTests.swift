@@ -0,0 +1,90 @@
+//
+//  FramePacerTests.swift
+//  VideoChatTests
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import XCTest
+@testable import VideoChat
+
+final class FramePacerTests: XCTestCase {
+
+    // The traces of FramePacerBenchmark: nominal 30 fps on a clock 0.2% slow,
+    // triangular jitter, and now and then a frame the camera dropped.
+    static let captureFrameRate = 29.94
+    static let jitters = [0.002, 0.005, 0.010]
+    static let dropRates = [0.0, 0.02]
+    static let targetFrameRates = [30, 15, 7, 1]
+    static let duration: TimeInterval = 60
+    // Left out while the loop locks on
+    static let warmup: TimeInterval = 2
+
+    func testOutputJitterIsBoundedForJitteredTraces() {
+        for jitter in FramePacerTests.jitters {
+            for dropRate in FramePacerTests.dropRates {
+                for target in FramePacerTests.targetFrameRates {
+                    let name = "jitter \(jitter * 1_000) ms, drop rate \(dropRate), target \(target) fps"
+                    let pacer = FramePacer(targetFrameRate: target)
+                    let trace = makeTrace(jitter: jitter, dropRate: dropRate)
+                    var input: [Double] = []
+                    var output: [Double] = []
+                    for (captureTime, time) in trace {
+                        let paced = pacer.pace(seconds: time)
+                        guard captureTime >= FramePacerTests.warmup else { continue }
+                        input.append(time)
+                        if let paced = paced {
+                            output.append(paced)
+                        }
+                    }
+
+                    let period = 1 / FramePacerTests.captureFrameRate
+                    let interval = max(1 / Double(target), period)
+                    let inputJitter = deviation(of: input, from: period)
+                    let outputJitter = deviation(of: output, from: interval)
+                    XCTAssertLessThan(outputJitter.rms, inputJitter.rms / 4, name)
+                    XCTAssertLessThan(outputJitter.max, jitter / 4, name)
+
+                    let frameRate = Double(output.count) / (FramePacerTests.duration - FramePacerTests.warmup)
+                    let expected = min(Double(target), FramePacerTests.captureFrameRate) * (1 - dropRate)
+                    XCTAssertEqual(frameRate, expected, accuracy: expected * 0.05 + 0.1, name)
+                }
+            }
+        }
+    }
+
+    // Capture time and the jittered timestamp of every frame the camera delivers
+    private func makeTrace(jitter: Double, dropRate: Double) -> [(Double, Double)] {
+        var random: UInt64 = 0x9E37_79B9_7F4A_7C15
+        // xorshift64*, uniform in 0..<1
+        func nextRandom() -> Double {
+            random ^= random >> 12
+            random ^= random << 25
+            random ^= random >> 27
+            return Double((random &* 0x2545_F491_4F6C_DD1D) >> 11) / Double(1 << 53)
+        }
+
+        let period = 1 / FramePacerTests.captureFrameRate
+        var trace: [(Double, Double)] = []
+        for index in 0..<Int(FramePacerTests.duration / period) {
+            guard nextRandom() >= dropRate else { continue }
+            let offset = (nextRandom() + nextRandom() - 1) * jitter
+            trace.append((Double(index) * period, Double(index) * period + offset))
+        }
+        return trace
+    }
+
+    // How far the gaps between timestamps are from a whole number of
+    // intervals, so frames the camera dropped do not count as jitter
+    private func deviation(of times: [Double], from interval: Double) -> (rms: Double, max: Double) {
+        var squares = 0.0
+        var largest = 0.0
+        for index in 1..<times.count {
+            let gap = times[index] - times[index - 1]
+            let error = gap - (gap / interval).rounded() * interval
+            squares += error * error
+            largest = max(largest, abs(error))
+        }
+        return ((squares / Double(max(times.count - 1, 1))).squareRoot(), largest)
+    }
+}
@@ -0,0 +1,117 @@
+//
+//  FrameTransformerTests.swift
+//  VideoChatTests
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import OpenTok
+import XCTest
+@testable import VideoChat
+
+final class FrameTransformerTests: XCTestCase {
+
+    static let pixelFormats: [PixelFormat] = [.i420, .nv12, .argb]
+    static let orientations: [OTVideoOrientation] = [.up, .down, .left, .right]
+    // Neither side a multiple of the tile, so edge tiles are covered
+    static let width = FrameTransformer.tileSize * 2 + 22
+    static let height = FrameTransformer.tileSize + 34
+
+    // Converted upright first, then rotated one pixel at a time, so nothing
+    // is shared with the tiled path but the converter.
+    func testMatchesPerPixelRotation() {
+        let pool = VideoFrameBufferPool()
+        let transformer = FrameTransformer(pool: pool)
+        for source in FrameTransformerTests.pixelFormats {
+            let input = SyntheticVideoSource(pixelFormat: source, width: FrameTransformerTests.width,
+                                             height: FrameTransformerTests.height, noise: 8, pool: pool)
+            let frame = input.nextFrame()
+            defer { frame.release() }
+            for destination in FrameTransformerTests.pixelFormats {
+                guard let upright = PixelFormatConverter.shared.convert(frame, to: destination, pool: pool) else {
+                    XCTFail("\(source) to \(destination) conversion failed")
+                    continue
+                }
+                defer { upright.release() }
+                for orientation in FrameTransformerTests.orientations {
+                    let name = "\(source) to \(destination), orientation \(orientation.rawValue)"
+                    guard let transformed = transformer.transform(frame, orientation: orientation, to: destination) else {
+                        XCTFail("\(name): transform failed")
+                        continue
+                    }
+                    defer { transformed.release() }
+                    let reference = rotated(VideoPlanes(buffer: upright), orientation: orientation, pool: pool)
+                    defer { reference.release() }
+
+                    XCTAssertEqual(mismatchedBytes(VideoPlanes(buffer: transformed), VideoPlanes(buffer: reference)), 0,
+                                   name)
+                }
+            }
+        }
+    }
+
+    func testRejectsWrongDestinationSize() {
+        let pool = VideoFrameBufferPool()
+        let source = pool.acquire(format: VideoFrameFormat(pixelFormat: .i420, width: 64, height: 32))
+        let destination = pool.acquire(format: VideoFrameFormat(pixelFormat: .i420, width: 64, height: 32))
+        defer {
+            source.release()
+            destination.release()
+        }
+
+        XCTAssertFalse(FrameTransformer(pool: pool).transform(VideoPlanes(buffer: source), orientation: .left,
+                                                              into: VideoPlanes(buffer: destination)))
+    }
+
+    // Left turns the image clockwise, right counter-clockwise.
+    private func rotated(_ source: VideoPlanes, orientation: OTVideoOrientation,
+                         pool: VideoFrameBufferPool) -> VideoFrameBuffer {
+        let size = FrameTransformer.outputSize(width: source.width, height: source.height, orientation: orientation)
+        let buffer = pool.acquire(format: VideoFrameFormat(pixelFormat: source.pixelFormat,
+                                                           width: size.width, height: size.height))
+        let destination = VideoPlanes(buffer: buffer)
+        for plane in 0..<source.pixelFormat.planeCount {
+            let width = source.planeWidth(plane)
+            let height = source.planeHeight(plane)
+            let bytesPerPixel = source.pixelFormat.bytesPerPixel(plane: plane)
+            for y in 0..<height {
+                for x in 0..<width {
+                    let target: (x: Int, y: Int)
+                    switch orientation {
+                    case .left:
+                        target = (height - 1 - y, x)
+                    case .right:
+                        target = (y, width - 1 - x)
+                    case .down:
+                        target = (width - 1 - x, height - 1 - y)
+                    default:
+                        target = (x, y)
+                    }
+                    let from = source.plane(plane).row(y) + x * bytesPerPixel
+                    let to = destination.plane(plane).row(target.y) + target.x * bytesPerPixel
+                    to.assign(from: from, count: bytesPerPixel)
+                }
+            }
+        }
+        return buffer
+    }
+
+    // Row padding is never written, so it is not compared.
+    private func mismatchedBytes(_ lhs: VideoPlanes, _ rhs: VideoPlanes) -> Int {
+        guard lhs.pixelFormat == rhs.pixelFormat, lhs.width == rhs.width, lhs.height == rhs.height else {
+            return Int.max
+        }
+        var count = 0
+        for plane in 0..<lhs.pixelFormat.planeCount {
+            let rowLength = lhs.planeWidth(plane) * lhs.pixelFormat.bytesPerPixel(plane: plane)
+            for y in 0..<lhs.planeHeight(plane) {
+                let left = lhs.plane(plane).row(y)
+                let right = rhs.plane(plane).row(y)
+                for x in 0..<rowLength where left[x] != right[x] {
+                    count += 1
+                }
+            }
+        }
+        return count
+    }
+}
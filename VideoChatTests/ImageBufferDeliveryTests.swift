@@ -0,0 +1,192 @@
+//
+//  ImageBufferDeliveryTests.swift
+//  VideoChatTests
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import CoreGraphics
+import CoreMedia
+import OpenTok
+import XCTest
+@testable import VideoChat
+
+final class ImageBufferDeliveryTests: XCTestCase {
+
+    final class CountingConsumer: NSObject, OTVideoCaptureConsumer {
+
+        var acceptsImageBuffers: Bool
+        private(set) var imageBuffers = 0
+        private(set) var imageBufferAttempts = 0
+        private(set) var frames = 0
+        private(set) var metadata: [Data?] = []
+
+        init(acceptsImageBuffers: Bool) {
+            self.acceptsImageBuffers = acceptsImageBuffers
+            super.init()
+        }
+
+        func consumeFrame(_ frame: OTVideoFrame) {
+            frames += 1
+            metadata.append(frame.metadata)
+        }
+
+        func consumeImageBuffer(_ frame: CVImageBuffer, orientation: OTVideoOrientation,
+                                timestamp ts: CMTime, metadata: Data?) -> Bool {
+            imageBufferAttempts += 1
+            if acceptsImageBuffers {
+                imageBuffers += 1
+            }
+            return acceptsImageBuffers
+        }
+    }
+
+    static let pixelFormats: [PixelFormat] = [.nv12, .i420, .argb]
+    static let filters = ["none", "crop", "mirror"]
+    static let width = 320
+    static let height = 180
+    static let frames = 10
+
+    // The capturer's path as in DeliveryBenchmark: optionally halved, then a
+    // filter, then delivery. A crop is a view the graph copies out, a mirror
+    // writes its own buffer, and consumeFrame copies into the SDK's frame.
+    func testCopiesPerPath() {
+        for pixelFormat in ImageBufferDeliveryTests.pixelFormats {
+            for acceptsImageBuffers in [true, false] {
+                for isDownscaled in [false, true] {
+                    for filter in ImageBufferDeliveryTests.filters {
+                        var expected = filter == "crop" ? 1 : 0
+                        if isDownscaled {
+                            expected += 1
+                        }
+                        if !acceptsImageBuffers {
+                            expected += 1
+                        }
+                        let name = "\(pixelFormat) \(filter), image buffers \(acceptsImageBuffers), "
+                            + "downscaled \(isDownscaled)"
+                        let statistics = deliver(pixelFormat: pixelFormat, acceptsImageBuffers: acceptsImageBuffers,
+                                                 isDownscaled: isDownscaled, filter: filter)
+
+                        XCTAssertEqual(statistics.frames, Int64(ImageBufferDeliveryTests.frames), name)
+                        XCTAssertEqual(statistics.copies, Int64(expected * ImageBufferDeliveryTests.frames), name)
+                        XCTAssertEqual(statistics.zeroCopyFrames,
+                                       acceptsImageBuffers ? Int64(ImageBufferDeliveryTests.frames) : 0, name)
+                    }
+                }
+            }
+        }
+    }
+
+    func testFrameWithoutMetadataClearsThePreviousOne() {
+        let delivery = ImageBufferDelivery()
+        let consumer = CountingConsumer(acceptsImageBuffers: false)
+        let stamp = FrameStamp(sequence: 1, capturedAt: 1).data
+
+        for metadata in [stamp, nil] {
+            guard let pixelBuffer = makePixelBuffer(pixelFormat: .i420, width: 64, height: 64) else {
+                return XCTFail("No pixel buffer")
+            }
+            delivery.deliver(pixelBuffer, orientation: .up, timestamp: .zero, metadata: metadata, to: consumer)
+        }
+
+        XCTAssertEqual(consumer.metadata.count, 2)
+        XCTAssertEqual(consumer.metadata.first ?? nil, stamp)
+        XCTAssertTrue(consumer.metadata.last??.isEmpty ?? true)
+    }
+
+    func testRefusedImageBuffersAreRetried() {
+        let delivery = ImageBufferDelivery()
+        let consumer = CountingConsumer(acceptsImageBuffers: false)
+        func deliver(width: Int, height: Int) {
+            guard let pixelBuffer = makePixelBuffer(pixelFormat: .nv12, width: width, height: height) else {
+                return XCTFail("No pixel buffer")
+            }
+            delivery.deliver(pixelBuffer, orientation: .up, timestamp: .zero, metadata: nil, to: consumer)
+        }
+
+        for _ in 0..<3 {
+            deliver(width: 64, height: 64)
+        }
+        XCTAssertEqual(consumer.imageBufferAttempts, 1)
+        XCTAssertFalse(delivery.isZeroCopy)
+
+        // A new size is tried at once
+        deliver(width: 32, height: 32)
+        XCTAssertEqual(consumer.imageBufferAttempts, 2)
+
+        // The same size again after retryFrames
+        consumer.acceptsImageBuffers = true
+        for _ in 0..<ImageBufferDelivery.retryFrames {
+            deliver(width: 32, height: 32)
+        }
+        XCTAssertEqual(consumer.imageBufferAttempts, 3)
+        XCTAssertEqual(consumer.imageBuffers, 1)
+        XCTAssertTrue(delivery.isZeroCopy)
+    }
+
+    // Copying full range planes into a video range frame would shift every level.
+    func testFullRangeIsNotCopied() {
+        var pixelBuffer: CVPixelBuffer?
+        CVPixelBufferCreate(nil, 64, 64, kCVPixelFormatType_420YpCbCr8BiPlanarFullRange, nil, &pixelBuffer)
+        guard let fullRange = pixelBuffer else { return XCTFail("No pixel buffer") }
+        let delivery = ImageBufferDelivery()
+        let consumer = CountingConsumer(acceptsImageBuffers: false)
+
+        XCTAssertFalse(delivery.deliver(fullRange, orientation: .up, timestamp: .zero, metadata: nil, to: consumer))
+        XCTAssertEqual(consumer.frames, 0)
+        XCTAssertEqual(delivery.statistics.framesDropped, 1)
+    }
+
+    private func makePixelBuffer(pixelFormat: PixelFormat, width: Int, height: Int) -> CVPixelBuffer? {
+        let buffer = SyntheticVideoSource(pixelFormat: pixelFormat, width: width, height: height).nextFrame()
+        defer { buffer.release() }
+        return buffer.makePixelBuffer()
+    }
+
+    private func deliver(pixelFormat: PixelFormat, acceptsImageBuffers: Bool, isDownscaled: Bool,
+                         filter: String) -> ImageBufferDelivery.Statistics {
+        let width = ImageBufferDeliveryTests.width
+        let height = ImageBufferDeliveryTests.height
+        let source = SyntheticVideoSource(pixelFormat: pixelFormat, width: width, height: height)
+        let downscaler = FrameDownscaler()
+        let delivery = ImageBufferDelivery()
+        let graph = VideoFilterGraph()
+        graph.onCopy = { bytes in
+            delivery.recordCopy(bytes: bytes)
+        }
+        switch filter {
+        case "crop":
+            graph.filters = [CropFilter(rect: CGRect(x: 0.125, y: 0.125, width: 0.75, height: 0.75))]
+        case "mirror":
+            graph.filters = [MirrorFilter()]
+        default:
+            break
+        }
+        let consumer = CountingConsumer(acceptsImageBuffers: acceptsImageBuffers)
+
+        for index in 0..<ImageBufferDeliveryTests.frames {
+            let buffer = source.nextFrame()
+            var pixelBuffer: CVPixelBuffer?
+            if isDownscaled {
+                downscaler.begin(VideoPlanes(buffer: buffer))
+                if let scaled = downscaler.scale(toWidth: width / 2, height: height / 2) {
+                    pixelBuffer = scaled.makePixelBuffer()
+                    delivery.recordCopy(bytes: scaled.format.byteCount)
+                    scaled.release()
+                }
+                downscaler.end()
+            } else {
+                pixelBuffer = buffer.makePixelBuffer()
+            }
+            buffer.release()
+            guard let input = pixelBuffer else {
+                XCTFail("No pixel buffer for frame \(index)")
+                continue
+            }
+            delivery.deliver(graph.process(input), orientation: .up,
+                             timestamp: CMTime(value: CMTimeValue(index), timescale: 30),
+                             metadata: nil, to: consumer)
+        }
+        return delivery.statistics
+    }
+}
@@ -0,0 +1,85 @@
+//
+//  LatencyTracerTests.swift
+//  VideoChatTests
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import OpenTok
+import XCTest
+@testable import VideoChat
+
+final class LatencyTracerTests: XCTestCase {
+
+    private final class CountingRender: NSObject, OTVideoRender {
+        private(set) var frames = 0
+
+        func renderVideoFrame(_ frame: OTVideoFrame) {
+            frames += 1
+        }
+    }
+
+    func testStampRoundTrips() {
+        let stamp = FrameStamp(sequence: 0x0102_0304, capturedAt: 0x1122_3344_5566_7788)
+        let data = stamp.data
+
+        XCTAssertEqual(data.count, FrameStamp.size)
+        XCTAssertEqual(Array(data.prefix(4)), Array("VLT1".utf8))
+        XCTAssertEqual(FrameStamp(metadata: data), stamp)
+        XCTAssertNil(FrameStamp(metadata: data.prefix(FrameStamp.size - 1)))
+        var foreign = data
+        foreign[0] ^= 0xFF
+        XCTAssertNil(FrameStamp(metadata: foreign))
+    }
+
+    func testRecordsLatencyAndLostFrames() {
+        let tracer = LatencyTracer()
+        let next = CountingRender()
+        let render = LatencyTracingRender(next: next, streamName: "stream", tracer: tracer)
+        let frame = OTVideoFrame(format: VideoFrameFormat(pixelFormat: .i420, width: 64, height: 64).makeVideoFormat())
+        let delay: UInt64 = 5_000_000
+
+        let startedAt = FrameStamp.now()
+        for sequence: UInt32 in [1, 2, 5, 6] {
+            var error: OTError?
+            frame.setMetadata(tracer.stamp(sequence: sequence, capturedAt: FrameStamp.now() - delay), error: &error)
+            XCTAssertNil(error)
+            render.renderVideoFrame(frame)
+        }
+        let elapsed = FrameStamp.now() - startedAt
+
+        let statistics = tracer.statistics["stream"]
+        XCTAssertEqual(next.frames, 4)
+        XCTAssertEqual(statistics?.latency.count, 4)
+        XCTAssertGreaterThanOrEqual(statistics?.latency.max ?? 0, Int64(delay))
+        XCTAssertLessThanOrEqual(statistics?.latency.max ?? .max, Int64(delay + elapsed))
+        XCTAssertEqual(statistics?.framesLost, 2)
+    }
+
+    func testUnstampedFramesPassThrough() {
+        let tracer = LatencyTracer()
+        let next = CountingRender()
+        let render = LatencyTracingRender(next: next, streamName: "stream", tracer: tracer)
+        let frame = OTVideoFrame(format: VideoFrameFormat(pixelFormat: .i420, width: 64, height: 64).makeVideoFormat())
+
+        render.renderVideoFrame(frame)
+
+        XCTAssertEqual(next.frames, 1)
+        XCTAssertEqual(tracer.statistics["stream"]?.latency.count, 0)
+    }
+
+    // A stream subscribed again after a recovery keeps its history.
+    func testStreamHistorySurvivesNewRender() {
+        let tracer = LatencyTracer()
+        let frame = OTVideoFrame(format: VideoFrameFormat(pixelFormat: .i420, width: 64, height: 64).makeVideoFormat())
+        var error: OTError?
+        frame.setMetadata(tracer.stamp(sequence: 1, capturedAt: FrameStamp.now()), error: &error)
+
+        LatencyTracingRender(next: CountingRender(), streamName: "stream", tracer: tracer).renderVideoFrame(frame)
+        LatencyTracingRender(next: CountingRender(), streamName: "stream", tracer: tracer).renderVideoFrame(frame)
+        XCTAssertEqual(tracer.statistics["stream"]?.latency.count, 2)
+
+        tracer.removeAll()
+        XCTAssertTrue(tracer.statistics.isEmpty)
+    }
+}
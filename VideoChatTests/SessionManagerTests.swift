@@ -0,0 +1,245 @@
+//
+//  SessionManagerTests.swift
+//  VideoChatTests
+//
+//  Copyright © 2020 SW-Expert. All rights reserved.
+//
+
+import XCTest
+@testable import VideoChat
+
+final class SessionManagerTests: XCTestCase {
+
+    // Delegate calls in order, on its own serial queue
+    private final class Recorder: SessionManagerDelegate {
+
+        enum Kind {
+            case connect, disconnect, failure, willRecover, beginReconnecting, reconnect
+        }
+
+        struct Event {
+            let kind: Kind
+            let index: Int
+            let time: TimeInterval
+        }
+
+        let queue = DispatchQueue(label: "VideoChatTests.SessionManager.callbacks")
+        private var recorded: [Event] = []
+
+        var events: [Event] {
+            return queue.sync { recorded }
+        }
+
+        func count(_ kind: Kind, at index: Int? = nil) -> Int {
+            return events.filter { $0.kind == kind && (index == nil || $0.index == index) }.count
+        }
+
+        // Polls until `condition` holds; false on timeout.
+        func wait(timeout: TimeInterval, until condition: ([Event]) -> Bool) -> Bool {
+            let deadline = Date().addingTimeInterval(timeout)
+            while Date() < deadline {
+                if condition(events) {
+                    return true
+                }
+                Thread.sleep(forTimeInterval: 0.005)
+            }
+            return condition(events)
+        }
+
+        private func record(_ kind: Kind, _ index: Int) {
+            recorded.append(Event(kind: kind, index: index, time: SessionManagerTests.now()))
+        }
+
+        func sessionManager(_ manager: SessionManager, didConnectConfigAt index: Int) {
+            record(.connect, index)
+        }
+
+        func sessionManager(_ manager: SessionManager, didDisconnectConfigAt index: Int) {
+            record(.disconnect, index)
+        }
+
+        func sessionManager(_ manager: SessionManager, configAt index: Int, didFailWithError error: Error) {
+            record(.failure, index)
+        }
+
+        func sessionManager(_ manager: SessionManager, configAt index: Int, streamCreated stream: AnyObject) {
+        }
+
+        func sessionManager(_ manager: SessionManager, configAt index: Int, streamDestroyed stream: AnyObject) {
+        }
+
+        func sessionManager(_ manager: SessionManager, didBeginReconnectingConfigAt index: Int) {
+            record(.beginReconnecting, index)
+        }
+
+        func sessionManager(_ manager: SessionManager, didReconnectConfigAt index: Int) {
+            record(.reconnect, index)
+        }
+
+        func sessionManager(_ manager: SessionManager, willRecoverConfigAt index: Int) {
+            record(.willRecover, index)
+        }
+    }
+
+    static let connectDelay: TimeInterval = 0.02
+    // Queue hops and timer leeway on a busy simulator
+    static let slack: TimeInterval = 0.5
+
+    private static func now() -> TimeInterval {
+        return TimeInterval(DispatchTime.now().uptimeNanoseconds) / 1_000_000_000
+    }
+
+    private func makeConfigs(_ count: Int) -> [CameraSessionConfig] {
+        return (0..<count).map {
+            CameraSessionConfig(apiKey: "key", cameraIndex: $0, session: "session-\($0)", token: "token", isPublisher: true)
+        }
+    }
+
+    private func makeManager(backend: FakeSessionBackend, policy: ReconnectPolicy, isWarmStandbyEnabled: Bool,
+                             recorder: Recorder) -> SessionManager {
+        let manager = SessionManager(backend: backend)
+        manager.reconnectPolicy = policy
+        manager.isWarmStandbyEnabled = isWarmStandbyEnabled
+        manager.callbackQueue = recorder.queue
+        manager.delegate = recorder
+        return manager
+    }
+
+    // The longest a loss may take to be recovered: every attempt times out
+    // after the longest backoff, and the last one connects.
+    private func recoveryBound(_ policy: ReconnectPolicy) -> TimeInterval {
+        var bound = SessionManagerTests.connectDelay + SessionManagerTests.slack
+        for attempt in 0..<policy.maxAttempts {
+            bound += policy.delay(forAttempt: attempt, random: 1) + policy.connectTimeout
+        }
+        return bound
+    }
+
+    func testDroppedSessionReconnectsAfterBackoff() {
+        var policy = ReconnectPolicy()
+        policy.baseDelay = 0.05
+        policy.maxDelay = 0.4
+        let backend = FakeSessionBackend(connectDelay: SessionManagerTests.connectDelay)
+        let recorder = Recorder()
+        let manager = makeManager(backend: backend, policy: policy, isWarmStandbyEnabled: false, recorder: recorder)
+
+        manager.connect(makeConfigs(1))
+        XCTAssertTrue(recorder.wait(timeout: 2) { $0.contains { $0.kind == .connect } })
+        guard let session = manager.session(at: 0) else { return XCTFail("No session after connecting") }
+
+        let droppedAt = SessionManagerTests.now()
+        backend.dropConnection(session)
+        XCTAssertTrue(recorder.wait(timeout: 5) { events in events.filter { $0.kind == .connect }.count == 2 })
+
+        let reconnectedAt = recorder.events.last { $0.kind == .connect }?.time ?? .infinity
+        let bound = policy.delay(forAttempt: 0, random: 1) + SessionManagerTests.connectDelay + SessionManagerTests.slack
+        XCTAssertLessThan(reconnectedAt - droppedAt, bound)
+        XCTAssertEqual(recorder.count(.willRecover), 1)
+        XCTAssertEqual(recorder.count(.failure), 0)
+        XCTAssertTrue(manager.session(at: 0) !== session)
+        manager.disconnectAll()
+    }
+
+    // The standby is already connected, so no backoff applies.
+    func testStandbyTakesOverWithoutBackoff() {
+        var policy = ReconnectPolicy()
+        policy.baseDelay = 2
+        let backend = FakeSessionBackend(connectDelay: SessionManagerTests.connectDelay)
+        let recorder = Recorder()
+        let manager = makeManager(backend: backend, policy: policy, isWarmStandbyEnabled: true, recorder: recorder)
+
+        manager.connect(makeConfigs(1))
+        XCTAssertTrue(recorder.wait(timeout: 2) { $0.contains { $0.kind == .connect } })
+        // Time for the standby to connect too
+        Thread.sleep(forTimeInterval: SessionManagerTests.connectDelay * 10)
+        guard let session = manager.session(at: 0) else { return XCTFail("No session after connecting") }
+
+        let droppedAt = SessionManagerTests.now()
+        backend.dropConnection(session)
+        XCTAssertTrue(recorder.wait(timeout: 5) { events in events.filter { $0.kind == .connect }.count == 2 })
+
+        let reconnectedAt = recorder.events.last { $0.kind == .connect }?.time ?? .infinity
+        XCTAssertLessThan(reconnectedAt - droppedAt, policy.delay(forAttempt: 0, random: 0))
+        XCTAssertEqual(recorder.count(.failure), 0)
+        manager.disconnectAll()
+    }
+
+    func testConnectTimeoutsFailAfterMaxAttempts() {
+        var policy = ReconnectPolicy()
+        policy.baseDelay = 0.02
+        policy.maxDelay = 0.1
+        policy.maxAttempts = 3
+        policy.connectTimeout = 0.05
+        var faults = FakeSessionBackend.Faults()
+        faults.connectTimeoutRate = 1
+        let backend = FakeSessionBackend(connectDelay: SessionManagerTests.connectDelay, faults: faults)
+        let recorder = Recorder()
+        let manager = makeManager(backend: backend, policy: policy, isWarmStandbyEnabled: false, recorder: recorder)
+
+        let startedAt = SessionManagerTests.now()
+        manager.connect(makeConfigs(1))
+        XCTAssertTrue(recorder.wait(timeout: 5) { $0.contains { $0.kind == .failure } })
+
+        let failedAt = recorder.events.first { $0.kind == .failure }?.time ?? .infinity
+        XCTAssertLessThan(failedAt - startedAt, recoveryBound(policy) + policy.connectTimeout)
+        XCTAssertEqual(recorder.count(.willRecover), policy.maxAttempts)
+        XCTAssertEqual(recorder.count(.connect), 0)
+        XCTAssertEqual(recorder.count(.failure), 1)
+        manager.disconnectAll()
+    }
+
+    // Hanging connects, dropped sessions and SDK reconnects at random for a
+    // few configs. Every loss must be recovered within the policy's limits
+    // and no config may fail.
+    func testRecoversFromInjectedFaults() {
+        var policy = ReconnectPolicy()
+        policy.baseDelay = 0.02
+        policy.maxDelay = 0.2
+        policy.connectTimeout = 0.1
+        var faults = FakeSessionBackend.Faults()
+        faults.connectTimeoutRate = 0.3
+        faults.dropRate = 0.5
+        faults.dropDelay = 0.3
+        faults.reconnectRate = 0.2
+        let backend = FakeSessionBackend(connectDelay: SessionManagerTests.connectDelay, faults: faults)
+        let recorder = Recorder()
+        let manager = makeManager(backend: backend, policy: policy, isWarmStandbyEnabled: false, recorder: recorder)
+        let configs = 4
+
+        manager.connect(makeConfigs(configs))
+        Thread.sleep(forTimeInterval: 3)
+        let endedAt = SessionManagerTests.now()
+        let events = recorder.events
+        manager.disconnectAll()
+
+        let bound = recoveryBound(policy)
+        XCTAssertEqual(events.filter { $0.kind == .failure }.count, 0)
+        XCTAssertGreaterThan(events.filter { $0.kind == .willRecover }.count, 0, "No faults were injected")
+        for index in 0..<configs {
+            var lostAt: TimeInterval?
+            var isReconnecting = false
+            for event in events where event.index == index {
+                switch event.kind {
+                case .willRecover:
+                    lostAt = lostAt ?? event.time
+                case .connect:
+                    if let lost = lostAt {
+                        XCTAssertLessThan(event.time - lost, bound, "Config \(index)")
+                    }
+                    lostAt = nil
+                case .beginReconnecting:
+                    isReconnecting = true
+                case .reconnect:
+                    XCTAssertTrue(isReconnecting, "Config \(index) reconnected without losing the connection")
+                    isReconnecting = false
+                default:
+                    break
+                }
+            }
+            if let lost = lostAt {
+                XCTAssertLessThan(endedAt - lost, bound, "Config \(index) still recovering")
+            }
+            XCTAssertTrue(events.contains { $0.index == index && $0.kind == .connect }, "Config \(index) never connected")
+        }
+    }
+}